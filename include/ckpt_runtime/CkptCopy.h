@@ -0,0 +1,118 @@
+#ifndef _CKPT_COPY_H
+#define _CKPT_COPY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+* Copy kernels used by the save/restore subroutines injected by SubroutineInjection
+* (with -ckpt-runtime). Each kernel has a scalar, an AVX2 and an AVX-512 variant; the
+* variant is selected once at startup from the CPU features, and can be overridden
+* with the CKPT_COPY_ISA environment variable (scalar | avx2 | avx512).
+*
+* Index lists hold element offsets (not byte offsets) of 32-bit elements (float / int32).
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+* Contiguous copy of bytes from src to dst (regular stores).
+* Used for restores, where dst is read again straight after the copy.
+*/
+void
+ckpt_copy(void *dst, const void *src, size_t bytes);
+
+/**
+* Contiguous copy of bytes from src to dst. Copies of at least the non-temporal
+* threshold use streaming stores, so that saving a big array to the checkpoint
+* does not evict the kernel's working set from the cache.
+*/
+void
+ckpt_copy_stream(void *dst, const void *src, size_t bytes);
+
+/**
+* dst[k] = src[index_list[k]] for k in [0, n)
+*/
+void
+ckpt_gather32(void *dst, const void *src, const int32_t *index_list, int32_t n);
+
+/**
+* dst[index_list[k]] = src[k] for k in [0, n)
+*/
+void
+ckpt_scatter32(void *dst, const void *src, const int32_t *index_list, int32_t n);
+
+/**
+* dst[index_list[k]] = src[index_list[k]] for k in [0, *sp); then resets *sp to 0.
+* Saves the elements of an index-tracked array that were modified since the last save;
+* has the same interface as mem_cpy_index_f(dest, src, index_list, sp).
+*/
+void
+ckpt_copy_index32(void *dst, const void *src, int32_t *index_list, int32_t *sp);
+
+/**
+* Copies count blocks of block_bytes bytes; block k goes from src + k * src_stride
+* to dst + k * dst_stride (strides in bytes). Used for sub-range saves, e.g. a band
+* of rows of a 2-D array.
+*/
+void
+ckpt_copy_strided(void *dst, const void *src, size_t block_bytes, size_t count,
+                  size_t dst_stride, size_t src_stride);
+
+/**
+* With -ckpt-dedup-chunk-bytes, the hash tables of a checkpoint's arrays follow
+* each array's slots, and an 8-byte owner word before the values holds
+* CKPT_DEDUP_OWNER_MAGIC << 32 | the number of the checkpoint whose save last
+* completed. A save only trusts the tables if it is the owner; it clears the word
+* first, so a save interrupted by a failure, or by another checkpoint's layout,
+* copies every chunk next time.
+*/
+#define CKPT_DEDUP_OWNER_MAGIC 0x44445550ULL
+
+/**
+* Saves bytes from src to dst in chunks of chunk_bytes, and only copies the chunks
+* whose hash differs from the one in hashes (one per chunk, written by the previous
+* ckpt_copy_dedup to the same dst). With hashes_valid == 0 (e.g. dst may have been
+* overwritten since), every chunk is copied. Updates hashes and returns the number
+* of bytes copied.
+*
+* Needs no instrumentation of the stores to src, e.g. for arrays written by external
+* code or DMA, but reads all of src. A chunk changed to contents with the same 64-bit
+* hash as before is not saved.
+*/
+size_t
+ckpt_copy_dedup(void *dst, const void *src, size_t bytes, size_t chunk_bytes, uint64_t *hashes, int32_t hashes_valid);
+
+/**
+* 64-bit hash used by ckpt_copy_dedup; every variant computes the same hash.
+*/
+uint64_t
+ckpt_hash64(const void *data, size_t bytes);
+
+/**
+* Name of the selected variant ("scalar", "avx2" or "avx512").
+*/
+const char *
+ckpt_copy_isa(void);
+
+/**
+* Selects a variant by name. Returns 0 on success, or -1 if the variant is unknown
+* or not supported by this CPU (the current variant is kept).
+*/
+int
+ckpt_copy_select_isa(const char *isa);
+
+/**
+* Sets the minimum size (bytes) for which ckpt_copy_stream uses streaming stores.
+* Defaults to CKPT_COPY_NT_THRESHOLD (env var) or 1 MiB.
+*/
+void
+ckpt_copy_set_nt_threshold(size_t bytes);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _CKPT_COPY_H */
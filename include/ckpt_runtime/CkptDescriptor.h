@@ -0,0 +1,59 @@
+#ifndef _CKPT_DESCRIPTOR_H
+#define _CKPT_DESCRIPTOR_H
+
+#include <stdint.h>
+
+/**
+* Table-driven saves and restores, used by the code that SubroutineInjection
+* injects with -ckpt-descriptor-table.
+*
+* Instead of a load/convert/store or copy per tracked value, each saveBB and
+* restoreBB holds a constant table with a 16-byte descriptor per value, and calls
+* ckpt_desc_save or ckpt_desc_restore once. The values themselves go through a
+* spill area of 8-byte fields on the kernel's stack, one per tracked value of the
+* kernel: before a save, the kernel stores each scalar (or the address of each
+* scalar in memory) into its field; a restore writes the scalars back into their
+* fields, which the kernel then loads. The addresses of arrays never change, so
+* they are stored once, on entry.
+*/
+
+/* Kinds of values */
+#define CKPT_DESC_VALUE          0  /* scalar in the spill field */
+#define CKPT_DESC_SCALAR_PTR     1  /* scalar at the address in the spill field */
+#define CKPT_DESC_ARRAY          2  /* array at the address in the spill field */
+#define CKPT_DESC_ARRAY_INDIRECT 3  /* array at the address stored at the address in the spill field (e.g. %arr.addr) */
+
+/* Conversions between the value and its ckpt_mem slot */
+#define CKPT_DESC_CONV_NONE      0  /* bytes are copied */
+#define CKPT_DESC_CONV_I32_F32   1  /* an int32 value in a float slot */
+#define CKPT_DESC_CONV_I32_F64   2  /* an int32 value in a double slot */
+
+#define CKPT_DESC_SPILL_FIELD_BYTES 8
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* SubroutineInjection emits these as { i8, i8, i16, i32, i32, i32 } */
+typedef struct {
+  uint8_t kind;
+  uint8_t conv;
+  uint16_t spill_field;   /* index of the value's field in the spill area */
+  uint32_t ckpt_offset;   /* byte offset of the value's slot(s) in ckpt_mem */
+  uint32_t bytes;         /* size of a scalar, or bytes of an array that are copied */
+  uint32_t array_offset;  /* byte offset of the copied part in the array (checkpoint_region) */
+} ckpt_desc_t;
+
+/* Saves the num_descs values described by table (arrays with ckpt_copy_stream) */
+void
+ckpt_desc_save(void *ckpt_mem, const ckpt_desc_t *table, int32_t num_descs, void *spill);
+
+/* Restores the num_descs values described by table (arrays with ckpt_copy) */
+void
+ckpt_desc_restore(void *ckpt_mem, const ckpt_desc_t *table, int32_t num_descs, void *spill);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _CKPT_DESCRIPTOR_H */
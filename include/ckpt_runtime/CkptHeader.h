@@ -0,0 +1,139 @@
+#ifndef _CKPT_HEADER_H
+#define _CKPT_HEADER_H
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+* Layout of the checkpoint memory segment (ckpt_mem) header written by the code
+* that SubroutineInjection injects with -ckpt-header.
+*
+* The header takes the first cache line of the segment and holds native 32-bit
+* integers; the saved values start on the next cache line. The kernel increments
+* the heartbeat with relaxed atomic adds, and publishes a completed checkpoint by
+* storing its id with release ordering (-1 while the checkpoint is being written).
+* A save bumps the heartbeat when it starts, right after setting the id to -1 and
+* before a release fence, so a reader that copies the segment can tell that a save
+* overlapped its copy from the heartbeat, even if the same id was published again
+* (see CkptReplica.h); a restore bumps it when it ends.
+*
+* If the kernel has an int `ckpt_epoch` argument, a checkpoint is only restored
+* when it was written by an invocation with the same epoch. A fresh run then only
+* needs a new epoch (ckpt_fresh_epoch), instead of zeroing the whole segment;
+* a run that resumes after a failure passes the epoch of the failed run.
+*
+* With -ckpt-on-demand, checkpoint sites only save when the host requested it
+* (ckpt_request_save); the kernel then clears the request and bumps save_ack, which
+* the host polls with ckpt_save_done. The heartbeat then only counts those saves
+* (and restores).
+*
+* Kernels with int `ckpt_thread` and `ckpt_nthreads` arguments are checkpointed as
+* a team (see CkptTeam.h); the barrier fields belong to the team barrier.
+*
+* Without -ckpt-header, HEARTBEAT, CKPT_ID and IS_COMPLETE are the first slots of
+* the segment, stored in the segment's element type, and values start at slot 3.
+*/
+
+#define CKPT_CACHE_LINE_BYTES 64
+#define CKPT_HEADER_BYTES     CKPT_CACHE_LINE_BYTES
+
+/* Index of each field in the header (in int32 units) */
+#define CKPT_HEADER_HEARTBEAT    0
+#define CKPT_HEADER_CKPT_ID      1
+#define CKPT_HEADER_IS_COMPLETE  2
+#define CKPT_HEADER_EPOCH        3
+#define CKPT_HEADER_SAVE_REQUEST 4
+#define CKPT_HEADER_SAVE_ACK     5
+#define CKPT_HEADER_BARRIER_COUNT 6
+#define CKPT_HEADER_BARRIER_GEN  7
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  int32_t heartbeat;    /* incremented at the start of every save and the end of every restore */
+  int32_t ckpt_id;      /* id of the last complete checkpoint; 0 = none, -1 = being written */
+  int32_t is_complete;  /* return value of the kernel (1 for void kernels) once it returned */
+  int32_t epoch;        /* ckpt_epoch argument of the invocation that wrote ckpt_id */
+  int32_t save_request; /* -ckpt-on-demand: set by the host to request a save */
+  int32_t save_ack;     /* -ckpt-on-demand: incremented after each requested save */
+  int32_t barrier_count; /* team kernels: threads waiting at the team barrier */
+  int32_t barrier_gen;  /* team kernels: incremented each time the team barrier opens */
+  int32_t reserved[CKPT_HEADER_BYTES / sizeof(int32_t) - 8];
+} __attribute__((aligned(CKPT_CACHE_LINE_BYTES))) ckpt_header_t;
+
+static inline ckpt_header_t *
+ckpt_header(void *ckpt_mem)
+{
+  return (ckpt_header_t *)ckpt_mem;
+}
+
+/* Start of the saved values (first value slot) */
+static inline void *
+ckpt_values(void *ckpt_mem)
+{
+  return (char *)ckpt_mem + CKPT_HEADER_BYTES;
+}
+
+/* For watchdogs polling the heartbeat while the kernel runs */
+static inline int32_t
+ckpt_heartbeat(const ckpt_header_t *header)
+{
+  return __atomic_load_n(&header->heartbeat, __ATOMIC_RELAXED);
+}
+
+/* Pairs with the release store of the ckpt id in the saveBB */
+static inline int32_t
+ckpt_last_id(const ckpt_header_t *header)
+{
+  return __atomic_load_n(&header->ckpt_id, __ATOMIC_ACQUIRE);
+}
+
+/**
+* Gets an epoch that differs from the one of the last saved checkpoint; passing it
+* as ckpt_epoch starts the kernel from the beginning.
+*/
+static inline int32_t
+ckpt_fresh_epoch(const ckpt_header_t *header)
+{
+  return __atomic_load_n(&header->epoch, __ATOMIC_RELAXED) + 1;
+}
+
+/**
+* Initializes the header of a newly-allocated segment. The rest of the segment
+* does not need to be cleared.
+*/
+static inline void
+ckpt_header_reset(void *ckpt_mem)
+{
+  memset(ckpt_mem, 0, CKPT_HEADER_BYTES);
+}
+
+/**
+* Asks the kernel to save at its next checkpoint site (-ckpt-on-demand).
+* Returns the ticket to pass to ckpt_save_done.
+*/
+static inline int32_t
+ckpt_request_save(ckpt_header_t *header)
+{
+  int32_t ticket = __atomic_load_n(&header->save_ack, __ATOMIC_ACQUIRE);
+  __atomic_store_n(&header->save_request, 1, __ATOMIC_RELEASE);
+  return ticket;
+}
+
+/**
+* Returns non-zero once a save completed after the ckpt_request_save call that
+* returned ticket; the saved ckpt is then complete (ckpt_last_id).
+*/
+static inline int
+ckpt_save_done(const ckpt_header_t *header, int32_t ticket)
+{
+  return __atomic_load_n(&header->save_ack, __ATOMIC_ACQUIRE) != ticket;
+}
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _CKPT_HEADER_H */
@@ -0,0 +1,141 @@
+#ifndef _CKPT_INCREMENTAL_H
+#define _CKPT_INCREMENTAL_H
+
+#include <stdint.h>
+
+#include "ckpt_runtime/CkptHeader.h"
+
+/**
+* Incremental (amortized) saves of the arrays passed to a kernel, used by the code
+* that SubroutineInjection injects with -ckpt-incremental-chunk-bytes.
+*
+* A save (saveBB) no longer copies these arrays. It backs up the values of the
+* published checkpoint (ckpt_incr_begin), saves the other values as usual, and
+* logically freezes the arrays by starting a new version of their chunks. Each
+* checkpoint site reached afterwards copies at most chunks_per_site chunks (of
+* all arrays) into their pending buffers (ckpt_incr_poll); a store into a chunk that is
+* not copied yet copies that chunk first (ckpt_incr_before_write). Once all chunks
+* are copied, the pending buffers and the checkpoint id are published, and the
+* next site may start a new save. The stall per site is bounded by the copy of
+* chunks_per_site chunks (CKPT_INCR_CHUNKS_PER_SITE overrides it at startup).
+*
+* Until then the header's ckpt id stays -1; after a failure, ckpt_incr_recover
+* (called before the id is read) puts the backed up values, id and epoch of the
+* last published checkpoint back, so the previous checkpoint stays restorable for
+* the whole save.
+*
+* Layout in ckpt_mem (8-byte aligned, after the header):
+*   [ckpt_incr_session_t][array 0: versions, buffer 0, buffer 1][array 1: ...]
+*   [values][backup of the values]
+*/
+
+#define CKPT_INCR_MAX_ARRAYS 8
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  void *array;            /* attached at each invocation */
+  int64_t array_bytes;
+  int64_t chunk_bytes;
+  int64_t num_chunks;
+  int64_t next_chunk;     /* chunks before it were copied for the current save */
+  int64_t state_offset;   /* byte offset of the chunk versions (then both buffers) from the session */
+} ckpt_incr_array_t;
+
+typedef struct {
+  int32_t active;           /* a save began and its arrays are not all copied yet */
+  int32_t save_epoch;       /* version of the chunks copied for the current save */
+  int32_t published;        /* buffer (0/1) holding the arrays of the published ckpt */
+  int32_t pending_id;       /* id published once all chunks are copied */
+  int32_t backup_id;        /* ckpt id, epoch and buffer published before the current save */
+  int32_t backup_epoch;
+  int32_t backup_published;
+  int32_t num_arrays;
+  int32_t chunks_per_site;
+  int32_t reserved;
+  int64_t values_offset;    /* byte offsets from ckpt_mem */
+  int64_t values_bytes;
+  int64_t backup_offset;
+  ckpt_incr_array_t arrays[CKPT_INCR_MAX_ARRAYS];
+} ckpt_incr_session_t;
+
+static inline int64_t
+ckpt_incr_num_chunks(int64_t array_bytes, int64_t chunk_bytes)
+{
+  return (array_bytes + chunk_bytes - 1) / chunk_bytes;
+}
+
+/* Bytes of ckpt_mem taken by the chunk versions and both buffers of an array */
+static inline int64_t
+ckpt_incr_array_state_bytes(int64_t array_bytes, int64_t chunk_bytes)
+{
+  int64_t version_bytes = (ckpt_incr_num_chunks(array_bytes, chunk_bytes) * sizeof(int32_t) + 7) & ~(int64_t)7;
+  return version_bytes + 2 * ((array_bytes + 7) & ~(int64_t)7);
+}
+
+/**
+* Sets the layout of the session at the start of each invocation; leaves the
+* state of a save in progress as it is.
+*/
+void
+ckpt_incr_init(void *session, int32_t num_arrays, int32_t chunks_per_site,
+               int64_t values_offset, int64_t values_bytes, int64_t backup_offset);
+
+/* Attaches array idx of this invocation */
+void
+ckpt_incr_attach(void *session, int32_t idx, void *array, int64_t array_bytes, int64_t chunk_bytes, int64_t state_offset);
+
+/* Forgets any save in progress at the start of a fresh (not resumed) invocation */
+void
+ckpt_incr_reset(void *session);
+
+/**
+* After a failure during a save: puts the values, ckpt id and epoch of the last
+* published checkpoint back. Must run before the ckpt id is read.
+*/
+void
+ckpt_incr_recover(void *ckpt_mem, void *session);
+
+/* Starts a save (first thing in the saveBB) */
+void
+ckpt_incr_begin(void *ckpt_mem, void *session);
+
+/* Ends the saveBB of checkpoint ckpt_id; the id is published by ckpt_incr_poll */
+void
+ckpt_incr_commit(void *session, int32_t ckpt_id);
+
+/**
+* Copies the next chunks of a save in progress, and publishes it once all chunks
+* are copied. Returns non-zero if no save is in progress (anymore), i.e. if a new
+* save may start.
+*/
+int32_t
+ckpt_incr_poll(void *ckpt_mem, void *session);
+
+/**
+* Copies all chunks left of the save in progress, and publishes it. Ends saveBBs
+* whose site could not be made conditional on ckpt_incr_poll.
+*/
+void
+ckpt_incr_finish(void *ckpt_mem, void *session);
+
+/**
+* Copies the chunk of array idx holding byte offset before it is written, if it
+* was not copied for the save in progress. While no save is in progress, all chunk
+* versions equal save_epoch, so stores only call this when the (inline) version
+* check fails.
+*/
+void
+ckpt_incr_before_write(void *session, int32_t idx, int64_t offset);
+
+/* Copies the published buffer of array idx back into array */
+void
+ckpt_incr_restore(void *session, int32_t idx, void *array);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _CKPT_INCREMENTAL_H */
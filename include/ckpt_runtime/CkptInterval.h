@@ -0,0 +1,70 @@
+#ifndef _CKPT_INTERVAL_H
+#define _CKPT_INTERVAL_H
+
+#include <stdint.h>
+
+/**
+* Adaptive checkpoint interval controller used by the code that SubroutineInjection
+* injects with -ckpt-adaptive.
+*
+* Each checkpoint site calls ckpt_interval_poll() and only saves when it returns
+* non-zero. The controller times every save (ckpt_interval_save_begin/end), keeps
+* a moving average of the save cost C, and targets Daly's optimum interval between
+* saves for the configured mean time between failures M:
+*   T = sqrt(2CM) * (1 + sqrt(C/2M)/3 + C/18M) - C   (C < 2M; else T = M)
+* clamped to [min, max]. Polls are counted down between clock reads, from the
+* measured time per site, so most polls cost a decrement.
+*
+* Configuration (env vars, read at startup, or ckpt_interval_configure):
+*   CKPT_INTERVAL_MTBF_S  mean time between failures in seconds (default 3600)
+*   CKPT_INTERVAL_MIN_S   lower bound of the interval in seconds (default 0)
+*   CKPT_INTERVAL_MAX_S   upper bound of the interval in seconds (default 3600)
+*   CKPT_INTERVAL_LOG     file to log each decision to ("-" for stderr)
+*
+* The controller state is per thread.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+* Returns non-zero if the calling checkpoint site should save now.
+*/
+int32_t
+ckpt_interval_poll(void);
+
+/**
+* Marks the start and end of a save; the time in between is the save cost.
+*/
+void
+ckpt_interval_save_begin(void);
+
+void
+ckpt_interval_save_end(void);
+
+/**
+* Sets the mean time between failures and the bounds of the interval (seconds).
+*/
+void
+ckpt_interval_configure(double mtbf_s, double min_interval_s, double max_interval_s);
+
+/**
+* Forgets the measured save cost and the time of the last save of the calling
+* thread (e.g. in a forked child); the next poll saves.
+*/
+void
+ckpt_interval_reset(void);
+
+/**
+* Current target interval between saves of the calling thread (seconds);
+* 0 until the first save was timed.
+*/
+double
+ckpt_interval_target(void);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _CKPT_INTERVAL_H */
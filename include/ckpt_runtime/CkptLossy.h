@@ -0,0 +1,89 @@
+#ifndef _CKPT_LOSSY_H
+#define _CKPT_LOSSY_H
+
+#include <stdint.h>
+
+/**
+* Error-bounded lossy encoding of float/double arrays, used by the code that
+* SubroutineInjection injects for arrays declared with
+* checkpoint_lossy(ptr, max_abs_error).
+*
+* A save quantizes each element to the nearest multiple of 2 * max_abs_error, and
+* stores blocks of CKPT_LOSSY_BLOCK_ELEMS quantized values as the first value and
+* the (zigzag coded) deltas of neighbouring values, in only as many bit planes as
+* the largest delta needs; smooth data such as images needs few of them. A
+* restore decodes the elements back, each within max_abs_error of its saved value.
+* Blocks that would not shrink, or hold values that cannot be quantized within the
+* bound (NaN, infinities, values too large for the step), are stored raw, so the
+* bound always holds (max_abs_error <= 0 stores everything raw).
+*
+* ckpt_mem reserves ckpt_lossy_max_bytes for the encoded array; only the first
+* ckpt_lossy_encoded_bytes of it are written by a save (and need to be copied out
+* or persisted).
+*
+* Layout of an encoded array:
+*   [ckpt_lossy_header_t][block 0: int64 first value, uint8 #bits, packed deltas or raw elements][block 1: ...]
+*/
+
+#define CKPT_LOSSY_BLOCK_ELEMS 256
+#define CKPT_LOSSY_BLOCK_HEADER_BYTES 9   /* int64 first value + uint8 #bits */
+#define CKPT_LOSSY_RAW_BLOCK   0xFF       /* #bits of a block stored raw */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  int64_t encoded_bytes;  /* including this header */
+  int64_t num_elems;
+  double max_error;
+  int32_t elem_bytes;     /* 4 (float) or 8 (double) */
+  int32_t reserved;
+} ckpt_lossy_header_t;
+
+/* Bytes of ckpt_mem reserved for an encoded array of num_elems elements (the worst case) */
+static inline int64_t
+ckpt_lossy_max_bytes(int64_t num_elems, int64_t elem_bytes)
+{
+  int64_t num_blocks = (num_elems + CKPT_LOSSY_BLOCK_ELEMS - 1) / CKPT_LOSSY_BLOCK_ELEMS;
+  return (int64_t)sizeof(ckpt_lossy_header_t) + num_blocks * CKPT_LOSSY_BLOCK_HEADER_BYTES + num_elems * elem_bytes;
+}
+
+/* Bytes written by the last ckpt_lossy_encode_* into encoded */
+int64_t
+ckpt_lossy_encoded_bytes(const void *encoded);
+
+/**
+* Encodes num_elems elements of src into dst (at most ckpt_lossy_max_bytes), each
+* within max_error. Returns the number of bytes written.
+*/
+int64_t
+ckpt_lossy_encode_f32(void *dst, const float *src, int64_t num_elems, double max_error);
+
+int64_t
+ckpt_lossy_encode_f64(void *dst, const double *src, int64_t num_elems, double max_error);
+
+/* Decodes the array encoded at src into dst */
+void
+ckpt_lossy_decode_f32(float *dst, const void *src);
+
+void
+ckpt_lossy_decode_f64(double *dst, const void *src);
+
+/**
+* Accuracy check: the largest absolute difference between the elements of out and
+* ref, e.g. the output of a run restored from lossy checkpoints and that of an
+* uninterrupted run (NaN if they differ in NaNs). Errors made on restore can grow
+* in the computation that follows, so this may exceed max_error.
+*/
+double
+ckpt_lossy_max_abs_diff_f32(const float *out, const float *ref, int64_t num_elems);
+
+double
+ckpt_lossy_max_abs_diff_f64(const double *out, const double *ref, int64_t num_elems);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _CKPT_LOSSY_H */
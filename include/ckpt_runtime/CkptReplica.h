@@ -0,0 +1,129 @@
+#ifndef _CKPT_REPLICA_H
+#define _CKPT_REPLICA_H
+
+#include <stdint.h>
+
+/**
+* Streaming replication of published checkpoints to a peer over TCP, so that a
+* checkpoint survives the failure of the node that runs the kernel.
+*
+* The sender runs in the host process, next to the kernel, and only reads the
+* segment: it never makes the kernel wait. Its threads form a pipeline:
+*   snapshot  polls the header's ckpt id and heartbeat; when a new checkpoint is
+*             published, it copies the segment after the header in chunks, and
+*             keeps the chunks whose hash differs from the one last sent
+*   compress  encodes runs of equal 8-byte words (CKPT_REPL_COMPRESS), if smaller
+*   send      writes the chunks, then a commit with the ckpt id and epoch
+*   ack       reads the peer's acknowledgements of commits
+* so the copy of one chunk overlaps the encoding and sending of the previous ones.
+* A checkpoint is only committed if the ckpt id and heartbeat are the same before
+* and after its chunks were copied, i.e. the kernel did not start another save
+* meanwhile (otherwise the copy is retried); if the sender falls behind, it skips
+* to the newest checkpoint. The segment must have a header (-ckpt-header), whose
+* heartbeat is bumped when a save starts, and the arrays must be saved into it
+* (not with undo logs, which leave the arrays outside the segment).
+*
+* The receiver (the peer daemon, see tools/CkptReplicaPeer.cpp) applies the chunks
+* to a staging copy of the segment, and on each commit copies the chunks changed
+* since the last commit into the newest fully received checkpoint, then acknowledges
+* it. A restore on the peer's node copies that checkpoint into a new segment:
+*
+*   // peer:
+*   ckpt_repl_receiver_t *receiver = ckpt_repl_receiver_start(NULL, 7070, bytes);
+*   ...                                                 // the primary node fails
+*   if (ckpt_repl_receiver_restore(receiver, ckpt_mem, bytes) > 0)
+*     workload(..., ckpt_mem, epoch);                   // resumes from that checkpoint
+*   // primary node, after creating ckpt_mem:
+*   ckpt_repl_sender_t *sender = ckpt_repl_sender_start(ckpt_mem, bytes, "peer", 7070, 1 << 20, CKPT_REPL_COMPRESS);
+*   workload(..., ckpt_mem, epoch);
+*   ckpt_repl_sender_flush(sender, 1000);               // optional: wait for the last ckpt
+*   ckpt_repl_sender_stop(sender);
+*
+* Both ends must have the same byte order and segment size. After a lost connection
+* the sender stops replicating (sender stats: error); the receiver keeps its newest
+* checkpoint and accepts a new sender, which then sends every chunk again.
+*/
+
+/* Flags of ckpt_repl_sender_start */
+#define CKPT_REPL_COMPRESS 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ckpt_repl_sender ckpt_repl_sender_t;
+typedef struct ckpt_repl_receiver ckpt_repl_receiver_t;
+
+typedef struct {
+  int64_t ckpts_sent;       /* commits sent */
+  int64_t ckpts_acked;      /* commits acknowledged by the peer */
+  int64_t ckpts_retried;    /* copies discarded because the kernel saved meanwhile */
+  int64_t chunks_scanned;
+  int64_t chunks_sent;      /* changed chunks */
+  int64_t raw_bytes_sent;   /* bytes of the changed chunks */
+  int64_t wire_bytes_sent;  /* bytes written to the socket (after compression) */
+  int32_t last_acked_id;    /* newest ckpt id acknowledged by the peer (0 = none) */
+  int32_t acked_heartbeat;  /* header heartbeat of the save it holds */
+  int32_t error;            /* non-zero once the connection was lost */
+  double last_ack_us;       /* from seeing the last acked ckpt published to its ack */
+} ckpt_repl_stats_t;
+
+/**
+* Connects to the peer (retrying for up to 5 s) and starts replicating the
+* checkpoints published in ckpt_mem (bytes, including the header), in chunks of
+* chunk_bytes (a multiple of 8). Returns NULL if the peer cannot be reached.
+*/
+ckpt_repl_sender_t *
+ckpt_repl_sender_start(void *ckpt_mem, int64_t bytes, const char *host, int32_t port, int64_t chunk_bytes,
+                       int32_t flags);
+
+/**
+* Waits until the checkpoint published last is acknowledged by the peer, for at
+* most timeout_ms. Returns its ckpt id, or -1 on timeout or error.
+*/
+int32_t
+ckpt_repl_sender_flush(ckpt_repl_sender_t *sender, int32_t timeout_ms);
+
+void
+ckpt_repl_sender_stats(const ckpt_repl_sender_t *sender, ckpt_repl_stats_t *stats);
+
+/* Stops the threads and closes the connection (in-flight checkpoints are dropped) */
+void
+ckpt_repl_sender_stop(ckpt_repl_sender_t *sender);
+
+/**
+* Listens on bind_addr:port (NULL for any address; port 0 picks a free port) for
+* senders of a segment of bytes, one at a time. Returns NULL on failure.
+*/
+ckpt_repl_receiver_t *
+ckpt_repl_receiver_start(const char *bind_addr, int32_t port, int64_t bytes);
+
+/* Port the receiver listens on */
+int32_t
+ckpt_repl_receiver_port(const ckpt_repl_receiver_t *receiver);
+
+/**
+* Number of checkpoints fully received so far, waiting up to timeout_ms until it
+* is at least min_commits. The ckpt id and epoch of the newest one are stored in
+* *ckpt_id and *epoch if not NULL (0 if none was received).
+*/
+int64_t
+ckpt_repl_receiver_wait(ckpt_repl_receiver_t *receiver, int64_t min_commits, int32_t timeout_ms,
+                        int32_t *ckpt_id, int32_t *epoch);
+
+/**
+* Copies the newest fully received checkpoint into ckpt_mem (bytes, including the
+* header, which gets its ckpt id and epoch and a zero heartbeat). Returns the ckpt
+* id, or 0 if none was received (ckpt_mem is then not changed).
+*/
+int32_t
+ckpt_repl_receiver_restore(ckpt_repl_receiver_t *receiver, void *ckpt_mem, int64_t bytes);
+
+void
+ckpt_repl_receiver_stop(ckpt_repl_receiver_t *receiver);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _CKPT_REPLICA_H */
@@ -0,0 +1,98 @@
+#ifndef _CKPT_SEGMENT_H
+#define _CKPT_SEGMENT_H
+
+#include <stdint.h>
+
+/**
+* Allocator for ckpt_mem segments (and other large checkpointed buffers), in place
+* of a plain mmap (create_shared_memory) or a static array. With 4 KiB pages, the
+* first save into a segment of hundreds of MiB pays a page fault per page and
+* then misses the TLB on most of them, and the pages land on whichever NUMA node
+* the first fault ran on. The allocator backs the segment with huge pages, binds
+* it to the NUMA node of the thread that runs the kernel, and faults it in (and
+* optionally locks it) before the kernel starts, so the first save runs at the
+* bandwidth of the following ones:
+*
+*   // on the thread that runs the kernel (or pass its node, see ckpt_segment_node):
+*   double *ckpt_mem = (double *)ckpt_segment_alloc(CKPT_SIZE * sizeof(double), CKPT_SEGMENT_NODE_LOCAL,
+*                                                   CKPT_SEGMENT_SHARED | CKPT_SEGMENT_HUGE
+*                                                   | CKPT_SEGMENT_PREFAULT);
+*   ...
+*   workload(..., ckpt_mem, 0);
+*   ckpt_segment_free(ckpt_mem);
+*
+* Huge pages: CKPT_SEGMENT_HUGE first tries MAP_HUGETLB (pages reserved in
+* /proc/sys/vm/nr_hugepages), then transparent huge pages (madvise(MADV_HUGEPAGE);
+* for shared segments, /sys/kernel/mm/transparent_hugepage/shmem_enabled must
+* allow it). The bytes are rounded up to whole huge pages. ckpt_segment_info
+* reports how much of the segment huge pages back.
+*
+* NUMA: the segment is bound (mbind, MPOL_BIND) before it is faulted in, so the
+* pages are placed on the node even when another thread touches them first. If
+* the kernel's thread is pinned after the allocation, ckpt_segment_bind moves the
+* pages to its node.
+*
+* Flags that cannot be honoured (no huge pages reserved, a single NUMA node,
+* RLIMIT_MEMLOCK too low for CKPT_SEGMENT_MLOCK) are dropped with a warning;
+* ckpt_segment_info reports the ones in effect.
+*/
+
+/* Flags of ckpt_segment_alloc */
+#define CKPT_SEGMENT_SHARED    1  /* MAP_SHARED, like create_shared_memory (visible to forked processes) */
+#define CKPT_SEGMENT_HUGE      2  /* huge pages: MAP_HUGETLB, else transparent huge pages */
+#define CKPT_SEGMENT_PREFAULT  4  /* fault all pages in before returning */
+#define CKPT_SEGMENT_MLOCK     8  /* lock the pages in memory (implies faulting them in) */
+
+/* Flags only reported by ckpt_segment_info */
+#define CKPT_SEGMENT_HUGETLB   16 /* the huge pages are MAP_HUGETLB pages (not THP) */
+#define CKPT_SEGMENT_BOUND     32 /* bound to numa_node */
+
+/* numa_node of ckpt_segment_alloc */
+#define CKPT_SEGMENT_NODE_LOCAL  -1 /* the node of the CPU the calling thread runs on */
+#define CKPT_SEGMENT_NODE_ANY    -2 /* no binding (the process's memory policy) */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  int64_t bytes;          /* mapped bytes (rounded up to whole pages) */
+  int64_t page_bytes;     /* size of the pages faults map (huge page or base page) */
+  int64_t huge_bytes;     /* bytes currently backed by huge pages (from /proc/self/smaps) */
+  int64_t resident_bytes; /* bytes currently faulted in */
+  int32_t flags;          /* flags in effect */
+  int32_t numa_node;      /* node the segment is bound to, -1 if none */
+  double prefault_ms;     /* time spent faulting the segment in (and locking it) */
+} ckpt_segment_info_t;
+
+/**
+* Maps a zeroed segment of at least bytes, bound to numa_node (a node number, or
+* CKPT_SEGMENT_NODE_LOCAL / CKPT_SEGMENT_NODE_ANY). Returns NULL on failure.
+*/
+void *
+ckpt_segment_alloc(int64_t bytes, int32_t numa_node, int32_t flags);
+
+/* Unmaps a segment returned by ckpt_segment_alloc */
+void
+ckpt_segment_free(void *segment);
+
+/* Returns 0 and fills info, or -1 if segment was not returned by ckpt_segment_alloc */
+int32_t
+ckpt_segment_info(const void *segment, ckpt_segment_info_t *info);
+
+/**
+* Binds the segment to numa_node (or the calling thread's, CKPT_SEGMENT_NODE_LOCAL)
+* and moves the pages already faulted in there. Returns 0, or -1 on failure.
+*/
+int32_t
+ckpt_segment_bind(void *segment, int32_t numa_node);
+
+/* NUMA node of the CPU the calling thread runs on (0 if unknown) */
+int32_t
+ckpt_segment_node(void);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _CKPT_SEGMENT_H */
@@ -0,0 +1,128 @@
+#ifndef _CKPT_SPILL_H
+#define _CKPT_SPILL_H
+
+#include <stdint.h>
+
+/**
+* Asynchronous spill of checkpoints from ckpt_mem to a local file with io_uring,
+* so the host thread that persists them is not blocked in write/fsync while the
+* kernel keeps running.
+*
+* ckpt_spill_begin starts spilling the checkpoint published last; ckpt_spill_poll,
+* called from the host's loop (e.g. the watchdog that polls the heartbeat), reaps
+* completions and keeps up to queue_depth chunk writes in flight, straight from
+* ckpt_mem (no copy). Once all writes completed, an fdatasync follows, then the
+* file's superblock is pointed at the new copy and synced; only then is the
+* checkpoint durable. The file holds two slots, used in turn, so a crash during
+* a spill leaves the previous durable checkpoint intact:
+*   [superblock, 4 KiB][slot 0][slot 1]
+*
+*   ckpt_spill_t *spill = ckpt_spill_open("ckpt.bin", ckpt_mem, bytes, 1 << 20, 32,
+*                                         CKPT_SPILL_DIRECT | CKPT_SPILL_REGISTERED);
+*   while (!ckpt_header(ckpt_mem)->is_complete)             // host loop
+*   {
+*     if (ckpt_spill_poll(spill) != CKPT_SPILL_RUNNING) ckpt_spill_begin(spill);
+*     ...                                                   // heartbeat checks etc.
+*   }
+*   ckpt_spill_wait(spill, -1);
+*   ckpt_spill_close(spill);
+*   // after a restart (e.g. on another boot):
+*   int32_t epoch;
+*   if (ckpt_spill_load("ckpt.bin", ckpt_mem, bytes, &epoch) > 0)
+*     workload(..., ckpt_mem, epoch);                       // resumes from it
+*
+* The kernel is not stopped meanwhile: if it starts another save before all
+* chunks were written (the header's ckpt id or heartbeat changed), the spill ends
+* as CKPT_SPILL_TORN and is not made durable; begin again to spill the newer one.
+* Kernels that save on demand (ckpt_request_save) spill without tearing. The
+* segment must have a header (-ckpt-header).
+*
+* Flags:
+*   CKPT_SPILL_DIRECT      open the file with O_DIRECT (bypasses the page cache;
+*                          needs a page-aligned ckpt_mem and chunk_bytes that is a
+*                          multiple of 4 KiB), if the file system supports it
+*   CKPT_SPILL_REGISTERED  register ckpt_mem with io_uring (pins it, subject to
+*                          RLIMIT_MEMLOCK), so chunks are written with WRITE_FIXED
+* Flags that cannot be honoured are dropped with a warning. Without io_uring
+* (e.g. blocked by seccomp), a helper thread spills with pwrite and fdatasync.
+*/
+
+/* Flags of ckpt_spill_open */
+#define CKPT_SPILL_DIRECT      1
+#define CKPT_SPILL_REGISTERED  2
+
+/* States returned by ckpt_spill_poll and ckpt_spill_wait */
+#define CKPT_SPILL_IDLE     0  /* no spill begun yet */
+#define CKPT_SPILL_RUNNING  1
+#define CKPT_SPILL_DURABLE  2  /* the last spill is on disk */
+#define CKPT_SPILL_TORN     3  /* the kernel saved during the last spill; not durable */
+#define CKPT_SPILL_FAILED   4  /* a write or sync failed; not durable */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ckpt_spill ckpt_spill_t;
+
+typedef struct {
+  int64_t spills_begun;
+  int64_t spills_durable;
+  int64_t spills_torn;
+  int64_t bytes_written;
+  int32_t durable_id;         /* ckpt id of the newest durable spill (0 = none) */
+  int32_t durable_heartbeat;  /* header heartbeat of the save it holds */
+  int32_t uses_io_uring;
+  int32_t flags;              /* flags in effect */
+  int32_t max_queue_depth;    /* most writes in flight at once */
+  double mean_queue_depth;    /* writes in flight after each submission, on average */
+  double last_spill_ms;       /* begin to durable, of the last durable spill */
+  double last_bandwidth_mibs; /* segment bytes / last_spill_ms */
+  double host_ms;             /* time spent in ckpt_spill_begin/poll (what the host is blocked for) */
+} ckpt_spill_stats_t;
+
+/**
+* Opens (creates) the spill file at path for checkpoints of ckpt_mem (bytes,
+* including the header), written in chunks of chunk_bytes with up to queue_depth
+* writes in flight. Returns NULL on failure.
+*/
+ckpt_spill_t *
+ckpt_spill_open(const char *path, void *ckpt_mem, int64_t bytes, int64_t chunk_bytes, int32_t queue_depth,
+                int32_t flags);
+
+/**
+* Begins spilling the checkpoint published last. Returns its ckpt id, or 0 if there
+* is nothing new to spill (no checkpoint, a save in progress, the last durable one
+* is still the newest, or a spill is running).
+*/
+int32_t
+ckpt_spill_begin(ckpt_spill_t *spill);
+
+/* Reaps completions and submits more writes without blocking; returns the state */
+int32_t
+ckpt_spill_poll(ckpt_spill_t *spill);
+
+/* Polls until the spill is no longer running, for at most timeout_ms (-1: no limit) */
+int32_t
+ckpt_spill_wait(ckpt_spill_t *spill, int32_t timeout_ms);
+
+void
+ckpt_spill_stats(const ckpt_spill_t *spill, ckpt_spill_stats_t *stats);
+
+/* Waits for a running spill, then closes the file */
+void
+ckpt_spill_close(ckpt_spill_t *spill);
+
+/**
+* Loads the durable checkpoint of the spill file at path into ckpt_mem (bytes, as
+* spilled), with a fresh header holding its ckpt id and epoch. Returns the ckpt id,
+* or 0 if the file holds none (ckpt_mem is then not changed). The epoch is stored
+* in *epoch if not NULL.
+*/
+int32_t
+ckpt_spill_load(const char *path, void *ckpt_mem, int64_t bytes, int32_t *epoch);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _CKPT_SPILL_H */
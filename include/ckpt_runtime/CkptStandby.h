@@ -0,0 +1,124 @@
+#ifndef _CKPT_STANDBY_H
+#define _CKPT_STANDBY_H
+
+#include <stdint.h>
+
+/**
+* Hot standby for failing over a checkpointed kernel to a second, pre-warmed
+* process, instead of restoring in the process that hosts the watchdog.
+*
+* The host creates the control block (shared memory) before forking, then forks
+* the primary, which runs the kernel, and the standby, which maps and pre-faults
+* everything the restore touches, and blocks in ckpt_standby_wait:
+*
+*   ckpt_standby_t *standby = ckpt_standby_create();
+*   // standby process:
+*   ckpt_standby_prewarm(ckpt_mem, ckpt_mem_bytes, 0);      // shared: read-touched only
+*   ckpt_standby_prewarm(out, out_bytes, 1);                // private output buffers
+*   ckpt_standby_prewarm_code((const void *)&workload);     // code of the kernel
+*   if (ckpt_standby_wait(standby) == CKPT_STANDBY_HANDOVER)
+*   {
+*     ckpt_standby_resumed(standby);
+*     workload(out, size, ckpt_mem, 0);                     // restores from the last checkpoint
+*   }
+*   // watchdog (e.g. the parent), when the heartbeat of the primary stalls:
+*   kill(primary, SIGKILL);
+*   ckpt_standby_handover(standby);
+*   // ... or, once the primary completed:
+*   ckpt_standby_release(standby);
+*
+* The standby sleeps on a futex in the control block, so waiting costs no CPU and a
+* handover wakes it within microseconds; its page tables and caches are warm, so
+* the restore does not stall on page faults. ckpt_standby_failover_us reports the
+* time from the handover to ckpt_standby_resumed. The standby does not depend on
+* the watchdog's process either: if that process exits or crashes, ckpt_standby_wait
+* returns CKPT_STANDBY_ORPHANED, and the standby can take over watching the primary.
+*
+* Buffers the primary writes while the standby waits (ckpt_mem, shared inputs and
+* outputs) must only be pre-warmed read-only.
+*/
+
+/* States of the control block, and results of ckpt_standby_wait */
+#define CKPT_STANDBY_WAITING   0
+#define CKPT_STANDBY_HANDOVER  1  /* the standby resumes the kernel */
+#define CKPT_STANDBY_RELEASED  2  /* the primary completed; the standby exits */
+#define CKPT_STANDBY_ORPHANED  3  /* the process that created the control block is gone */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  int32_t state;          /* futex word: CKPT_STANDBY_WAITING, _HANDOVER or _RELEASED */
+  int32_t ready;          /* non-zero once the standby waits */
+  int32_t watchdog_pid;   /* process that created the control block */
+  int32_t standby_pid;
+  int64_t handover_ns;    /* CLOCK_MONOTONIC times (comparable across processes) */
+  int64_t woken_ns;
+  int64_t resumed_ns;
+} ckpt_standby_t;
+
+/* Maps a control block shared with the processes forked afterwards (NULL on failure) */
+ckpt_standby_t *
+ckpt_standby_create(void);
+
+void
+ckpt_standby_destroy(ckpt_standby_t *standby);
+
+/**
+* Pre-faults the pages of [addr, addr + bytes) in the calling process: writes a
+* byte of each page if writable is non-zero (for private buffers, whose contents
+* are overwritten by the restore), and otherwise only reads one. Returns the
+* number of bytes pre-faulted.
+*/
+int64_t
+ckpt_standby_prewarm(void *addr, int64_t bytes, int32_t writable);
+
+/**
+* Reads every page of the executable segment that contains func (e.g. the
+* kernel), so its code is mapped and cached. Returns the number of bytes touched,
+* or -1 if func is not in a loaded object.
+*/
+int64_t
+ckpt_standby_prewarm_code(const void *func);
+
+/**
+* Marks the standby ready and blocks until a handover or release, or until the
+* process that created the control block is gone. Returns CKPT_STANDBY_HANDOVER,
+* CKPT_STANDBY_RELEASED or CKPT_STANDBY_ORPHANED.
+*/
+int32_t
+ckpt_standby_wait(ckpt_standby_t *standby);
+
+/* Non-zero once the standby is pre-warmed and waits */
+int32_t
+ckpt_standby_is_ready(const ckpt_standby_t *standby);
+
+/* Wakes the standby to resume the kernel (called by the watchdog) */
+void
+ckpt_standby_handover(ckpt_standby_t *standby);
+
+/* Wakes the standby to exit (the primary completed) */
+void
+ckpt_standby_release(ckpt_standby_t *standby);
+
+/* Called by the standby right before it resumes the kernel */
+void
+ckpt_standby_resumed(ckpt_standby_t *standby);
+
+/**
+* Failover latency: microseconds from ckpt_standby_handover to the standby's
+* return from ckpt_standby_wait (wake) and to ckpt_standby_resumed (failover);
+* -1 until they happened.
+*/
+double
+ckpt_standby_wake_us(const ckpt_standby_t *standby);
+
+double
+ckpt_standby_failover_us(const ckpt_standby_t *standby);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _CKPT_STANDBY_H */
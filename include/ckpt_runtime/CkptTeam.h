@@ -0,0 +1,61 @@
+#ifndef _CKPT_TEAM_H
+#define _CKPT_TEAM_H
+
+#include <stdint.h>
+
+#include "ckpt_runtime/CkptHeader.h"
+
+/**
+* Coordinated checkpoints of multithreaded (SPMD) kernels, used by the code that
+* SubroutineInjection injects into kernels with int `ckpt_thread` (id of the calling
+* thread, 0 .. n-1) and `ckpt_nthreads` (n) arguments, e.g. kernels called by every
+* thread of an OpenMP parallel region:
+*
+*   #pragma omp parallel
+*   kern(arr, ckpt_mem, omp_get_thread_num(), omp_get_num_threads());
+*
+* Every thread of the team must reach the same checkpoints in the same order. At a
+* checkpoint, the threads wait for each other (ckpt_team_barrier), each thread copies
+* its slice of the arrays passed to the kernel (ckpt_team_copy) and saves its own
+* values into its own sub-segment, and the threads wait again before the ckpt id is
+* published. Restores copy the slices back the same way, and end with a barrier.
+*
+* Layout of the values of a checkpoint (after the header):
+*   [arrays passed to the kernel][thread 0 values][thread 1 values]...
+* where each thread's sub-segment is cache-line aligned; the pass prints the size
+* of both parts.
+*
+* The barrier lives in the ckpt_mem header, so ckpt_team_reset must be called before
+* each launch of the team (e.g. after a failed launch left threads in the barrier).
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+* Waits until nthreads threads called ckpt_team_barrier on the same ckpt_mem.
+* Writes before the barrier happen-before reads after it.
+*/
+void
+ckpt_team_barrier(void *ckpt_mem, int32_t nthreads);
+
+/**
+* Copies the slice of thread (of nthreads) of the bytes bytes at src to dst. The
+* slices of all threads cover the whole range and are cache-line multiples.
+*/
+void
+ckpt_team_copy(void *dst, const void *src, uint64_t bytes, int32_t thread, int32_t nthreads);
+
+/* Clears the team barrier before launching the team; must not run concurrently with the kernel */
+static inline void
+ckpt_team_reset(ckpt_header_t *header)
+{
+  __atomic_store_n(&header->barrier_count, 0, __ATOMIC_RELAXED);
+}
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _CKPT_TEAM_H */
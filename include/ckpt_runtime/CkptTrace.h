@@ -0,0 +1,149 @@
+#ifndef _CKPT_TRACE_H
+#define _CKPT_TRACE_H
+
+#include <stdint.h>
+
+/**
+* Recording of checkpoint events into a compact binary trace, and reading it back
+* to replay the saves against a storage or compression backend (see
+* CkptTraceReplay) without re-running the kernel.
+*
+* The recorder is a thread of the host process that polls the segment's header,
+* like the replication sender, and only reads the segment. The segment is split
+* into regions of region_bytes; for each save it sees published, it records when
+* the save started and was published, its ckpt id, epoch and heartbeat, and the
+* ranges of regions whose contents changed since the last event (with their
+* bytes), optionally with the 64-bit hash (ckpt_hash64) and the contents of each
+* changed region:
+*
+*   ckpt_trace_t *trace = ckpt_trace_start("lud.ckpt_trace", ckpt_mem, bytes, 64 << 10,
+*                                          CKPT_TRACE_HASHES);
+*   workload(..., ckpt_mem, epoch);                         // or the watchdog loop
+*   ckpt_trace_stop(trace, NULL);
+*
+* The first event (CKPT_TRACE_BASELINE) holds every region, so a trace with
+* payloads replays the exact contents of each checkpoint. A save is only seen
+* between two polls (every 100 us); if the kernel saved more than once meanwhile,
+* the event counts them in saves, and holds the changes of all of them. The
+* regions are hashed (and copied) while the kernel keeps running; if a save
+* starts meanwhile, the recorder tries again, and after 8 attempts records what
+* it saw as CKPT_TRACE_TORN. Restores bump the heartbeat too, and appear as events
+* without changed regions. Needs -ckpt-header.
+*
+* Reading a trace:
+*
+*   ckpt_trace_info_t info;
+*   ckpt_trace_reader_t *reader = ckpt_trace_open("lud.ckpt_trace", &info);
+*   ckpt_trace_event_t event;
+*   while (ckpt_trace_next(reader, &event) > 0)
+*     ckpt_trace_replay_save(ckpt_mem, &info, &event);      // a save, as the kernel did it
+*   ckpt_trace_close(reader);
+*
+* File layout (native byte order): a 64-byte file header, then one record per
+* event: a 56-byte event header, its ranges (first region and number of regions,
+* 32-bit each), the hashes of the changed regions in order, then their contents.
+*/
+
+/* Flags of ckpt_trace_start (and of ckpt_trace_info_t) */
+#define CKPT_TRACE_HASHES    1  /* record the hash of each changed region */
+#define CKPT_TRACE_PAYLOADS  2  /* record the contents of each changed region */
+
+/* Flags of events */
+#define CKPT_TRACE_BASELINE  1  /* the segment when the recording started (all regions) */
+#define CKPT_TRACE_TORN      2  /* the kernel kept saving while it was recorded */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ckpt_trace ckpt_trace_t;
+typedef struct ckpt_trace_reader ckpt_trace_reader_t;
+
+typedef struct {
+  int64_t segment_bytes;      /* bytes of ckpt_mem, including the header */
+  int64_t region_bytes;
+  int64_t num_regions;        /* regions of the values (after the header) */
+  int64_t start_realtime_ns;  /* CLOCK_REALTIME when the recording started */
+  int32_t flags;              /* CKPT_TRACE_HASHES, CKPT_TRACE_PAYLOADS */
+  int32_t poll_us;
+} ckpt_trace_info_t;
+
+typedef struct {
+  uint32_t first_region;
+  uint32_t num_regions;
+} ckpt_trace_range_t;
+
+typedef struct {
+  int64_t start_ns;           /* save seen starting (or published, if it was not), since the recording started */
+  int64_t publish_ns;         /* save seen published */
+  int32_t ckpt_id;
+  int32_t epoch;
+  int32_t heartbeat;
+  int32_t saves;              /* saves since the previous event (heartbeat difference) */
+  int32_t flags;              /* CKPT_TRACE_BASELINE, CKPT_TRACE_TORN */
+  int32_t num_ranges;
+  int64_t changed_regions;
+  int64_t changed_bytes;
+  const ckpt_trace_range_t *ranges;
+  const uint64_t *hashes;     /* one per changed region; NULL without CKPT_TRACE_HASHES */
+  const void *payload;        /* changed_bytes of contents; NULL without CKPT_TRACE_PAYLOADS */
+} ckpt_trace_event_t;
+
+typedef struct {
+  int64_t events;
+  int64_t saves;              /* saves seen (sum of the events' saves) */
+  int64_t missed_saves;       /* saves that were not seen on their own (saves - events) */
+  int64_t torn_events;
+  int64_t retries;            /* hashes discarded because a save started meanwhile */
+  int64_t changed_bytes;
+  int64_t file_bytes;
+} ckpt_trace_stats_t;
+
+/**
+* Creates the trace file at path and starts recording the saves published in
+* ckpt_mem (bytes, including the header), in regions of region_bytes (a multiple
+* of 8). Returns NULL on failure.
+*/
+ckpt_trace_t *
+ckpt_trace_start(const char *path, const void *ckpt_mem, int64_t bytes, int64_t region_bytes, int32_t flags);
+
+void
+ckpt_trace_stats(const ckpt_trace_t *trace, ckpt_trace_stats_t *stats);
+
+/**
+* Records a save published since the last poll, then closes the file. Returns the
+* number of events; the final stats are stored in *stats if not NULL.
+*/
+int64_t
+ckpt_trace_stop(ckpt_trace_t *trace, ckpt_trace_stats_t *stats);
+
+/* Opens a trace and reads its file header into info; NULL if it is not a trace */
+ckpt_trace_reader_t *
+ckpt_trace_open(const char *path, ckpt_trace_info_t *info);
+
+/**
+* Reads the next event; its ranges, hashes and payload stay valid until the next
+* call. Returns 1, 0 at the end of the trace, or -1 if it is truncated or malformed.
+*/
+int32_t
+ckpt_trace_next(ckpt_trace_reader_t *reader, ckpt_trace_event_t *event);
+
+void
+ckpt_trace_close(ckpt_trace_reader_t *reader);
+
+/**
+* Saves into ckpt_mem (info->segment_bytes) the way the code injected with
+* -ckpt-header does: sets the ckpt id to -1, bumps the heartbeat, writes the
+* changed regions of the event, then publishes its epoch and ckpt id. Regions are
+* written with the event's payload, or else with a pattern derived from the event
+* and region (which compresses differently from the kernel's values). Returns the
+* heartbeat of the save.
+*/
+int32_t
+ckpt_trace_replay_save(void *ckpt_mem, const ckpt_trace_info_t *info, const ckpt_trace_event_t *event);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _CKPT_TRACE_H */
@@ -0,0 +1,78 @@
+#ifndef _CKPT_UNDO_LOG_H
+#define _CKPT_UNDO_LOG_H
+
+#include <stdint.h>
+
+/**
+* Undo logs of arrays passed to a kernel, used by the code that SubroutineInjection
+* injects for arrays selected with checkpoint_undo_log(ptr, max_entries) or
+* -ckpt-undo-log-entries.
+*
+* Such an array is not copied at checkpoints. Instead, each store to it first
+* appends the byte offset, width and old contents of the stored element to the
+* array's undo log in ckpt_mem (inline, without a call), a save empties the log,
+* and a restore writes the old contents back in reverse order, which rolls the
+* array back to its state at the last checkpoint. The array itself must therefore
+* survive the failure, e.g. in shared or persistent memory that the resumed
+* invocation is passed again.
+*
+* When the log is full, ckpt_undo_log_full saves the array as it was at the last
+* checkpoint (the array with the logged stores undone) into the snapshot area
+* behind the entries, and marks the log as spilled: later stores are not logged
+* until the next save, and a restore copies the snapshot back.
+*
+* Layout of an undo log in ckpt_mem (8-byte aligned):
+*   [ckpt_undo_log_t][capacity x ckpt_undo_entry_t][array_bytes of snapshot]
+*/
+
+#define CKPT_UNDO_LOG_SPILLED  (-1)  /* len of a spilled log */
+#define CKPT_UNDO_WIDTH_BITS   4     /* low bits of offset_width hold the width of the store */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  int64_t len;          /* #entries since the last save; CKPT_UNDO_LOG_SPILLED once spilled */
+  int64_t capacity;     /* max #entries */
+  int64_t array_bytes;  /* size of the array (and of the snapshot) */
+  int64_t reserved;
+} ckpt_undo_log_t;
+
+typedef struct {
+  int64_t offset_width;  /* (byte offset into the array << CKPT_UNDO_WIDTH_BITS) | width in bytes (1..8) */
+  uint64_t old_bits;     /* previous contents of the element, zero-extended */
+} ckpt_undo_entry_t;
+
+/* Bytes of ckpt_mem taken by the undo log of an array */
+static inline uint64_t
+ckpt_undo_log_bytes(int64_t capacity, int64_t array_bytes)
+{
+  return sizeof(ckpt_undo_log_t) + capacity * sizeof(ckpt_undo_entry_t) + array_bytes;
+}
+
+/**
+* Empties the log at the start of a fresh (not resumed) invocation.
+*/
+void
+ckpt_undo_log_init(void *log, int64_t capacity, int64_t array_bytes);
+
+/**
+* Called by a store that finds the log full: saves the snapshot of the array as
+* of the last checkpoint, and marks the log as spilled.
+*/
+void
+ckpt_undo_log_full(void *log, const void *array);
+
+/**
+* Rolls array back to its state at the last checkpoint, and empties the log.
+* Can be repeated if it is interrupted.
+*/
+void
+ckpt_undo_log_rollback(void *log, void *array);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _CKPT_UNDO_LOG_H */
@@ -0,0 +1,115 @@
+#ifndef _CHECKPOINT_TILING_H
+#define _CHECKPOINT_TILING_H
+
+#include <map>
+#include <vector>
+
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/ValueHandle.h"
+
+namespace llvm {
+
+class Loop;
+class SCEV;
+class ScalarEvolution;
+
+/**
+* Estimates the work done by one iteration of the loop around each checkpoint, so
+* that SubroutineInjection (-ckpt-tile-work) can save once per tile of iterations
+* that together do about the same amount of work, even if the work per iteration
+* grows or shrinks from one iteration to the next (e.g. lud).
+*
+* The work of an iteration is the number of times the bodies of the loop and of
+* the loops nested in it run, computed from the SCEV backedge-taken counts of the
+* nested loops. SCEV needs the -O0 IR in SSA form, so the analysis runs on a copy
+* of the function whose allocas are promoted to registers. The result is kept as
+* an expression in the function's arguments and the iteration numbers of the loops
+* around the checkpoint, which are computed from the loop counters loaded in the
+* loop headers of the original function.
+*/
+class CheckpointTiling
+{
+public:
+  CheckpointTiling(void) : Func(nullptr) {}
+  ~CheckpointTiling(void) {}
+
+  /**
+  * Analyzes the loops around checkpointBBs of F. Checkpoints whose work per
+  * iteration cannot be estimated are left out, with a warning.
+  */
+  void
+  analyze(Function &F, const std::vector<const BasicBlock *> &checkpointBBs);
+
+  bool
+  hasCheckpoint(const BasicBlock *checkpointBB) const { return CkptWork.count(checkpointBB); }
+
+  /**
+  * Emits the work (int64) of the current iteration of the loop around checkpointBB,
+  * at the insert point of builder (in checkpointBB).
+  */
+  Value *
+  createIterationWork(const BasicBlock *checkpointBB, IRBuilder<> &builder) const;
+
+private:
+  /* Node of a work expression: a SCEV of the promoted copy, in values of the original function */
+  struct WorkExpr {
+    enum Kind { CONST, ARG, LOOP_ITER, ADD, MUL, UDIV, SMAX, UMAX, SMIN, UMIN };
+    Kind kind;
+    int64_t constVal;            // CONST
+    unsigned index;              // argument no. (ARG), or index into LoopIVs (LOOP_ITER)
+    std::vector<WorkExpr> ops;
+  };
+
+  /* Counter of a loop around a checkpoint, whose value is start + step * (iteration number) */
+  struct LoopIV {
+    WeakTrackingVH headerLoad;   // load of the counter in the loop header of the original function
+    WorkExpr start;
+    int64_t step;
+  };
+
+  /* State of the promoted copy of the function, only valid during analyze */
+  struct CloneState;
+
+  Function *Func;
+  std::map<const BasicBlock *, WorkExpr> CkptWork;
+  std::vector<LoopIV> LoopIVs;
+
+  /**
+  * Returns the work of one iteration of L: 1 + the total work of its subloops,
+  * or nullptr if it cannot be computed.
+  */
+  const SCEV *
+  getIterationWork(const Loop *L, ScalarEvolution &SE) const;
+
+  /**
+  * Returns the total work of all iterations of L in one run of it, summing the
+  * work per iteration (loop-invariant, or a chain of recurrences of L) over the
+  * backedge-taken count of L, or nullptr if it cannot be computed.
+  */
+  const SCEV *
+  getTotalWork(const Loop *L, ScalarEvolution &SE) const;
+
+  /**
+  * Translates S into expr. Fails for values other than integer arguments and
+  * constants, and for recurrences of loops that do not contain the checkpoint or
+  * whose counter is not found.
+  */
+  bool
+  translate(const SCEV *S, CloneState &state, WorkExpr &expr);
+
+  /**
+  * Returns the index into LoopIVs of the counter of L (a loop of the copy), adding
+  * it if needed, or -1 if no load in its header is an affine recurrence of L.
+  */
+  int
+  getLoopIV(const Loop *L, CloneState &state);
+
+  Value *
+  createWorkExpr(const WorkExpr &expr, IRBuilder<> &builder) const;
+};
+
+} // namespace llvm
+
+#endif /* _CHECKPOINT_TILING_H */
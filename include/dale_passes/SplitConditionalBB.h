@@ -11,6 +11,9 @@
 #include "popcorn_compiler/LiveValues.h"
 #include "json/JsonHelper.h"
 
+/* Metadata kind of the allocas that replace the fields of a split struct alloca (holds the struct's name) */
+#define STRUCT_FIELD_MD_NAME "ckpt.struct.field"
+
 namespace llvm {
 
 class SplitConditionalBB : public FunctionPass
@@ -67,6 +70,21 @@ public:
   Instruction *
   getCmpInstForCondiBrInst(Instruction *condiBranchInst, Module *M) const;
 
+  /**
+  * Returns true if alloca is only used by GEPs that select one of its fields
+  * with constant indices (0, field, ...).
+  */
+  bool
+  hasOnlyFieldUses(const AllocaInst *alloca) const;
+
+  /**
+  * Replaces each struct alloca that hasOnlyFieldUses with one alloca per field
+  * (named <struct>.f<field>, tagged with STRUCT_FIELD_MD_NAME), so that the
+  * fields are analysed and saved on their own. Struct fields are split in turn.
+  */
+  bool
+  splitStructAllocas(Function *F);
+
   /**
   * Spits BBs with conditional branches into two BBs.
   * Lower half will only contain the icmp/fcmp and br instructions.
@@ -1,6 +1,7 @@
 #ifndef _SUBROUTINE_INJECTION_H
 #define _SUBROUTINE_INJECTION_H
 
+#include <functional>
 #include <map>
 #include <set>
 #include <limits>
@@ -10,9 +11,13 @@
 #include "llvm/IR/Function.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Support/raw_ostream.h"
 
 #include "popcorn_compiler/LiveValues.h"
+#include "dale_passes/ValueVersionTracker.h"
+#include "dale_passes/CheckpointTiling.h"
 
 #define HEARTBEAT     0
 #define CKPT_ID       1
@@ -85,7 +90,47 @@ private:
 
   /* Maps tracked values to the checkpointed BBs*/
   typedef std::map<const BasicBlock*, std::set<const Value*>> CheckpointBBMap;
-  typedef std::map<const BasicBlock*, std::map<const Value*, const Value*>> CheckpointBBOldNewValsMap;
+
+  /* Part of an array that is saved, declared with checkpoint_region(ptr, len) */
+  typedef struct {
+    uint64_t offsetBytes;
+    uint64_t numBytes;
+  } CheckpointRegion;
+
+  /* Maps the alloca of an array (or of the pointer to it, e.g. %arr.addr) to its saved region */
+  typedef std::map<const Value*, CheckpointRegion> CheckpointRegionMap;
+
+  /* Maps the alloca holding an array argument to the #entries of its undo log, declared with checkpoint_undo_log(ptr, max_entries) */
+  typedef std::map<const Value*, uint64_t> UndoLogEntriesMap;
+
+  /* Maps the alloca of a float/double array (or of the pointer to it) to the max absolute error of its lossy saves, declared with checkpoint_lossy(ptr, max_abs_error) */
+  typedef std::map<const Value*, double> LossyErrorMap;
+
+  /* Descriptor table of a saveBB/restoreBB pair, with -ckpt-descriptor-table (see ckpt_runtime/CkptDescriptor.h) */
+  typedef struct {
+    CallInst *saveCall;               // ckpt_desc_save in the saveBB (nullptr without saveBB)
+    CallInst *restoreCall;            // ckpt_desc_restore in the restoreBB (nullptr without restoreBB)
+    std::vector<Constant *> descs;    // ckpt_desc_t of each value, in spill field order
+  } DescriptorTable;
+
+  /* Array argument that is rolled back with an undo log instead of being saved (see ckpt_runtime/CkptUndoLog.h) */
+  typedef struct {
+    AllocaInst *holder;               // alloca holding the array argument (e.g. %arr.addr)
+    uint64_t capacity;                // #entries
+    uint64_t arrayBytes;
+    int64_t slot;                     // first ckpt_mem slot of the log
+    Value *logPtr;                    // i64* to the log, computed in the entry block
+    std::vector<StoreInst *> stores;  // stores into the array, instrumented once the checkpoints are in place
+  } UndoLog;
+
+  /* Array argument saved incrementally, a few chunks per checkpoint site (see ckpt_runtime/CkptIncremental.h) */
+  typedef struct {
+    AllocaInst *holder;               // alloca holding the array argument (e.g. %arr.addr)
+    uint64_t arrayBytes;
+    uint64_t chunkBytes;
+    int64_t stateOffset;              // byte offset of its chunk versions and buffers from the session
+    std::vector<StoreInst *> stores;  // stores into the array, instrumented once the checkpoints are in place
+  } IncrementalArray;
 
   Instruction* instScopeEntry;
   Instruction* instScopeExit;
@@ -131,16 +176,17 @@ private:
   };
 
   void
-  printFuncValuePtrsMap(SubroutineInjection::FuncValuePtrsMap map, Module &M);
+  printFuncValuePtrsMap(const SubroutineInjection::FuncValuePtrsMap &map, Module &M);
 
   long unsigned int
-  getMaxNumOfTrackedValsForBBs(LiveValues::BBTrackedVals &bbTrackedVals) const;
+  getMaxNumOfTrackedValsForBBs(const LiveValues::BBTrackedVals &bbTrackedVals) const;
 
   /**
-  * Filters for BBs that only have one successor.
+  * Filters for BBs that only have one successor, or a checkpoint() call
+  * (after which they are split).
   */
   LiveValues::BBTrackedVals
-  getBBsWithOneSuccessor(LiveValues::BBTrackedVals bbTrackedVals) const;
+  getBBsWithOneSuccessor(const LiveValues::BBTrackedVals &bbTrackedVals) const;
 
   /**
   * Removes Values in ingoredValues from tracked vals sets of all BBs.
@@ -148,7 +194,7 @@ private:
   * a sustring of this tracked val's name, ignore this tracked val too.
   */
   LiveValues::BBTrackedVals
-  removeSelectedTrackedVals(LiveValues::BBTrackedVals bbTrackedVals, std::set<Value *> ignoredValues) const;
+  removeSelectedTrackedVals(const LiveValues::BBTrackedVals &bbTrackedVals, const std::set<Value *> &ignoredValues) const;
 
   /**
   * For each BB, filter out values contianing substring matchStr that have nested 
@@ -156,27 +202,28 @@ private:
   * not include this BB in returned BBTrackedVals map.
   */
   LiveValues::BBTrackedVals
-  removeMatchedNestedPtrVals(LiveValues::BBTrackedVals bbTrackedVals, StringRef matchStr) const;
+  removeMatchedNestedPtrVals(const LiveValues::BBTrackedVals &bbTrackedVals, StringRef matchStr) const;
 
   /**
   * Remove BBs with no tracked values from consideration as checkpoints
   */
   LiveValues::BBTrackedVals
-  removeBBsWithNoTrackedVals(LiveValues::BBTrackedVals bbTrackedVals) const;
+  removeBBsWithNoTrackedVals(const LiveValues::BBTrackedVals &bbTrackedVals) const;
 
   /**
   * Chooses BBs for checkpointing based on least number of tracked values in BB.
   * Only considers BBs with at least minValsCount number of tracked values.
   */
   CheckpointBBMap
-  chooseBBWithLeastTrackedVals(LiveValues::BBTrackedVals bbTrackedVals, Function *F,
+  chooseBBWithLeastTrackedVals(const LiveValues::BBTrackedVals &bbTrackedVals, Function *F,
                               long unsigned int minValsCount) const;
 
   /**
   * Chooses BB for checkpointing if it contains the `checkpoint()` function call.
+  * The BB is split right after the call, whose live values are its tracked values.
   */
   CheckpointBBMap
-  chooseBBWithCheckpointDirective(LiveValues::BBTrackedVals bbTrackedVals, Function *F);
+  chooseBBWithCheckpointDirective(const LiveValues::BBTrackedVals &bbTrackedVals, Function *F);
   
   /**
   * Prints the chosen checkpoint BBs and their tracked values.
@@ -194,13 +241,21 @@ private:
   * Get set func params that are 'const'
   */
   std::set<Value *>
-  getConstFuncParams(std::set<Value *> funcParams) const;
+  getConstFuncParams(const std::set<Value *> &funcParams) const;
 
   /**
   * Get Value that ptrValue is dereferenced (stored) to in function F
+  * Store addresses of F are indexed on first use (see StoredValsByAddr).
   */
   Value *
-  getDerefValFromPointer(Value* valPtr, std::set<const Value *> valVersions, Function *F) const;
+  getDerefValFromPointer(Value* valPtr, const ValueVersionTracker::VersionSet &valVersions, Function *F);
+
+  /*
+    Maps each address stored to in StoredValsFunc to <position of first store, stored value>.
+    Is only valid while no stores to versions of tracked values are added to the function.
+  */
+  DenseMap<const Value *, std::pair<unsigned, Value *>> StoredValsByAddr;
+  const Function *StoredValsFunc = nullptr;
 
   /**
   * Adds type conversion instruction to convert val to destType
@@ -208,11 +263,105 @@ private:
   Instruction *
   addTypeConversionInst(Value *val, Type *destType, std::string valName, Instruction* insertBefore);
 
+  /**
+  * Gets the index of the first ckpt_mem slot used for saved values; with -ckpt-header
+  * this is the first slot after the cache-line header (see ckpt_runtime/CkptHeader.h).
+  */
+  int
+  getValuesStartSlot(int ckptMemSegContainedTypeSize) const;
+
+  /**
+  * Gets a pointer (i32*) to the given int32 field of the ckpt_mem header (-ckpt-header).
+  */
+  Instruction *
+  getCkptHeaderFieldPtr(Value *ckptMemSegment, unsigned field, std::string name, Instruction *insertBefore) const;
+
+  /**
+  * Makes load/store I of a ckpt_mem header field atomic with the given ordering.
+  */
+  void
+  setCkptHeaderAccessOrdering(Instruction *I, AtomicOrdering order) const;
+
+  /**
+  * Gets (or declares) the ckpt_runtime copy function funcName (see ckpt_runtime/CkptCopy.h).
+  * If isIndexed, its signature is void(i8*, i8*, i32*, i32*); else void(i8*, i8*, i64).
+  */
+  Function *
+  getCkptRuntimeFunc(Module &M, StringRef funcName, bool isIndexed) const;
+
+  /**
+  * Gets (or declares) the ckpt_runtime function funcName with type funcTy.
+  */
+  Function *
+  getCkptRuntimeFunc(Module &M, StringRef funcName, FunctionType *funcTy) const;
+
+  /**
+  * Inserts a call to the ckpt_runtime copy function copyFunc (void(i8*, i8*, i64))
+  * before insertBefore, copying numBytes bytes from src to dst.
+  */
+  CallInst *
+  createCkptRuntimeCopy(Function *copyFunc, Value *dst, Value *src, uint64_t numBytes, Instruction *insertBefore) const;
+
+  /**
+  * Gets the CKPT_DESC_* kind of tracked value val in a descriptor table, and sets
+  * conv and valueBytes (of scalars). Returns -1 for values that are saved inline
+  * (scalars whose type differs from the ckpt_mem element type, other than int32s).
+  */
+  int
+  getDescriptorKind(Value *val, Type *ckptMemSegContainedType, const DataLayout &DL, int &conv, int &valueBytes) const;
+
+  /**
+  * Inserts a ckpt_desc_save/ckpt_desc_restore call (descFunc) before insertBefore;
+  * its table is set by finishDescriptorTable.
+  */
+  CallInst *
+  createDescriptorCall(Function *descFunc, Value *ckptMemSegment, AllocaInst *spill, Instruction *insertBefore) const;
+
+  /**
+  * Appends a descriptor of a value with field spillField in the spill area to table;
+  * numBytes is the size of a scalar, or the bytes copied of an array.
+  */
+  void
+  addDescriptor(DescriptorTable &table, int kind, int conv, unsigned spillField, int64_t ckptOffset, int64_t numBytes,
+                int64_t arrayOffset) const;
+
+  /**
+  * Gets a pointer of type fieldType* to field idx of the spill area.
+  */
+  Value *
+  getDescriptorSpillField(AllocaInst *spill, unsigned idx, Type *fieldType, Instruction *insertBefore) const;
+
+  /**
+  * Emits the descriptors of table as a constant global named name and passes it to
+  * the table's calls, or removes the calls if the table is empty.
+  */
+  void
+  finishDescriptorTable(DescriptorTable &table, Module &M, std::string name) const;
+
+  /**
+  * Inserts a call to ckpt_lossy_encode_* (saving numElems elements of src, each within
+  * maxError, to dst) or ckpt_lossy_decode_* (restoring src into dst) before insertBefore.
+  */
+  CallInst *
+  createCkptLossyCopy(Function *lossyFunc, Value *dst, Value *src, int64_t numElems, double maxError,
+                      Instruction *insertBefore) const;
+
+  /**
+  * Inserts a call to ckpt_copy_dedup before insertBefore, saving numBytes bytes from
+  * src to dst and skipping the chunks whose hash is unchanged. The hash table is put
+  * at the first 8-byte aligned slot from tableSlot on; hashesValid (i32) says if it
+  * holds the hashes of the previous save to dst.
+  * @return the number of ckpt_mem slots taken from tableSlot on
+  */
+  int
+  createCkptDedupCopy(Function *dedupFunc, Value *ckptMemSegment, Value *dst, Value *src, uint64_t numBytes,
+                      int tableSlot, Value *hashesValid, Instruction *insertBefore) const;
+
   /**
   * Gets the Value* for the function param that matches segmentName exactly.
   */
   Value *
-  getSelectedFuncParam(std::set<Value *> funcParams, StringRef segmentName, Module *M) const;
+  getSelectedFuncParam(const std::set<Value *> &funcParams, StringRef segmentName, Module *M) const;
 
   /**
   * Get list of successor BBs for given BB
@@ -269,39 +418,19 @@ private:
   /**
   * Maps checkpoint ID to Checkpoint Topo struct
   */
-  typedef std::map<uint8_t, SubroutineInjection::CheckpointTopo> CheckpointIdBBMap;
+  typedef std::map<unsigned, SubroutineInjection::CheckpointTopo> CheckpointIdBBMap;
 
   /**
-  * Update the tracked values set for the given checkpointBB
-  * If ckptBBMap contains value in valueVersions, remove value and replace it with newVal.
+  * Initialise the version tracker with the <originalTrackedValue, updatedTrackedValue> pairs of each checkpoint BB,
+  * and with the propagated versions of each original tracked value (across all ckpts in func).
   */
   void
-  updateCkptBBMap(BasicBlock *ckptBB, Value *newVal, std::set<Value *> valueVersions, CheckpointBBOldNewValsMap *ckptBBOldNewValsMap,
-                  Value *originalTrackedVal);
-
-  /**
-  * Initialise map of BBs each corresponding to a map of <originalTrackedValue, updatedTrackedValue> pairs 
-  */
-  std::map<const BasicBlock*, std::map<const Value*, const Value*>> 
-  initBBCheckpointsOldNewVals(CheckpointBBMap bbCheckpoints);
-
-  /**
-  * Initialise map which tracks all propagated versions of an original tracked value (across all ckpts in func)
-  */
-  std::map<const Value *, std::set<const Value *>>
-  initAllTrackedValVersions(CheckpointBBMap bbCheckpoints);
+  initValueVersionTracker(const CheckpointBBMap &bbCheckpoints, ValueVersionTracker &valVersionTracker);
 
   /** Update global version history for each tracked value across all checkpoints */
   void
   updateAllTrackedValVersionsMap(Value *originalTrackedVal, Value *newTrackedVal,
-                                std::map<const Value*, std::set<const Value*>> *allTrackedValVersions,
-                                Module *M);
-
-  /**
-  * Converts map into a pair with 1) a set of map keys, and 2) a set of map values
-  */
-  std::pair<std::set<const Value *>, std::set<const Value *>>
-  getOldNewTrackedValsSets(std::map<const Value*, const Value*> oldNewTrackedVals);
+                                ValueVersionTracker &valVersionTracker, Module *M);
 
   /**
   * Allocates Checkpoint IDs to Checkpoints.
@@ -314,129 +443,309 @@ private:
   ) const;
 
   void
-  printCheckpointIdBBMap(SubroutineInjection::CheckpointIdBBMap map, Function *F);
+  printCheckpointIdBBMap(const SubroutineInjection::CheckpointIdBBMap &map, Function *F);
 
   /**
-  * For each module, selects and constructs additional BBs for checkpointing & restoration:
-  * 0. Obtains candidate checkpoint BBs.
-  * 1. Get pointers to entry BB and checkpoint BBs.
-  * 2. Add block on exit edge of entry block that leads to computation.
-  * 3. Add saveBB on exit edge of checkpointed block.
-  * 4. Add restoreBBs and junctionBBs for each checkpointed block.
-  * 5. Add checkpointIDs to saveBBs and restoreBBs.
-  * 6. Populate saveBB and restoreBB with load and store instructions.
-  * 7. Propagate loaded values from restoreBB across CFG.
-  * 8. Populate restoreControllerBB with switch instructions.
+  * Makes the saveBB of checkpointTopo conditional on the save request flag in the
+  * ckpt_mem header (-ckpt-on-demand): checkpointBB polls the flag and skips the
+  * saveBB unless it is set. The saveBB clears the flag and acknowledges the save.
   */
-  bool
-  injectSubroutines(
-    Module &M,
-    const LiveValues::TrackedValuesResult &funcBBTrackedValsMap,
-    const LiveValues::LivenessResult &funcBBLiveValsMap,
-    const LiveValues::FuncVariableDefMap &funcVariableDefMap
-  );
+  void
+  insertSaveRequestPoll(const CheckpointTopo &checkpointTopo, Value *ckptMemSegment);
 
   /**
-  * Propagate loaded values from restoreBB across CFG to restore
-  * Values while maintaining SSA form.
+  * Makes the saveBB of checkpointTopo conditional on the runtime's adaptive interval
+  * controller (-ckpt-adaptive, see ckpt_runtime/CkptInterval.h), and times each save.
   */
   void
-  propagateRestoredValuesBFS(BasicBlock *startBB, BasicBlock *prevBB, Value *oldVal, Value *newVal,
-                            Value *originalTrackedVal,
-                            std::map<BasicBlock *, std::set<Value *>> *visitedBBs,
-                            const LiveValues::LivenessResult *funcBBLiveValsMap,
-                            std::map<BasicBlock *, std::set<const Value *>> &funcSaveBBsLiveOutMap,
-                            std::map<BasicBlock *, std::set<const Value *>> &funcRestoreBBsLiveOutMap,
-                            std::map<BasicBlock *, std::set<const Value *>> &funcJunctionBBsLiveOutMap,
-                            CheckpointBBOldNewValsMap *ckptBBOldNewValsMap,
-                            std::map<const Value*, std::set<const Value*>> *allTrackedValVersions);
+  insertAdaptiveIntervalPoll(const CheckpointTopo &checkpointTopo, Module &M);
 
-  typedef struct {
-    BasicBlock *startBB;
-    BasicBlock *currBB;
-    BasicBlock *prevBB;   // is the direct previous BB that was processed
-    Value *oldVal;
-    Value *newVal;        // is the value that we want to propagate
-    // keeps track of existing propagated verions of the current trackedVal in the current "path/branch" of traversal 
-    std::set<Value *> valueVersions; 
-  } BBUpdateRequest;
+  /**
+  * Makes the saveBB of checkpointTopo conditional on the work of the loop iterations
+  * since the last save (-ckpt-tile-work), as estimated by ckptTiling, reaching
+  * a tile. The work is kept in an alloca that entryBB sets to a full tile.
+  */
+  void
+  insertTileWorkPoll(const CheckpointTopo &checkpointTopo, const CheckpointTiling &ckptTiling, BasicBlock *entryBB);
+
+  /**
+  * Makes the saveBB of checkpointTopo conditional on ckpt_incr_poll, which copies the
+  * next chunks of the incremental save in progress (-ckpt-incremental-chunk-bytes),
+  * and only lets a new save start once the previous one is published. The saveBB
+  * starts the save (ckpt_incr_begin) and hands its ckpt id to the session
+  * (ckpt_incr_commit) instead of publishing it.
+  */
+  void
+  insertIncrementalSavePoll(const CheckpointTopo &checkpointTopo, Value *ckptMemSegment, Value *incrSession,
+                            StoreInst *storeCkptId, Module &M);
+
+  /**
+  * Rounds slot up to the first slot of a cache line of ckpt_mem.
+  */
+  int
+  alignSlotToCacheLine(int slot, int ckptMemSegContainedTypeSize) const;
+
+  /**
+  * Team kernels: inserts the computation of the first slot of the calling thread's
+  * sub-segment (teamThread * stride + start) before insertBefore. Stride and start
+  * are set with setTeamSlotLayout once the layout of the ckpt is known.
+  */
+  Instruction *
+  createTeamSlotBase(Value *teamThread, Instruction *insertBefore) const;
 
   void
-  processUpdateRequest(BBUpdateRequest updateRequest, std::queue<BBUpdateRequest> *q,
-                      Value *originalTrackedVal,
-                      std::map<BasicBlock *, std::set<Value *>> *visitedBBs,
-                      const LiveValues::LivenessResult *funcBBLiveValsMap,
-                      std::map<BasicBlock *, std::set<const Value *>> &funcSaveBBsLiveOutMap,
-                      std::map<BasicBlock *, std::set<const Value *>> &funcRestoreBBsLiveOutMap,
-                      std::map<BasicBlock *, std::set<const Value *>> &funcJunctionBBsLiveOutMap,
-                      CheckpointBBOldNewValsMap *ckptBBOldNewValsMap);
+  setTeamSlotLayout(Instruction *teamSlotBase, int privateStartSlot, int threadStrideSlots) const;
+
+  /**
+  * Team kernels: inserts a call to ckpt_team_copy (the calling thread's slice of the
+  * copy) or ckpt_team_barrier before insertBefore (see ckpt_runtime/CkptTeam.h).
+  */
+  CallInst *
+  createCkptTeamCopy(Function *teamCopyFunc, Value *dst, Value *src, uint64_t numBytes,
+                     Value *teamThread, Value *teamNumThreads, Instruction *insertBefore) const;
+
+  CallInst *
+  createCkptTeamBarrier(Function *teamBarrierFunc, Value *ckptMemSegment, Value *teamNumThreads, Instruction *insertBefore) const;
+
+  /**
+  * Moves BB (a saveBB or restoreBB) into a new function marked cold and noinline,
+  * and replaces it with a cold call (-ckpt-outline-cold). Allocas in BB move to the
+  * entry block. Returns nullptr if BB could not be outlined.
+  */
+  Function *
+  outlineColdBB(BasicBlock *BB) const;
 
+  /**
+  * Replaces the branch checkpointBB -> saveBB with a branch on isSaveDue (computed
+  * in checkpointBB), whose false edge skips the saveBB. Returns false if the
+  * checkpointBB does not end in an unconditional branch to the saveBB.
+  */
+  bool
+  makeSaveBBConditional(const CheckpointTopo &checkpointTopo, std::function<Value *(IRBuilder<> &)> getIsSaveDue);
+
+  /**
+  * Gets the buffer that ptr (an argument of a checkpoint directive, or the address
+  * of a load/store) points into: the alloca of a local array or scalar, or the
+  * alloca holding the pointer to an array passed to the function (e.g. %arr.addr).
+  * Sets offsetBytes to the constant byte offset of ptr in the buffer (-1 if it is
+  * not constant). Returns nullptr if ptr does not point into such a buffer.
+  */
+  AllocaInst *
+  getDirectiveBuffer(Value *ptr, const DataLayout &DL, int64_t &offsetBytes) const;
+
+  /**
+  * Collects and removes the checkpoint_region(ptr, len), checkpoint_exclude(ptr),
+  * checkpoint_undo_log(ptr, max_entries) and checkpoint_lossy(ptr, max_abs_error)
+  * calls in F. An excluded buffer that
+  * may be read after a checkpoint before it is overwritten is still saved (with a
+  * warning).
+  */
   void
-  updateMapEntry(BasicBlock *key, std::set<Value *> newVal, std::map<BasicBlock *, std::set<Value *>> *map);
+  getCheckpointRegionDirectives(Function &F, CheckpointRegionMap &regions, std::set<Value *> &excluded,
+                                UndoLogEntriesMap &undoLogEntries, LossyErrorMap &lossyErrors);
+
+  /**
+  * Returns true if, on every path from ckptCall (i.e. from where a resumed run
+  * continues), buffer is overwritten before it is read. Loops entered after
+  * ckptCall are assumed to run at least once; a store inside a loop that also
+  * contains ckptCall only overwrites buffer if its address does not depend on the
+  * induction variable of that loop (otherwise the resumed run only writes the
+  * remaining iterations' part).
+  */
+  bool
+  isOverwrittenBeforeRead(AllocaInst *buffer, Instruction *ckptCall, LoopInfo &LI) const;
 
   /**
-  * Gets value for corresponding key in map.
-  * If key is not in map, a key-value entry is initialised and added to map; value is empty set.
+  * Gets the fields of split struct allocas (see SplitConditionalBB) that are only
+  * written in entryBB, with values that are the same each time entryBB runs. A
+  * restore runs entryBB again, so they need not be saved.
   */
   std::set<Value *>
-  getOrDefault(BasicBlock *key, std::map<BasicBlock *, std::set<Value *>> *map);
+  getStructFieldsInitializedOnEntry(Function &F, BasicBlock *entryBB) const;
 
   /**
-  * Given a value, finds the corresponding key in the map
+  * Returns true if the memory at ptr (or at pointers derived from it with GEPs and
+  * casts) is only read, or written by stores in entryBB of values that
+  * isRecomputedOnEntry.
   */
-  const Value *
-  findKeyByValueInMap(const Value *value, std::map<const Value*, const Value*> map);
+  bool
+  isOnlyWrittenOnEntry(Value *ptr, BasicBlock *entryBB) const;
 
-  const Value *
-  findKeyByValueInMap(Value *value, std::map<const Value*, std::set<const Value*>> map);
+  /**
+  * Returns true if -ckpt-restore-in-place is set and ptr is a static alloca of
+  * entryBB, whose restored value is then stored back into it instead of into a
+  * new alloca that is propagated with phis.
+  */
+  bool
+  isRestorableInPlace(Value *ptr, BasicBlock *entryBB) const;
 
   /**
-  * Checks if Value val is live-out of basic block BB.
+  * Returns true if val is the same each time entryBB runs: constants, arguments, and
+  * instructions of entryBB on such values (no calls; loads only from allocas that
+  * are only written by such stores before the load).
   */
   bool
-  isValLiveOutofBB(BasicBlock *BB, Value *val, const LiveValues::LivenessResult *funcBBLiveValsMap,
-                  std::map<BasicBlock *, std::set<const Value *>> &funcSaveBBsLiveOutMap,
-                  std::map<BasicBlock *, std::set<const Value *>> &funcRestoreBBsLiveOutMap,
-                  std::map<BasicBlock *, std::set<const Value *>> &funcJunctionBBsLiveOutMap);
+  isRecomputedOnEntry(Value *val, BasicBlock *entryBB) const;
 
+  /**
+  * Gets the object that ptr points into: a pointer argument or a local alloca,
+  * looking through GEPs, casts and pointers loaded from pointer allocas (whose
+  * provenance is that of every pointer stored to them). Returns nullptr if the
+  * object is unknown or not unique.
+  */
+  Value *
+  getPointerProvenance(Value *ptr, std::set<Value *> &visited) const;
 
   /**
-  * Counts how many of BB's predecessors has val in their live-out set
+  * Gets the object that every pointer stored to ptrAlloca (e.g. %arr.addr) points
+  * into; nullptr if they differ, are unknown, or the address of ptrAlloca escapes.
   */
-  unsigned
-  numOfPredsWhereVarIsLiveOut(BasicBlock *BB, Value *val, const LiveValues::LivenessResult *funcBBLiveValsMap,
-                              std::map<BasicBlock *, std::set<const Value *>> &funcSaveBBsLiveOutMap,
-                              std::map<BasicBlock *, std::set<const Value *>> &funcRestoreBBsLiveOutMap,
-                              std::map<BasicBlock *, std::set<const Value *>> &funcJunctionBBsLiveOutMap);
+  Value *
+  getStoredPointerProvenance(AllocaInst *ptrAlloca, std::set<Value *> &visited) const;
 
   /**
-  * Checks if currBB contains a phi instruction with incoming entry [value, prevBB],
-  * where value is in valueVersions (i.e. value is a version of the currently-tracked value)
+  * Gets the alloca that only ever holds the pointer argument arg (e.g. %arr.addr),
+  * or nullptr.
   */
-  bool
-  isPhiInstExistForIncomingBBForTrackedVal(std::set<Value *> valueVersions, BasicBlock *currBB, BasicBlock *prevBB);
+  AllocaInst *
+  getPointerArgHolder(Value *arg) const;
+
+  /*
+    Results of getPointerArgHolder and getTrackedPointerObject for the current function,
+    computed on first use. Both walk every user of a pointer alloca (e.g. the loads of
+    %arr.addr), and are looked up for every checkpoint.
+  */
+  mutable DenseMap<const Value *, AllocaInst *> PointerArgHolders;
+  mutable DenseMap<const Value *, Value *> TrackedPointerObjects;
+
+  /**
+  * Gets the array argument or local alloca that a tracked pointer (a pointer alloca
+  * or an SSA pointer) points into; nullptr if it is unknown, or if trackedVal is
+  * the alloca holding the whole array argument.
+  */
+  Value *
+  getTrackedPointerObject(const Value *trackedVal) const;
+
+  /**
+  * A tracked pointer into an array argument makes the array itself live: adds the
+  * alloca holding the array (e.g. %arr.addr) to the checkpoint's tracked values,
+  * unless it is ignored (e.g. a const array).
+  */
+  void
+  addArraysOfTrackedPointers(CheckpointBBMap &bbCheckpoints, const std::set<Value *> &ignoredVals) const;
+
+  /**
+  * Maps each tracked pointer into an array to the value addressing that array (the
+  * local array's alloca, or the alloca holding the array argument). Such pointers
+  * are saved as their offset from the array, instead of as an array of their own.
+  */
+  std::map<const Value *, const Value *>
+  getDerivedPointers(const std::set<const Value *> &trackedVals) const;
 
   /**
-  * Checks if val is an operand of a phi instruction in BB.
+  * Inserts instructions computing the (i8*) address of the object saved by
+  * baseVal (a local array, or a pointer alloca holding the array pointer).
+  */
+  Value *
+  createObjectBasePtr(Value *baseVal, IRBuilder<> &builder) const;
+
+  /**
+  * Returns ptr advanced by offsetBytes (ptr itself if offsetBytes is 0), for saving
+  * and restoring the region of an array.
+  */
+  Value *
+  createOffsetPointer(Value *ptr, uint64_t offsetBytes, Instruction *insertBefore) const;
+
+  /**
+  * Chooses the array arguments of F that get an undo log: those with a
+  * checkpoint_undo_log directive, and (with -ckpt-undo-log-entries) those whose log
+  * would take at most a quarter of the bytes of the array. The array must only be
+  * written by plain stores through the pointer loaded from its holder.
+  */
+  std::vector<UndoLog>
+  getUndoLogArrays(Function &F, const CheckpointBBMap &bbCheckpoints, const UndoLogEntriesMap &undoLogEntries,
+                   const LiveValues::VariableDefMap &valDefMap, const ValueVersionTracker &valVersionTracker);
+
+  /**
+  * Collects the stores into the array held by holder; returns false if the array
+  * is also written (or its address escapes) in some other way.
   */
   bool
-  isPhiInstForValExistInBB(Value *val, BasicBlock *BB);
+  getArrayStores(AllocaInst *holder, std::vector<StoreInst *> &stores) const;
+
+  /**
+  * Inserts the (inline) append of the old contents of the stored element to the
+  * undo log before each store into the array.
+  */
+  void
+  insertUndoLogging(const UndoLog &undoLog, Function *func_ckpt_undo_log_full) const;
+
+  /**
+  * Chooses the array arguments of F that are saved incrementally: those tracked at
+  * some checkpoint that span at least two chunks, and are only written by plain
+  * stores through the pointer loaded from their holder.
+  */
+  std::vector<IncrementalArray>
+  getIncrementalArrays(Function &F, const CheckpointBBMap &bbCheckpoints, const LiveValues::VariableDefMap &valDefMap,
+                       const ValueVersionTracker &valVersionTracker);
+
+  /**
+  * Inserts the copy-before-write of the stored chunk before each store into the
+  * array: an inline check of the session's active flag, and a call to
+  * ckpt_incr_before_write while a save is in progress.
+  */
+  void
+  insertCopyBeforeWrite(const IncrementalArray &incrArray, int idx, Value *incrSession, Function *func_ckpt_incr_before_write) const;
+
+  /**
+  * Adds the allocas loaded and the phis used to compute V to roots (stops at them).
+  */
+  void
+  getAddressRoots(Value *V, std::set<Value *> &roots, std::set<Value *> &visited) const;
 
   /**
-  * Replaces occurrences of oldVal in inst to newVal.
-  * Returns true if replacement has occured.
+  * For each module, selects and constructs additional BBs for checkpointing & restoration:
+  * 0. Obtains candidate checkpoint BBs.
+  * 1. Get pointers to entry BB and checkpoint BBs.
+  * 2. Add block on exit edge of entry block that leads to computation.
+  * 3. Add saveBB on exit edge of checkpointed block.
+  * 4. Add restoreBBs and junctionBBs for each checkpointed block.
+  * 5. Add checkpointIDs to saveBBs and restoreBBs.
+  * 6. Populate saveBB and restoreBB with load and store instructions.
+  * 7. Propagate loaded values from restoreBB across CFG.
+  * 8. Populate restoreControllerBB with switch instructions.
   */
   bool
-  replaceOperandsInInst(Instruction *inst, Value *oldVal, Value *newVal);
+  injectSubroutines(
+    Module &M,
+    const LiveValues::TrackedValuesResult &funcBBTrackedValsMap,
+    const LiveValues::LivenessResult &funcBBLiveValsMap,
+    const LiveValues::FuncVariableDefMap &funcVariableDefMap
+  );
+
+  /**
+  * Propagate loaded values from restoreBB across CFG to restore
+  * Values while maintaining SSA form.
+  * Rewrites every use of originalTrackedVal to the version that reaches it, given the
+  * phis that merge the restored & saved versions in each junctionBB. Is done once per
+  * tracked value for all checkpoints in the function, and only places new phis where
+  * different versions meet, so cost is linear in the number of uses.
+  * Created phis are added to valVersionTracker, and the current version of
+  * originalTrackedVal at each checkpoint BB is updated.
+  */
+  void
+  propagateRestoredValuesSSA(Value *originalTrackedVal, const std::vector<PHINode *> &junctionPhis,
+                            const std::set<BasicBlock *> &checkpointBBs,
+                            ValueVersionTracker &valVersionTracker);
 
   BasicBlock*
   SplitEdgeCustom(BasicBlock *BB, BasicBlock *Succ, DominatorTree *DT, LoopInfo *LI) const;
 
   std::tuple<llvm::Value*, Value*> getOffsetArray(Value* v, Function &F);
   int insertIndexTracking(Function &F);
-  void allocateindexStacks(std::set<const Value *> trackedVals, std::map<const Value*, const Value*> oldNewTrackedVals,
-                          std::map<const Value *, std::set<const Value*>> allTrackedValVersions, LiveValues::VariableDefMap valDefMap,
-                          LiveValues::VariableDefMap liveValDefMap, Value* ckptMemSegment, Function& F, Module& M);
+  void allocateindexStacks(const std::set<const Value *> &trackedVals, const ValueVersionTracker &valVersionTracker,
+                          const LiveValues::VariableDefMap &valDefMap, const LiveValues::VariableDefMap &liveValDefMap,
+                          Value* ckptMemSegment, Function& F, Module& M);
   
 
   /**
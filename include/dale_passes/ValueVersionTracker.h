@@ -0,0 +1,123 @@
+#ifndef _VALUE_VERSION_TRACKER_H
+#define _VALUE_VERSION_TRACKER_H
+
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Value.h"
+
+namespace llvm {
+
+/**
+* Tracks the versions of tracked values that are created while restored values
+* are propagated across the CFG of a function (e.g. phi nodes in junctionBBs).
+*
+* Keeps two views, both with O(1) lookup in either direction:
+* 1. Function-wide: original tracked value <-> every version of it seen so far.
+* 2. Per checkpoint BB: original tracked value <-> its current version, i.e. the
+*    version that must be saved/restored at that checkpoint.
+*/
+class ValueVersionTracker
+{
+public:
+  /* Set of all versions of one original tracked value (includes the original) */
+  typedef SmallPtrSet<const Value *, 8> VersionSet;
+
+  /* (original tracked value, current version) pair */
+  typedef std::pair<const Value *, const Value *> OriginalCurrentPair;
+
+  ValueVersionTracker(void) {}
+  ~ValueVersionTracker(void) {}
+
+  /**
+  * Registers the tracked values of checkpointBB. Each tracked value starts off
+  * as its own current version, and is added to the function-wide version sets.
+  */
+  void
+  addCheckpoint(const BasicBlock *checkpointBB, const std::set<const Value *> &trackedVals);
+
+  bool
+  hasCheckpoint(const BasicBlock *checkpointBB) const { return CkptVersions.count(checkpointBB); }
+
+  /**
+  * Records newVersion as a version of originalVal (function-wide).
+  * Returns false if originalVal is not a tracked value.
+  */
+  bool
+  addVersion(const Value *originalVal, const Value *newVersion);
+
+  /**
+  * Gets the original tracked value that version is a version of.
+  * Returns nullptr if version is not a known version of any tracked value.
+  */
+  const Value *
+  getOriginal(const Value *version) const;
+
+  /**
+  * Gets all versions of originalVal seen so far. originalVal must be tracked.
+  */
+  const VersionSet &
+  getVersions(const Value *originalVal) const;
+
+  bool
+  isOriginal(const Value *val) const { return AllVersions.count(val); }
+
+  /**
+  * Gets the current version of originalVal at checkpointBB.
+  * Returns nullptr if originalVal is not tracked at checkpointBB.
+  */
+  const Value *
+  getCurrent(const BasicBlock *checkpointBB, const Value *originalVal) const;
+
+  /**
+  * Gets the original tracked value whose current version at checkpointBB is currentVal.
+  * Returns nullptr if currentVal is not a current version at checkpointBB.
+  */
+  const Value *
+  getOriginalOfCurrent(const BasicBlock *checkpointBB, const Value *currentVal) const;
+
+  /**
+  * Replaces the current version of originalVal at checkpointBB with newCurrent.
+  * Returns false if originalVal is not tracked at checkpointBB.
+  */
+  bool
+  setCurrent(const BasicBlock *checkpointBB, const Value *originalVal, const Value *newCurrent);
+
+  /**
+  * Gets a snapshot of the (original, current) pairs for checkpointBB, in the
+  * order in which the original values were registered.
+  */
+  std::vector<OriginalCurrentPair>
+  getOriginalCurrentPairs(const BasicBlock *checkpointBB) const;
+
+  /**
+  * Gets the set of current versions of all tracked values at checkpointBB.
+  */
+  std::set<const Value *>
+  getCurrentVals(const BasicBlock *checkpointBB) const;
+
+private:
+  typedef struct {
+    SmallVector<const Value *, 8> originals;  // keeps registration order for deterministic iteration
+    DenseMap<const Value *, const Value *> originalToCurrent;
+    DenseMap<const Value *, const Value *> currentToOriginal;
+  } CheckpointVersions;
+
+  /* Maps each original tracked value to all of its versions */
+  DenseMap<const Value *, VersionSet> AllVersions;
+
+  /* Maps each version (including originals) back to its original tracked value */
+  DenseMap<const Value *, const Value *> VersionToOriginal;
+
+  /* Per-checkpoint current versions of tracked values */
+  DenseMap<const BasicBlock *, CheckpointVersions> CkptVersions;
+};
+
+} /* llvm namespace */
+
+#endif /* _VALUE_VERSION_TRACKER_H */
@@ -7,6 +7,7 @@
 
 #include "json/json.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/ModuleSlotTracker.h"
 #include "llvm/Support/raw_ostream.h"
 #include "popcorn_compiler/LiveValues.h"
 #include "dale_passes/SubroutineInjection.h"
@@ -146,6 +147,14 @@ public:
   static std::string
   getOpName(const Value *value_ptr, const Module *M);
 
+  /*
+    Same as getOpName(value_ptr, M), but numbers unnamed values with a shared
+    ModuleSlotTracker, instead of re-numbering the whole function on every call.
+    Use when naming many values of the same (incorporated) function.
+  */
+  static std::string
+  getOpName(const Value *value_ptr, ModuleSlotTracker &MST);
+
   /* 
     Gets the llvm::BasicBlock name captured from Value::printAsOperand().
     Value names (e.g. %0) do not exist in memory; they're only generated 
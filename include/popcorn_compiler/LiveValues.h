@@ -104,7 +104,8 @@ public:
   /**
    * Get the live values across a given instruction, i.e., values live right
    * after the invocation of the instruction (excluding the value defined by
-   * the instruction itself).
+   * the instruction itself). The sets of all instructions of a block are
+   * computed by one reverse scan on the first query and cached.
    * @param inst an instruction
    * @return the set of values live directly before the instruction; this set
    *         must be freed by the user.
@@ -178,7 +179,9 @@ public:
 
   /**
    * Get the values to be tracked for each BB.
-   * For each BB, are the values in its live-out set.
+   * For each BB, are the values in its live-out set, or for a BB with a
+   * checkpoint() call, the values live at the call (the checkpoint is placed
+   * right after it).
    * Modifies the FuncBBTrackedVals instance.
    * @param F function to perform analysis on.
    */
@@ -245,6 +248,28 @@ private:
   std::map<const Function *, LiveVals> FuncBBLiveIn;
   std::map<const Function *, LiveVals> FuncBBLiveOut;
 
+  /* Maps the instructions of a basic block to the values live directly before them. */
+  typedef std::map<const Instruction *, std::set<const Value *> > InstLiveVals;
+
+  /* Per-instruction live values of the blocks queried so far (see getLiveValues). */
+  mutable std::map<const BasicBlock *, InstLiveVals> BBInstLiveVals;
+
+  /**
+   * Return the per-instruction live values of a basic block, scanning it
+   * backwards from its live-out set on the first call.
+   * @param BB a basic block with liveness analysis
+   * @return the values live directly before each instruction of BB
+   */
+  const InstLiveVals &getInstLiveVals(const BasicBlock *BB) const;
+
+  /**
+   * Return the checkpoint() call of a basic block (not the checkpoint_*
+   * directives), if any.
+   * @param BB a basic block
+   * @return the first checkpoint() call of BB, or nullptr
+   */
+  const Instruction *getCheckpointCall(const BasicBlock *BB) const;
+
   /**
    * Return whether or not a value is a variable that should be tracked.
    * @param val a value
@@ -0,0 +1,538 @@
+/**
+ * Copy kernels for the save/restore subroutines, with runtime CPU dispatch.
+ *
+ * Every kernel has a scalar (portable), an AVX2 and an AVX-512 variant. The SIMD
+ * variants are compiled with per-function target attributes, so the library itself
+ * can be built for a baseline x86-64 target and still use the widest ISA available
+ * on the machine it runs on.
+ */
+
+#include "ckpt_runtime/CkptCopy.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CKPT_COPY_X86
+#endif
+
+#define DEFAULT_NT_THRESHOLD (1 << 20)
+#define HASH_LANES          8     // 64-bit lanes of the hash; a stripe is HASH_LANES * 8 bytes
+#define HASH_PRIME_1        0x9E3779B185EBCA87ULL
+#define HASH_PRIME_2        0xC2B2AE3D27D4EB4FULL
+
+namespace {
+
+/* Set of kernels for one ISA */
+typedef struct {
+  const char *name;
+  void (*copy)(void *dst, const void *src, size_t bytes);
+  void (*copyStream)(void *dst, const void *src, size_t bytes);
+  void (*gather32)(void *dst, const void *src, const int32_t *indexList, int32_t n);
+  void (*scatter32)(void *dst, const void *src, const int32_t *indexList, int32_t n);
+  void (*copyIndex32)(void *dst, const void *src, const int32_t *indexList, int32_t n);
+  void (*hashStripes)(uint64_t *acc, const void *data, size_t numStripes);
+} CopyKernels;
+
+/* Per-lane keys of the hash accumulators */
+const uint64_t HashKeys[HASH_LANES] = {
+  0xBE4BA423396CFEB8ULL, 0x1CAD21F72C81017CULL, 0xDB979083E96DD4DEULL, 0x1F67B3B7A4A44072ULL,
+  0x78E5C0CC4EE679CBULL, 0x2172FFCC7DD05A82ULL, 0x8E2443F7744608B8ULL, 0x4C263A81E69035E0ULL
+};
+
+inline uint64_t
+mixHash(uint64_t h)
+{
+  h ^= h >> 33;
+  h *= HASH_PRIME_2;
+  h ^= h >> 29;
+  h *= HASH_PRIME_1;
+  return h ^ (h >> 32);
+}
+
+/* ========== Scalar ========== */
+
+void
+copyScalar(void *dst, const void *src, size_t bytes)
+{
+  memcpy(dst, src, bytes);
+}
+
+void
+gather32Scalar(void *dst, const void *src, const int32_t *indexList, int32_t n)
+{
+  uint32_t *d = static_cast<uint32_t *>(dst);
+  const uint32_t *s = static_cast<const uint32_t *>(src);
+  for (int32_t k = 0; k < n; k++)
+  {
+    d[k] = s[indexList[k]];
+  }
+}
+
+void
+scatter32Scalar(void *dst, const void *src, const int32_t *indexList, int32_t n)
+{
+  uint32_t *d = static_cast<uint32_t *>(dst);
+  const uint32_t *s = static_cast<const uint32_t *>(src);
+  for (int32_t k = 0; k < n; k++)
+  {
+    d[indexList[k]] = s[k];
+  }
+}
+
+void
+copyIndex32Scalar(void *dst, const void *src, const int32_t *indexList, int32_t n)
+{
+  uint32_t *d = static_cast<uint32_t *>(dst);
+  const uint32_t *s = static_cast<const uint32_t *>(src);
+  for (int32_t k = 0; k < n; k++)
+  {
+    d[indexList[k]] = s[indexList[k]];
+  }
+}
+
+/**
+* Adds numStripes stripes of HASH_LANES words to the lane accumulators: each lane
+* adds the product of the low and high halves of its word xor its key, plus the
+* word of its neighbour lane (as in XXH3). The SIMD variants compute the same lanes.
+*/
+void
+hashStripesScalar(uint64_t *acc, const void *data, size_t numStripes)
+{
+  const char *d = static_cast<const char *>(data);
+  for (size_t k = 0; k < numStripes; k++)
+  {
+    uint64_t words[HASH_LANES];
+    memcpy(words, d + k * sizeof(words), sizeof(words));
+    for (int j = 0; j < HASH_LANES; j++)
+    {
+      uint64_t keyed = words[j] ^ HashKeys[j];
+      acc[j] += (keyed & 0xFFFFFFFFULL) * (keyed >> 32) + words[j ^ 1];
+    }
+  }
+}
+
+const CopyKernels ScalarKernels = {
+  "scalar", copyScalar, copyScalar, gather32Scalar, scatter32Scalar, copyIndex32Scalar, hashStripesScalar
+};
+
+#ifdef CKPT_COPY_X86
+
+/* ========== AVX2 ========== */
+
+__attribute__((target("avx2"))) void
+copyAVX2(void *dst, const void *src, size_t bytes)
+{
+  char *d = static_cast<char *>(dst);
+  const char *s = static_cast<const char *>(src);
+  size_t i = 0;
+  if (bytes >= 256)
+  {
+    // align the stores; unaligned stores that split cache lines halve the bandwidth
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(d), _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s)));
+    i = (32 - (reinterpret_cast<uintptr_t>(d) & 31)) & 31;
+  }
+  for (; i + 128 <= bytes; i += 128)
+  {
+    __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+    __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i + 32));
+    __m256i v2 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i + 64));
+    __m256i v3 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i + 96));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(d + i), v0);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(d + i + 32), v1);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(d + i + 64), v2);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(d + i + 96), v3);
+  }
+  for (; i + 32 <= bytes; i += 32)
+  {
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(d + i),
+                        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i)));
+  }
+  memcpy(d + i, s + i, bytes - i);
+}
+
+__attribute__((target("avx2"))) void
+copyStreamAVX2(void *dst, const void *src, size_t bytes)
+{
+  char *d = static_cast<char *>(dst);
+  const char *s = static_cast<const char *>(src);
+  // streaming stores must be aligned; copy head until dst is 32-byte aligned
+  size_t head = (32 - (reinterpret_cast<uintptr_t>(d) & 31)) & 31;
+  if (bytes < head + 128)
+  {
+    copyAVX2(dst, src, bytes);
+    return;
+  }
+  memcpy(d, s, head);
+  size_t i = head;
+  for (; i + 128 <= bytes; i += 128)
+  {
+    __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+    __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i + 32));
+    __m256i v2 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i + 64));
+    __m256i v3 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i + 96));
+    _mm256_stream_si256(reinterpret_cast<__m256i *>(d + i), v0);
+    _mm256_stream_si256(reinterpret_cast<__m256i *>(d + i + 32), v1);
+    _mm256_stream_si256(reinterpret_cast<__m256i *>(d + i + 64), v2);
+    _mm256_stream_si256(reinterpret_cast<__m256i *>(d + i + 96), v3);
+  }
+  // make streamed data visible before the ckpt id is written
+  _mm_sfence();
+  copyAVX2(d + i, s + i, bytes - i);
+}
+
+__attribute__((target("avx2"))) void
+gather32AVX2(void *dst, const void *src, const int32_t *indexList, int32_t n)
+{
+  float *d = static_cast<float *>(dst);
+  const float *s = static_cast<const float *>(src);
+  int32_t k = 0;
+  for (; k + 8 <= n; k += 8)
+  {
+    __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(indexList + k));
+    _mm256_storeu_ps(d + k, _mm256_i32gather_ps(s, idx, 4));
+  }
+  gather32Scalar(d + k, s, indexList + k, n - k);
+}
+
+/* AVX2 has no scatter instructions; the scalar loop is as fast as emulating one */
+#define scatter32AVX2 scatter32Scalar
+
+__attribute__((target("avx2"))) void
+copyIndex32AVX2(void *dst, const void *src, const int32_t *indexList, int32_t n)
+{
+  uint32_t *d = static_cast<uint32_t *>(dst);
+  const float *s = static_cast<const float *>(src);
+  int32_t k = 0;
+  alignas(32) uint32_t lanes[8];
+  for (; k + 8 <= n; k += 8)
+  {
+    __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(indexList + k));
+    _mm256_store_ps(reinterpret_cast<float *>(lanes), _mm256_i32gather_ps(s, idx, 4));
+    for (int l = 0; l < 8; l++)
+    {
+      d[indexList[k + l]] = lanes[l];
+    }
+  }
+  copyIndex32Scalar(d, s, indexList + k, n - k);
+}
+
+__attribute__((target("avx2"))) void
+hashStripesAVX2(uint64_t *acc, const void *data, size_t numStripes)
+{
+  const char *d = static_cast<const char *>(data);
+  __m256i acc0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(acc));
+  __m256i acc1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(acc + 4));
+  const __m256i key0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(HashKeys));
+  const __m256i key1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(HashKeys + 4));
+  for (size_t k = 0; k < numStripes; k++)
+  {
+    __m256i w0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(d + k * 64));
+    __m256i w1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(d + k * 64 + 32));
+    __m256i keyed0 = _mm256_xor_si256(w0, key0);
+    __m256i keyed1 = _mm256_xor_si256(w1, key1);
+    // low half * high half of each lane; the swap of 64-bit halves gives the neighbour lane's word
+    __m256i prod0 = _mm256_mul_epu32(keyed0, _mm256_srli_epi64(keyed0, 32));
+    __m256i prod1 = _mm256_mul_epu32(keyed1, _mm256_srli_epi64(keyed1, 32));
+    acc0 = _mm256_add_epi64(acc0, _mm256_add_epi64(prod0, _mm256_shuffle_epi32(w0, _MM_SHUFFLE(1, 0, 3, 2))));
+    acc1 = _mm256_add_epi64(acc1, _mm256_add_epi64(prod1, _mm256_shuffle_epi32(w1, _MM_SHUFFLE(1, 0, 3, 2))));
+  }
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc), acc0);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc + 4), acc1);
+}
+
+const CopyKernels AVX2Kernels = {
+  "avx2", copyAVX2, copyStreamAVX2, gather32AVX2, scatter32AVX2, copyIndex32AVX2, hashStripesAVX2
+};
+
+/* ========== AVX-512 ========== */
+
+__attribute__((target("avx512f"))) void
+copyAVX512(void *dst, const void *src, size_t bytes)
+{
+  char *d = static_cast<char *>(dst);
+  const char *s = static_cast<const char *>(src);
+  size_t i = 0;
+  if (bytes >= 512)
+  {
+    // align the stores; unaligned stores that split cache lines halve the bandwidth
+    _mm512_storeu_si512(d, _mm512_loadu_si512(s));
+    i = (64 - (reinterpret_cast<uintptr_t>(d) & 63)) & 63;
+  }
+  for (; i + 256 <= bytes; i += 256)
+  {
+    __m512i v0 = _mm512_loadu_si512(s + i);
+    __m512i v1 = _mm512_loadu_si512(s + i + 64);
+    __m512i v2 = _mm512_loadu_si512(s + i + 128);
+    __m512i v3 = _mm512_loadu_si512(s + i + 192);
+    _mm512_storeu_si512(d + i, v0);
+    _mm512_storeu_si512(d + i + 64, v1);
+    _mm512_storeu_si512(d + i + 128, v2);
+    _mm512_storeu_si512(d + i + 192, v3);
+  }
+  for (; i + 64 <= bytes; i += 64)
+  {
+    _mm512_storeu_si512(d + i, _mm512_loadu_si512(s + i));
+  }
+  memcpy(d + i, s + i, bytes - i);
+}
+
+__attribute__((target("avx512f"))) void
+copyStreamAVX512(void *dst, const void *src, size_t bytes)
+{
+  char *d = static_cast<char *>(dst);
+  const char *s = static_cast<const char *>(src);
+  // streaming stores must be aligned; copy head until dst is 64-byte aligned
+  size_t head = (64 - (reinterpret_cast<uintptr_t>(d) & 63)) & 63;
+  if (bytes < head + 256)
+  {
+    copyAVX512(dst, src, bytes);
+    return;
+  }
+  memcpy(d, s, head);
+  size_t i = head;
+  for (; i + 256 <= bytes; i += 256)
+  {
+    __m512i v0 = _mm512_loadu_si512(s + i);
+    __m512i v1 = _mm512_loadu_si512(s + i + 64);
+    __m512i v2 = _mm512_loadu_si512(s + i + 128);
+    __m512i v3 = _mm512_loadu_si512(s + i + 192);
+    _mm512_stream_si512(reinterpret_cast<__m512i *>(d + i), v0);
+    _mm512_stream_si512(reinterpret_cast<__m512i *>(d + i + 64), v1);
+    _mm512_stream_si512(reinterpret_cast<__m512i *>(d + i + 128), v2);
+    _mm512_stream_si512(reinterpret_cast<__m512i *>(d + i + 192), v3);
+  }
+  // make streamed data visible before the ckpt id is written
+  _mm_sfence();
+  copyAVX512(d + i, s + i, bytes - i);
+}
+
+__attribute__((target("avx512f"))) void
+gather32AVX512(void *dst, const void *src, const int32_t *indexList, int32_t n)
+{
+  float *d = static_cast<float *>(dst);
+  const float *s = static_cast<const float *>(src);
+  int32_t k = 0;
+  for (; k + 16 <= n; k += 16)
+  {
+    __m512i idx = _mm512_loadu_si512(indexList + k);
+    _mm512_storeu_ps(d + k, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), 0xFFFF, idx, s, 4));
+  }
+  if (k < n)
+  {
+    __mmask16 mask = (__mmask16)((1u << (n - k)) - 1);
+    __m512i idx = _mm512_maskz_loadu_epi32(mask, indexList + k);
+    __m512 v = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, idx, s, 4);
+    _mm512_mask_storeu_ps(d + k, mask, v);
+  }
+}
+
+/* lanes are scattered in order, so duplicate indexes behave like the scalar loop */
+__attribute__((target("avx512f"))) void
+scatter32AVX512(void *dst, const void *src, const int32_t *indexList, int32_t n)
+{
+  float *d = static_cast<float *>(dst);
+  const float *s = static_cast<const float *>(src);
+  int32_t k = 0;
+  for (; k + 16 <= n; k += 16)
+  {
+    __m512i idx = _mm512_loadu_si512(indexList + k);
+    _mm512_i32scatter_ps(d, idx, _mm512_loadu_ps(s + k), 4);
+  }
+  if (k < n)
+  {
+    __mmask16 mask = (__mmask16)((1u << (n - k)) - 1);
+    __m512i idx = _mm512_maskz_loadu_epi32(mask, indexList + k);
+    _mm512_mask_i32scatter_ps(d, mask, idx, _mm512_maskz_loadu_ps(mask, s + k), 4);
+  }
+}
+
+__attribute__((target("avx512f"))) void
+copyIndex32AVX512(void *dst, const void *src, const int32_t *indexList, int32_t n)
+{
+  float *d = static_cast<float *>(dst);
+  const float *s = static_cast<const float *>(src);
+  int32_t k = 0;
+  for (; k + 16 <= n; k += 16)
+  {
+    __m512i idx = _mm512_loadu_si512(indexList + k);
+    _mm512_i32scatter_ps(d, idx, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), 0xFFFF, idx, s, 4), 4);
+  }
+  if (k < n)
+  {
+    __mmask16 mask = (__mmask16)((1u << (n - k)) - 1);
+    __m512i idx = _mm512_maskz_loadu_epi32(mask, indexList + k);
+    __m512 v = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, idx, s, 4);
+    _mm512_mask_i32scatter_ps(d, mask, idx, v, 4);
+  }
+}
+
+__attribute__((target("avx512f"))) void
+hashStripesAVX512(uint64_t *acc, const void *data, size_t numStripes)
+{
+  const char *d = static_cast<const char *>(data);
+  __m512i accv = _mm512_loadu_si512(acc);
+  const __m512i key = _mm512_loadu_si512(HashKeys);
+  for (size_t k = 0; k < numStripes; k++)
+  {
+    __m512i w = _mm512_loadu_si512(d + k * 64);
+    __m512i keyed = _mm512_xor_si512(w, key);
+    // full-mask maskz forms: the unmasked ones merge into an uninitialized __Y (GCC -Wmaybe-uninitialized)
+    __m512i prod = _mm512_maskz_mul_epu32(0xFF, keyed, _mm512_maskz_srli_epi64(0xFF, keyed, 32));
+    accv = _mm512_add_epi64(accv, _mm512_add_epi64(prod, _mm512_maskz_shuffle_epi32(0xFFFF, w, _MM_PERM_BADC)));
+  }
+  _mm512_storeu_si512(acc, accv);
+}
+
+const CopyKernels AVX512Kernels = {
+  "avx512", copyAVX512, copyStreamAVX512, gather32AVX512, scatter32AVX512, copyIndex32AVX512, hashStripesAVX512
+};
+
+#endif /* CKPT_COPY_X86 */
+
+/* ========== Dispatch ========== */
+
+const CopyKernels *SelectedKernels = &ScalarKernels;
+size_t NtThreshold = DEFAULT_NT_THRESHOLD;
+
+const CopyKernels *
+getKernelsForIsa(const char *isa)
+{
+  if (strcmp(isa, "scalar") == 0) return &ScalarKernels;
+#ifdef CKPT_COPY_X86
+  if (strcmp(isa, "avx2") == 0 && __builtin_cpu_supports("avx2")) return &AVX2Kernels;
+  if (strcmp(isa, "avx512") == 0 && __builtin_cpu_supports("avx512f")) return &AVX512Kernels;
+#endif
+  return nullptr;
+}
+
+/* Selects the widest supported ISA before main() (i.e. before any kernel can run) */
+__attribute__((constructor)) void
+initCkptCopy(void)
+{
+#ifdef CKPT_COPY_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) SelectedKernels = &AVX512Kernels;
+  else if (__builtin_cpu_supports("avx2")) SelectedKernels = &AVX2Kernels;
+#endif
+  const char *isa = getenv("CKPT_COPY_ISA");
+  if (isa != nullptr) ckpt_copy_select_isa(isa);
+  const char *threshold = getenv("CKPT_COPY_NT_THRESHOLD");
+  if (threshold != nullptr) NtThreshold = strtoull(threshold, nullptr, 10);
+}
+
+} /* anonymous namespace */
+
+void
+ckpt_copy(void *dst, const void *src, size_t bytes)
+{
+  SelectedKernels->copy(dst, src, bytes);
+}
+
+void
+ckpt_copy_stream(void *dst, const void *src, size_t bytes)
+{
+  if (bytes >= NtThreshold) SelectedKernels->copyStream(dst, src, bytes);
+  else SelectedKernels->copy(dst, src, bytes);
+}
+
+void
+ckpt_gather32(void *dst, const void *src, const int32_t *index_list, int32_t n)
+{
+  SelectedKernels->gather32(dst, src, index_list, n);
+}
+
+void
+ckpt_scatter32(void *dst, const void *src, const int32_t *index_list, int32_t n)
+{
+  SelectedKernels->scatter32(dst, src, index_list, n);
+}
+
+void
+ckpt_copy_index32(void *dst, const void *src, int32_t *index_list, int32_t *sp)
+{
+  SelectedKernels->copyIndex32(dst, src, index_list, *sp);
+  *sp = 0;
+}
+
+void
+ckpt_copy_strided(void *dst, const void *src, size_t block_bytes, size_t count,
+                  size_t dst_stride, size_t src_stride)
+{
+  if (block_bytes == dst_stride && block_bytes == src_stride)
+  {
+    // blocks are back-to-back; is one contiguous copy
+    SelectedKernels->copy(dst, src, block_bytes * count);
+    return;
+  }
+  char *d = static_cast<char *>(dst);
+  const char *s = static_cast<const char *>(src);
+  for (size_t k = 0; k < count; k++)
+  {
+    SelectedKernels->copy(d + k * dst_stride, s + k * src_stride, block_bytes);
+  }
+}
+
+uint64_t
+ckpt_hash64(const void *data, size_t bytes)
+{
+  uint64_t acc[HASH_LANES];
+  memcpy(acc, HashKeys, sizeof(acc));
+  size_t numStripes = bytes / sizeof(acc);
+  SelectedKernels->hashStripes(acc, data, numStripes);
+  uint64_t h = bytes * HASH_PRIME_1;
+  for (int j = 0; j < HASH_LANES; j++)
+  {
+    h = (h ^ mixHash(acc[j])) * HASH_PRIME_2;
+  }
+  // the tail (less than a stripe) word by word, zero-padded
+  const char *tail = static_cast<const char *>(data) + numStripes * sizeof(acc);
+  for (size_t i = numStripes * sizeof(acc); i < bytes; i += sizeof(uint64_t))
+  {
+    uint64_t word = 0;
+    memcpy(&word, tail, (bytes - i < sizeof(word)) ? bytes - i : sizeof(word));
+    h = (h ^ mixHash(word ^ HashKeys[(i / sizeof(word)) % HASH_LANES])) * HASH_PRIME_1;
+    tail += sizeof(word);
+  }
+  return mixHash(h);
+}
+
+size_t
+ckpt_copy_dedup(void *dst, const void *src, size_t bytes, size_t chunk_bytes, uint64_t *hashes, int32_t hashes_valid)
+{
+  char *d = static_cast<char *>(dst);
+  const char *s = static_cast<const char *>(src);
+  size_t copied = 0;
+  for (size_t offset = 0, c = 0; offset < bytes; offset += chunk_bytes, c++)
+  {
+    size_t len = (bytes - offset < chunk_bytes) ? bytes - offset : chunk_bytes;
+    uint64_t h = ckpt_hash64(s + offset, len);
+    if (hashes_valid && hashes[c] == h) continue;
+    SelectedKernels->copy(d + offset, s + offset, len);
+    hashes[c] = h;
+    copied += len;
+  }
+  return copied;
+}
+
+const char *
+ckpt_copy_isa(void)
+{
+  return SelectedKernels->name;
+}
+
+int
+ckpt_copy_select_isa(const char *isa)
+{
+  const CopyKernels *kernels = getKernelsForIsa(isa);
+  if (kernels == nullptr) return -1;
+  SelectedKernels = kernels;
+  return 0;
+}
+
+void
+ckpt_copy_set_nt_threshold(size_t bytes)
+{
+  NtThreshold = bytes;
+}
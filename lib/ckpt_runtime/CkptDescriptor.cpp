@@ -0,0 +1,124 @@
+/**
+ * Shared save/restore routines walking the descriptor tables of checkpoints.
+ */
+
+#include "ckpt_runtime/CkptDescriptor.h"
+#include "ckpt_runtime/CkptCopy.h"
+
+#include <cstring>
+
+namespace {
+
+/* Address of the value described by desc (the spill field itself for CKPT_DESC_VALUE) */
+inline char *
+getValueAddress(const ckpt_desc_t *desc, void *spill)
+{
+  char *field = static_cast<char *>(spill) + (size_t)desc->spill_field * CKPT_DESC_SPILL_FIELD_BYTES;
+  char *address = nullptr;
+  switch (desc->kind)
+  {
+    case CKPT_DESC_VALUE:
+      return field;
+    case CKPT_DESC_ARRAY_INDIRECT:
+      memcpy(&address, field, sizeof(address));
+      memcpy(&address, address, sizeof(address));
+      return address + desc->array_offset;
+    default:
+      memcpy(&address, field, sizeof(address));
+      return address + ((desc->kind == CKPT_DESC_ARRAY) ? desc->array_offset : 0);
+  }
+}
+
+inline void
+saveScalar(char *slot, const char *value, const ckpt_desc_t *desc)
+{
+  int32_t intValue;
+  switch (desc->conv)
+  {
+    case CKPT_DESC_CONV_I32_F32:
+    {
+      memcpy(&intValue, value, sizeof(intValue));
+      float converted = (float)intValue;
+      memcpy(slot, &converted, sizeof(converted));
+      break;
+    }
+    case CKPT_DESC_CONV_I32_F64:
+    {
+      memcpy(&intValue, value, sizeof(intValue));
+      double converted = (double)intValue;
+      memcpy(slot, &converted, sizeof(converted));
+      break;
+    }
+    default:
+      memcpy(slot, value, desc->bytes);
+      break;
+  }
+}
+
+inline void
+restoreScalar(char *value, const char *slot, const ckpt_desc_t *desc)
+{
+  int32_t intValue;
+  switch (desc->conv)
+  {
+    case CKPT_DESC_CONV_I32_F32:
+    {
+      float saved;
+      memcpy(&saved, slot, sizeof(saved));
+      intValue = (int32_t)saved;
+      memcpy(value, &intValue, sizeof(intValue));
+      break;
+    }
+    case CKPT_DESC_CONV_I32_F64:
+    {
+      double saved;
+      memcpy(&saved, slot, sizeof(saved));
+      intValue = (int32_t)saved;
+      memcpy(value, &intValue, sizeof(intValue));
+      break;
+    }
+    default:
+      memcpy(value, slot, desc->bytes);
+      break;
+  }
+}
+
+} /* anonymous namespace */
+
+void
+ckpt_desc_save(void *ckpt_mem, const ckpt_desc_t *table, int32_t num_descs, void *spill)
+{
+  for (int32_t i = 0; i < num_descs; i++)
+  {
+    const ckpt_desc_t *desc = &table[i];
+    char *slot = static_cast<char *>(ckpt_mem) + desc->ckpt_offset;
+    char *value = getValueAddress(desc, spill);
+    if (desc->kind == CKPT_DESC_ARRAY || desc->kind == CKPT_DESC_ARRAY_INDIRECT)
+    {
+      ckpt_copy_stream(slot, value, desc->bytes);
+    }
+    else
+    {
+      saveScalar(slot, value, desc);
+    }
+  }
+}
+
+void
+ckpt_desc_restore(void *ckpt_mem, const ckpt_desc_t *table, int32_t num_descs, void *spill)
+{
+  for (int32_t i = 0; i < num_descs; i++)
+  {
+    const ckpt_desc_t *desc = &table[i];
+    const char *slot = static_cast<const char *>(ckpt_mem) + desc->ckpt_offset;
+    char *value = getValueAddress(desc, spill);
+    if (desc->kind == CKPT_DESC_ARRAY || desc->kind == CKPT_DESC_ARRAY_INDIRECT)
+    {
+      ckpt_copy(value, slot, desc->bytes);
+    }
+    else
+    {
+      restoreScalar(value, slot, desc);
+    }
+  }
+}
@@ -0,0 +1,210 @@
+/**
+ * Incremental saves of arrays: chunk versions, copy-before-write, and the
+ * bounded copy steps of the checkpoint sites.
+ */
+
+#include "ckpt_runtime/CkptIncremental.h"
+#include "ckpt_runtime/CkptCopy.h"
+
+#include <cstdint>
+#include <cstdlib>
+
+namespace {
+
+int32_t ChunksPerSiteOverride = 0;  // CKPT_INCR_CHUNKS_PER_SITE (0 = as injected)
+
+inline char *
+getState(ckpt_incr_session_t *session, const ckpt_incr_array_t *arr)
+{
+  return reinterpret_cast<char *>(session) + arr->state_offset;
+}
+
+inline int32_t *
+getVersions(ckpt_incr_session_t *session, const ckpt_incr_array_t *arr)
+{
+  return reinterpret_cast<int32_t *>(getState(session, arr));
+}
+
+inline char *
+getBuffer(ckpt_incr_session_t *session, const ckpt_incr_array_t *arr, int32_t buffer)
+{
+  int64_t versionBytes = (arr->num_chunks * (int64_t)sizeof(int32_t) + 7) & ~(int64_t)7;
+  int64_t bufferBytes = (arr->array_bytes + 7) & ~(int64_t)7;
+  return getState(session, arr) + versionBytes + buffer * bufferBytes;
+}
+
+/* Copies chunk c of arr into the pending buffer, unless it was copied for the current save */
+inline bool
+copyChunk(ckpt_incr_session_t *session, ckpt_incr_array_t *arr, int64_t c)
+{
+  int32_t *versions = getVersions(session, arr);
+  if (versions[c] == session->save_epoch) return false;
+  int64_t offset = c * arr->chunk_bytes;
+  int64_t bytes = arr->array_bytes - offset;
+  if (bytes > arr->chunk_bytes) bytes = arr->chunk_bytes;
+  char *pending = getBuffer(session, arr, 1 - session->published);
+  ckpt_copy(pending + offset, static_cast<const char *>(arr->array) + offset, bytes);
+  versions[c] = session->save_epoch;
+  return true;
+}
+
+/* Marks all chunks as copied for the current save (the state of all chunks while no save is in progress) */
+void
+setAllCopied(ckpt_incr_session_t *session)
+{
+  for (int32_t i = 0; i < session->num_arrays; i++)
+  {
+    ckpt_incr_array_t *arr = &session->arrays[i];
+    int32_t *versions = getVersions(session, arr);
+    for (int64_t c = 0; c < arr->num_chunks; c++) versions[c] = session->save_epoch;
+  }
+}
+
+/* Copies up to budget chunks; publishes the save once all are copied. Returns non-zero once published */
+int32_t
+copyChunks(void *ckpt_mem, ckpt_incr_session_t *session, int64_t budget)
+{
+  for (int32_t i = 0; i < session->num_arrays; i++)
+  {
+    ckpt_incr_array_t *arr = &session->arrays[i];
+    // chunks already copied by a store are skipped for free
+    while (arr->next_chunk < arr->num_chunks && budget > 0)
+    {
+      if (copyChunk(session, arr, arr->next_chunk)) budget--;
+      arr->next_chunk++;
+    }
+    while (arr->next_chunk < arr->num_chunks && getVersions(session, arr)[arr->next_chunk] == session->save_epoch)
+    {
+      arr->next_chunk++;
+    }
+    if (arr->next_chunk < arr->num_chunks) return 0;
+  }
+  // all chunks copied: publish the pending buffers, then the ckpt id
+  session->published = 1 - session->published;
+  __atomic_store_n(&ckpt_header(ckpt_mem)->ckpt_id, session->pending_id, __ATOMIC_RELEASE);
+  __atomic_store_n(&session->active, 0, __ATOMIC_RELEASE);
+  return 1;
+}
+
+inline ckpt_incr_session_t *
+getSession(void *session)
+{
+  return static_cast<ckpt_incr_session_t *>(session);
+}
+
+__attribute__((constructor)) void
+initCkptIncremental(void)
+{
+  const char *val = getenv("CKPT_INCR_CHUNKS_PER_SITE");
+  if (val != nullptr) ChunksPerSiteOverride = atoi(val);
+}
+
+} /* anonymous namespace */
+
+void
+ckpt_incr_init(void *session, int32_t num_arrays, int32_t chunks_per_site,
+               int64_t values_offset, int64_t values_bytes, int64_t backup_offset)
+{
+  ckpt_incr_session_t *s = getSession(session);
+  s->num_arrays = num_arrays;
+  s->chunks_per_site = (ChunksPerSiteOverride > 0) ? ChunksPerSiteOverride : chunks_per_site;
+  s->values_offset = values_offset;
+  s->values_bytes = values_bytes;
+  s->backup_offset = backup_offset;
+}
+
+void
+ckpt_incr_attach(void *session, int32_t idx, void *array, int64_t array_bytes, int64_t chunk_bytes, int64_t state_offset)
+{
+  ckpt_incr_array_t *arr = &getSession(session)->arrays[idx];
+  arr->array = array;
+  arr->array_bytes = array_bytes;
+  arr->chunk_bytes = chunk_bytes;
+  arr->num_chunks = ckpt_incr_num_chunks(array_bytes, chunk_bytes);
+  arr->state_offset = state_offset;
+}
+
+void
+ckpt_incr_reset(void *session)
+{
+  ckpt_incr_session_t *s = getSession(session);
+  s->active = 0;
+  s->save_epoch = 0;
+  s->published = 0;
+  // the segment is not cleared
+  setAllCopied(s);
+}
+
+void
+ckpt_incr_recover(void *ckpt_mem, void *session)
+{
+  ckpt_incr_session_t *s = getSession(session);
+  ckpt_header_t *header = ckpt_header(ckpt_mem);
+  // the ckpt id stays -1 from the start of a save until it is published
+  if (__atomic_load_n(&header->ckpt_id, __ATOMIC_ACQUIRE) == -1 && __atomic_load_n(&s->active, __ATOMIC_ACQUIRE) != 0)
+  {
+    char *mem = static_cast<char *>(ckpt_mem);
+    ckpt_copy(mem + s->values_offset, mem + s->backup_offset, s->values_bytes);
+    s->published = s->backup_published;
+    setAllCopied(s);
+    header->epoch = s->backup_epoch;
+    // a failure before this store repeats the recovery
+    __atomic_store_n(&header->ckpt_id, s->backup_id, __ATOMIC_RELEASE);
+  }
+  // also clears the flag of a save that failed right after it was published (or of a new segment)
+  __atomic_store_n(&s->active, 0, __ATOMIC_RELEASE);
+}
+
+void
+ckpt_incr_begin(void *ckpt_mem, void *session)
+{
+  ckpt_incr_session_t *s = getSession(session);
+  char *mem = static_cast<char *>(ckpt_mem);
+  ckpt_header_t *header = ckpt_header(ckpt_mem);
+  s->backup_id = __atomic_load_n(&header->ckpt_id, __ATOMIC_ACQUIRE);
+  s->backup_epoch = header->epoch;
+  s->backup_published = s->published;
+  ckpt_copy(mem + s->backup_offset, mem + s->values_offset, s->values_bytes);
+  s->save_epoch++;
+  for (int32_t i = 0; i < s->num_arrays; i++) s->arrays[i].next_chunk = 0;
+  // the backup must be complete before the saveBB overwrites the values
+  __atomic_store_n(&s->active, 1, __ATOMIC_RELEASE);
+}
+
+void
+ckpt_incr_commit(void *session, int32_t ckpt_id)
+{
+  getSession(session)->pending_id = ckpt_id;
+}
+
+int32_t
+ckpt_incr_poll(void *ckpt_mem, void *session)
+{
+  ckpt_incr_session_t *s = getSession(session);
+  if (s->active == 0) return 1;
+  return copyChunks(ckpt_mem, s, s->chunks_per_site);
+}
+
+void
+ckpt_incr_finish(void *ckpt_mem, void *session)
+{
+  ckpt_incr_session_t *s = getSession(session);
+  if (s->active != 0) copyChunks(ckpt_mem, s, INT64_MAX);
+}
+
+void
+ckpt_incr_before_write(void *session, int32_t idx, int64_t offset)
+{
+  ckpt_incr_session_t *s = getSession(session);
+  if (s->active == 0) return;
+  ckpt_incr_array_t *arr = &s->arrays[idx];
+  copyChunk(s, arr, offset / arr->chunk_bytes);
+}
+
+void
+ckpt_incr_restore(void *session, int32_t idx, void *array)
+{
+  ckpt_incr_session_t *s = getSession(session);
+  ckpt_incr_array_t *arr = &s->arrays[idx];
+  ckpt_copy(array, getBuffer(s, arr, s->published), arr->array_bytes);
+}
@@ -0,0 +1,171 @@
+/**
+ * Adaptive checkpoint interval controller (Young/Daly optimum from the measured
+ * save cost), polled by the checkpoint sites injected with -ckpt-adaptive.
+ */
+
+#include "ckpt_runtime/CkptInterval.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#define DEFAULT_MTBF_S          3600.0
+#define DEFAULT_MAX_INTERVAL_S  3600.0
+#define COST_EMA_WEIGHT         0.25        // weight of the newest save in the average save cost
+#define MAX_COUNTDOWN           (1L << 24)  // max #polls between two clock reads
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+/* Per-thread controller state; all zero initially (keeps the thread_local access cheap) */
+typedef struct {
+  long countdown;           // polls left until the next clock read
+  long countdownStart;      // value countdown was last set to (0 = 1)
+  long sitesSinceSave;      // polls since the end of the last save
+  bool hasSaved;
+  double lastSaveEnd;       // seconds since Start
+  double saveBegin;
+  double saveCost;          // moving average of the save cost (seconds)
+  double targetInterval;
+} IntervalState;
+
+double MtbfS = DEFAULT_MTBF_S;
+double MinIntervalS = 0;
+double MaxIntervalS = DEFAULT_MAX_INTERVAL_S;
+FILE *LogFile = nullptr;
+const Clock::time_point Start = Clock::now();
+
+thread_local IntervalState State;
+
+double
+now(void)
+{
+  return std::chrono::duration<double>(Clock::now() - Start).count();
+}
+
+/**
+* Daly's higher-order estimate of the optimum interval between saves for save
+* cost C and mean time between failures M.
+*/
+double
+getDalyInterval(double C, double M)
+{
+  if (C >= 2 * M) return M;
+  return std::sqrt(2 * C * M) * (1 + std::sqrt(C / (2 * M)) / 3 + C / (18 * M)) - C;
+}
+
+__attribute__((format(printf, 3, 4))) void
+logDecision(const char *event, double t, const char *fmt, ...)
+{
+  if (LogFile == nullptr) return;
+  size_t tid = std::hash<std::thread::id>()(std::this_thread::get_id()) & 0xffff;
+  fprintf(LogFile, "[ckpt_interval] t=%.6f tid=%04zx %-6s ", t, tid, event);
+  va_list args;
+  va_start(args, fmt);
+  vfprintf(LogFile, fmt, args);
+  va_end(args);
+  fprintf(LogFile, "\n");
+}
+
+/* Reads the clock, decides whether to save, and sets how many polls to skip until the next decision */
+int32_t
+pollSlow(void)
+{
+  State.sitesSinceSave += (State.countdownStart > 0) ? State.countdownStart : 1;
+  double t = now();
+  if (!State.hasSaved)
+  {
+    logDecision("save", t, "first save (no save cost measured yet)");
+    return 1;
+  }
+  double elapsed = t - State.lastSaveEnd;
+  if (elapsed >= State.targetInterval)
+  {
+    logDecision("save", t, "elapsed=%.6f target=%.6f sites=%ld", elapsed, State.targetInterval, State.sitesSinceSave);
+    return 1;
+  }
+  // skip the polls expected until the target interval is reached
+  double timePerSite = elapsed / State.sitesSinceSave;
+  long countdown = 1;
+  if (timePerSite > 0)
+  {
+    double sitesLeft = (State.targetInterval - elapsed) / timePerSite;
+    countdown = (sitesLeft >= MAX_COUNTDOWN) ? MAX_COUNTDOWN : (long)sitesLeft;
+    if (countdown < 1) countdown = 1;
+  }
+  State.countdown = State.countdownStart = countdown;
+  return 0;
+}
+
+__attribute__((constructor)) void
+initCkptInterval(void)
+{
+  const char *val = getenv("CKPT_INTERVAL_MTBF_S");
+  if (val != nullptr) MtbfS = atof(val);
+  val = getenv("CKPT_INTERVAL_MIN_S");
+  if (val != nullptr) MinIntervalS = atof(val);
+  val = getenv("CKPT_INTERVAL_MAX_S");
+  if (val != nullptr) MaxIntervalS = atof(val);
+  val = getenv("CKPT_INTERVAL_LOG");
+  if (val != nullptr)
+  {
+    LogFile = (strcmp(val, "-") == 0) ? stderr : fopen(val, "w");
+    if (LogFile == nullptr) fprintf(stderr, "[ckpt_interval] could not open log file '%s'\n", val);
+  }
+}
+
+} /* anonymous namespace */
+
+int32_t
+ckpt_interval_poll(void)
+{
+  if (--State.countdown > 0) return 0;
+  return pollSlow();
+}
+
+void
+ckpt_interval_save_begin(void)
+{
+  State.saveBegin = now();
+}
+
+void
+ckpt_interval_save_end(void)
+{
+  double t = now();
+  double cost = t - State.saveBegin;
+  State.saveCost = State.hasSaved ? (1 - COST_EMA_WEIGHT) * State.saveCost + COST_EMA_WEIGHT * cost : cost;
+  double daly = getDalyInterval(State.saveCost, MtbfS);
+  State.targetInterval = std::fmin(std::fmax(daly, MinIntervalS), MaxIntervalS);
+  State.hasSaved = true;
+  State.lastSaveEnd = t;
+  State.sitesSinceSave = 0;
+  State.countdown = State.countdownStart = 1;
+  logDecision("saved", t, "cost=%.6f avg_cost=%.6f daly=%.6f", cost, State.saveCost, daly);
+  logDecision("target", t, "interval=%.6f bounds=[%g, %g]", State.targetInterval, MinIntervalS, MaxIntervalS);
+}
+
+void
+ckpt_interval_configure(double mtbf_s, double min_interval_s, double max_interval_s)
+{
+  MtbfS = mtbf_s;
+  MinIntervalS = min_interval_s;
+  MaxIntervalS = max_interval_s;
+}
+
+void
+ckpt_interval_reset(void)
+{
+  memset(&State, 0, sizeof(State));
+}
+
+double
+ckpt_interval_target(void)
+{
+  return State.targetInterval;
+}
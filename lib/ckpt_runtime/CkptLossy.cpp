@@ -0,0 +1,299 @@
+/**
+ * Error-bounded lossy encoding of float/double arrays: quantization to steps of
+ * 2 * max_error, delta coding of neighbouring elements, and truncation of the
+ * unused high bit planes of each block.
+ */
+
+#include "ckpt_runtime/CkptLossy.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+/* Quantized values beyond this magnitude are not exact in a double; their blocks are stored raw */
+const double MAX_QUANTUM = 4503599627370496.0;  // 2^52
+
+/* Writes values of up to 64 bits, least significant bit first */
+class BitWriter
+{
+public:
+  explicit BitWriter(unsigned char *out) : out(out), acc(0), numBits(0) {}
+
+  void
+  put(uint64_t value, int bits)
+  {
+    if (bits > 32)
+    {
+      put32(value & 0xFFFFFFFFULL, 32);
+      put32(value >> 32, bits - 32);
+    }
+    else
+    {
+      put32(value, bits);
+    }
+  }
+
+  /* Writes the last partial byte; returns the end of the output */
+  unsigned char *
+  flush(void)
+  {
+    if (numBits > 0) *out++ = (unsigned char)acc;
+    acc = 0;
+    numBits = 0;
+    return out;
+  }
+
+private:
+  void
+  put32(uint64_t value, int bits)
+  {
+    if (bits == 0) return;
+    acc |= (value & ((1ULL << bits) - 1)) << numBits;
+    numBits += bits;
+    while (numBits >= 8)
+    {
+      *out++ = (unsigned char)acc;
+      acc >>= 8;
+      numBits -= 8;
+    }
+  }
+
+  unsigned char *out;
+  uint64_t acc;
+  int numBits;
+};
+
+class BitReader
+{
+public:
+  explicit BitReader(const unsigned char *in) : in(in), acc(0), numBits(0) {}
+
+  uint64_t
+  get(int bits)
+  {
+    if (bits > 32)
+    {
+      uint64_t low = get32(32);
+      return low | (get32(bits - 32) << 32);
+    }
+    return get32(bits);
+  }
+
+  /* Skips the rest of the last byte read; returns the end of the input */
+  const unsigned char *
+  align(void)
+  {
+    acc = 0;
+    numBits = 0;
+    return in;
+  }
+
+private:
+  uint64_t
+  get32(int bits)
+  {
+    if (bits == 0) return 0;
+    while (numBits < bits)
+    {
+      acc |= (uint64_t)*in++ << numBits;
+      numBits += 8;
+    }
+    uint64_t value = acc & ((1ULL << bits) - 1);
+    acc >>= bits;
+    numBits -= bits;
+    return value;
+  }
+
+  const unsigned char *in;
+  uint64_t acc;
+  int numBits;
+};
+
+template <typename T>
+inline T
+dequantize(int64_t q, double step)
+{
+  return (T)((double)q * step);
+}
+
+/* Deltas of neighbouring quantized values, mapped to unsigned values (0, -1, 1, -2, ... -> 0, 1, 2, 3, ...) */
+inline uint64_t
+zigzag(int64_t delta)
+{
+  return ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+}
+
+inline int64_t
+unzigzag(uint64_t code)
+{
+  return (int64_t)(code >> 1) ^ -(int64_t)(code & 1);
+}
+
+/**
+* Quantizes src[0..len) into q; returns false if an element cannot be decoded
+* within maxError (the decoded value is checked, so rounding to T is accounted for).
+* Sets maxCode to the largest zigzag delta of neighbouring quantized values.
+*/
+template <typename T>
+bool
+quantizeBlock(const T *src, int64_t len, double maxError, int64_t *q, uint64_t &maxCode)
+{
+  if (!(maxError > 0)) return false;
+  double step = 2.0 * maxError;
+  maxCode = 0;
+  for (int64_t i = 0; i < len; i++)
+  {
+    double scaled = (double)src[i] / step;
+    if (!(std::fabs(scaled) < MAX_QUANTUM)) return false;  // also NaN and infinities
+    q[i] = (int64_t)std::nearbyint(scaled);
+    if (!(std::fabs((double)dequantize<T>(q[i], step) - (double)src[i]) <= maxError)) return false;
+    if (i > 0 && zigzag(q[i] - q[i - 1]) > maxCode) maxCode = zigzag(q[i] - q[i - 1]);
+  }
+  return true;
+}
+
+inline int
+bitsNeeded(uint64_t range)
+{
+  return (range == 0) ? 0 : 64 - __builtin_clzll(range);
+}
+
+template <typename T>
+int64_t
+encode(void *dst, const T *src, int64_t numElems, double maxError)
+{
+  unsigned char *out = static_cast<unsigned char *>(dst) + sizeof(ckpt_lossy_header_t);
+  int64_t q[CKPT_LOSSY_BLOCK_ELEMS];
+  for (int64_t start = 0; start < numElems; start += CKPT_LOSSY_BLOCK_ELEMS)
+  {
+    int64_t len = (numElems - start < CKPT_LOSSY_BLOCK_ELEMS) ? numElems - start : CKPT_LOSSY_BLOCK_ELEMS;
+    uint64_t maxCode = 0;
+    bool isQuantized = quantizeBlock(src + start, len, maxError, q, maxCode);
+    int bits = isQuantized ? bitsNeeded(maxCode) : CKPT_LOSSY_RAW_BLOCK;
+    if (isQuantized && (bits * (len - 1) + 7) / 8 >= len * (int64_t)sizeof(T)) bits = CKPT_LOSSY_RAW_BLOCK;
+
+    // the first quantized value is the base; the others are stored as deltas to their predecessor
+    int64_t base = isQuantized ? q[0] : 0;
+    memcpy(out, &base, sizeof(base));
+    out[sizeof(base)] = (unsigned char)bits;
+    out += CKPT_LOSSY_BLOCK_HEADER_BYTES;
+    if (bits == CKPT_LOSSY_RAW_BLOCK)
+    {
+      memcpy(out, src + start, len * sizeof(T));
+      out += len * sizeof(T);
+      continue;
+    }
+    BitWriter writer(out);
+    for (int64_t i = 1; i < len; i++)
+    {
+      writer.put(zigzag(q[i] - q[i - 1]), bits);
+    }
+    out = writer.flush();
+  }
+
+  ckpt_lossy_header_t header;
+  memset(&header, 0, sizeof(header));
+  header.encoded_bytes = out - static_cast<unsigned char *>(dst);
+  header.num_elems = numElems;
+  header.max_error = maxError;
+  header.elem_bytes = sizeof(T);
+  memcpy(dst, &header, sizeof(header));
+  return header.encoded_bytes;
+}
+
+template <typename T>
+void
+decode(T *dst, const void *src)
+{
+  ckpt_lossy_header_t header;
+  memcpy(&header, src, sizeof(header));
+  const unsigned char *in = static_cast<const unsigned char *>(src) + sizeof(header);
+  double step = 2.0 * header.max_error;
+  for (int64_t start = 0; start < header.num_elems; start += CKPT_LOSSY_BLOCK_ELEMS)
+  {
+    int64_t len = (header.num_elems - start < CKPT_LOSSY_BLOCK_ELEMS) ? header.num_elems - start : CKPT_LOSSY_BLOCK_ELEMS;
+    int64_t q;
+    memcpy(&q, in, sizeof(q));
+    int bits = in[sizeof(q)];
+    in += CKPT_LOSSY_BLOCK_HEADER_BYTES;
+    if (bits == CKPT_LOSSY_RAW_BLOCK)
+    {
+      memcpy(dst + start, in, len * sizeof(T));
+      in += len * sizeof(T);
+      continue;
+    }
+    BitReader reader(in);
+    dst[start] = dequantize<T>(q, step);
+    for (int64_t i = 1; i < len; i++)
+    {
+      q += unzigzag(reader.get(bits));
+      dst[start + i] = dequantize<T>(q, step);
+    }
+    in = reader.align();
+  }
+}
+
+template <typename T>
+double
+maxAbsDiff(const T *out, const T *ref, int64_t numElems)
+{
+  double maxDiff = 0;
+  for (int64_t i = 0; i < numElems; i++)
+  {
+    if (std::isnan(out[i]) || std::isnan(ref[i]))
+    {
+      if (std::isnan(out[i]) != std::isnan(ref[i])) return NAN;
+      continue;
+    }
+    double diff = std::fabs((double)out[i] - (double)ref[i]);
+    if (diff > maxDiff) maxDiff = diff;
+  }
+  return maxDiff;
+}
+
+} /* anonymous namespace */
+
+int64_t
+ckpt_lossy_encoded_bytes(const void *encoded)
+{
+  ckpt_lossy_header_t header;
+  memcpy(&header, encoded, sizeof(header));
+  return header.encoded_bytes;
+}
+
+int64_t
+ckpt_lossy_encode_f32(void *dst, const float *src, int64_t num_elems, double max_error)
+{
+  return encode(dst, src, num_elems, max_error);
+}
+
+int64_t
+ckpt_lossy_encode_f64(void *dst, const double *src, int64_t num_elems, double max_error)
+{
+  return encode(dst, src, num_elems, max_error);
+}
+
+void
+ckpt_lossy_decode_f32(float *dst, const void *src)
+{
+  decode(dst, src);
+}
+
+void
+ckpt_lossy_decode_f64(double *dst, const void *src)
+{
+  decode(dst, src);
+}
+
+double
+ckpt_lossy_max_abs_diff_f32(const float *out, const float *ref, int64_t num_elems)
+{
+  return maxAbsDiff(out, ref, num_elems);
+}
+
+double
+ckpt_lossy_max_abs_diff_f64(const double *out, const double *ref, int64_t num_elems)
+{
+  return maxAbsDiff(out, ref, num_elems);
+}
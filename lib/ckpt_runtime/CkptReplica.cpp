@@ -0,0 +1,769 @@
+/**
+ * Streaming replication of published checkpoints over TCP: a pipelined sender
+ * (snapshot, compress, send and ack threads) and a receiver that keeps the newest
+ * fully received checkpoint.
+ */
+
+#include "ckpt_runtime/CkptReplica.h"
+#include "ckpt_runtime/CkptCopy.h"
+#include "ckpt_runtime/CkptHeader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#define REPL_MAGIC          0x434b5250U  // "CKRP"
+#define PIPELINE_ITEMS      16           // chunks (and commits) in flight between the snapshot and send threads
+#define POLL_INTERVAL_US    100          // how often an idle snapshot thread reads the header
+#define CONNECT_TIMEOUT_MS  5000
+#define CONNECT_RETRY_MS    50
+#define MIN_RUN_WORDS       4            // shortest run of equal words encoded as a run
+#define RUN_FLAG            0x80000000U
+
+namespace {
+
+enum MessageType : uint32_t { MSG_HELLO = 1, MSG_CHUNK, MSG_COMMIT, MSG_ACK };
+enum Encoding : uint32_t { ENC_RAW = 0, ENC_RUNS };
+
+/* Fixed-size message; CHUNK messages are followed by payloadBytes of data */
+typedef struct {
+  uint32_t magic;
+  uint32_t type;
+  int32_t ckptId;        // COMMIT, ACK
+  int32_t epoch;         // COMMIT
+  int64_t seq;           // COMMIT, ACK: number of the commit on this connection
+  int64_t offset;        // CHUNK: byte offset in ckpt_mem; HELLO: segment bytes
+  int64_t rawBytes;      // CHUNK: bytes of the chunk
+  int64_t payloadBytes;  // CHUNK: bytes that follow (encoded or raw)
+  uint32_t encoding;     // CHUNK
+  uint32_t reserved;
+} Message;
+
+/* A chunk or commit on its way through the pipeline */
+typedef struct {
+  Message msg;
+  std::vector<char> raw;
+  std::vector<char> encoded;
+  const char *payload;
+} Item;
+
+/* Commit that was sent, but not acknowledged yet */
+typedef struct {
+  int64_t seq;
+  int32_t heartbeat;
+  int64_t seenNs;        // when the snapshot thread saw the checkpoint published
+} PendingAck;
+
+template <typename T>
+class BlockingQueue
+{
+public:
+  void
+  push(T item)
+  {
+    {
+      std::lock_guard<std::mutex> lock(Mutex);
+      Items.push_back(item);
+    }
+    Cond.notify_one();
+  }
+
+  /* Returns false once the queue is closed and empty */
+  bool
+  pop(T &item)
+  {
+    std::unique_lock<std::mutex> lock(Mutex);
+    Cond.wait(lock, [this] { return !Items.empty() || Closed; });
+    if (Items.empty()) return false;
+    item = Items.front();
+    Items.pop_front();
+    return true;
+  }
+
+  void
+  close(void)
+  {
+    {
+      std::lock_guard<std::mutex> lock(Mutex);
+      Closed = true;
+    }
+    Cond.notify_all();
+  }
+
+private:
+  std::mutex Mutex;
+  std::condition_variable Cond;
+  std::deque<T> Items;
+  bool Closed = false;
+};
+
+int64_t
+nowNs(void)
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Message
+makeMessage(uint32_t type)
+{
+  Message msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.magic = REPL_MAGIC;
+  msg.type = type;
+  return msg;
+}
+
+bool
+writeAll(int fd, const void *data, size_t bytes)
+{
+  const char *p = static_cast<const char *>(data);
+  while (bytes > 0)
+  {
+    ssize_t n = send(fd, p, bytes, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    bytes -= n;
+  }
+  return true;
+}
+
+bool
+readAll(int fd, void *data, size_t bytes)
+{
+  char *p = static_cast<char *>(data);
+  while (bytes > 0)
+  {
+    ssize_t n = recv(fd, p, bytes, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    bytes -= n;
+  }
+  return true;
+}
+
+bool
+readMessage(int fd, Message &msg)
+{
+  return readAll(fd, &msg, sizeof(msg)) && msg.magic == REPL_MAGIC;
+}
+
+void
+setNoDelay(int fd)
+{
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+/**
+* Encodes numWords words as tokens: a run (RUN_FLAG | count, then the word) or
+* literals (count, then the words). Returns the encoded bytes, or 0 if they would
+* not be fewer than maxBytes.
+*/
+size_t
+encodeRuns(const uint64_t *words, size_t numWords, char *out, size_t maxBytes)
+{
+  size_t outBytes = 0;
+  auto emit = [&](const void *data, size_t bytes) {
+    if (outBytes + bytes >= maxBytes) return false;
+    memcpy(out + outBytes, data, bytes);
+    outBytes += bytes;
+    return true;
+  };
+  auto isRunStart = [&](size_t i) {
+    if (i + MIN_RUN_WORDS > numWords) return false;
+    for (size_t k = 1; k < MIN_RUN_WORDS; k++)
+    {
+      if (words[i + k] != words[i]) return false;
+    }
+    return true;
+  };
+
+  size_t i = 0;
+  while (i < numWords)
+  {
+    if (isRunStart(i))
+    {
+      size_t end = i + MIN_RUN_WORDS;
+      while (end < numWords && words[end] == words[i] && end - i < RUN_FLAG - 1) end++;
+      uint32_t token = RUN_FLAG | (uint32_t)(end - i);
+      if (!emit(&token, sizeof(token)) || !emit(&words[i], sizeof(uint64_t))) return 0;
+      i = end;
+    }
+    else
+    {
+      size_t end = i + 1;
+      while (end < numWords && !isRunStart(end) && end - i < RUN_FLAG - 1) end++;
+      uint32_t token = (uint32_t)(end - i);
+      if (!emit(&token, sizeof(token)) || !emit(&words[i], (end - i) * sizeof(uint64_t))) return 0;
+      i = end;
+    }
+  }
+  return outBytes;
+}
+
+/* Decodes the tokens of encodeRuns into exactly outBytes; returns false if they are malformed */
+bool
+decodeRuns(const char *in, size_t inBytes, char *out, size_t outBytes)
+{
+  size_t inPos = 0;
+  size_t outPos = 0;
+  while (inPos < inBytes)
+  {
+    uint32_t token;
+    if (inPos + sizeof(token) > inBytes) return false;
+    memcpy(&token, in + inPos, sizeof(token));
+    inPos += sizeof(token);
+    size_t count = token & ~RUN_FLAG;
+    if (outPos + count * sizeof(uint64_t) > outBytes) return false;
+    if (token & RUN_FLAG)
+    {
+      uint64_t word;
+      if (inPos + sizeof(word) > inBytes) return false;
+      memcpy(&word, in + inPos, sizeof(word));
+      inPos += sizeof(word);
+      for (size_t k = 0; k < count; k++) memcpy(out + outPos + k * sizeof(word), &word, sizeof(word));
+    }
+    else
+    {
+      if (inPos + count * sizeof(uint64_t) > inBytes) return false;
+      memcpy(out + outPos, in + inPos, count * sizeof(uint64_t));
+      inPos += count * sizeof(uint64_t);
+    }
+    outPos += count * sizeof(uint64_t);
+  }
+  return outPos == outBytes;
+}
+
+int
+connectToPeer(const char *host, int32_t port)
+{
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *addrs = nullptr;
+  std::string service = std::to_string(port);
+  if (getaddrinfo(host, service.c_str(), &hints, &addrs) != 0) return -1;
+
+  int fd = -1;
+  int64_t deadline = nowNs() + CONNECT_TIMEOUT_MS * 1000000L;
+  while (fd < 0 && nowNs() < deadline)
+  {
+    for (addrinfo *addr = addrs; addr != nullptr && fd < 0; addr = addr->ai_next)
+    {
+      fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+      if (fd < 0) continue;
+      if (connect(fd, addr->ai_addr, addr->ai_addrlen) != 0)
+      {
+        close(fd);
+        fd = -1;
+      }
+    }
+    if (fd < 0) std::this_thread::sleep_for(std::chrono::milliseconds(CONNECT_RETRY_MS));
+  }
+  freeaddrinfo(addrs);
+  if (fd >= 0) setNoDelay(fd);
+  return fd;
+}
+
+} /* anonymous namespace */
+
+struct ckpt_repl_sender {
+  char *mem;
+  int64_t bytes;
+  int64_t chunkBytes;
+  bool compress;
+  int fd;
+
+  std::vector<uint64_t> hashes;          // per chunk: hash of the contents last sent
+  bool hashesValid;
+
+  BlockingQueue<Item *> freeItems;
+  BlockingQueue<Item *> toCompress;
+  BlockingQueue<Item *> toSend;
+  std::vector<Item *> items;
+  std::atomic<bool> stopping;
+  std::thread snapshotThread, compressThread, sendThread, ackThread;
+
+  std::mutex ackMutex;                   // guards pendingAcks and the acked fields
+  std::condition_variable ackCond;
+  std::deque<PendingAck> pendingAcks;
+  int64_t nextSeq;
+  bool hasAcked;
+  std::atomic<int32_t> ackedHeartbeat;   // also read by ckpt_repl_sender_stats
+
+  std::atomic<int64_t> ckptsSent, ckptsAcked, ckptsRetried, chunksScanned, chunksSent, rawBytesSent, wireBytesSent;
+  std::atomic<int32_t> lastAckedId, error;
+  std::atomic<double> lastAckUs;
+};
+
+namespace {
+
+/* Stops the pipeline after an error; ckpt_repl_sender_stop still joins the threads */
+void
+failSender(ckpt_repl_sender_t *sender)
+{
+  if (!sender->stopping.exchange(true) && !sender->error.exchange(1))
+  {
+    fprintf(stderr, "WARNING: checkpoint replication stopped: connection to the peer lost\n");
+  }
+  sender->freeItems.close();
+  sender->toCompress.close();
+  sender->toSend.close();
+  shutdown(sender->fd, SHUT_RDWR);
+  sender->ackCond.notify_all();
+}
+
+void
+runSnapshot(ckpt_repl_sender_t *sender)
+{
+  ckpt_header_t *header = ckpt_header(sender->mem);
+  bool hasSent = false;
+  int32_t lastId = 0;
+  int32_t lastHeartbeat = 0;
+  while (!sender->stopping)
+  {
+    // the heartbeat is bumped when a save starts, and the id is set to -1 before it
+    int32_t id = ckpt_last_id(header);
+    int32_t heartbeat = ckpt_heartbeat(header);
+    if (id <= 0 || (hasSent && id == lastId && heartbeat == lastHeartbeat))
+    {
+      std::this_thread::sleep_for(std::chrono::microseconds(POLL_INTERVAL_US));
+      continue;
+    }
+    int32_t epoch = __atomic_load_n(&header->epoch, __ATOMIC_RELAXED);
+    int64_t seenNs = nowNs();
+
+    bool isTorn = false;
+    for (int64_t offset = CKPT_HEADER_BYTES; offset < sender->bytes; offset += sender->chunkBytes)
+    {
+      if (ckpt_last_id(header) != id)
+      {
+        isTorn = true;
+        break;
+      }
+      Item *item;
+      if (!sender->freeItems.pop(item)) return;
+      int64_t chunk = (offset - CKPT_HEADER_BYTES) / sender->chunkBytes;
+      int64_t rawBytes = std::min(sender->chunkBytes, sender->bytes - offset);
+      memcpy(item->raw.data(), sender->mem + offset, rawBytes);
+      sender->chunksScanned++;
+      // hash the copy, not the segment: the receiver gets the copy, even if the kernel changed the chunk since
+      uint64_t hash = ckpt_hash64(item->raw.data(), rawBytes);
+      if (sender->hashesValid && sender->hashes[chunk] == hash)
+      {
+        sender->freeItems.push(item);
+        continue;
+      }
+      sender->hashes[chunk] = hash;
+      item->msg = makeMessage(MSG_CHUNK);
+      item->msg.offset = offset;
+      item->msg.rawBytes = rawBytes;
+      sender->toCompress.push(item);
+    }
+    // every chunk was sent or is unchanged, so the receiver's staging copy matches the hashes
+    if (!isTorn) sender->hashesValid = true;
+
+    // commit only if no save started while the chunks were copied (the chunks sent stay in the staging copy)
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (isTorn || __atomic_load_n(&header->ckpt_id, __ATOMIC_RELAXED) != id || ckpt_heartbeat(header) != heartbeat)
+    {
+      sender->ckptsRetried++;
+      continue;
+    }
+    Item *commit;
+    if (!sender->freeItems.pop(commit)) return;
+    commit->msg = makeMessage(MSG_COMMIT);
+    commit->msg.ckptId = id;
+    commit->msg.epoch = epoch;
+    {
+      std::lock_guard<std::mutex> lock(sender->ackMutex);
+      commit->msg.seq = sender->nextSeq++;
+      sender->pendingAcks.push_back({commit->msg.seq, heartbeat, seenNs});
+    }
+    sender->toCompress.push(commit);
+    hasSent = true;
+    lastId = id;
+    lastHeartbeat = heartbeat;
+  }
+}
+
+void
+runCompress(ckpt_repl_sender_t *sender)
+{
+  Item *item;
+  while (sender->toCompress.pop(item))
+  {
+    if (item->msg.type == MSG_CHUNK)
+    {
+      size_t encodedBytes = 0;
+      if (sender->compress && item->msg.rawBytes % sizeof(uint64_t) == 0)
+      {
+        encodedBytes = encodeRuns(reinterpret_cast<const uint64_t *>(item->raw.data()),
+                                  item->msg.rawBytes / sizeof(uint64_t), item->encoded.data(), item->msg.rawBytes);
+      }
+      item->msg.encoding = encodedBytes ? ENC_RUNS : ENC_RAW;
+      item->msg.payloadBytes = encodedBytes ? encodedBytes : item->msg.rawBytes;
+      item->payload = encodedBytes ? item->encoded.data() : item->raw.data();
+    }
+    sender->toSend.push(item);
+  }
+}
+
+void
+runSend(ckpt_repl_sender_t *sender)
+{
+  Item *item;
+  while (sender->toSend.pop(item))
+  {
+    // counted before it is written, since the ack may arrive before the write returns
+    if (item->msg.type == MSG_COMMIT) sender->ckptsSent++;
+    bool ok = writeAll(sender->fd, &item->msg, sizeof(Message));
+    if (ok && item->msg.type == MSG_CHUNK) ok = writeAll(sender->fd, item->payload, item->msg.payloadBytes);
+    if (!ok)
+    {
+      failSender(sender);
+      return;
+    }
+    if (item->msg.type == MSG_CHUNK)
+    {
+      sender->chunksSent++;
+      sender->rawBytesSent += item->msg.rawBytes;
+      sender->wireBytesSent += sizeof(Message) + item->msg.payloadBytes;
+    }
+    else
+    {
+      sender->wireBytesSent += sizeof(Message);
+    }
+    sender->freeItems.push(item);
+  }
+}
+
+void
+runAck(ckpt_repl_sender_t *sender)
+{
+  Message msg;
+  while (readMessage(sender->fd, msg) && msg.type == MSG_ACK)
+  {
+    std::lock_guard<std::mutex> lock(sender->ackMutex);
+    while (!sender->pendingAcks.empty() && sender->pendingAcks.front().seq < msg.seq) sender->pendingAcks.pop_front();
+    if (sender->pendingAcks.empty() || sender->pendingAcks.front().seq != msg.seq) continue;
+    const PendingAck &pending = sender->pendingAcks.front();
+    sender->lastAckUs = (nowNs() - pending.seenNs) / 1000.0;
+    sender->ackedHeartbeat = pending.heartbeat;
+    sender->hasAcked = true;
+    sender->lastAckedId = msg.ckptId;
+    sender->ckptsAcked++;
+    sender->pendingAcks.pop_front();
+    sender->ackCond.notify_all();
+  }
+  if (!sender->stopping) failSender(sender);
+}
+
+} /* anonymous namespace */
+
+ckpt_repl_sender_t *
+ckpt_repl_sender_start(void *ckpt_mem, int64_t bytes, const char *host, int32_t port, int64_t chunk_bytes,
+                       int32_t flags)
+{
+  if (ckpt_mem == nullptr || bytes <= CKPT_HEADER_BYTES || chunk_bytes <= 0 || chunk_bytes % sizeof(uint64_t)) return nullptr;
+  int fd = connectToPeer(host, port);
+  if (fd < 0) return nullptr;
+  Message hello = makeMessage(MSG_HELLO);
+  hello.offset = bytes;
+  if (!writeAll(fd, &hello, sizeof(hello)))
+  {
+    close(fd);
+    return nullptr;
+  }
+
+  ckpt_repl_sender_t *sender = new ckpt_repl_sender_t();
+  sender->mem = static_cast<char *>(ckpt_mem);
+  sender->bytes = bytes;
+  sender->chunkBytes = chunk_bytes;
+  sender->compress = flags & CKPT_REPL_COMPRESS;
+  sender->fd = fd;
+  sender->hashes.resize((bytes - CKPT_HEADER_BYTES + chunk_bytes - 1) / chunk_bytes);
+  sender->hashesValid = false;
+  sender->stopping = false;
+  sender->nextSeq = 1;
+  sender->hasAcked = false;
+  sender->ackedHeartbeat = 0;
+  sender->ckptsSent = sender->ckptsAcked = sender->ckptsRetried = 0;
+  sender->chunksScanned = sender->chunksSent = sender->rawBytesSent = sender->wireBytesSent = 0;
+  sender->lastAckedId = sender->error = 0;
+  sender->lastAckUs = 0;
+  for (int i = 0; i < PIPELINE_ITEMS; i++)
+  {
+    Item *item = new Item();
+    item->raw.resize(chunk_bytes);
+    item->encoded.resize(chunk_bytes);
+    sender->items.push_back(item);
+    sender->freeItems.push(item);
+  }
+  sender->snapshotThread = std::thread(runSnapshot, sender);
+  sender->compressThread = std::thread(runCompress, sender);
+  sender->sendThread = std::thread(runSend, sender);
+  sender->ackThread = std::thread(runAck, sender);
+  return sender;
+}
+
+int32_t
+ckpt_repl_sender_flush(ckpt_repl_sender_t *sender, int32_t timeout_ms)
+{
+  const ckpt_header_t *header = ckpt_header(sender->mem);
+  int32_t id = ckpt_last_id(header);
+  int32_t heartbeat = ckpt_heartbeat(header);
+  if (id == 0) return 0;
+  // a save in progress (id -1) already bumped the heartbeat; its snapshot has at least this one
+  std::unique_lock<std::mutex> lock(sender->ackMutex);
+  bool isAcked = sender->ackCond.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&] {
+    return sender->error || (sender->hasAcked && (int32_t)((uint32_t)sender->ackedHeartbeat - (uint32_t)heartbeat) >= 0);
+  });
+  return (isAcked && !sender->error) ? sender->lastAckedId.load() : -1;
+}
+
+void
+ckpt_repl_sender_stats(const ckpt_repl_sender_t *sender, ckpt_repl_stats_t *stats)
+{
+  stats->ckpts_sent = sender->ckptsSent;
+  stats->ckpts_acked = sender->ckptsAcked;
+  stats->ckpts_retried = sender->ckptsRetried;
+  stats->chunks_scanned = sender->chunksScanned;
+  stats->chunks_sent = sender->chunksSent;
+  stats->raw_bytes_sent = sender->rawBytesSent;
+  stats->wire_bytes_sent = sender->wireBytesSent;
+  stats->last_acked_id = sender->lastAckedId;
+  stats->acked_heartbeat = sender->ackedHeartbeat;
+  stats->error = sender->error;
+  stats->last_ack_us = sender->lastAckUs;
+}
+
+void
+ckpt_repl_sender_stop(ckpt_repl_sender_t *sender)
+{
+  if (sender == nullptr) return;
+  sender->stopping = true;
+  sender->freeItems.close();
+  sender->toCompress.close();
+  sender->toSend.close();
+  shutdown(sender->fd, SHUT_RDWR);
+  sender->snapshotThread.join();
+  sender->compressThread.join();
+  sender->sendThread.join();
+  sender->ackThread.join();
+  close(sender->fd);
+  for (Item *item : sender->items) delete item;
+  delete sender;
+}
+
+struct ckpt_repl_receiver {
+  int64_t bytes;
+  int listenFd;
+  int32_t port;
+  std::atomic<bool> stopping;
+  std::thread thread;
+
+  std::mutex connMutex;                  // guards connFd (closed by the receiver thread, shut down by stop)
+  int connFd;
+
+  std::vector<char> staging;             // the sender's chunks as they arrive
+  std::vector<std::pair<int64_t, int64_t>> dirty;  // (offset, bytes) of staging that may differ from committed
+
+  std::mutex mutex;                      // guards committed and the fields below
+  std::condition_variable cond;
+  std::vector<char> committed;           // newest fully received checkpoint
+  int64_t commits;
+  int32_t ckptId;
+  int32_t epoch;
+};
+
+namespace {
+
+/* Applies the messages of one sender until it disconnects or sends something malformed */
+void
+serveSender(ckpt_repl_receiver_t *receiver, int fd)
+{
+  Message msg;
+  if (!readMessage(fd, msg) || msg.type != MSG_HELLO || msg.offset != receiver->bytes)
+  {
+    fprintf(stderr, "WARNING: checkpoint replication: rejected a sender of a different segment\n");
+    return;
+  }
+  std::vector<char> payload;
+  while (readMessage(fd, msg))
+  {
+    if (msg.type == MSG_CHUNK)
+    {
+      if (msg.offset < CKPT_HEADER_BYTES || msg.rawBytes <= 0 || msg.offset + msg.rawBytes > receiver->bytes
+          || msg.payloadBytes <= 0 || msg.payloadBytes > msg.rawBytes)
+      {
+        return;
+      }
+      char *dst = receiver->staging.data() + msg.offset;
+      receiver->dirty.push_back({msg.offset, msg.rawBytes});
+      if (msg.encoding == ENC_RAW)
+      {
+        if (msg.payloadBytes != msg.rawBytes || !readAll(fd, dst, msg.rawBytes)) return;
+      }
+      else
+      {
+        payload.resize(msg.payloadBytes);
+        if (!readAll(fd, payload.data(), msg.payloadBytes) || !decodeRuns(payload.data(), msg.payloadBytes, dst, msg.rawBytes)) return;
+      }
+    }
+    else if (msg.type == MSG_COMMIT)
+    {
+      {
+        std::lock_guard<std::mutex> lock(receiver->mutex);
+        for (const std::pair<int64_t, int64_t> &range : receiver->dirty)
+        {
+          memcpy(receiver->committed.data() + range.first, receiver->staging.data() + range.first, range.second);
+        }
+        receiver->commits++;
+        receiver->ckptId = msg.ckptId;
+        receiver->epoch = msg.epoch;
+      }
+      receiver->dirty.clear();
+      receiver->cond.notify_all();
+      Message ack = makeMessage(MSG_ACK);
+      ack.ckptId = msg.ckptId;
+      ack.seq = msg.seq;
+      if (!writeAll(fd, &ack, sizeof(ack))) return;
+    }
+    else
+    {
+      return;
+    }
+  }
+}
+
+void
+runReceiver(ckpt_repl_receiver_t *receiver)
+{
+  while (!receiver->stopping)
+  {
+    int fd = accept(receiver->listenFd, nullptr, nullptr);
+    if (fd < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      break;
+    }
+    setNoDelay(fd);
+    {
+      std::lock_guard<std::mutex> lock(receiver->connMutex);
+      receiver->connFd = fd;
+    }
+    if (!receiver->stopping) serveSender(receiver, fd);
+    {
+      std::lock_guard<std::mutex> lock(receiver->connMutex);
+      receiver->connFd = -1;
+      close(fd);
+    }
+  }
+}
+
+} /* anonymous namespace */
+
+ckpt_repl_receiver_t *
+ckpt_repl_receiver_start(const char *bind_addr, int32_t port, int64_t bytes)
+{
+  if (bytes <= CKPT_HEADER_BYTES) return nullptr;
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  addrinfo *addr = nullptr;
+  std::string service = std::to_string(port);
+  if (getaddrinfo(bind_addr, service.c_str(), &hints, &addr) != 0) return nullptr;
+  int fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+  int one = 1;
+  bool ok = fd >= 0 && setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == 0
+            && bind(fd, addr->ai_addr, addr->ai_addrlen) == 0 && listen(fd, 1) == 0;
+  freeaddrinfo(addr);
+  sockaddr_in bound;
+  socklen_t boundLen = sizeof(bound);
+  if (!ok || getsockname(fd, reinterpret_cast<sockaddr *>(&bound), &boundLen) != 0)
+  {
+    if (fd >= 0) close(fd);
+    return nullptr;
+  }
+
+  ckpt_repl_receiver_t *receiver = new ckpt_repl_receiver_t();
+  receiver->bytes = bytes;
+  receiver->listenFd = fd;
+  receiver->port = ntohs(bound.sin_port);
+  receiver->stopping = false;
+  receiver->connFd = -1;
+  receiver->staging.assign(bytes, 0);
+  receiver->committed.assign(bytes, 0);
+  receiver->commits = 0;
+  receiver->ckptId = 0;
+  receiver->epoch = 0;
+  receiver->thread = std::thread(runReceiver, receiver);
+  return receiver;
+}
+
+int32_t
+ckpt_repl_receiver_port(const ckpt_repl_receiver_t *receiver)
+{
+  return receiver->port;
+}
+
+int64_t
+ckpt_repl_receiver_wait(ckpt_repl_receiver_t *receiver, int64_t min_commits, int32_t timeout_ms,
+                        int32_t *ckpt_id, int32_t *epoch)
+{
+  std::unique_lock<std::mutex> lock(receiver->mutex);
+  receiver->cond.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                          [&] { return receiver->commits >= min_commits; });
+  if (ckpt_id) *ckpt_id = receiver->ckptId;
+  if (epoch) *epoch = receiver->epoch;
+  return receiver->commits;
+}
+
+int32_t
+ckpt_repl_receiver_restore(ckpt_repl_receiver_t *receiver, void *ckpt_mem, int64_t bytes)
+{
+  std::lock_guard<std::mutex> lock(receiver->mutex);
+  if (receiver->commits == 0) return 0;
+  int64_t copyBytes = std::min(bytes, receiver->bytes);
+  memcpy(ckpt_values(ckpt_mem), ckpt_values(receiver->committed.data()), copyBytes - CKPT_HEADER_BYTES);
+  ckpt_header_reset(ckpt_mem);
+  ckpt_header(ckpt_mem)->epoch = receiver->epoch;
+  __atomic_store_n(&ckpt_header(ckpt_mem)->ckpt_id, receiver->ckptId, __ATOMIC_RELEASE);
+  return receiver->ckptId;
+}
+
+void
+ckpt_repl_receiver_stop(ckpt_repl_receiver_t *receiver)
+{
+  if (receiver == nullptr) return;
+  receiver->stopping = true;
+  shutdown(receiver->listenFd, SHUT_RDWR);
+  {
+    std::lock_guard<std::mutex> lock(receiver->connMutex);
+    if (receiver->connFd >= 0) shutdown(receiver->connFd, SHUT_RDWR);
+  }
+  receiver->thread.join();
+  close(receiver->listenFd);
+  delete receiver;
+}
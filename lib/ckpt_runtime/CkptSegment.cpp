@@ -0,0 +1,341 @@
+/**
+ * Allocator for checkpoint segments: huge pages (MAP_HUGETLB, else THP), NUMA
+ * binding with the raw mbind syscall, pre-faulting and mlock, and a registry of
+ * the segments for ckpt_segment_info/free.
+ */
+
+#include "ckpt_runtime/CkptSegment.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <linux/mempolicy.h>
+#include <map>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23  // Linux 5.14
+#endif
+
+#define DEFAULT_HUGE_BYTES (2L << 20)
+#define MAX_NUMA_NODES     1024
+
+namespace {
+
+/* A mapped segment (keyed by its address in the registry) */
+typedef struct {
+  int64_t mapBytes;
+  ckpt_segment_info_t info;
+} Segment;
+
+std::mutex RegistryMutex;
+std::map<uintptr_t, Segment> Registry;
+
+int64_t
+basePageBytes(void)
+{
+  static int64_t bytes = sysconf(_SC_PAGESIZE);
+  return bytes;
+}
+
+/* Reads a number from a sysfs or procfs file, after the given prefix if any */
+int64_t
+readNumber(const char *path, const char *prefix, int64_t fallback)
+{
+  FILE *file = fopen(path, "r");
+  if (file == nullptr) return fallback;
+  char line[256];
+  int64_t value = fallback;
+  size_t prefixLen = prefix ? strlen(prefix) : 0;
+  while (fgets(line, sizeof(line), file))
+  {
+    if (prefix && strncmp(line, prefix, prefixLen) != 0) continue;
+    value = strtoll(line + prefixLen, nullptr, 10);
+    break;
+  }
+  fclose(file);
+  return value;
+}
+
+int64_t
+hugetlbPageBytes(void)
+{
+  static int64_t bytes = readNumber("/proc/meminfo", "Hugepagesize:", DEFAULT_HUGE_BYTES >> 10) << 10;
+  return bytes;
+}
+
+int64_t
+thpPageBytes(void)
+{
+  static int64_t bytes = readNumber("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", nullptr, DEFAULT_HUGE_BYTES);
+  return bytes;
+}
+
+/* Whether THP may back shared anonymous mappings (shmem_enabled is not [never] or [deny]) */
+bool
+isShmemThpEnabled(void)
+{
+  FILE *file = fopen("/sys/kernel/mm/transparent_hugepage/shmem_enabled", "r");
+  if (file == nullptr) return false;
+  char line[256] = "";
+  bool isRead = fgets(line, sizeof(line), file) != nullptr;
+  fclose(file);
+  return isRead && strstr(line, "[never]") == nullptr && strstr(line, "[deny]") == nullptr;
+}
+
+int64_t
+roundUp(int64_t bytes, int64_t unit)
+{
+  return (bytes + unit - 1) / unit * unit;
+}
+
+int32_t
+resolveNode(int32_t numaNode)
+{
+  return numaNode == CKPT_SEGMENT_NODE_LOCAL ? ckpt_segment_node() : numaNode;
+}
+
+/* mbind with MPOL_BIND to a single node (raw syscall: no libnuma needed) */
+int
+bindToNode(void *addr, int64_t bytes, int32_t node, unsigned flags)
+{
+  if (node < 0 || node >= MAX_NUMA_NODES)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  unsigned long mask[MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = {};
+  mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+  return syscall(SYS_mbind, addr, bytes, MPOL_BIND, mask, MAX_NUMA_NODES + 1, flags);
+}
+
+/**
+* Maps bytes (a multiple of alignBytes) at an address aligned to alignBytes, so
+* THP can back every huge page of it; trims the excess. Returns MAP_FAILED on
+* failure.
+*/
+void *
+mapAligned(int64_t bytes, int64_t alignBytes, int mapFlags)
+{
+  int64_t overBytes = bytes + alignBytes - basePageBytes();
+  char *addr = static_cast<char *>(mmap(nullptr, overBytes, PROT_READ | PROT_WRITE, mapFlags, -1, 0));
+  if (addr == MAP_FAILED) return MAP_FAILED;
+  char *aligned = reinterpret_cast<char *>(roundUp(reinterpret_cast<uintptr_t>(addr), alignBytes));
+  if (aligned > addr) munmap(addr, aligned - addr);
+  if (addr + overBytes > aligned + bytes) munmap(aligned + bytes, addr + overBytes - (aligned + bytes));
+  return aligned;
+}
+
+/* Writes a byte of every page (the segment is zero, so are the bytes written) */
+void
+touchPages(char *addr, int64_t bytes, int64_t strideBytes)
+{
+  for (int64_t offset = 0; offset < bytes; offset += strideBytes)
+  {
+    *reinterpret_cast<volatile char *>(addr + offset) = 0;
+  }
+}
+
+/* Bytes of [addr, addr + bytes) that are faulted in */
+int64_t
+residentBytes(void *addr, int64_t bytes)
+{
+  int64_t pageBytes = basePageBytes();
+  std::vector<unsigned char> pages((bytes + pageBytes - 1) / pageBytes);
+  if (mincore(addr, bytes, pages.data()) != 0) return -1;
+  int64_t resident = 0;
+  for (unsigned char page : pages) resident += (page & 1) ? pageBytes : 0;
+  return resident;
+}
+
+/* Bytes backed by transparent huge pages in the mappings that overlap [addr, addr + bytes) */
+int64_t
+thpBytes(const void *addr, int64_t bytes)
+{
+  FILE *file = fopen("/proc/self/smaps", "r");
+  if (file == nullptr) return 0;
+  uintptr_t begin = reinterpret_cast<uintptr_t>(addr), end = begin + bytes;
+  bool isOverlapping = false;
+  int64_t hugeKiB = 0;
+  char line[512];
+  while (fgets(line, sizeof(line), file))
+  {
+    unsigned long vmaBegin, vmaEnd;
+    if (sscanf(line, "%lx-%lx ", &vmaBegin, &vmaEnd) == 2)  // the header of a mapping
+    {
+      isOverlapping = vmaBegin < end && vmaEnd > begin;
+      continue;
+    }
+    if (!isOverlapping) continue;
+    if (strncmp(line, "AnonHugePages:", 14) == 0) hugeKiB += strtoll(line + 14, nullptr, 10);
+    if (strncmp(line, "ShmemPmdMapped:", 15) == 0) hugeKiB += strtoll(line + 15, nullptr, 10);
+  }
+  fclose(file);
+  return hugeKiB << 10;
+}
+
+double
+msSince(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+} /* anonymous namespace */
+
+int32_t
+ckpt_segment_node(void)
+{
+  unsigned cpu = 0, node = 0;
+  if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) return 0;
+  return node;
+}
+
+void *
+ckpt_segment_alloc(int64_t bytes, int32_t numa_node, int32_t flags)
+{
+  if (bytes <= 0) return nullptr;
+  flags &= CKPT_SEGMENT_SHARED | CKPT_SEGMENT_HUGE | CKPT_SEGMENT_PREFAULT | CKPT_SEGMENT_MLOCK;
+  int mapFlags = ((flags & CKPT_SEGMENT_SHARED) ? MAP_SHARED : MAP_PRIVATE) | MAP_ANONYMOUS;
+  Segment segment;
+  memset(&segment.info, 0, sizeof(segment.info));
+  void *addr = MAP_FAILED;
+
+  if (flags & CKPT_SEGMENT_HUGE)
+  {
+    // reserves the huge pages (fails if too few are free), so faults cannot SIGBUS later
+    segment.mapBytes = roundUp(bytes, hugetlbPageBytes());
+    addr = mmap(nullptr, segment.mapBytes, PROT_READ | PROT_WRITE, mapFlags | MAP_HUGETLB, -1, 0);
+    if (addr != MAP_FAILED)
+    {
+      flags |= CKPT_SEGMENT_HUGETLB;
+      segment.info.page_bytes = hugetlbPageBytes();
+    }
+  }
+  if (addr == MAP_FAILED && (flags & CKPT_SEGMENT_HUGE))
+  {
+    // no reserved huge pages (or too few): transparent huge pages, if enabled
+    addr = mapAligned(roundUp(bytes, thpPageBytes()), thpPageBytes(), mapFlags);
+    segment.mapBytes = roundUp(bytes, thpPageBytes());
+    if (addr != MAP_FAILED && madvise(addr, segment.mapBytes, MADV_HUGEPAGE) != 0)
+    {
+      fprintf(stderr, "WARNING: ckpt_segment: no huge pages reserved and THP not available (%s); using %ld-byte pages\n",
+              strerror(errno), (long)basePageBytes());
+      flags &= ~CKPT_SEGMENT_HUGE;
+    }
+    else if (addr != MAP_FAILED && (flags & CKPT_SEGMENT_SHARED) && !isShmemThpEnabled())
+    {
+      fprintf(stderr, "WARNING: ckpt_segment: no huge pages reserved and THP disabled for shared memory "
+                      "(transparent_hugepage/shmem_enabled); using %ld-byte pages\n", (long)basePageBytes());
+      flags &= ~CKPT_SEGMENT_HUGE;
+    }
+    segment.info.page_bytes = (flags & CKPT_SEGMENT_HUGE) ? thpPageBytes() : basePageBytes();
+  }
+  if (addr == MAP_FAILED)
+  {
+    segment.mapBytes = roundUp(bytes, basePageBytes());
+    addr = mmap(nullptr, segment.mapBytes, PROT_READ | PROT_WRITE, mapFlags, -1, 0);
+    segment.info.page_bytes = basePageBytes();
+  }
+  if (addr == MAP_FAILED) return nullptr;
+
+  // bind before the first fault, so the pages are placed on the node whichever thread touches them
+  segment.info.numa_node = -1;
+  if (numa_node != CKPT_SEGMENT_NODE_ANY)
+  {
+    int32_t node = resolveNode(numa_node);
+    if (bindToNode(addr, segment.mapBytes, node, 0) == 0)
+    {
+      flags |= CKPT_SEGMENT_BOUND;
+      segment.info.numa_node = node;
+    }
+    else
+    {
+      fprintf(stderr, "WARNING: ckpt_segment: cannot bind to NUMA node %d (%s); not bound\n", node, strerror(errno));
+    }
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  if (flags & CKPT_SEGMENT_PREFAULT)
+  {
+    // MAP_HUGETLB pages fault one per huge page; THP may fall back to base pages for a part
+    if (madvise(addr, segment.mapBytes, MADV_POPULATE_WRITE) != 0)
+    {
+      touchPages(static_cast<char *>(addr), segment.mapBytes,
+                 (flags & CKPT_SEGMENT_HUGETLB) ? segment.info.page_bytes : basePageBytes());
+    }
+  }
+  if ((flags & CKPT_SEGMENT_MLOCK) && mlock(addr, segment.mapBytes) != 0)
+  {
+    fprintf(stderr, "WARNING: ckpt_segment: cannot lock %lld bytes (%s; see RLIMIT_MEMLOCK); not locked\n",
+            (long long)segment.mapBytes, strerror(errno));
+    flags &= ~CKPT_SEGMENT_MLOCK;
+  }
+  segment.info.prefault_ms = (flags & (CKPT_SEGMENT_PREFAULT | CKPT_SEGMENT_MLOCK)) ? msSince(start) : 0;
+  segment.info.bytes = segment.mapBytes;
+  segment.info.flags = flags;
+
+  std::lock_guard<std::mutex> lock(RegistryMutex);
+  Registry[reinterpret_cast<uintptr_t>(addr)] = segment;
+  return addr;
+}
+
+void
+ckpt_segment_free(void *segment)
+{
+  int64_t mapBytes;
+  {
+    std::lock_guard<std::mutex> lock(RegistryMutex);
+    std::map<uintptr_t, Segment>::iterator it = Registry.find(reinterpret_cast<uintptr_t>(segment));
+    if (it == Registry.end()) return;
+    mapBytes = it->second.mapBytes;
+    Registry.erase(it);
+  }
+  munmap(segment, mapBytes);
+}
+
+int32_t
+ckpt_segment_info(const void *segment, ckpt_segment_info_t *info)
+{
+  {
+    std::lock_guard<std::mutex> lock(RegistryMutex);
+    std::map<uintptr_t, Segment>::const_iterator it = Registry.find(reinterpret_cast<uintptr_t>(segment));
+    if (it == Registry.end()) return -1;
+    *info = it->second.info;
+  }
+  void *addr = const_cast<void *>(segment);
+  info->resident_bytes = residentBytes(addr, info->bytes);
+  if (info->flags & CKPT_SEGMENT_HUGETLB)
+  {
+    info->huge_bytes = info->resident_bytes;
+  }
+  else
+  {
+    // the overlapping mappings may extend beyond the segment (merged with a neighbour)
+    int64_t huge = thpBytes(segment, info->bytes);
+    info->huge_bytes = huge < info->resident_bytes ? huge : info->resident_bytes;
+  }
+  return 0;
+}
+
+int32_t
+ckpt_segment_bind(void *segment, int32_t numa_node)
+{
+  std::lock_guard<std::mutex> lock(RegistryMutex);
+  std::map<uintptr_t, Segment>::iterator it = Registry.find(reinterpret_cast<uintptr_t>(segment));
+  if (it == Registry.end()) return -1;
+  int32_t node = resolveNode(numa_node);
+  if (bindToNode(segment, it->second.info.bytes, node, MPOL_MF_MOVE) != 0)
+  {
+    fprintf(stderr, "WARNING: ckpt_segment: cannot move the segment to NUMA node %d (%s)\n", node, strerror(errno));
+    return -1;
+  }
+  it->second.info.flags |= CKPT_SEGMENT_BOUND;
+  it->second.info.numa_node = node;
+  return 0;
+}
@@ -0,0 +1,656 @@
+/**
+ * Asynchronous spill of checkpoints to a local file: chunk writes submitted to an
+ * io_uring (set up with the raw syscalls), an fdatasync, then a superblock update,
+ * driven by the host's polls; with a pwrite thread as fallback.
+ */
+
+#include "ckpt_runtime/CkptSpill.h"
+#include "ckpt_runtime/CkptCopy.h"
+#include "ckpt_runtime/CkptHeader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define SPILL_MAGIC          0x4c4c495053504b43ULL  // "CKPSPILL"
+#define BLOCK_BYTES          4096L                  // O_DIRECT alignment, and size of the superblock
+#define MAX_REGISTERED_BYTES (1L << 30)             // largest buffer io_uring registers
+#define WAIT_POLL_US         50
+
+namespace {
+
+/* Kinds of requests, in the user_data of their SQEs */
+enum RequestKind : uint64_t { REQ_DATA = 1, REQ_SYNC, REQ_SUPERBLOCK, REQ_SUPERBLOCK_SYNC };
+
+/* Phases of a running spill */
+enum Phase { PHASE_DATA, PHASE_SYNC, PHASE_COMMIT };
+
+/* First block of the file; points at the slot that holds the durable checkpoint */
+typedef struct {
+  uint64_t magic;
+  int64_t seq;           // number of the spill; 0 = no durable checkpoint
+  int64_t bytes;         // segment bytes
+  int64_t slotOffset;    // file offset of the slot
+  int32_t ckptId;
+  int32_t epoch;
+  uint64_t hash;         // of the fields above
+} Superblock;
+
+int64_t
+nowNs(void)
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t
+roundUp(int64_t bytes, int64_t align)
+{
+  return (bytes + align - 1) / align * align;
+}
+
+uint64_t
+hashSuperblock(const Superblock &superblock)
+{
+  return ckpt_hash64(&superblock, offsetof(Superblock, hash));
+}
+
+/* Submission and completion rings of an io_uring, mapped from the kernel */
+class Ring
+{
+public:
+  bool
+  setup(unsigned entries)
+  {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    Fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (Fd < 0) return false;
+    SqBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    CqBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) SqBytes = CqBytes = std::max(SqBytes, CqBytes);
+    SqPtr = mmap(nullptr, SqBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_SQ_RING);
+    CqPtr = (params.features & IORING_FEAT_SINGLE_MMAP)
+            ? SqPtr : mmap(nullptr, CqBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_CQ_RING);
+    SqesBytes = params.sq_entries * sizeof(io_uring_sqe);
+    Sqes = static_cast<io_uring_sqe *>(mmap(nullptr, SqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                            Fd, IORING_OFF_SQES));
+    if (SqPtr == MAP_FAILED || CqPtr == MAP_FAILED || Sqes == MAP_FAILED)
+    {
+      close(Fd);
+      Fd = -1;
+      return false;
+    }
+    char *sq = static_cast<char *>(SqPtr);
+    char *cq = static_cast<char *>(CqPtr);
+    SqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    SqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    SqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    SqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    SqEntries = params.sq_entries;
+    CqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    CqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    CqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    Cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    return true;
+  }
+
+  void
+  teardown(void)
+  {
+    if (Fd < 0) return;
+    munmap(Sqes, SqesBytes);
+    if (CqPtr != SqPtr) munmap(CqPtr, CqBytes);
+    munmap(SqPtr, SqBytes);
+    close(Fd);
+    Fd = -1;
+  }
+
+  bool
+  registerBuffers(const std::vector<iovec> &iovecs)
+  {
+    return syscall(__NR_io_uring_register, Fd, IORING_REGISTER_BUFFERS, iovecs.data(), iovecs.size()) == 0;
+  }
+
+  /* Next free SQE (cleared), or nullptr if the submission ring is full */
+  io_uring_sqe *
+  getSqe(void)
+  {
+    unsigned tail = *SqTail + Unsubmitted;
+    if (tail - __atomic_load_n(SqHead, __ATOMIC_ACQUIRE) >= SqEntries) return nullptr;
+    unsigned index = tail & SqMask;
+    SqArray[index] = index;
+    Unsubmitted++;
+    memset(&Sqes[index], 0, sizeof(io_uring_sqe));
+    return &Sqes[index];
+  }
+
+  /* Submits the SQEs got since the last call, waiting for minComplete completions */
+  bool
+  submit(unsigned minComplete)
+  {
+    __atomic_store_n(SqTail, *SqTail + Unsubmitted, __ATOMIC_RELEASE);
+    unsigned toSubmit = Unsubmitted;
+    Unsubmitted = 0;
+    while (toSubmit > 0 || minComplete > 0)
+    {
+      int submitted = syscall(__NR_io_uring_enter, Fd, toSubmit, minComplete,
+                              minComplete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+      if (submitted < 0)
+      {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+        return false;
+      }
+      toSubmit -= std::min<unsigned>(submitted, toSubmit);
+      minComplete = 0;
+    }
+    return true;
+  }
+
+  /* Calls handle(user_data, res) for each completion; returns their number */
+  template <typename Handler>
+  int
+  reap(Handler handle)
+  {
+    unsigned head = *CqHead;
+    unsigned tail = __atomic_load_n(CqTail, __ATOMIC_ACQUIRE);
+    int count = 0;
+    for (; head != tail; head++, count++)
+    {
+      const io_uring_cqe &cqe = Cqes[head & CqMask];
+      handle(cqe.user_data, cqe.res);
+    }
+    __atomic_store_n(CqHead, head, __ATOMIC_RELEASE);
+    return count;
+  }
+
+  int Fd = -1;
+
+private:
+  void *SqPtr = nullptr;
+  void *CqPtr = nullptr;
+  size_t SqBytes = 0, CqBytes = 0, SqesBytes = 0;
+  io_uring_sqe *Sqes = nullptr;
+  unsigned *SqHead = nullptr, *SqTail = nullptr, *SqArray = nullptr;
+  unsigned SqMask = 0, SqEntries = 0, Unsubmitted = 0;
+  unsigned *CqHead = nullptr, *CqTail = nullptr;
+  unsigned CqMask = 0;
+  io_uring_cqe *Cqes = nullptr;
+};
+
+bool
+pwriteAll(int fd, const char *data, int64_t bytes, int64_t offset)
+{
+  while (bytes > 0)
+  {
+    ssize_t n = pwrite(fd, data, bytes, offset);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data += n;
+    bytes -= n;
+    offset += n;
+  }
+  return true;
+}
+
+} /* anonymous namespace */
+
+struct ckpt_spill {
+  int fd;
+  int32_t flags;
+  bool useRing;
+  Ring ring;
+  std::vector<iovec> registered;     // ckpt_mem in buffers of at most MAX_REGISTERED_BYTES
+
+  char *mem;
+  int64_t bytes;
+  int64_t chunkBytes;
+  int32_t queueDepth;
+  int64_t slotBytes;
+  int64_t alignedBytes;              // part of the segment written straight from ckpt_mem
+  char *tailBuffer;                  // rest of the segment, padded to a block (O_DIRECT)
+  int64_t tailBytes;
+  char *superblockBuffer;            // BLOCK_BYTES, aligned
+
+  // the running (or last) spill
+  std::atomic<int32_t> state;
+  Phase phase;
+  int32_t ckptId, epoch, heartbeat;
+  int64_t seq;                       // durableSeq + 1
+  int64_t slotOffset;
+  int64_t nextOffset;                // next byte of the segment to submit
+  int32_t inflight;
+  bool hasFailed;
+  int64_t beginNs;
+  std::thread fallbackThread;
+
+  bool hasDurable;
+  int32_t durableId, durableHeartbeat;
+  int64_t durableSeq;
+
+  int64_t spillsBegun, spillsDurable, spillsTorn, bytesWritten;
+  int64_t submissions, inflightSum;
+  int32_t maxInflight;
+  double lastSpillMs, hostMs;
+};
+
+namespace {
+
+/* Length of the write of the segment at offset, and its source */
+int64_t
+getWrite(const ckpt_spill_t *spill, int64_t offset, const char **src)
+{
+  if (offset < spill->alignedBytes)
+  {
+    *src = spill->mem + offset;
+    return std::min(spill->chunkBytes, spill->alignedBytes - offset);
+  }
+  *src = spill->tailBuffer;
+  return roundUp(spill->tailBytes, (spill->flags & CKPT_SPILL_DIRECT) ? BLOCK_BYTES : 1);
+}
+
+/* Whether the kernel started a save since the spill began (its data may have changed meanwhile) */
+bool
+isTorn(const ckpt_spill_t *spill)
+{
+  const ckpt_header_t *header = ckpt_header(spill->mem);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return __atomic_load_n(&header->ckpt_id, __ATOMIC_RELAXED) != spill->ckptId
+         || ckpt_heartbeat(header) != spill->heartbeat;
+}
+
+void
+fillSuperblock(ckpt_spill_t *spill)
+{
+  memset(spill->superblockBuffer, 0, BLOCK_BYTES);
+  Superblock superblock;
+  memset(&superblock, 0, sizeof(superblock));
+  superblock.magic = SPILL_MAGIC;
+  superblock.seq = spill->seq;
+  superblock.bytes = spill->bytes;
+  superblock.slotOffset = spill->slotOffset;
+  superblock.ckptId = spill->ckptId;
+  superblock.epoch = spill->epoch;
+  superblock.hash = hashSuperblock(superblock);
+  memcpy(spill->superblockBuffer, &superblock, sizeof(superblock));
+}
+
+void
+finishSpill(ckpt_spill_t *spill, int32_t state)
+{
+  if (state == CKPT_SPILL_DURABLE)
+  {
+    spill->hasDurable = true;
+    spill->durableId = spill->ckptId;
+    spill->durableHeartbeat = spill->heartbeat;
+    spill->durableSeq = spill->seq;
+    spill->spillsDurable++;
+    spill->lastSpillMs = (nowNs() - spill->beginNs) / 1e6;
+  }
+  else if (state == CKPT_SPILL_TORN)
+  {
+    spill->spillsTorn++;
+  }
+  spill->state = state;
+}
+
+/* Spills with pwrite and fdatasync, when io_uring is not available */
+void
+runFallbackSpill(ckpt_spill_t *spill)
+{
+  bool ok = true;
+  for (int64_t offset = 0; ok && offset < spill->bytes;)
+  {
+    const char *src;
+    int64_t bytes = getWrite(spill, offset, &src);
+    ok = pwriteAll(spill->fd, src, bytes, spill->slotOffset + offset);
+    spill->bytesWritten += bytes;
+    offset = (offset < spill->alignedBytes) ? offset + std::min(bytes, spill->alignedBytes - offset) : spill->bytes;
+  }
+  if (ok && isTorn(spill))
+  {
+    finishSpill(spill, CKPT_SPILL_TORN);
+    return;
+  }
+  ok = ok && fdatasync(spill->fd) == 0;
+  fillSuperblock(spill);
+  ok = ok && pwriteAll(spill->fd, spill->superblockBuffer, BLOCK_BYTES, 0) && fdatasync(spill->fd) == 0;
+  finishSpill(spill, ok ? CKPT_SPILL_DURABLE : CKPT_SPILL_FAILED);
+}
+
+/* Queues the write of the segment at spill->nextOffset; false if the submission ring is full */
+bool
+queueDataWrite(ckpt_spill_t *spill)
+{
+  io_uring_sqe *sqe = spill->ring.getSqe();
+  if (sqe == nullptr) return false;
+  const char *src;
+  int64_t offset = spill->nextOffset;
+  int64_t bytes = getWrite(spill, offset, &src);
+  bool isFixed = !spill->registered.empty() && src != spill->tailBuffer;
+  sqe->opcode = isFixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+  sqe->fd = spill->fd;
+  sqe->addr = reinterpret_cast<uint64_t>(src);
+  sqe->len = bytes;
+  sqe->off = spill->slotOffset + offset;
+  if (isFixed) sqe->buf_index = offset / spill->registered[0].iov_len;
+  sqe->user_data = REQ_DATA << 32 | (uint32_t)bytes;
+  spill->nextOffset = (offset < spill->alignedBytes) ? offset + bytes : spill->bytes;
+  spill->inflight++;
+  return true;
+}
+
+void
+queueSync(ckpt_spill_t *spill, uint64_t kind, uint8_t sqeFlags)
+{
+  io_uring_sqe *sqe = spill->ring.getSqe();
+  sqe->opcode = IORING_OP_FSYNC;
+  sqe->fd = spill->fd;
+  sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+  sqe->flags = sqeFlags;
+  sqe->user_data = kind << 32;
+  spill->inflight++;
+}
+
+/* One step of the state machine of a spill with io_uring; never blocks */
+void
+advanceSpill(ckpt_spill_t *spill)
+{
+  spill->ring.reap([spill](uint64_t userData, int32_t res) {
+    spill->inflight--;
+    uint64_t kind = userData >> 32;
+    if (res < 0 || (kind == REQ_DATA && res != (int32_t)(uint32_t)userData)
+        || (kind == REQ_SUPERBLOCK && res != BLOCK_BYTES))
+    {
+      spill->hasFailed = true;
+    }
+    else if (kind == REQ_DATA)
+    {
+      spill->bytesWritten += res;
+    }
+  });
+  if (spill->hasFailed)
+  {
+    // let the writes still in flight complete before the buffers may be reused
+    while (spill->inflight > 0)
+    {
+      spill->ring.submit(1);
+      spill->ring.reap([spill](uint64_t, int32_t) { spill->inflight--; });
+    }
+    finishSpill(spill, CKPT_SPILL_FAILED);
+    return;
+  }
+
+  if (spill->phase == PHASE_DATA)
+  {
+    if (isTorn(spill))
+    {
+      // no point in writing the rest; wait for the writes in flight
+      spill->nextOffset = spill->bytes;
+      if (spill->inflight == 0) finishSpill(spill, CKPT_SPILL_TORN);
+      return;
+    }
+    int queued = 0;
+    while (spill->nextOffset < spill->bytes && spill->inflight < spill->queueDepth && queueDataWrite(spill)) queued++;
+    if (queued)
+    {
+      spill->submissions++;
+      spill->inflightSum += spill->inflight;
+      spill->maxInflight = std::max(spill->maxInflight, spill->inflight);
+    }
+    else if (spill->nextOffset >= spill->bytes && spill->inflight == 0)
+    {
+      queueSync(spill, REQ_SYNC, 0);
+      spill->phase = PHASE_SYNC;
+    }
+  }
+  else if (spill->inflight == 0 && spill->phase == PHASE_SYNC)
+  {
+    // the data is on disk: point the superblock at it
+    fillSuperblock(spill);
+    io_uring_sqe *sqe = spill->ring.getSqe();
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = spill->fd;
+    sqe->addr = reinterpret_cast<uint64_t>(spill->superblockBuffer);
+    sqe->len = BLOCK_BYTES;
+    sqe->off = 0;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = (uint64_t)REQ_SUPERBLOCK << 32;
+    spill->inflight++;
+    queueSync(spill, REQ_SUPERBLOCK_SYNC, 0);
+    spill->phase = PHASE_COMMIT;
+  }
+  else if (spill->inflight == 0 && spill->phase == PHASE_COMMIT)
+  {
+    finishSpill(spill, CKPT_SPILL_DURABLE);
+    return;
+  }
+  if (!spill->ring.submit(0))
+  {
+    spill->hasFailed = true;
+    finishSpill(spill, CKPT_SPILL_FAILED);
+  }
+}
+
+void *
+allocBlocks(int64_t bytes)
+{
+  void *ptr = nullptr;
+  if (posix_memalign(&ptr, BLOCK_BYTES, roundUp(std::max<int64_t>(bytes, 1), BLOCK_BYTES)) != 0) return nullptr;
+  memset(ptr, 0, roundUp(std::max<int64_t>(bytes, 1), BLOCK_BYTES));
+  return ptr;
+}
+
+} /* anonymous namespace */
+
+ckpt_spill_t *
+ckpt_spill_open(const char *path, void *ckpt_mem, int64_t bytes, int64_t chunk_bytes, int32_t queue_depth,
+                int32_t flags)
+{
+  if (ckpt_mem == nullptr || bytes <= CKPT_HEADER_BYTES || chunk_bytes <= 0 || queue_depth <= 0) return nullptr;
+  if ((flags & CKPT_SPILL_DIRECT)
+      && (reinterpret_cast<uintptr_t>(ckpt_mem) % BLOCK_BYTES != 0 || chunk_bytes % BLOCK_BYTES != 0))
+  {
+    fprintf(stderr, "WARNING: ckpt_spill: O_DIRECT needs a page-aligned ckpt_mem and 4 KiB chunks; not used\n");
+    flags &= ~CKPT_SPILL_DIRECT;
+  }
+  int fd = -1;
+  if (flags & CKPT_SPILL_DIRECT)
+  {
+    fd = open(path, O_RDWR | O_CREAT | O_DIRECT, 0644);
+    if (fd < 0)
+    {
+      fprintf(stderr, "WARNING: ckpt_spill: cannot open '%s' with O_DIRECT (%s); not used\n", path, strerror(errno));
+      flags &= ~CKPT_SPILL_DIRECT;
+    }
+  }
+  if (fd < 0) fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) return nullptr;
+
+  ckpt_spill_t *spill = new ckpt_spill_t();
+  spill->fd = fd;
+  spill->mem = static_cast<char *>(ckpt_mem);
+  spill->bytes = bytes;
+  spill->chunkBytes = chunk_bytes;
+  spill->queueDepth = queue_depth;
+  spill->slotBytes = roundUp(bytes, BLOCK_BYTES);
+  spill->alignedBytes = (flags & CKPT_SPILL_DIRECT) ? bytes / BLOCK_BYTES * BLOCK_BYTES : bytes;
+  spill->tailBytes = bytes - spill->alignedBytes;
+  spill->tailBuffer = static_cast<char *>(allocBlocks(spill->tailBytes));
+  spill->superblockBuffer = static_cast<char *>(allocBlocks(BLOCK_BYTES));
+  spill->state = CKPT_SPILL_IDLE;
+  spill->useRing = spill->ring.setup(queue_depth + 2);
+  if (!spill->useRing)
+  {
+    fprintf(stderr, "WARNING: ckpt_spill: io_uring not available (%s); spilling with pwrite in a thread\n", strerror(errno));
+  }
+  if ((flags & CKPT_SPILL_REGISTERED) && spill->useRing)
+  {
+    // buffers of a multiple of chunk_bytes, so no write crosses two of them
+    int64_t bufferBytes = std::max(chunk_bytes, MAX_REGISTERED_BYTES / chunk_bytes * chunk_bytes);
+    for (int64_t offset = 0; offset < spill->alignedBytes; offset += bufferBytes)
+    {
+      spill->registered.push_back({spill->mem + offset, (size_t)std::min(bufferBytes, spill->alignedBytes - offset)});
+    }
+    if (!spill->ring.registerBuffers(spill->registered))
+    {
+      fprintf(stderr, "WARNING: ckpt_spill: cannot register ckpt_mem with io_uring (%s; see RLIMIT_MEMLOCK); not used\n",
+              strerror(errno));
+      spill->registered.clear();
+    }
+  }
+  if (spill->registered.empty()) flags &= ~CKPT_SPILL_REGISTERED;
+  spill->flags = flags;
+
+  // the file keeps its durable checkpoint, if it has one of this size; new spills go to the other slot
+  Superblock superblock;
+  spill->seq = 0;
+  spill->durableSeq = 0;
+  if (pread(fd, spill->superblockBuffer, BLOCK_BYTES, 0) == BLOCK_BYTES)
+  {
+    memcpy(&superblock, spill->superblockBuffer, sizeof(superblock));
+    if (superblock.magic == SPILL_MAGIC && superblock.hash == hashSuperblock(superblock) && superblock.bytes == bytes)
+    {
+      spill->seq = superblock.seq;
+      spill->durableSeq = superblock.seq;
+    }
+  }
+  if (ftruncate(fd, BLOCK_BYTES + 2 * spill->slotBytes) != 0)
+  {
+    fprintf(stderr, "WARNING: ckpt_spill: cannot size '%s' (%s)\n", path, strerror(errno));
+  }
+  return spill;
+}
+
+int32_t
+ckpt_spill_begin(ckpt_spill_t *spill)
+{
+  int64_t start = nowNs();
+  int32_t id = 0;
+  const ckpt_header_t *header = ckpt_header(spill->mem);
+  if (spill->state != CKPT_SPILL_RUNNING)
+  {
+    if (spill->fallbackThread.joinable()) spill->fallbackThread.join();
+    int32_t ckptId = ckpt_last_id(header);
+    int32_t heartbeat = ckpt_heartbeat(header);
+    if (ckptId > 0 && !(spill->hasDurable && ckptId == spill->durableId && heartbeat == spill->durableHeartbeat))
+    {
+      spill->ckptId = ckptId;
+      spill->heartbeat = heartbeat;
+      spill->epoch = __atomic_load_n(&header->epoch, __ATOMIC_RELAXED);
+      // the slot the superblock does not point at (also after torn or failed spills)
+      spill->seq = spill->durableSeq + 1;
+      spill->slotOffset = BLOCK_BYTES + (spill->seq % 2) * spill->slotBytes;
+      if (spill->tailBytes) memcpy(spill->tailBuffer, spill->mem + spill->alignedBytes, spill->tailBytes);
+      spill->phase = PHASE_DATA;
+      spill->nextOffset = 0;
+      spill->inflight = 0;
+      spill->hasFailed = false;
+      spill->beginNs = start;
+      spill->spillsBegun++;
+      spill->state = CKPT_SPILL_RUNNING;
+      if (spill->useRing)
+      {
+        advanceSpill(spill);
+      }
+      else
+      {
+        spill->fallbackThread = std::thread(runFallbackSpill, spill);
+      }
+      id = ckptId;
+    }
+  }
+  spill->hostMs += (nowNs() - start) / 1e6;
+  return id;
+}
+
+int32_t
+ckpt_spill_poll(ckpt_spill_t *spill)
+{
+  int64_t start = nowNs();
+  if (spill->state == CKPT_SPILL_RUNNING && spill->useRing) advanceSpill(spill);
+  spill->hostMs += (nowNs() - start) / 1e6;
+  return spill->state;
+}
+
+int32_t
+ckpt_spill_wait(ckpt_spill_t *spill, int32_t timeout_ms)
+{
+  int64_t deadline = nowNs() + (int64_t)timeout_ms * 1000000L;
+  int32_t state;
+  while ((state = ckpt_spill_poll(spill)) == CKPT_SPILL_RUNNING && (timeout_ms < 0 || nowNs() < deadline))
+  {
+    std::this_thread::sleep_for(std::chrono::microseconds(WAIT_POLL_US));
+  }
+  return state;
+}
+
+void
+ckpt_spill_stats(const ckpt_spill_t *spill, ckpt_spill_stats_t *stats)
+{
+  stats->spills_begun = spill->spillsBegun;
+  stats->spills_durable = spill->spillsDurable;
+  stats->spills_torn = spill->spillsTorn;
+  stats->bytes_written = spill->bytesWritten;
+  stats->durable_id = spill->hasDurable ? spill->durableId : 0;
+  stats->durable_heartbeat = spill->hasDurable ? spill->durableHeartbeat : 0;
+  stats->uses_io_uring = spill->useRing;
+  stats->flags = spill->flags;
+  stats->max_queue_depth = spill->maxInflight;
+  stats->mean_queue_depth = spill->submissions ? (double)spill->inflightSum / spill->submissions : 0;
+  stats->last_spill_ms = spill->lastSpillMs;
+  stats->last_bandwidth_mibs = spill->lastSpillMs > 0 ? spill->bytes / 1048576.0 / (spill->lastSpillMs / 1000) : 0;
+  stats->host_ms = spill->hostMs;
+}
+
+void
+ckpt_spill_close(ckpt_spill_t *spill)
+{
+  if (spill == nullptr) return;
+  ckpt_spill_wait(spill, -1);
+  if (spill->fallbackThread.joinable()) spill->fallbackThread.join();
+  spill->ring.teardown();
+  close(spill->fd);
+  free(spill->tailBuffer);
+  free(spill->superblockBuffer);
+  delete spill;
+}
+
+int32_t
+ckpt_spill_load(const char *path, void *ckpt_mem, int64_t bytes, int32_t *epoch)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return 0;
+  Superblock superblock;
+  bool ok = pread(fd, &superblock, sizeof(superblock), 0) == sizeof(superblock) && superblock.magic == SPILL_MAGIC
+            && superblock.hash == hashSuperblock(superblock) && superblock.seq > 0 && superblock.bytes == bytes
+            && superblock.ckptId > 0;
+  // read into a copy first, so ckpt_mem is not changed if the file is short
+  std::vector<char> segment(ok ? bytes : 0);
+  for (int64_t done = 0; ok && done < bytes;)
+  {
+    ssize_t n = pread(fd, segment.data() + done, bytes - done, superblock.slotOffset + done);
+    if (n < 0 && errno == EINTR) continue;
+    ok = n > 0;
+    done += std::max<ssize_t>(n, 0);
+  }
+  close(fd);
+  if (!ok) return 0;
+  memcpy(ckpt_values(ckpt_mem), ckpt_values(segment.data()), bytes - CKPT_HEADER_BYTES);
+  ckpt_header_reset(ckpt_mem);
+  ckpt_header(ckpt_mem)->epoch = superblock.epoch;
+  __atomic_store_n(&ckpt_header(ckpt_mem)->ckpt_id, superblock.ckptId, __ATOMIC_RELEASE);
+  if (epoch) *epoch = superblock.epoch;
+  return superblock.ckptId;
+}
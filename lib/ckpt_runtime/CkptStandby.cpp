@@ -0,0 +1,209 @@
+/**
+ * Hot standby process for failover: shared control block, pre-faulting of the
+ * buffers and code a restore touches, and a futex-based handover.
+ */
+
+#include "ckpt_runtime/CkptStandby.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <link.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define ORPHAN_CHECK_NS 100000000L  // how often a waiting standby checks that the watchdog is alive (100 ms)
+
+namespace {
+
+int64_t
+nowNs(void)
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+long
+pageBytes(void)
+{
+  static long bytes = sysconf(_SC_PAGESIZE);
+  return bytes;
+}
+
+/* The control block is shared between processes, so the futex ops are not private */
+int
+futexWait(int32_t *addr, int32_t expected, long timeoutNs)
+{
+  timespec timeout = {timeoutNs / 1000000000L, timeoutNs % 1000000000L};
+  return syscall(SYS_futex, addr, FUTEX_WAIT, expected, &timeout, nullptr, 0);
+}
+
+void
+futexWakeAll(int32_t *addr)
+{
+  syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+void
+setState(ckpt_standby_t *standby, int32_t state)
+{
+  __atomic_store_n(&standby->state, state, __ATOMIC_RELEASE);
+  futexWakeAll(&standby->state);
+}
+
+bool
+isProcessAlive(pid_t pid)
+{
+  return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+/* Range of the executable PT_LOAD segment that contains an address */
+typedef struct {
+  uintptr_t addr;
+  uintptr_t begin;
+  uintptr_t end;
+} CodeSegment;
+
+int
+findCodeSegment(struct dl_phdr_info *info, size_t, void *data)
+{
+  CodeSegment *segment = static_cast<CodeSegment *>(data);
+  for (int i = 0; i < info->dlpi_phnum; i++)
+  {
+    const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+    if (phdr.p_type != PT_LOAD || !(phdr.p_flags & PF_X)) continue;
+    uintptr_t begin = info->dlpi_addr + phdr.p_vaddr;
+    uintptr_t end = begin + phdr.p_memsz;
+    if (segment->addr >= begin && segment->addr < end)
+    {
+      segment->begin = begin;
+      segment->end = end;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+} /* anonymous namespace */
+
+ckpt_standby_t *
+ckpt_standby_create(void)
+{
+  void *mem = mmap(nullptr, sizeof(ckpt_standby_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) return nullptr;
+  ckpt_standby_t *standby = static_cast<ckpt_standby_t *>(mem);
+  memset(standby, 0, sizeof(*standby));
+  standby->state = CKPT_STANDBY_WAITING;
+  standby->watchdog_pid = getpid();
+  return standby;
+}
+
+void
+ckpt_standby_destroy(ckpt_standby_t *standby)
+{
+  if (standby) munmap(standby, sizeof(ckpt_standby_t));
+}
+
+int64_t
+ckpt_standby_prewarm(void *addr, int64_t bytes, int32_t writable)
+{
+  if (addr == nullptr || bytes <= 0) return 0;
+  long page = pageBytes();
+  uintptr_t begin = reinterpret_cast<uintptr_t>(addr);
+  uintptr_t end = begin + bytes;
+  madvise(reinterpret_cast<void *>(begin & ~(uintptr_t)(page - 1)), end - (begin & ~(uintptr_t)(page - 1)), MADV_WILLNEED);
+  // one access per page, starting at addr itself (the first page may be partial)
+  for (uintptr_t p = begin; p < end; p = (p & ~(uintptr_t)(page - 1)) + page)
+  {
+    volatile char *byte = reinterpret_cast<volatile char *>(p);
+    if (writable)
+    {
+      *byte = 0;
+    }
+    else
+    {
+      (void)*byte;
+    }
+  }
+  return bytes;
+}
+
+int64_t
+ckpt_standby_prewarm_code(const void *func)
+{
+  CodeSegment segment = {reinterpret_cast<uintptr_t>(func), 0, 0};
+  if (!dl_iterate_phdr(findCodeSegment, &segment)) return -1;
+  long page = pageBytes();
+  for (uintptr_t p = segment.begin & ~(uintptr_t)(page - 1); p < segment.end; p += page)
+  {
+    (void)*reinterpret_cast<volatile const char *>(p < segment.begin ? segment.begin : p);
+  }
+  return segment.end - segment.begin;
+}
+
+int32_t
+ckpt_standby_wait(ckpt_standby_t *standby)
+{
+  standby->standby_pid = getpid();
+  __atomic_store_n(&standby->ready, 1, __ATOMIC_RELEASE);
+  int32_t state;
+  while ((state = __atomic_load_n(&standby->state, __ATOMIC_ACQUIRE)) == CKPT_STANDBY_WAITING)
+  {
+    futexWait(&standby->state, CKPT_STANDBY_WAITING, ORPHAN_CHECK_NS);
+    if (__atomic_load_n(&standby->state, __ATOMIC_ACQUIRE) == CKPT_STANDBY_WAITING
+        && !isProcessAlive(standby->watchdog_pid))
+    {
+      state = CKPT_STANDBY_ORPHANED;
+      break;
+    }
+  }
+  __atomic_store_n(&standby->woken_ns, nowNs(), __ATOMIC_RELAXED);
+  __atomic_store_n(&standby->ready, 0, __ATOMIC_RELEASE);
+  return state;
+}
+
+int32_t
+ckpt_standby_is_ready(const ckpt_standby_t *standby)
+{
+  return __atomic_load_n(&standby->ready, __ATOMIC_ACQUIRE);
+}
+
+void
+ckpt_standby_handover(ckpt_standby_t *standby)
+{
+  __atomic_store_n(&standby->handover_ns, nowNs(), __ATOMIC_RELAXED);
+  setState(standby, CKPT_STANDBY_HANDOVER);
+}
+
+void
+ckpt_standby_release(ckpt_standby_t *standby)
+{
+  setState(standby, CKPT_STANDBY_RELEASED);
+}
+
+void
+ckpt_standby_resumed(ckpt_standby_t *standby)
+{
+  __atomic_store_n(&standby->resumed_ns, nowNs(), __ATOMIC_RELEASE);
+}
+
+double
+ckpt_standby_wake_us(const ckpt_standby_t *standby)
+{
+  int64_t handover = __atomic_load_n(&standby->handover_ns, __ATOMIC_RELAXED);
+  int64_t woken = __atomic_load_n(&standby->woken_ns, __ATOMIC_RELAXED);
+  return (handover > 0 && woken >= handover) ? (woken - handover) / 1000.0 : -1;
+}
+
+double
+ckpt_standby_failover_us(const ckpt_standby_t *standby)
+{
+  int64_t handover = __atomic_load_n(&standby->handover_ns, __ATOMIC_RELAXED);
+  int64_t resumed = __atomic_load_n(&standby->resumed_ns, __ATOMIC_ACQUIRE);
+  return (handover > 0 && resumed >= handover) ? (resumed - handover) / 1000.0 : -1;
+}
@@ -0,0 +1,63 @@
+/**
+ * Team barrier and collective copies for checkpoints of multithreaded kernels.
+ */
+
+#include "ckpt_runtime/CkptTeam.h"
+#include "ckpt_runtime/CkptCopy.h"
+
+#include <sched.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define SPINS_BEFORE_YIELD 1024
+
+namespace {
+
+inline void
+cpuRelax(void)
+{
+  #if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+  #endif
+}
+
+} /* anonymous namespace */
+
+void
+ckpt_team_barrier(void *ckpt_mem, int32_t nthreads)
+{
+  if (nthreads <= 1) return;
+  ckpt_header_t *header = ckpt_header(ckpt_mem);
+  int32_t gen = __atomic_load_n(&header->barrier_gen, __ATOMIC_ACQUIRE);
+  if (__atomic_fetch_add(&header->barrier_count, 1, __ATOMIC_ACQ_REL) == nthreads - 1)
+  {
+    // last thread in: reset the count for the next barrier, then open this one
+    __atomic_store_n(&header->barrier_count, 0, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&header->barrier_gen, 1, __ATOMIC_RELEASE);
+    return;
+  }
+  // spin first (the team usually arrives together), then yield to oversubscribed threads
+  for (unsigned spins = 0; __atomic_load_n(&header->barrier_gen, __ATOMIC_ACQUIRE) == gen; spins++)
+  {
+    if (spins < SPINS_BEFORE_YIELD) cpuRelax();
+    else sched_yield();
+  }
+}
+
+void
+ckpt_team_copy(void *dst, const void *src, uint64_t bytes, int32_t thread, int32_t nthreads)
+{
+  if (nthreads <= 1)
+  {
+    ckpt_copy(dst, src, bytes);
+    return;
+  }
+  // whole cache lines per thread, so no two threads write the same line of dst
+  uint64_t lines = (bytes + CKPT_CACHE_LINE_BYTES - 1) / CKPT_CACHE_LINE_BYTES;
+  uint64_t sliceBytes = ((lines + nthreads - 1) / nthreads) * CKPT_CACHE_LINE_BYTES;
+  uint64_t begin = (uint64_t)thread * sliceBytes;
+  if (begin >= bytes) return;
+  uint64_t end = (begin + sliceBytes < bytes) ? begin + sliceBytes : bytes;
+  ckpt_copy((char *)dst + begin, (const char *)src + begin, end - begin);
+}
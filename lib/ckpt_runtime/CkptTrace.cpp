@@ -0,0 +1,464 @@
+/**
+ * Checkpoint event traces: a recorder thread that polls the header and writes an
+ * event per save seen (changed regions, found by hashing them), a reader, and the
+ * save a replay performs for an event.
+ */
+
+#include "ckpt_runtime/CkptTrace.h"
+#include "ckpt_runtime/CkptCopy.h"
+#include "ckpt_runtime/CkptHeader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <thread>
+#include <vector>
+
+#define TRACE_MAGIC       0x31435254544b4300ULL  // "\0CKTTRC1"
+#define TRACE_VERSION     1
+#define POLL_INTERVAL_US  100                    // how often the recorder reads the header
+#define MAX_ATTEMPTS      8                      // hashes of one save redone before it is recorded as torn
+
+namespace {
+
+typedef struct {
+  uint64_t magic;
+  uint32_t version;
+  int32_t flags;
+  int64_t segmentBytes;
+  int64_t regionBytes;
+  int64_t startRealtimeNs;
+  int32_t pollUs;
+  int32_t reserved[5];
+} FileHeader;
+
+typedef struct {
+  int64_t startNs;
+  int64_t publishNs;
+  int32_t ckptId;
+  int32_t epoch;
+  int32_t heartbeat;
+  int32_t saves;
+  int32_t flags;
+  int32_t numRanges;
+  int64_t changedRegions;
+  int64_t changedBytes;
+} EventHeader;
+
+static_assert(sizeof(FileHeader) == 64 && sizeof(EventHeader) == 56, "trace layout");
+
+int64_t
+nowNs(int clock)
+{
+  timespec ts;
+  clock_gettime(clock, &ts);
+  return (int64_t)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+int64_t
+regionOffset(int64_t region, int64_t regionBytes)
+{
+  return CKPT_HEADER_BYTES + region * regionBytes;
+}
+
+int64_t
+regionLength(int64_t region, int64_t regionBytes, int64_t segmentBytes)
+{
+  return std::min(regionBytes, segmentBytes - regionOffset(region, regionBytes));
+}
+
+} /* anonymous namespace */
+
+struct ckpt_trace {
+  const char *mem;
+  int64_t bytes;
+  int64_t regionBytes;
+  int64_t numRegions;
+  int32_t flags;
+  FILE *file;
+  int64_t startNs;
+  std::atomic<bool> stopping;
+  std::thread thread;
+
+  std::vector<uint64_t> hashes;          // per region: hash at the last event
+  std::vector<uint64_t> newHashes;       // per region: hash of the event being recorded
+  std::vector<ckpt_trace_range_t> ranges;
+  std::vector<uint64_t> changedHashes;
+  std::vector<char> payload;
+  int64_t changedRegions, changedBytes;
+  int32_t lastHeartbeat;
+  bool hasFailed;
+
+  std::atomic<int64_t> events, saves, tornEvents, retries, totalChangedBytes, fileBytes;
+};
+
+namespace {
+
+/**
+* Hashes every region, and collects the ranges of those whose hash differs from
+* the last event's (all of them for the baseline), with their hashes and, if
+* recorded, their contents. Payloads are copied before they are hashed, so the
+* hash describes the payload even if the kernel wrote the region meanwhile.
+*/
+void
+scanRegions(ckpt_trace_t *trace, bool isBaseline)
+{
+  bool hasPayloads = trace->flags & CKPT_TRACE_PAYLOADS;
+  trace->ranges.clear();
+  trace->changedHashes.clear();
+  trace->payload.clear();
+  trace->changedRegions = trace->changedBytes = 0;
+  for (int64_t region = 0; region < trace->numRegions; region++)
+  {
+    const char *data = trace->mem + regionOffset(region, trace->regionBytes);
+    int64_t length = regionLength(region, trace->regionBytes, trace->bytes);
+    size_t payloadBytes = trace->payload.size();
+    if (hasPayloads)
+    {
+      trace->payload.insert(trace->payload.end(), data, data + length);
+      data = trace->payload.data() + payloadBytes;
+    }
+    uint64_t hash = ckpt_hash64(data, length);
+    trace->newHashes[region] = hash;
+    if (!isBaseline && hash == trace->hashes[region])
+    {
+      trace->payload.resize(payloadBytes);
+      continue;
+    }
+    if (!trace->ranges.empty()
+        && trace->ranges.back().first_region + trace->ranges.back().num_regions == (uint32_t)region)
+    {
+      trace->ranges.back().num_regions++;
+    }
+    else
+    {
+      trace->ranges.push_back({(uint32_t)region, 1});
+    }
+    trace->changedHashes.push_back(hash);
+    trace->changedRegions++;
+    trace->changedBytes += length;
+  }
+}
+
+bool
+writeEvent(ckpt_trace_t *trace, const EventHeader &event)
+{
+  FILE *file = trace->file;
+  bool ok = fwrite(&event, sizeof(event), 1, file) == 1;
+  ok = ok && fwrite(trace->ranges.data(), sizeof(ckpt_trace_range_t), trace->ranges.size(), file) == trace->ranges.size();
+  size_t bytes = sizeof(event) + trace->ranges.size() * sizeof(ckpt_trace_range_t);
+  if (trace->flags & CKPT_TRACE_HASHES)
+  {
+    size_t n = trace->changedHashes.size();
+    ok = ok && fwrite(trace->changedHashes.data(), sizeof(uint64_t), n, file) == n;
+    bytes += n * sizeof(uint64_t);
+  }
+  if (trace->flags & CKPT_TRACE_PAYLOADS)
+  {
+    ok = ok && fwrite(trace->payload.data(), 1, trace->payload.size(), file) == trace->payload.size();
+    bytes += trace->payload.size();
+  }
+  if (!ok)
+  {
+    fprintf(stderr, "WARNING: ckpt_trace: cannot write the trace (%s); recording stopped\n", strerror(errno));
+    trace->hasFailed = true;
+    return false;
+  }
+  trace->events++;
+  trace->saves += event.saves;
+  trace->tornEvents += (event.flags & CKPT_TRACE_TORN) ? 1 : 0;
+  trace->totalChangedBytes += event.changedBytes;
+  trace->fileBytes += bytes;
+  return true;
+}
+
+EventHeader
+makeEvent(const ckpt_trace_t *trace, int64_t startNs, int64_t publishNs, int32_t ckptId, int32_t epoch,
+          int32_t heartbeat, int32_t saves, int32_t flags)
+{
+  EventHeader event;
+  memset(&event, 0, sizeof(event));
+  event.startNs = startNs - trace->startNs;
+  event.publishNs = publishNs - trace->startNs;
+  event.ckptId = ckptId;
+  event.epoch = epoch;
+  event.heartbeat = heartbeat;
+  event.saves = saves;
+  event.flags = flags;
+  event.numRanges = trace->ranges.size();
+  event.changedRegions = trace->changedRegions;
+  event.changedBytes = trace->changedBytes;
+  return event;
+}
+
+void
+runRecorder(ckpt_trace_t *trace)
+{
+  const ckpt_header_t *header = ckpt_header(const_cast<char *>(trace->mem));
+  int64_t now = nowNs(CLOCK_MONOTONIC);
+  trace->lastHeartbeat = ckpt_heartbeat(header);
+  scanRegions(trace, true);
+  if (!writeEvent(trace, makeEvent(trace, now, now, ckpt_last_id(header), header->epoch, trace->lastHeartbeat, 0,
+                                   CKPT_TRACE_BASELINE)))
+  {
+    return;
+  }
+  trace->hashes.swap(trace->newHashes);
+
+  int64_t saveStartNs = -1;
+  int attempts = 0;
+  while (!trace->hasFailed)
+  {
+    // after a stop, one more look at the header records the save published last
+    bool isStopping = trace->stopping;
+    int32_t id = ckpt_last_id(header);
+    int32_t heartbeat = ckpt_heartbeat(header);
+    if (id == -1 && saveStartNs < 0)
+    {
+      // the first save since the last event started
+      saveStartNs = nowNs(CLOCK_MONOTONIC);
+    }
+    else if (id > 0 && heartbeat != trace->lastHeartbeat)
+    {
+      int64_t publishNs = nowNs(CLOCK_MONOTONIC);
+      int32_t epoch = __atomic_load_n(&header->epoch, __ATOMIC_RELAXED);
+      scanRegions(trace, false);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      bool isTorn = __atomic_load_n(&header->ckpt_id, __ATOMIC_RELAXED) != id || ckpt_heartbeat(header) != heartbeat;
+      if (isTorn && ++attempts < MAX_ATTEMPTS)
+      {
+        trace->retries++;
+        continue;
+      }
+      int64_t startNs = saveStartNs >= 0 ? saveStartNs : publishNs;
+      int32_t saves = (int32_t)((uint32_t)heartbeat - (uint32_t)trace->lastHeartbeat);
+      writeEvent(trace, makeEvent(trace, startNs, publishNs, id, epoch, heartbeat, saves, isTorn ? CKPT_TRACE_TORN : 0));
+      trace->hashes.swap(trace->newHashes);
+      trace->lastHeartbeat = heartbeat;
+      saveStartNs = -1;
+      attempts = 0;
+      continue;
+    }
+    if (isStopping) break;
+    std::this_thread::sleep_for(std::chrono::microseconds(POLL_INTERVAL_US));
+  }
+}
+
+} /* anonymous namespace */
+
+ckpt_trace_t *
+ckpt_trace_start(const char *path, const void *ckpt_mem, int64_t bytes, int64_t region_bytes, int32_t flags)
+{
+  if (ckpt_mem == nullptr || bytes <= CKPT_HEADER_BYTES || region_bytes <= 0 || region_bytes % sizeof(uint64_t))
+  {
+    return nullptr;
+  }
+  FILE *file = fopen(path, "wb");
+  if (file == nullptr) return nullptr;
+  ckpt_trace_t *trace = new ckpt_trace_t();
+  trace->mem = static_cast<const char *>(ckpt_mem);
+  trace->bytes = bytes;
+  trace->regionBytes = region_bytes;
+  trace->numRegions = (bytes - CKPT_HEADER_BYTES + region_bytes - 1) / region_bytes;
+  trace->flags = flags & (CKPT_TRACE_HASHES | CKPT_TRACE_PAYLOADS);
+  trace->file = file;
+  trace->startNs = nowNs(CLOCK_MONOTONIC);
+  trace->stopping = false;
+  trace->hashes.resize(trace->numRegions);
+  trace->newHashes.resize(trace->numRegions);
+  if (trace->flags & CKPT_TRACE_PAYLOADS) trace->payload.reserve(bytes);
+  trace->hasFailed = false;
+  trace->events = trace->saves = trace->tornEvents = trace->retries = trace->totalChangedBytes = 0;
+
+  FileHeader fileHeader;
+  memset(&fileHeader, 0, sizeof(fileHeader));
+  fileHeader.magic = TRACE_MAGIC;
+  fileHeader.version = TRACE_VERSION;
+  fileHeader.flags = trace->flags;
+  fileHeader.segmentBytes = bytes;
+  fileHeader.regionBytes = region_bytes;
+  fileHeader.startRealtimeNs = nowNs(CLOCK_REALTIME);
+  fileHeader.pollUs = POLL_INTERVAL_US;
+  if (fwrite(&fileHeader, sizeof(fileHeader), 1, file) != 1)
+  {
+    fclose(file);
+    delete trace;
+    return nullptr;
+  }
+  trace->fileBytes = sizeof(fileHeader);
+  trace->thread = std::thread(runRecorder, trace);
+  return trace;
+}
+
+void
+ckpt_trace_stats(const ckpt_trace_t *trace, ckpt_trace_stats_t *stats)
+{
+  stats->events = trace->events;
+  stats->saves = trace->saves;
+  // the baseline is an event, but no save
+  stats->missed_saves = std::max<int64_t>(0, stats->saves - (stats->events - 1));
+  stats->torn_events = trace->tornEvents;
+  stats->retries = trace->retries;
+  stats->changed_bytes = trace->totalChangedBytes;
+  stats->file_bytes = trace->fileBytes;
+}
+
+int64_t
+ckpt_trace_stop(ckpt_trace_t *trace, ckpt_trace_stats_t *stats)
+{
+  if (trace == nullptr) return 0;
+  trace->stopping = true;
+  trace->thread.join();
+  if (stats) ckpt_trace_stats(trace, stats);
+  if (fclose(trace->file) != 0 && !trace->hasFailed)
+  {
+    fprintf(stderr, "WARNING: ckpt_trace: cannot write the trace (%s)\n", strerror(errno));
+  }
+  int64_t events = trace->events;
+  delete trace;
+  return events;
+}
+
+struct ckpt_trace_reader {
+  FILE *file;
+  ckpt_trace_info_t info;
+  std::vector<ckpt_trace_range_t> ranges;
+  std::vector<uint64_t> hashes;
+  std::vector<char> payload;
+};
+
+ckpt_trace_reader_t *
+ckpt_trace_open(const char *path, ckpt_trace_info_t *info)
+{
+  FILE *file = fopen(path, "rb");
+  if (file == nullptr) return nullptr;
+  FileHeader fileHeader;
+  if (fread(&fileHeader, sizeof(fileHeader), 1, file) != 1 || fileHeader.magic != TRACE_MAGIC
+      || fileHeader.version != TRACE_VERSION || fileHeader.segmentBytes <= CKPT_HEADER_BYTES
+      || fileHeader.regionBytes <= 0)
+  {
+    fclose(file);
+    return nullptr;
+  }
+  ckpt_trace_reader_t *reader = new ckpt_trace_reader_t();
+  reader->file = file;
+  reader->info.segment_bytes = fileHeader.segmentBytes;
+  reader->info.region_bytes = fileHeader.regionBytes;
+  reader->info.num_regions = (fileHeader.segmentBytes - CKPT_HEADER_BYTES + fileHeader.regionBytes - 1)
+                             / fileHeader.regionBytes;
+  reader->info.start_realtime_ns = fileHeader.startRealtimeNs;
+  reader->info.flags = fileHeader.flags;
+  reader->info.poll_us = fileHeader.pollUs;
+  if (info) *info = reader->info;
+  return reader;
+}
+
+int32_t
+ckpt_trace_next(ckpt_trace_reader_t *reader, ckpt_trace_event_t *event)
+{
+  EventHeader header;
+  size_t n = fread(&header, 1, sizeof(header), reader->file);
+  if (n == 0 && feof(reader->file)) return 0;
+  const ckpt_trace_info_t &info = reader->info;
+  if (n != sizeof(header) || header.numRanges < 0 || header.changedRegions < 0
+      || header.changedRegions > info.num_regions || header.changedBytes < 0)
+  {
+    return -1;
+  }
+  reader->ranges.resize(header.numRanges);
+  if (fread(reader->ranges.data(), sizeof(ckpt_trace_range_t), header.numRanges, reader->file) != reader->ranges.size())
+  {
+    return -1;
+  }
+  // the ranges must be in order, inside the segment, and add up to the changed regions and bytes
+  int64_t regions = 0, bytes = 0, end = 0;
+  for (const ckpt_trace_range_t &range : reader->ranges)
+  {
+    if (range.num_regions == 0 || range.first_region < end || range.first_region + (int64_t)range.num_regions > info.num_regions)
+    {
+      return -1;
+    }
+    end = range.first_region + (int64_t)range.num_regions;
+    regions += range.num_regions;
+    for (int64_t region = range.first_region; region < end; region++)
+    {
+      bytes += regionLength(region, info.region_bytes, info.segment_bytes);
+    }
+  }
+  if (regions != header.changedRegions || bytes != header.changedBytes) return -1;
+  reader->hashes.resize((info.flags & CKPT_TRACE_HASHES) ? header.changedRegions : 0);
+  reader->payload.resize((info.flags & CKPT_TRACE_PAYLOADS) ? header.changedBytes : 0);
+  if (fread(reader->hashes.data(), sizeof(uint64_t), reader->hashes.size(), reader->file) != reader->hashes.size()
+      || fread(reader->payload.data(), 1, reader->payload.size(), reader->file) != reader->payload.size())
+  {
+    return -1;
+  }
+
+  event->start_ns = header.startNs;
+  event->publish_ns = header.publishNs;
+  event->ckpt_id = header.ckptId;
+  event->epoch = header.epoch;
+  event->heartbeat = header.heartbeat;
+  event->saves = header.saves;
+  event->flags = header.flags;
+  event->num_ranges = header.numRanges;
+  event->changed_regions = header.changedRegions;
+  event->changed_bytes = header.changedBytes;
+  event->ranges = reader->ranges.data();
+  event->hashes = (info.flags & CKPT_TRACE_HASHES) ? reader->hashes.data() : nullptr;
+  event->payload = (info.flags & CKPT_TRACE_PAYLOADS) ? reader->payload.data() : nullptr;
+  return 1;
+}
+
+void
+ckpt_trace_close(ckpt_trace_reader_t *reader)
+{
+  if (reader == nullptr) return;
+  fclose(reader->file);
+  delete reader;
+}
+
+int32_t
+ckpt_trace_replay_save(void *ckpt_mem, const ckpt_trace_info_t *info, const ckpt_trace_event_t *event)
+{
+  char *mem = static_cast<char *>(ckpt_mem);
+  ckpt_header_t *header = ckpt_header(mem);
+  __atomic_store_n(&header->ckpt_id, -1, __ATOMIC_RELAXED);
+  int32_t heartbeat = __atomic_add_fetch(&header->heartbeat, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  const char *payload = static_cast<const char *>(event->payload);
+  int64_t changed = 0;
+  for (int32_t i = 0; i < event->num_ranges; i++)
+  {
+    const ckpt_trace_range_t &range = event->ranges[i];
+    for (int64_t region = range.first_region; region < range.first_region + (int64_t)range.num_regions; region++)
+    {
+      char *data = mem + regionOffset(region, info->region_bytes);
+      int64_t length = regionLength(region, info->region_bytes, info->segment_bytes);
+      if (payload)
+      {
+        memcpy(data, payload, length);
+        payload += length;
+      }
+      else
+      {
+        // differs from the region's previous contents as its hash (or the heartbeat) does
+        uint64_t seed = event->hashes ? event->hashes[changed] : ((uint64_t)heartbeat << 32 | (uint64_t)region);
+        uint64_t word = seed * 0x9e3779b97f4a7c15ULL + 1;
+        int64_t numWords = length / sizeof(uint64_t);
+        uint64_t *words = reinterpret_cast<uint64_t *>(data);
+        for (int64_t k = 0; k < numWords; k++) words[k] = word + (uint64_t)k * 0xbf58476d1ce4e5b9ULL;
+        memset(data + numWords * sizeof(uint64_t), (int)(word & 0xff), length - numWords * sizeof(uint64_t));
+      }
+      changed++;
+    }
+  }
+  __atomic_store_n(&header->epoch, event->epoch, __ATOMIC_RELAXED);
+  __atomic_store_n(&header->ckpt_id, std::max(event->ckpt_id, 0), __ATOMIC_RELEASE);
+  return heartbeat;
+}
@@ -0,0 +1,84 @@
+/**
+ * Undo logs of sparsely written arrays: rollback on restore, and spilling of a
+ * full log into a snapshot of the array.
+ */
+
+#include "ckpt_runtime/CkptUndoLog.h"
+#include "ckpt_runtime/CkptCopy.h"
+
+#include <cstring>
+
+namespace {
+
+inline ckpt_undo_entry_t *
+getEntries(ckpt_undo_log_t *log)
+{
+  return reinterpret_cast<ckpt_undo_entry_t *>(log + 1);
+}
+
+inline char *
+getSnapshot(ckpt_undo_log_t *log)
+{
+  return reinterpret_cast<char *>(getEntries(log) + log->capacity);
+}
+
+/* Writes the old contents of the first numEntries entries back into array, newest first */
+void
+undoEntries(ckpt_undo_log_t *log, int64_t numEntries, char *array)
+{
+  const ckpt_undo_entry_t *entries = getEntries(log);
+  for (int64_t k = numEntries - 1; k >= 0; k--)
+  {
+    int64_t offset = entries[k].offset_width >> CKPT_UNDO_WIDTH_BITS;
+    int width = (int)(entries[k].offset_width & ((1 << CKPT_UNDO_WIDTH_BITS) - 1));
+    uint64_t bits = entries[k].old_bits;
+    // stores of narrower types were zero-extended; write back their low-order bytes
+    switch (width)
+    {
+      case 1: { uint8_t v = (uint8_t)bits; memcpy(array + offset, &v, 1); break; }
+      case 2: { uint16_t v = (uint16_t)bits; memcpy(array + offset, &v, 2); break; }
+      case 4: { uint32_t v = (uint32_t)bits; memcpy(array + offset, &v, 4); break; }
+      case 8: memcpy(array + offset, &bits, 8); break;
+      default: break;
+    }
+  }
+}
+
+} /* anonymous namespace */
+
+void
+ckpt_undo_log_init(void *log, int64_t capacity, int64_t array_bytes)
+{
+  ckpt_undo_log_t *header = static_cast<ckpt_undo_log_t *>(log);
+  header->len = 0;
+  header->capacity = capacity;
+  header->array_bytes = array_bytes;
+}
+
+void
+ckpt_undo_log_full(void *log, const void *array)
+{
+  ckpt_undo_log_t *header = static_cast<ckpt_undo_log_t *>(log);
+  if (header->len == CKPT_UNDO_LOG_SPILLED) return;
+  char *snapshot = getSnapshot(header);
+  ckpt_copy(snapshot, array, header->array_bytes);
+  undoEntries(header, header->len, snapshot);
+  // only a complete snapshot may replace the log (a failure above leaves the log valid)
+  __atomic_store_n(&header->len, (int64_t)CKPT_UNDO_LOG_SPILLED, __ATOMIC_RELEASE);
+}
+
+void
+ckpt_undo_log_rollback(void *log, void *array)
+{
+  ckpt_undo_log_t *header = static_cast<ckpt_undo_log_t *>(log);
+  int64_t len = __atomic_load_n(&header->len, __ATOMIC_ACQUIRE);
+  if (len == CKPT_UNDO_LOG_SPILLED)
+  {
+    ckpt_copy(array, getSnapshot(header), header->array_bytes);
+  }
+  else
+  {
+    undoEntries(header, (len < header->capacity) ? len : header->capacity, static_cast<char *>(array));
+  }
+  header->len = 0;
+}
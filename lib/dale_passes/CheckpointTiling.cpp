@@ -0,0 +1,316 @@
+/**
+ * Work estimates of the loops around checkpoints, used by SubroutineInjection to
+ * save once per tile of iterations (-ckpt-tile-work).
+ */
+
+#include "dale_passes/CheckpointTiling.h"
+
+#include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/PromoteMemToReg.h"
+
+#include <iostream>
+
+using namespace llvm;
+
+struct CheckpointTiling::CloneState
+{
+  ScalarEvolution &SE;
+  const BasicBlock *checkpointBB;                          // in the copy
+  std::map<const BasicBlock *, const BasicBlock *> originalBBs;  // copy -> original
+  std::vector<std::pair<LoadInst *, WeakTrackingVH>> headerLoads;  // original load, its value in the copy
+  std::map<const Loop *, int> loopIVs;
+
+  CloneState(ScalarEvolution &SE) : SE(SE), checkpointBB(nullptr) {}
+};
+
+void
+CheckpointTiling::analyze(Function &F, const std::vector<const BasicBlock *> &checkpointBBs)
+{
+  Func = &F;
+  ValueToValueMapTy VMap;
+  Function *clone = CloneFunction(&F, VMap);
+  {
+    DominatorTree DT(*clone);
+    LoopInfo LI(DT);
+    AssumptionCache AC(*clone);
+    TargetLibraryInfoImpl TLII(Triple(F.getParent()->getTargetTriple()));
+    TargetLibraryInfo TLI(TLII);
+
+    // loads of the loop counters in the headers, followed through the promotion (which replaces them with phis)
+    std::map<const BasicBlock *, const BasicBlock *> originalBBs;
+    for (BasicBlock &BB : F)
+    {
+      originalBBs[cast<BasicBlock>(VMap[&BB])] = &BB;
+    }
+    std::vector<std::pair<LoadInst *, WeakTrackingVH>> headerLoads;
+    for (Loop *L : LI.getLoopsInPreorder())
+    {
+      for (Instruction &I : *const_cast<BasicBlock *>(originalBBs.at(L->getHeader())))
+      {
+        LoadInst *load = dyn_cast<LoadInst>(&I);
+        if (load && load->getType()->isIntegerTy() && isa<AllocaInst>(load->getPointerOperand()))
+        {
+          headerLoads.push_back({load, WeakTrackingVH(VMap[load])});
+        }
+      }
+    }
+
+    std::vector<AllocaInst *> allocas;
+    for (Instruction &I : clone->getEntryBlock())
+    {
+      AllocaInst *alloca = dyn_cast<AllocaInst>(&I);
+      if (alloca && isAllocaPromotable(alloca)) allocas.push_back(alloca);
+    }
+    if (!allocas.empty()) PromoteMemToReg(allocas, DT, &AC);
+
+    ScalarEvolution SE(*clone, TLI, AC, DT, LI);
+    CloneState state(SE);
+    state.originalBBs = originalBBs;
+    state.headerLoads = headerLoads;
+    for (const BasicBlock *checkpointBB : checkpointBBs)
+    {
+      std::string bbName = checkpointBB->getName().str();
+      state.checkpointBB = cast<BasicBlock>(VMap[checkpointBB]);
+      const Loop *L = LI.getLoopFor(state.checkpointBB);
+      if (!L)
+      {
+        std::cout << "WARNING: Checkpoint '" << bbName << "' is not in a loop; saving at every checkpoint." << std::endl;
+        continue;
+      }
+      const SCEV *work = getIterationWork(L, SE);
+      WorkExpr expr;
+      if (!work || !translate(work, state, expr))
+      {
+        std::cout << "WARNING: Could not estimate the work per iteration of the loop around checkpoint '" << bbName
+                  << "'; saving at every checkpoint." << std::endl;
+        continue;
+      }
+      CkptWork[checkpointBB] = expr;
+      std::string workStr;
+      raw_string_ostream rso(workStr);
+      work->print(rso);
+      std::cout << "Checkpoint '" << bbName << "' is tiled by the work per iteration of loop '"
+                << originalBBs.at(L->getHeader())->getName().str() << "': " << rso.str() << std::endl;
+    }
+  }
+  clone->eraseFromParent();
+}
+
+Value *
+CheckpointTiling::createIterationWork(const BasicBlock *checkpointBB, IRBuilder<> &builder) const
+{
+  return createWorkExpr(CkptWork.at(checkpointBB), builder);
+}
+
+const SCEV *
+CheckpointTiling::getIterationWork(const Loop *L, ScalarEvolution &SE) const
+{
+  Type *int64Ty = Type::getInt64Ty(L->getHeader()->getContext());
+  const SCEV *work = SE.getOne(int64Ty);
+  for (const Loop *subLoop : L->getSubLoops())
+  {
+    const SCEV *subLoopWork = getTotalWork(subLoop, SE);
+    if (!subLoopWork) return nullptr;
+    work = SE.getAddExpr(work, subLoopWork);
+  }
+  return work;
+}
+
+const SCEV *
+CheckpointTiling::getTotalWork(const Loop *L, ScalarEvolution &SE) const
+{
+  Type *int64Ty = Type::getInt64Ty(L->getHeader()->getContext());
+  const SCEV *backedgeTakenCount = SE.getBackedgeTakenCount(L);
+  const SCEV *work = getIterationWork(L, SE);
+  if (isa<SCEVCouldNotCompute>(backedgeTakenCount) || !work) return nullptr;
+  // the header holds the exit test, so the body runs once per backedge taken
+  const SCEV *numIters = SE.getTruncateOrSignExtend(backedgeTakenCount, int64Ty);
+  if (SE.isLoopInvariant(work, L))
+  {
+    return SE.getMulExpr(work, numIters);
+  }
+  const SCEVAddRecExpr *rec = dyn_cast<SCEVAddRecExpr>(work);
+  if (!rec || rec->getLoop() != L) return nullptr;
+
+  // sum of {o0,+,o1,+,o2,...} over n iterations: o0 * C(n,1) + o1 * C(n,2) + o2 * C(n,3) + ...
+  const SCEV *total = SE.getZero(int64Ty);
+  const SCEV *fallingFactorial = SE.getOne(int64Ty);
+  uint64_t factorial = 1;
+  for (unsigned j = 0; j < rec->getNumOperands(); j++)
+  {
+    fallingFactorial = SE.getMulExpr(fallingFactorial, SE.getMinusSCEV(numIters, SE.getConstant(int64Ty, j)));
+    factorial *= j + 1;
+    const SCEV *binomial = SE.getUDivExpr(fallingFactorial, SE.getConstant(int64Ty, factorial));
+    total = SE.getAddExpr(total, SE.getMulExpr(rec->getOperand(j), binomial));
+  }
+  return total;
+}
+
+bool
+CheckpointTiling::translate(const SCEV *S, CloneState &state, WorkExpr &expr)
+{
+  expr.constVal = 0;
+  expr.index = 0;
+  expr.ops.clear();
+  if (const SCEVConstant *constant = dyn_cast<SCEVConstant>(S))
+  {
+    if (constant->getAPInt().getMinSignedBits() > 64) return false;
+    expr.kind = WorkExpr::CONST;
+    expr.constVal = constant->getAPInt().getSExtValue();
+    return true;
+  }
+  if (const SCEVUnknown *unknown = dyn_cast<SCEVUnknown>(S))
+  {
+    Argument *arg = dyn_cast<Argument>(unknown->getValue());
+    if (!arg || !arg->getType()->isIntegerTy()) return false;
+    expr.kind = WorkExpr::ARG;
+    expr.index = arg->getArgNo();
+    return true;
+  }
+  if (const SCEVCastExpr *cast = dyn_cast<SCEVCastExpr>(S))
+  {
+    // all work is computed in int64; the casts of the copy do not change an estimate
+    if (isa<SCEVPtrToIntExpr>(cast)) return false;
+    return translate(cast->getOperand(), state, expr);
+  }
+  if (const SCEVUDivExpr *udiv = dyn_cast<SCEVUDivExpr>(S))
+  {
+    expr.kind = WorkExpr::UDIV;
+    expr.ops.resize(2);
+    return translate(udiv->getLHS(), state, expr.ops[0]) && translate(udiv->getRHS(), state, expr.ops[1]);
+  }
+  if (const SCEVAddRecExpr *rec = dyn_cast<SCEVAddRecExpr>(S))
+  {
+    // {o0,+,o1,+,o2,...} at iteration k: o0 + o1 * C(k,1) + o2 * C(k,2) + ...
+    if (!rec->getLoop()->contains(state.checkpointBB)) return false;
+    int ivIndex = getLoopIV(rec->getLoop(), state);
+    if (ivIndex < 0) return false;
+    WorkExpr iter;
+    iter.kind = WorkExpr::LOOP_ITER;
+    iter.constVal = 0;
+    iter.index = ivIndex;
+    expr.kind = WorkExpr::ADD;
+    WorkExpr fallingFactorial;
+    fallingFactorial.kind = WorkExpr::MUL;
+    uint64_t factorial = 1;
+    for (unsigned j = 0; j < rec->getNumOperands(); j++)
+    {
+      WorkExpr term;
+      term.kind = WorkExpr::MUL;
+      term.ops.resize(1);
+      if (!translate(rec->getOperand(j), state, term.ops[0])) return false;
+      if (j > 0)
+      {
+        WorkExpr iterMinus;
+        iterMinus.kind = WorkExpr::ADD;
+        iterMinus.ops.push_back(iter);
+        iterMinus.ops.push_back(WorkExpr{WorkExpr::CONST, -(int64_t)(j - 1), 0, {}});
+        fallingFactorial.ops.push_back(iterMinus);
+        factorial *= j;
+        WorkExpr binomial;
+        binomial.kind = WorkExpr::UDIV;
+        binomial.ops.push_back(fallingFactorial);
+        binomial.ops.push_back(WorkExpr{WorkExpr::CONST, (int64_t)factorial, 0, {}});
+        term.ops.push_back(binomial);
+      }
+      expr.ops.push_back(term);
+    }
+    return true;
+  }
+  if (const SCEVNAryExpr *nary = dyn_cast<SCEVNAryExpr>(S))
+  {
+    switch (nary->getSCEVType())
+    {
+      case scAddExpr:  expr.kind = WorkExpr::ADD; break;
+      case scMulExpr:  expr.kind = WorkExpr::MUL; break;
+      case scSMaxExpr: expr.kind = WorkExpr::SMAX; break;
+      case scUMaxExpr: expr.kind = WorkExpr::UMAX; break;
+      case scSMinExpr: expr.kind = WorkExpr::SMIN; break;
+      case scUMinExpr: expr.kind = WorkExpr::UMIN; break;
+      default: return false;
+    }
+    expr.ops.resize(nary->getNumOperands());
+    for (unsigned i = 0; i < nary->getNumOperands(); i++)
+    {
+      if (!translate(nary->getOperand(i), state, expr.ops[i])) return false;
+    }
+    return true;
+  }
+  return false;
+}
+
+int
+CheckpointTiling::getLoopIV(const Loop *L, CloneState &state)
+{
+  auto iter = state.loopIVs.find(L);
+  if (iter != state.loopIVs.end()) return iter->second;
+  state.loopIVs[L] = -1;  // also stops the recursion through the start value
+
+  const BasicBlock *originalHeader = state.originalBBs.at(L->getHeader());
+  for (auto &headerLoad : state.headerLoads)
+  {
+    if (headerLoad.first->getParent() != originalHeader || !headerLoad.second) continue;
+    const SCEVAddRecExpr *rec = dyn_cast<SCEVAddRecExpr>(state.SE.getSCEV(headerLoad.second));
+    if (!rec || rec->getLoop() != L || !rec->isAffine()) continue;
+    const SCEVConstant *step = dyn_cast<SCEVConstant>(rec->getStepRecurrence(state.SE));
+    if (!step || step->getValue()->isZero() || step->getAPInt().getMinSignedBits() > 64) continue;
+    LoopIV loopIV;
+    if (!translate(rec->getStart(), state, loopIV.start)) continue;
+    loopIV.headerLoad = headerLoad.first;
+    loopIV.step = step->getAPInt().getSExtValue();
+    LoopIVs.push_back(loopIV);
+    state.loopIVs[L] = LoopIVs.size() - 1;
+    return LoopIVs.size() - 1;
+  }
+  return -1;
+}
+
+Value *
+CheckpointTiling::createWorkExpr(const WorkExpr &expr, IRBuilder<> &builder) const
+{
+  Type *int64Ty = builder.getInt64Ty();
+  switch (expr.kind)
+  {
+    case WorkExpr::CONST:
+      return builder.getInt64(expr.constVal);
+    case WorkExpr::ARG:
+      return builder.CreateSExtOrTrunc(Func->arg_begin() + expr.index, int64Ty);
+    case WorkExpr::LOOP_ITER:
+    {
+      // iteration number k = (counter - start) / step
+      const LoopIV &loopIV = LoopIVs[expr.index];
+      assert(loopIV.headerLoad && "loop counter was removed!");
+      Value *counter = builder.CreateSExtOrTrunc(loopIV.headerLoad, int64Ty);
+      Value *offset = builder.CreateSub(counter, createWorkExpr(loopIV.start, builder));
+      return builder.CreateSDiv(offset, builder.getInt64(loopIV.step), "ckpt_tile_iter");
+    }
+    case WorkExpr::UDIV:
+      return builder.CreateUDiv(createWorkExpr(expr.ops[0], builder), createWorkExpr(expr.ops[1], builder));
+    default:
+      break;
+  }
+  Value *result = createWorkExpr(expr.ops[0], builder);
+  for (unsigned i = 1; i < expr.ops.size(); i++)
+  {
+    Value *op = createWorkExpr(expr.ops[i], builder);
+    switch (expr.kind)
+    {
+      case WorkExpr::ADD:  result = builder.CreateAdd(result, op); break;
+      case WorkExpr::MUL:  result = builder.CreateMul(result, op); break;
+      case WorkExpr::SMAX: result = builder.CreateSelect(builder.CreateICmpSGT(result, op), result, op); break;
+      case WorkExpr::UMAX: result = builder.CreateSelect(builder.CreateICmpUGT(result, op), result, op); break;
+      case WorkExpr::SMIN: result = builder.CreateSelect(builder.CreateICmpSLT(result, op), result, op); break;
+      case WorkExpr::UMIN: result = builder.CreateSelect(builder.CreateICmpULT(result, op), result, op); break;
+      default: break;
+    }
+  }
+  return result;
+}
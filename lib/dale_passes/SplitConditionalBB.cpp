@@ -3,6 +3,8 @@
  * First half will contain all computation before the conditional branch.
  * Second half will the icmp/fcmp and conditional br instructions.
  * Do not consider entry blocks.
+ * Also splits struct allocas that are only accessed through their fields into
+ * one alloca per field.
  *
  * To Run:
  * $ opt -enable-new-pm=0 -load /path/to/build/lib/libSplitConditionalBB.so `\`
@@ -12,6 +14,7 @@
 #include "dale_passes/SplitConditionalBB.h"
 #include "llvm/IR/Metadata.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/Constants.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/ADT/DepthFirstIterator.h"
 #include "llvm/Analysis/LoopInfo.h"
@@ -57,7 +60,8 @@ bool SplitConditionalBB::runOnFunction(Function &F)
   
   std::cout << "SplitConditionalBB Pass printout" << std::endl;
   std::cout << "Transforming function '" << JsonHelper::getOpName(&F, F.getParent()) << "':\n";
-  bool isModified = splitCondiBranchBBs(&F);
+  bool isModified = splitStructAllocas(&F);
+  isModified |= splitCondiBranchBBs(&F);
   return isModified;
 }
 
@@ -100,7 +104,8 @@ SplitConditionalBB::splitCondiBranchBBs(Function *F)
     BasicBlock* BB = originalFuncBBs[i];
     std::cout<<"##"<<JsonHelper::getOpName(BB, M)<<"\n";
     Instruction *terminator_instr = BB->getTerminator();
-    std::cout<<"  Terminator="<<JsonHelper::getOpName(dyn_cast<Value>(terminator_instr), M)<<std::endl;
+    // terminators are unnamed, and naming one would re-number the whole function
+    std::cout<<"  Terminator="<<terminator_instr->getOpcodeName()<<std::endl;
     Instruction *boundaryInst = nullptr;
     if (BB->getTerminator()->getNumSuccessors() > 1)
     {
@@ -141,6 +146,84 @@ SplitConditionalBB::splitCondiBranchBBs(Function *F)
   return isModified;
 }
 
+bool
+SplitConditionalBB::hasOnlyFieldUses(const AllocaInst *alloca) const
+{
+  for (const User *user : alloca->users())
+  {
+    const GetElementPtrInst *gep = dyn_cast<GetElementPtrInst>(user);
+    if (!gep || gep->getPointerOperand() != alloca || gep->getSourceElementType() != alloca->getAllocatedType()) return false;
+    if (gep->getNumIndices() < 2) return false;
+    const ConstantInt *first = dyn_cast<ConstantInt>(gep->getOperand(1));
+    if (!first || !first->isZero() || !isa<ConstantInt>(gep->getOperand(2))) return false;
+  }
+  return true;
+}
+
+bool
+SplitConditionalBB::splitStructAllocas(Function *F)
+{
+  bool isModified = false;
+  Module *M = F->getParent();
+  LLVMContext &context = F->getContext();
+
+  std::vector<AllocaInst *> worklist;
+  for (Instruction &I : F->getEntryBlock())
+  {
+    if (AllocaInst *alloca = dyn_cast<AllocaInst>(&I)) worklist.push_back(alloca);
+  }
+
+  while (!worklist.empty())
+  {
+    AllocaInst *alloca = worklist.back();
+    worklist.pop_back();
+    StructType *structType = dyn_cast<StructType>(alloca->getAllocatedType());
+    if (!structType || alloca->isArrayAllocation()) continue;
+    std::string structName = JsonHelper::getOpName(alloca, M).erase(0,1);
+    if (!hasOnlyFieldUses(alloca))
+    {
+      std::cout << "WARNING: struct '" << structName << "' is not only accessed through its fields; not split." << std::endl;
+      continue;
+    }
+
+    std::vector<AllocaInst *> fields;
+    MDNode *fieldMD = MDNode::get(context, MDString::get(context, structName));
+    for (unsigned i = 0; i < structType->getNumElements(); i++)
+    {
+      AllocaInst *field = new AllocaInst(structType->getElementType(i), alloca->getType()->getAddressSpace(),
+                                         structName + ".f" + std::to_string(i), alloca);
+      field->setMetadata(STRUCT_FIELD_MD_NAME, fieldMD);
+      fields.push_back(field);
+      worklist.push_back(field);
+    }
+
+    // (0, field, rest...) on the struct is (0, rest...) on the field
+    std::vector<User *> users(alloca->user_begin(), alloca->user_end());
+    for (User *user : users)
+    {
+      GetElementPtrInst *gep = cast<GetElementPtrInst>(user);
+      AllocaInst *field = fields[cast<ConstantInt>(gep->getOperand(2))->getZExtValue()];
+      Value *fieldPtr = field;
+      if (gep->getNumIndices() > 2)
+      {
+        std::vector<Value *> indices;
+        indices.push_back(gep->getOperand(1));
+        indices.insert(indices.end(), gep->idx_begin() + 2, gep->idx_end());
+        GetElementPtrInst *fieldGEP = GetElementPtrInst::Create(field->getAllocatedType(), field, indices, "", gep);
+        fieldGEP->setIsInBounds(gep->isInBounds());
+        fieldGEP->takeName(gep);
+        fieldPtr = fieldGEP;
+      }
+      gep->replaceAllUsesWith(fieldPtr);
+      gep->eraseFromParent();
+    }
+    alloca->eraseFromParent();
+    std::cout << "Split struct '" << structName << "' into " << fields.size() << " field(s)" << std::endl;
+    isModified = true;
+  }
+  return isModified;
+}
+
 std::vector<BasicBlock *>
 SplitConditionalBB::getBBsInFunction(Function *F) const
 {
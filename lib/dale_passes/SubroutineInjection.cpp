@@ -10,11 +10,15 @@
  */
 
 #include "dale_passes/SubroutineInjection.h"
+#include "dale_passes/SplitConditionalBB.h"
 #include "llvm/IR/Metadata.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/Analysis/CFG.h"
 #include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/MapVector.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
 
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/IR/IRBuilder.h"
@@ -23,9 +27,20 @@
 
 #include "llvm/IR/Dominators.h" // test
 #include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
+#include "llvm/Transforms/Utils/CodeExtractor.h"
 #include "llvm/IR/Instruction.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Operator.h"
 
 #include "json/JsonHelper.h"
+#include "ckpt_runtime/CkptHeader.h"
+#include "ckpt_runtime/CkptCopy.h"
+#include "ckpt_runtime/CkptTeam.h"
+#include "ckpt_runtime/CkptUndoLog.h"
+#include "ckpt_runtime/CkptIncremental.h"
+#include "ckpt_runtime/CkptLossy.h"
+#include "ckpt_runtime/CkptDescriptor.h"
 
 #include <asm-generic/errno.h>
 #include <cstddef>
@@ -38,6 +53,17 @@
 #define DEBUG_TYPE "module-transformation-pass"
 
 #define SEGMENT_PTR_NAME "ckpt_mem"
+#define EPOCH_ARG_NAME "ckpt_epoch"
+#define TEAM_THREAD_ARG_NAME "ckpt_thread"
+#define TEAM_NUM_THREADS_ARG_NAME "ckpt_nthreads"
+#define REGION_DIRECTIVE_NAME "checkpoint_region"
+#define EXCLUDE_DIRECTIVE_NAME "checkpoint_exclude"
+#define UNDO_LOG_DIRECTIVE_NAME "checkpoint_undo_log"
+#define LOSSY_DIRECTIVE_NAME "checkpoint_lossy"
+#define UNDO_LOG_MIN_ARRAY_TO_LOG_RATIO 4  // -ckpt-undo-log-entries only applies to arrays at least 4x as large as their log
+
+#define HOT_BRANCH_WEIGHT 2000  // branch weight of the compute path at checkpoint branches
+#define COLD_BRANCH_WEIGHT 1    // branch weight of saves and restores
 
 #define SAVE_ONLY "save"
 #define RESTORE_ONLY "restore"
@@ -49,6 +75,30 @@ static cl::opt<std::string> InjectionOption("inject", cl::desc("Specify subrouti
 
 static cl::opt<bool> TrackIndexOption("trackingIndex", cl::desc("activate tracking indexes optimization"), cl::value_desc("optimization"));
 
+static cl::opt<bool> CkptHeaderOption("ckpt-header", cl::desc("keep heartbeat, ckpt id and isComplete as int32s in a cache-line header of ckpt_mem (see ckpt_runtime/CkptHeader.h)"));
+
+static cl::opt<bool> CkptOnDemandOption("ckpt-on-demand", cl::desc("only save at checkpoints when the host sets the save request flag in the ckpt_mem header (needs -ckpt-header)"));
+
+static cl::opt<bool> CkptAdaptiveOption("ckpt-adaptive", cl::desc("only save at checkpoints when the ckpt_runtime interval controller says a save is due (see ckpt_runtime/CkptInterval.h)"));
+
+static cl::opt<bool> CkptOutlineColdOption("ckpt-outline-cold", cl::desc("move restoreBBs (and saveBBs that are only taken when a save is due) into cold functions"));
+
+static cl::opt<unsigned> CkptUndoLogEntriesOption("ckpt-undo-log-entries", cl::desc("roll arrays passed to the kernel back with an undo log of this many entries instead of saving them, if the log is at most a quarter of the array (see ckpt_runtime/CkptUndoLog.h)"), cl::init(0));
+
+static cl::opt<unsigned> CkptIncrementalChunkBytesOption("ckpt-incremental-chunk-bytes", cl::desc("save arrays passed to the kernel incrementally in chunks of this many bytes (rounded up to a multiple of 8), a few chunks per checkpoint site, instead of copying them whole at each save (needs -ckpt-header; see ckpt_runtime/CkptIncremental.h)"), cl::init(0));
+
+static cl::opt<unsigned> CkptIncrementalChunksPerSiteOption("ckpt-incremental-chunks-per-site", cl::desc("max #chunks an incremental save copies at each checkpoint site (the runtime's CKPT_INCR_CHUNKS_PER_SITE overrides it)"), cl::init(8));
+
+static cl::opt<bool> CkptRuntimeOption("ckpt-runtime", cl::desc("use the ckpt_runtime SIMD copy kernels (libCkptRuntime) for array saves/restores"));
+
+static cl::opt<bool> CkptDescriptorTableOption("ckpt-descriptor-table", cl::desc("save/restore the values of each checkpoint with one call to a shared routine walking a constant descriptor table (see ckpt_runtime/CkptDescriptor.h), instead of inline instructions per value"));
+
+static cl::opt<unsigned> CkptDedupChunkBytesOption("ckpt-dedup-chunk-bytes", cl::desc("with -ckpt-runtime, hash the arrays in chunks of this many bytes at each save, and only copy the chunks whose hash changed since the last save of the same checkpoint (see ckpt_copy_dedup in ckpt_runtime/CkptCopy.h)"), cl::init(0));
+
+static cl::opt<bool> CkptRestoreInPlaceOption("ckpt-restore-in-place", cl::desc("restore scalars kept in entry allocas back into the allocas, instead of into new allocas propagated with phis, so loops after a checkpoint keep plain allocas that mem2reg/SROA, the loop vectorizer and the unroller can handle"));
+
+static cl::opt<unsigned> CkptTileWorkOption("ckpt-tile-work", cl::desc("only save at a checkpoint in a loop once the iterations since the last save did at least this much work (#runs of the bodies of the loop and the loops nested in it, estimated from SCEV trip counts), so saves are evenly spaced when the work per iteration changes"), cl::init(0));
+
 char SubroutineInjection::ID = 0;
 
 // This is the core interface for pass plugins. It guarantees that 'opt' will
@@ -109,13 +159,13 @@ bool SubroutineInjection::runOnModule(Module &M)
   LiveValues::LivenessResult funcBBLiveValsMap = fullLiveValsInfo.first;
   LiveValues::FuncVariableDefMap funcVariableDefMap = fullLiveValsInfo.second;
 
-  for (auto fIter : funcVariableDefMap)
+  for (auto &fIter : funcVariableDefMap)
   {
     /** TODO: is for debugging */
     Function *F = fIter.first;
-    LiveValues::VariableDefMap sizeMap = fIter.second;
+    const LiveValues::VariableDefMap &sizeMap = fIter.second;
     std::cout<<"INI SIZE ANALYSIS RESULTS FOR FUNC "<<JsonHelper::getOpName(F, &M)<<" :"<<std::endl;
-    for (auto vIter : sizeMap)
+    for (auto &vIter : sizeMap)
     {
       Value * val = const_cast<Value*>(vIter.first);
       int size = vIter.second;
@@ -221,16 +271,40 @@ SubroutineInjection::injectSubroutines(
   //Function* func_mem_cpy_custom_f = M.getFunction("mem_cpy_custom_f");
   Function* func_mem_cpy_wrapper_f = M.getFunction("cpy_wrapper_f");
   
+  // ckpt_runtime copy kernels; are declared in the module only if used
+  Function* func_ckpt_copy = nullptr;
+  Function* func_ckpt_copy_stream = nullptr;
+  Function* func_ckpt_copy_dedup = nullptr;
+  if(CkptRuntimeOption){
+    std::cout << "Using ckpt_runtime copy kernels for array saves/restores." << std::endl;
+    func_ckpt_copy = getCkptRuntimeFunc(M, "ckpt_copy", false);
+    func_ckpt_copy_stream = getCkptRuntimeFunc(M, "ckpt_copy_stream", false);
+    if(TrackIndexOption){
+      // ckpt_copy_index32 has the same interface as mem_cpy_index_f
+      func_mem_cpy_index_f = getCkptRuntimeFunc(M, "ckpt_copy_index32", true);
+    }
+    if(CkptDedupChunkBytesOption > 0){
+      Type *bytePtrTy = Type::getInt8PtrTy(M.getContext());
+      Type *int64Ty = Type::getInt64Ty(M.getContext());
+      func_ckpt_copy_dedup = getCkptRuntimeFunc(M, "ckpt_copy_dedup",
+                                                FunctionType::get(int64Ty, {bytePtrTy, bytePtrTy, int64Ty, int64Ty, int64Ty->getPointerTo(),
+                                                                            Type::getInt32Ty(M.getContext())}, false));
+    }
+  }
+  else if(CkptDedupChunkBytesOption > 0){
+    std::cout << "WARNING: -ckpt-dedup-chunk-bytes needs -ckpt-runtime; saving whole arrays." << std::endl;
+  }
+
   if(func_mem_cpy_index_f == NULL){
     std::cout << "External mem_cpy_index function CANNOT be found. Disable index tracking optimization." << std::endl;
     TrackIndexOption = false;
   }
 
-  if(func_mem_cpy_wrapper_f == NULL){
-    std::cout << "External mem_cpy_wrapper function CANNOT be found. Disable index tracking optimization." << std::endl;
+  if(func_mem_cpy_wrapper_f == NULL && !CkptRuntimeOption){
+    std::cout << "External mem_cpy_wrapper function CANNOT be found. Use memcpy for array saves." << std::endl;
   }
   
-  if(TrackIndexOption){
+  if(TrackIndexOption && !CkptRuntimeOption){
     #ifndef LLVM14_VER
       func_mem_cpy_index_f->addAttribute(AttributeList::FunctionIndex, Attribute::NoInline);
     #else
@@ -238,11 +312,27 @@ SubroutineInjection::injectSubroutines(
     #endif
   }
 
-  if(func_mem_cpy_wrapper_f != NULL)
-    func_mem_cpy_wrapper_f->addAttribute(AttributeList::FunctionIndex, Attribute::NoInline);
+  if(func_mem_cpy_wrapper_f != NULL){
+    #ifndef LLVM14_VER
+      func_mem_cpy_wrapper_f->addAttribute(AttributeList::FunctionIndex, Attribute::NoInline);
+    #else
+      func_mem_cpy_wrapper_f->addFnAttr(Attribute::NoInline);
+    #endif
+  }
   
+  if(CkptOnDemandOption && !CkptHeaderOption){
+    std::cout << "WARNING: -ckpt-on-demand needs -ckpt-header; saving at every checkpoint." << std::endl;
+    CkptOnDemandOption = false;
+  }
+  if(CkptOnDemandOption && CkptAdaptiveOption){
+    std::cout << "WARNING: -ckpt-on-demand and -ckpt-adaptive are exclusive; using -ckpt-on-demand." << std::endl;
+    CkptAdaptiveOption = false;
+  }
+
   bool isModified = false;
   const DataLayout &DL = M.getDataLayout();
+  // saveBBs and restoreBBs to move into cold functions once all functions are done (-ckpt-outline-cold)
+  std::vector<BasicBlock *> coldBBs;
   for (auto &F : M.getFunctionList())
   {
     // init map to store size #bytes required for each checkpoint
@@ -261,8 +351,12 @@ SubroutineInjection::injectSubroutines(
       continue;
     }
 
-    LiveValues::BBTrackedVals bbTrackedVals = funcBBTrackedValsMap.at(&F);
-    LiveValues::VariableDefMap liveValDefMap = funcVariableDefMap.at(&F);
+    const LiveValues::BBTrackedVals &bbTrackedVals = funcBBTrackedValsMap.at(&F);
+    const LiveValues::VariableDefMap &liveValDefMap = funcVariableDefMap.at(&F);
+    // store addresses are re-indexed for each function, and pointer provenance looked up again
+    StoredValsFunc = nullptr;
+    PointerArgHolders.clear();
+    TrackedPointerObjects.clear();
 
     // re-calculate variableDefMap for func (could include alloca-ed vals that are not part of live-in/out sets)
     LiveValues::VariableDefMap valDefMap;
@@ -297,6 +391,25 @@ SubroutineInjection::injectSubroutines(
       continue;
     }
 
+    // get Value* to (optional) epoch token of this invocation; is checked against the epoch of the saved ckpt
+    Value *ckptEpoch = getSelectedFuncParam(funcParams, EPOCH_ARG_NAME, &M);
+    if (ckptEpoch && (!CkptHeaderOption || !ckptEpoch->getType()->isIntegerTy()))
+    {
+      std::cout << "WARNING: '" << EPOCH_ARG_NAME << "' must be an int and needs -ckpt-header; ignoring epoch." << std::endl;
+      ckptEpoch = nullptr;
+    }
+
+    // get Value*s to (optional) thread id and thread count of a team (multithreaded) kernel
+    Value *teamThread = getSelectedFuncParam(funcParams, TEAM_THREAD_ARG_NAME, &M);
+    Value *teamNumThreads = getSelectedFuncParam(funcParams, TEAM_NUM_THREADS_ARG_NAME, &M);
+    bool isTeamKernel = teamThread && teamNumThreads && teamThread->getType()->isIntegerTy()
+                        && teamNumThreads->getType()->isIntegerTy() && CkptHeaderOption;
+    if ((teamThread || teamNumThreads) && !isTeamKernel)
+    {
+      std::cout << "WARNING: '" << TEAM_THREAD_ARG_NAME << "' and '" << TEAM_NUM_THREADS_ARG_NAME
+                << "' must both be ints and need -ckpt-header; checkpointing as a single-threaded kernel." << std::endl;
+    }
+
     // get memory segment contained type
     Type *memSegPtrType = ckptMemSegment->getType();
     Type *ckptMemSegContainedType = ckptMemSegment->getType()->getContainedType(0); // %ckpt_mem should be <primitive>** type.
@@ -321,15 +434,31 @@ SubroutineInjection::injectSubroutines(
     = 0: get candidate checkpoint BBs
     ============================================================================= */
     LiveValues::BBTrackedVals filteredBBTrackedVals = getBBsWithOneSuccessor(bbTrackedVals);
+    // user directives: saved regions of arrays, and scratch buffers that need not be saved
+    CheckpointRegionMap ckptRegions;
+    std::set<Value *> excludedVals;
+    UndoLogEntriesMap undoLogEntries;
+    LossyErrorMap lossyErrors;
+    getCheckpointRegionDirectives(F, ckptRegions, excludedVals, undoLogEntries, lossyErrors);
     std::set<Value *> ignoredVals;
     ignoredVals.insert(ckptMemSegment);
+    ignoredVals.insert(excludedVals.begin(), excludedVals.end());
+    if (ckptEpoch) ignoredVals.insert(ckptEpoch);
+    if (teamThread) ignoredVals.insert(teamThread);
+    if (teamNumThreads) ignoredVals.insert(teamNumThreads);
     ignoredVals.insert(constFuncParams.begin(), constFuncParams.end());
+    // struct fields that are only set on entry are set again by the entry of a restoring run
+    std::set<Value *> entryInitFields = getStructFieldsInitializedOnEntry(F, entryBB);
+    ignoredVals.insert(entryInitFields.begin(), entryInitFields.end());
     filteredBBTrackedVals = removeSelectedTrackedVals(filteredBBTrackedVals, ignoredVals);
     filteredBBTrackedVals = removeMatchedNestedPtrVals(filteredBBTrackedVals, segmentName);
     filteredBBTrackedVals = removeBBsWithNoTrackedVals(filteredBBTrackedVals);
     CheckpointBBMap bbCheckpoints = chooseBBWithCheckpointDirective(filteredBBTrackedVals, &F);
-    // original tracked vals as key, updated tracked vals as value:
-    CheckpointBBOldNewValsMap bbCheckpointsOldNewVals = initBBCheckpointsOldNewVals(bbCheckpoints);
+    addArraysOfTrackedPointers(bbCheckpoints, ignoredVals);
+    // tracks <original tracked val, updated tracked val> pairs for each ckpt, and
+    // all the versions of tracked vals ever used during propagation
+    ValueVersionTracker valVersionTracker;
+    initValueVersionTracker(bbCheckpoints, valVersionTracker);
     
     // testing:
     std::cout<<"\n\n==========================="<<std::endl;
@@ -351,6 +480,106 @@ SubroutineInjection::injectSubroutines(
       std::cout << "WARNING: Could not find any valid BBs with checkpoint directive in function '" << funcName << std::endl;
       continue;
     }
+
+    // arrays passed to the kernel that are rolled back by an undo log instead of being saved
+    std::vector<UndoLog> undoLogs;
+    if (!undoLogEntries.empty() || CkptUndoLogEntriesOption > 0)
+    {
+      if (InjectionOption != SAVE_RESTORE || isTeamKernel || TrackIndexOption)
+      {
+        std::cout << "WARNING: Undo logs need -inject=" << SAVE_RESTORE << ", and are not supported for team kernels or with -trackingIndex; saving whole arrays." << std::endl;
+      }
+      else
+      {
+        undoLogs = getUndoLogArrays(F, bbCheckpoints, undoLogEntries, valDefMap, valVersionTracker);
+      }
+    }
+    // arrays passed to the kernel that are copied a few chunks per checkpoint site instead of at each save
+    std::vector<IncrementalArray> incrementalArrays;
+    if (CkptIncrementalChunkBytesOption > 0)
+    {
+      if (InjectionOption != SAVE_RESTORE || !CkptHeaderOption || isTeamKernel || TrackIndexOption || !undoLogs.empty()
+          || CkptOnDemandOption || CkptAdaptiveOption)
+      {
+        std::cout << "WARNING: Incremental saves need -inject=" << SAVE_RESTORE << " and -ckpt-header, and are not supported for team kernels, "
+                  << "with -trackingIndex, -ckpt-on-demand, -ckpt-adaptive or undo logs; saving whole arrays." << std::endl;
+      }
+      else
+      {
+        incrementalArrays = getIncrementalArrays(F, bbCheckpoints, valDefMap, valVersionTracker);
+      }
+    }
+    // arrays saved with ckpt_copy_dedup, which only copies the chunks whose hash changed
+    bool isDedupSave = func_ckpt_copy_dedup != nullptr && (InjectionOption == SAVE_ONLY || InjectionOption == SAVE_RESTORE);
+    if (isDedupSave && (isTeamKernel || !incrementalArrays.empty()))
+    {
+      std::cout << "WARNING: -ckpt-dedup-chunk-bytes is not supported for team kernels or with incremental saves; copying whole arrays." << std::endl;
+      isDedupSave = false;
+    }
+    // arrays declared with checkpoint_lossy are encoded by saves and decoded by restores
+    Function *func_ckpt_lossy_encode = nullptr;
+    Function *func_ckpt_lossy_decode = nullptr;
+    if (!lossyErrors.empty())
+    {
+      Type *elemTy = ckptMemSegment->getType()->getContainedType(0);
+      if (isTeamKernel || TrackIndexOption || !(elemTy->isFloatTy() || elemTy->isDoubleTy()))
+      {
+        std::cout << "WARNING: " << LOSSY_DIRECTIVE_NAME << " needs a float or double " << SEGMENT_PTR_NAME
+                  << ", and is not supported for team kernels or with -trackingIndex; saving arrays losslessly." << std::endl;
+        lossyErrors.clear();
+      }
+      else
+      {
+        std::string suffix = elemTy->isFloatTy() ? "_f32" : "_f64";
+        Type *bytePtrTy = Type::getInt8PtrTy(context);
+        Type *int64Ty = Type::getInt64Ty(context);
+        func_ckpt_lossy_encode = getCkptRuntimeFunc(M, "ckpt_lossy_encode" + suffix,
+                                                    FunctionType::get(int64Ty, {bytePtrTy, elemTy->getPointerTo(), int64Ty, Type::getDoubleTy(context)}, false));
+        func_ckpt_lossy_decode = getCkptRuntimeFunc(M, "ckpt_lossy_decode" + suffix,
+                                                    FunctionType::get(Type::getVoidTy(context), {elemTy->getPointerTo(), bytePtrTy}, false));
+      }
+    }
+    // work per iteration of the loop around each checkpoint, to save once per tile of iterations (before the CFG is changed)
+    CheckpointTiling ckptTiling;
+    if (CkptTileWorkOption > 0)
+    {
+      if (InjectionOption == RESTORE_ONLY || isTeamKernel || CkptOnDemandOption || CkptAdaptiveOption || !incrementalArrays.empty())
+      {
+        std::cout << "WARNING: -ckpt-tile-work needs saves, and is not supported for team kernels or with -ckpt-on-demand, "
+                  << "-ckpt-adaptive or incremental saves; saving at every checkpoint." << std::endl;
+      }
+      else
+      {
+        std::vector<const BasicBlock *> checkpointBBs;
+        for (auto &iter : bbCheckpoints) checkpointBBs.push_back(iter.first);
+        ckptTiling.analyze(F, checkpointBBs);
+      }
+    }
+    // values of each checkpoint are saved/restored by ckpt_desc_save/ckpt_desc_restore, through a spill area in the entry block
+    AllocaInst *descSpill = nullptr;
+    std::map<const Value *, unsigned> descSpillFields;
+    Function *func_ckpt_desc_save = nullptr;
+    Function *func_ckpt_desc_restore = nullptr;
+    if (CkptDescriptorTableOption)
+    {
+      if (isTeamKernel || TrackIndexOption)
+      {
+        std::cout << "WARNING: Descriptor tables are not supported for team kernels or with -trackingIndex; saving values inline." << std::endl;
+      }
+      else
+      {
+        Type *bytePtrTy = Type::getInt8PtrTy(context);
+        FunctionType *descFuncTy = FunctionType::get(Type::getVoidTy(context), {bytePtrTy, bytePtrTy, Type::getInt32Ty(context), bytePtrTy}, false);
+        func_ckpt_desc_save = getCkptRuntimeFunc(M, "ckpt_desc_save", descFuncTy);
+        func_ckpt_desc_restore = getCkptRuntimeFunc(M, "ckpt_desc_restore", descFuncTy);
+        // one field per tracked value, at the same index in every checkpoint
+        std::set<const Value *> allTrackedVals;
+        for (auto &iter : bbCheckpoints) allTrackedVals.insert(iter.second.begin(), iter.second.end());
+        assert(allTrackedVals.size() <= std::numeric_limits<uint16_t>::max() && "too many values for the spill area!");
+        Type *spillTy = ArrayType::get(Type::getInt64Ty(context), std::max<size_t>(allTrackedVals.size(), 1));
+        descSpill = new AllocaInst(spillTy, 0, "ckpt_spill", &*entryBB->getFirstInsertionPt());
+      }
+    }
     int currMinValsCount = bbCheckpoints.begin()->second.size();
     std::cout<< "#currNumOfTrackedVals=" << currMinValsCount << "\n";
 
@@ -390,19 +619,161 @@ SubroutineInjection::injectSubroutines(
     // store subroutine BBs for each checkpoint
     std::map<BasicBlock *, CheckpointTopo> checkpointBBTopoMap;
 
-    // store live-out data for all saveBBs, restoreBBs and junctionBBs in current function.
-    std::map<BasicBlock *, std::set<const Value *>> funcSaveBBsLiveOutMap;
-    std::map<BasicBlock *, std::set<const Value *>> funcRestoreBBsLiveOutMap;
-    std::map<BasicBlock *, std::set<const Value *>> funcJunctionBBsLiveOutMap;
+    // store map<original trackedVal, junctionBB phis for that val>; in order of creation.
+    MapVector<Value *, std::vector<PHINode *>> restoredValJunctionPhisMap;
+
+    // name tracked vals once per function; unnamed vals would otherwise re-number
+    // the whole function every time they are printed.
+    ModuleSlotTracker MST(&M);
+    MST.incorporateFunction(F);
+    std::map<const Value *, std::string> trackedValNames;
+    for (auto &iter : bbCheckpoints)
+    {
+      for (const Value *val : iter.second)
+      {
+        if (!trackedValNames.count(val)) trackedValNames[val] = JsonHelper::getOpName(val, MST).erase(0,1);
+      }
+    }
+
+    // undo logs take the slots before the saved values, so they stay at the same place for every checkpoint
+    int valuesStartSlot = getValuesStartSlot(ckptMemSegContainedTypeSize);
+    int undoLogBytes = 0;
+    std::set<const Value *> undoLogHolders;
+    Function *func_ckpt_undo_log_full = nullptr;
+    Function *func_ckpt_undo_log_rollback = nullptr;
+    if (!undoLogs.empty())
+    {
+      Type *bytePtrTy = Type::getInt8PtrTy(context);
+      FunctionType *undoLogFuncTy = FunctionType::get(Type::getVoidTy(context), {bytePtrTy, bytePtrTy}, false);
+      func_ckpt_undo_log_full = getCkptRuntimeFunc(M, "ckpt_undo_log_full", undoLogFuncTy);
+      func_ckpt_undo_log_rollback = getCkptRuntimeFunc(M, "ckpt_undo_log_rollback", undoLogFuncTy);
+      // the log holds a snapshot of the whole array: slots are counted in 64 bits
+      int64_t slot = valuesStartSlot;
+      builder.SetInsertPoint(entryBB->getTerminator());
+      for (UndoLog &undoLog : undoLogs)
+      {
+        // the log is made of int64s
+        while ((slot * ckptMemSegContainedTypeSize) % sizeof(int64_t) != 0) slot++;
+        std::string holderName = JsonHelper::getOpName(undoLog.holder, &M).erase(0,1);
+        Value *elemPtrLog = builder.CreateInBoundsGEP(ckptMemSegContainedType, ckptMemSegment, builder.getInt64(slot));
+        undoLog.slot = slot;
+        undoLog.logPtr = builder.CreatePointerCast(elemPtrLog, builder.getInt64Ty()->getPointerTo(), "undo_log_"+holderName);
+        uint64_t logBytes = ckpt_undo_log_bytes(undoLog.capacity, undoLog.arrayBytes);
+        slot += divideCeil(logBytes, ckptMemSegContainedTypeSize);
+        undoLogHolders.insert(undoLog.holder);
+        std::cout << "Undo log for '" << holderName << "': " << undoLog.capacity << " entries, " << undoLog.stores.size()
+                  << " store(s) logged; saves no longer copy its " << undoLog.arrayBytes << " bytes (the log takes "
+                  << logBytes << " bytes of ckpt_mem)" << std::endl;
+      }
+      undoLogBytes = (slot - valuesStartSlot) * ckptMemSegContainedTypeSize;
+      valuesStartSlot = slot;
+    }
+
+    // the session of incremental saves goes before the values too; the backup of the values follows the values of all checkpoints
+    int incrementalBytes = 0;
+    int valuesEndSlot = valuesStartSlot;
+    Value *incrSession = nullptr;
+    CallInst *incrInitCall = nullptr;
+    std::set<const Value *> incrementalHolders;
+    Function *func_ckpt_incr_restore = nullptr;
+    if (!incrementalArrays.empty())
+    {
+      Type *bytePtrTy = Type::getInt8PtrTy(context);
+      Type *int32Ty = Type::getInt32Ty(context);
+      Type *int64Ty = Type::getInt64Ty(context);
+      func_ckpt_incr_restore = getCkptRuntimeFunc(M, "ckpt_incr_restore",
+                                                  FunctionType::get(Type::getVoidTy(context), {bytePtrTy, int32Ty, bytePtrTy}, false));
+      FunctionType *initFuncTy = FunctionType::get(Type::getVoidTy(context), {bytePtrTy, int32Ty, int32Ty, int64Ty, int64Ty, int64Ty}, false);
+      FunctionType *attachFuncTy = FunctionType::get(Type::getVoidTy(context), {bytePtrTy, int32Ty, bytePtrTy, int64Ty, int64Ty, int64Ty}, false);
+      Function *func_ckpt_incr_init = getCkptRuntimeFunc(M, "ckpt_incr_init", initFuncTy);
+      Function *func_ckpt_incr_attach = getCkptRuntimeFunc(M, "ckpt_incr_attach", attachFuncTy);
+      // the state holds two buffers of each array: slots are counted in 64 bits
+      int64_t slot = valuesStartSlot;
+      while ((slot * ckptMemSegContainedTypeSize) % sizeof(int64_t) != 0) slot++;
+      builder.SetInsertPoint(entryBB->getTerminator());
+      Value *elemPtrSession = builder.CreateInBoundsGEP(ckptMemSegContainedType, ckptMemSegment, builder.getInt64(slot));
+      incrSession = builder.CreatePointerCast(elemPtrSession, bytePtrTy, "ckpt_incr_session");
+      // the layout of the values is only known after all checkpoints are populated (set below)
+      Value *initParams[6] = {incrSession, builder.getInt32(incrementalArrays.size()), builder.getInt32(CkptIncrementalChunksPerSiteOption),
+                              builder.getInt64(0), builder.getInt64(0), builder.getInt64(0)};
+      incrInitCall = builder.CreateCall(initFuncTy, func_ckpt_incr_init, initParams);
+      int64_t stateOffset = sizeof(ckpt_incr_session_t);
+      for (unsigned idx = 0; idx < incrementalArrays.size(); idx++)
+      {
+        IncrementalArray &incrArray = incrementalArrays[idx];
+        incrArray.stateOffset = stateOffset;
+        Value *array = builder.CreateLoad(incrArray.holder->getAllocatedType(), incrArray.holder, "incr_array");
+        Value *attachParams[6] = {incrSession, builder.getInt32(idx), builder.CreatePointerCast(array, bytePtrTy),
+                                  builder.getInt64(incrArray.arrayBytes), builder.getInt64(incrArray.chunkBytes), builder.getInt64(stateOffset)};
+        builder.CreateCall(attachFuncTy, func_ckpt_incr_attach, attachParams);
+        int64_t stateBytes = ckpt_incr_array_state_bytes(incrArray.arrayBytes, incrArray.chunkBytes);
+        stateOffset += stateBytes;
+        incrementalHolders.insert(incrArray.holder);
+        std::cout << "Incremental save of '" << JsonHelper::getOpName(incrArray.holder, &M).erase(0,1) << "': "
+                  << ckpt_incr_num_chunks(incrArray.arrayBytes, incrArray.chunkBytes) << " chunk(s) of " << incrArray.chunkBytes << " bytes, "
+                  << incrArray.stores.size() << " store(s) copy before write; saves no longer copy its " << incrArray.arrayBytes
+                  << " bytes (its buffers take " << stateBytes << " bytes of ckpt_mem)" << std::endl;
+      }
+      slot += divideCeil(stateOffset, ckptMemSegContainedTypeSize);
+      incrementalBytes = (slot - valuesStartSlot) * ckptMemSegContainedTypeSize;
+      valuesStartSlot = slot;
+      valuesEndSlot = slot;
+    }
+
+    // the owner word of the dedup hash tables goes before the values too (see CKPT_DEDUP_OWNER_MAGIC)
+    int dedupOwnerBytes = 0;
+    Value *dedupOwner = nullptr;
+    uint64_t dedupLayout = 0;
+    if (isDedupSave)
+    {
+      int slot = valuesStartSlot;
+      while ((slot * ckptMemSegContainedTypeSize) % sizeof(int64_t) != 0) slot++;
+      builder.SetInsertPoint(entryBB->getTerminator());
+      Value *elemPtrOwner = builder.CreateInBoundsGEP(ckptMemSegContainedType, ckptMemSegment, builder.getInt32(slot));
+      dedupOwner = builder.CreatePointerCast(elemPtrOwner, builder.getInt64Ty()->getPointerTo(), "ckpt_dedup_owner");
+      slot += ceil((float)sizeof(int64_t) / (float)ckptMemSegContainedTypeSize);
+      dedupOwnerBytes = (slot - valuesStartSlot) * ckptMemSegContainedTypeSize;
+      valuesStartSlot = slot;
+      valuesEndSlot = slot;
+      std::cout << "Saving the arrays of '" << funcName << "' with ckpt_copy_dedup in chunks of " << CkptDedupChunkBytesOption << " bytes" << std::endl;
+    }
+
+    // team kernels save their arrays collectively at each checkpoint; with index tracking,
+    // each thread would initialise the whole saved array on entry
+    Value *teamThread32 = nullptr;
+    Value *teamNumThreads32 = nullptr;
+    Function *func_ckpt_team_barrier = nullptr;
+    Function *func_ckpt_team_copy = nullptr;
+    if (isTeamKernel)
+    {
+      std::cout << "Checkpointing '" << funcName << "' as a team kernel (see ckpt_runtime/CkptTeam.h)." << std::endl;
+      if (TrackIndexOption) std::cout << "WARNING: Index tracking is not supported for team kernels; saving whole arrays." << std::endl;
+      builder.SetInsertPoint(entryBB->getTerminator());
+      teamThread32 = builder.CreateIntCast(teamThread, Type::getInt32Ty(context), true, "ckpt_thread32");
+      teamNumThreads32 = builder.CreateIntCast(teamNumThreads, Type::getInt32Ty(context), true, "ckpt_nthreads32");
+      Type *bytePtrTy = Type::getInt8PtrTy(context);
+      Type *int32Ty = Type::getInt32Ty(context);
+      func_ckpt_team_barrier = getCkptRuntimeFunc(M, "ckpt_team_barrier",
+                                                  FunctionType::get(Type::getVoidTy(context), {bytePtrTy, int32Ty}, false));
+      func_ckpt_team_copy = getCkptRuntimeFunc(M, "ckpt_team_copy",
+                                               FunctionType::get(Type::getVoidTy(context),
+                                                                 {bytePtrTy, bytePtrTy, Type::getInt64Ty(context), int32Ty, int32Ty},
+                                                                 false));
+    }
 
-    // store map<junctionBB, map<trackedVal, phi>>
-    std::map<BasicBlock *, std::map<Value *, PHINode *>> funcJunctionBBPhiValsMap;
-    // store all the versions of tracked vals ever used during propagation
-    std::map<const Value *, std::set<const Value *>> allTrackedValVersions = initAllTrackedValVersions(bbCheckpoints);
+    if(TrackIndexOption && !isTeamKernel){
+      // index stacks must all exist before stores are instrumented, and stores must
+      // only be instrumented once (not once per checkpoint).
+      for (BasicBlock *checkpointBB : checkpointBBPtrSet)
+      {
+        allocateindexStacks(valVersionTracker.getCurrentVals(checkpointBB), valVersionTracker, valDefMap, liveValDefMap, ckptMemSegment, F, M);
+      }
+      insertIndexTracking(F);
+    }
 
     for (auto bbIter : checkpointBBPtrSet)
     {
-      int ckptSizeBytes = 0;
+      int ckptSizeBytes = undoLogBytes + incrementalBytes + dedupOwnerBytes;
       BasicBlock *checkpointBB = &(*bbIter);
       std::string checkpointBBName = JsonHelper::getOpName(checkpointBB, &M).erase(0,1);
       std::vector<BasicBlock *> checkpointBBSuccessorsList = getBBSuccessors(checkpointBB);
@@ -479,52 +850,92 @@ SubroutineInjection::injectSubroutines(
 	if (InjectionOption == RESTORE_ONLY){
 	  if(instScopeExit != NULL){
 	    instScopeExit->eraseFromParent();
+	    instScopeExit = NULL;
 	  }
 	  if(instScopeEntry != NULL){
 	    instScopeEntry->eraseFromParent();
+	    instScopeEntry = NULL;
 	  }
 	}
 	
-        std::map<const Value*, const Value*> oldNewTrackedVals = bbCheckpointsOldNewVals.at(checkpointBB);
-        auto oldNewTrackedValsSetsPair = getOldNewTrackedValsSets(oldNewTrackedVals);
-        std::set<const Value *> originalTrackedVals = oldNewTrackedValsSetsPair.first;
-        std::set<const Value *> trackedVals = oldNewTrackedValsSetsPair.second;
+        // restored vals are propagated after all checkpoints are added, so the current
+        // version of each tracked val is still the original one here.
+        std::set<const Value *> trackedVals = valVersionTracker.getCurrentVals(checkpointBB);
 
         // sort tracked vals set by val name for consistent access later	
         auto cmp = [&](const Value* a, const Value* b) {
-          std::string aName = JsonHelper::getOpName(a, &M).erase(0,1);
-          std::string bName = JsonHelper::getOpName(b, &M).erase(0,1);
-          return (aName.compare(bName)<0);};
+          return (trackedValNames.at(a).compare(trackedValNames.at(b))<0);};
         std::set<const Value *, decltype(cmp)> trackedValsOrdered(cmp);
 
         for (auto iter : trackedVals){
           Value *trackedVal = const_cast<Value*>(&*iter);
           trackedValsOrdered.insert(trackedVal);
         }
-
-        if(TrackIndexOption){
-          allocateindexStacks(trackedVals, oldNewTrackedVals, allTrackedValVersions, valDefMap, liveValDefMap, ckptMemSegment, F, M);
-          insertIndexTracking(F);
-        }
-      
-        std::set<const Value *> saveBBLiveOutSet;
-        std::set<const Value *> restoreBBLiveOutSet;
-        std::set<const Value *> junctionBBLiveOutSet;
-
-        // stores map<trackedVal, phi> pairings for current junctionBB
-        std::map<Value *, PHINode *> trackedValPhiValMap;
         
-        int valMemSegIndex = VALUES_START; // start index of "slots" for values in memory segment
+        // pointers into an array that another tracked value saves whole are only saved as offsets (3.3.6)
+        std::map<const Value *, const Value *> derivedPtrs = getDerivedPointers(trackedVals);
+
+        int valMemSegIndex = valuesStartSlot; // start index of "slots" for values in memory segment
+        // team kernels: arrays passed to the kernel are saved collectively at valMemSegIndex; all other
+        // values go to the calling thread's sub-segment, at teamSlotS/R + teamPrivateSlot
+        int teamPrivateSlot = 0;
+        Instruction *teamSlotS = nullptr;
+        Instruction *teamSlotR = nullptr;
+        if (isTeamKernel)
+        {
+          if (saveBB) teamSlotS = createTeamSlotBase(teamThread32, saveBB->getTerminator());
+          if (restoreBB) teamSlotR = createTeamSlotBase(teamThread32, restoreBB->getTerminator());
+        }
+        // arrays with an undo log: a save empties the log (before the ckpt id is published), a restore rolls the array back
+        for (const UndoLog &undoLog : undoLogs)
+        {
+          new StoreInst(ConstantInt::get(Type::getInt64Ty(context), 0), undoLog.logPtr, false, saveBB->getTerminator());
+          IRBuilder<> restoreBuilder(restoreBB->getTerminator());
+          Value *array = restoreBuilder.CreateLoad(undoLog.holder->getAllocatedType(), undoLog.holder, "undo_array");
+          Value *callParams[2] = {restoreBuilder.CreatePointerCast(undoLog.logPtr, restoreBuilder.getInt8PtrTy()),
+                                  restoreBuilder.CreatePointerCast(array, restoreBuilder.getInt8PtrTy())};
+          restoreBuilder.CreateCall(func_ckpt_undo_log_rollback->getFunctionType(), func_ckpt_undo_log_rollback, callParams);
+        }
+        // incrementally saved arrays: a restore copies the buffer of the published ckpt back
+        for (unsigned idx = 0; idx < incrementalArrays.size(); idx++)
+        {
+          IRBuilder<> restoreBuilder(restoreBB->getTerminator());
+          Value *array = restoreBuilder.CreateLoad(incrementalArrays[idx].holder->getAllocatedType(), incrementalArrays[idx].holder, "incr_array");
+          Value *callParams[3] = {incrSession, restoreBuilder.getInt32(idx), restoreBuilder.CreatePointerCast(array, restoreBuilder.getInt8PtrTy())};
+          restoreBuilder.CreateCall(func_ckpt_incr_restore->getFunctionType(), func_ckpt_incr_restore, callParams);
+        }
+        // dedup saves only trust the hash tables if the last completed save to this layout was this one; a save
+        // interrupted by a failure leaves the owner cleared
+        Value *dedupHashesValid = nullptr;
+        uint64_t dedupOwnerTag = (CKPT_DEDUP_OWNER_MAGIC << 32) | ++dedupLayout;
+        if (dedupOwner)
+        {
+          IRBuilder<> saveBuilder(saveBB->getTerminator());
+          Value *owner = saveBuilder.CreateLoad(saveBuilder.getInt64Ty(), dedupOwner, "dedup_owner");
+          dedupHashesValid = saveBuilder.CreateZExt(saveBuilder.CreateICmpEQ(owner, saveBuilder.getInt64(dedupOwnerTag)),
+                                                    saveBuilder.getInt32Ty(), "dedup_hashes_valid");
+          saveBuilder.CreateStore(saveBuilder.getInt64(0), dedupOwner);
+        }
+        // values in the descriptor table only store their value (or address) into the spill area before the call
+        DescriptorTable descTable = {nullptr, nullptr, {}};
+        if (descSpill)
+        {
+          if (saveBB) descTable.saveCall = createDescriptorCall(func_ckpt_desc_save, ckptMemSegment, descSpill, saveBB->getTerminator());
+          if (restoreBB) descTable.restoreCall = createDescriptorCall(func_ckpt_desc_restore, ckptMemSegment, descSpill, restoreBB->getTerminator());
+        }
         for (auto iter : trackedValsOrdered)
         {
+          if (derivedPtrs.count(iter)) continue;
           printf("$$ valMemSegIndex = %d\n", valMemSegIndex);
           /*
           --- 3.3.2: Set up vars used for instruction creation
           ----------------------------------------------------------------------------- */
           /** TODO: verify safety of cast to non-const!! this is dangerous*/
           Value *trackedVal = const_cast<Value*>(&*iter); // is the current version of tracked val after previous propagations
-          Value *originalTrackedVal = const_cast<Value*>(findKeyByValueInMap(&*iter, oldNewTrackedVals));
-          std::string valName = JsonHelper::getOpName(trackedVal, &M).erase(0,1);
+          Value *originalTrackedVal = const_cast<Value*>(valVersionTracker.getOriginalOfCurrent(checkpointBB, &*iter));
+          std::string valName = trackedValNames.at(originalTrackedVal);
+          if (undoLogHolders.count(originalTrackedVal)) continue;  // rolled back by its undo log
+          if (incrementalHolders.count(originalTrackedVal)) continue;  // copied by the checkpoint sites after the save
           Type *valRawType = trackedVal->getType();
           bool isPointer = valRawType->isPointerTy();
           Type *containedType = isPointer ? valRawType->getContainedType(0) : valRawType;
@@ -533,8 +944,12 @@ SubroutineInjection::injectSubroutines(
           // init store location (index) in memory segment:
           Value *indexList[1] = {ConstantInt::get(Type::getInt32Ty(context), valMemSegIndex)};
           // init valSize and numOfArrSlotsUsed for case where Value has a "primitive" type
-          int valSizeBytes = liveValDefMap.at(originalTrackedVal);
+          // (arrays added by addArraysOfTrackedPointers are not live-out themselves, and vals only live at
+          // a checkpoint() call are in no live-in/out set; like in the json, their size is unknown (1))
+          int valSizeBytes = liveValDefMap.count(originalTrackedVal) ? liveValDefMap.at(originalTrackedVal)
+                             : (valDefMap.count(originalTrackedVal) ? valDefMap.at(originalTrackedVal) : 1);
           int numOfArrSlotsUsed = 1;
+          int dedupSlotsUsed = 0;  // hash table of a dedup save, after the value's slots
           if (isPointer)
           {         
             if (containedType->isArrayTy())
@@ -546,7 +961,7 @@ SubroutineInjection::injectSubroutines(
             {
               // array is allocated outside the function
               // find value that this trackedVal points to
-              std::set<const Value*> valVersions = allTrackedValVersions.at(originalTrackedVal);
+              const ValueVersionTracker::VersionSet &valVersions = valVersionTracker.getVersions(originalTrackedVal);
               Value *trackedValDeref = getDerefValFromPointer(originalTrackedVal, valVersions, &F);
               // std::cout<<"TRACKED_VAL_DEREF="<<JsonHelper::getOpName(trackedValDeref, &M)<<"("<<trackedValDeref<<")"<<std::endl;
               if (trackedValDeref != nullptr)
@@ -571,12 +986,107 @@ SubroutineInjection::injectSubroutines(
             }
 
           }
+          // only save the region of the array declared with checkpoint_region
+          bool hasRegion = false;
+          uint64_t regionOffsetBytes = 0;
+          auto regionIt = ckptRegions.find(originalTrackedVal);
+          if (regionIt != ckptRegions.end())
+          {
+            const CheckpointRegion &region = regionIt->second;
+            bool isArray = isPointer && (containedType->isArrayTy() || isPointerPointer);
+            if (!isArray || region.numBytes == 0 || region.offsetBytes + region.numBytes > (uint64_t)valSizeBytes)
+            {
+              std::cout << "WARNING: checkpoint region of '" << valName << "' is not within the array; saving the whole value." << std::endl;
+            }
+            else if (TrackIndexOption && isPointerPointer)
+            {
+              std::cout << "WARNING: checkpoint region of '" << valName << "' is ignored with -trackingIndex." << std::endl;
+            }
+            else
+            {
+              hasRegion = true;
+              regionOffsetBytes = region.offsetBytes;
+              valSizeBytes = region.numBytes;
+              numOfArrSlotsUsed = ceil((float)valSizeBytes / (float)ckptMemSegContainedTypeSize);
+            }
+          }
+          // arrays declared with checkpoint_lossy take the slots of their worst-case encoding (see ckpt_runtime/CkptLossy.h)
+          int64_t lossyNumElems = 0;
+          double lossyMaxError = 0;
+          auto lossyIt = lossyErrors.find(originalTrackedVal);
+          if (lossyIt != lossyErrors.end() && isPointer && (containedType->isArrayTy() || isPointerPointer))
+          {
+            lossyMaxError = lossyIt->second;
+            lossyNumElems = valSizeBytes / ckptMemSegContainedTypeSize;
+            numOfArrSlotsUsed = ceil((float)ckpt_lossy_max_bytes(lossyNumElems, ckptMemSegContainedTypeSize) / (float)ckptMemSegContainedTypeSize);
+          }
           // if valSizeBytes was 1, we "sign extend" it to fill up the available byte width of the ckpt mem segment.
           int sizeInCkptMemArr = ckptMemSegContainedTypeSize * numOfArrSlotsUsed;
           int paddedValSizeBytes = (valSizeBytes < sizeInCkptMemArr) ? sizeInCkptMemArr : valSizeBytes;
+          if (hasRegion && lossyNumElems == 0)
+          {
+            paddedValSizeBytes = valSizeBytes;  // never copy past the end of the region (and maybe of the array)
+          }
           printf("paddedValSizeBytes = %d, ckptMemSegContainedTypeSize = %d\n", paddedValSizeBytes, ckptMemSegContainedTypeSize);
           std::cout<<"numOfArrSlotsUsed for "<<valName<<" = "<<numOfArrSlotsUsed<<std::endl;
 
+          bool isTeamShared = isTeamKernel && isPointerPointer;
+          // lossy and dedup saves of arrays stay inline
+          int descKind = -1;
+          int descConv = CKPT_DESC_CONV_NONE;
+          int descValueBytes = 0;
+          bool isArray = isPointer && (containedType->isArrayTy() || isPointerPointer);
+          if (descSpill && lossyNumElems == 0 && !(dedupHashesValid && isArray))
+          {
+            descKind = getDescriptorKind(trackedVal, ckptMemSegContainedType, DL, descConv, descValueBytes);
+          }
+          // with -ckpt-restore-in-place, scalars in entry allocas are spilled by value, so their address never escapes
+          bool isDescByValue = (descKind == CKPT_DESC_SCALAR_PTR && isRestorableInPlace(originalTrackedVal, entryBB));
+          if (isDescByValue) descKind = CKPT_DESC_VALUE;
+          // and arrays behind entry allocas only written on entry by the array itself
+          bool isDescLoadedArray = (descKind == CKPT_DESC_ARRAY_INDIRECT && isRestorableInPlace(originalTrackedVal, entryBB)
+                                    && isOnlyWrittenOnEntry(originalTrackedVal, entryBB));
+          if (isDescLoadedArray) descKind = CKPT_DESC_ARRAY;
+          bool isDescVal = (descKind >= 0);
+          bool isDescArray = (descKind == CKPT_DESC_ARRAY || descKind == CKPT_DESC_ARRAY_INDIRECT);
+          unsigned descField = 0;
+          if (isDescVal)
+          {
+            auto fieldIt = descSpillFields.find(originalTrackedVal);
+            if (fieldIt == descSpillFields.end())
+            {
+              fieldIt = descSpillFields.emplace(originalTrackedVal, descSpillFields.size()).first;
+              if (isDescArray)
+              {
+                // arrays are not propagated, so their address is the same at every save and restore
+                Instruction *entryTerminator = entryBB->getTerminator();
+                Value *field = getDescriptorSpillField(descSpill, fieldIt->second, Type::getInt8PtrTy(context), entryTerminator);
+                Value *address = originalTrackedVal;
+                if (isDescLoadedArray)
+                {
+                  address = new LoadInst(containedType, originalTrackedVal, "loaded_"+valName, false, entryTerminator);
+                }
+                new StoreInst(new BitCastInst(address, Type::getInt8PtrTy(context), "", entryTerminator), field, false, entryTerminator);
+              }
+            }
+            descField = fieldIt->second;
+            addDescriptor(descTable, descKind, descConv, descField, (int64_t)valMemSegIndex * ckptMemSegContainedTypeSize,
+                          isDescArray ? paddedValSizeBytes : descValueBytes, regionOffsetBytes);
+          }
+          Value *restoreIndexList[1] = {indexList[0]};
+          if (isTeamShared)
+          {
+            // start on a new cache line, so the slices of different threads never share one
+            valMemSegIndex = alignSlotToCacheLine(valMemSegIndex, ckptMemSegContainedTypeSize);
+            indexList[0] = restoreIndexList[0] = ConstantInt::get(Type::getInt32Ty(context), valMemSegIndex);
+          }
+          else if (isTeamKernel)
+          {
+            Value *privateSlot = ConstantInt::get(Type::getInt32Ty(context), teamPrivateSlot);
+            if (teamSlotS) indexList[0] = BinaryOperator::CreateAdd(teamSlotS, privateSlot, "slot_"+valName, saveBB->getTerminator());
+            if (teamSlotR) restoreIndexList[0] = BinaryOperator::CreateAdd(teamSlotR, privateSlot, "slot_"+valName, restoreBB->getTerminator());
+          }
+
 
           if (InjectionOption == SAVE_ONLY || InjectionOption == SAVE_RESTORE)
           {
@@ -584,31 +1094,69 @@ SubroutineInjection::injectSubroutines(
             --- 3.3.3: Create instructions to store value to memory segment
             ----------------------------------------------------------------------------- */
             Instruction *saveBBTerminator = saveBB->getTerminator();
-            Instruction *elemPtrStore = GetElementPtrInst::CreateInBounds(ckptMemSegContainedType, ckptMemSegment,
-                                                                          ArrayRef<Value *>(indexList, 1), "idx_"+valName,
-                                                                          saveBBTerminator);
+            Instruction *elemPtrStore = nullptr;
+            if (!isDescVal)
+            {
+              elemPtrStore = GetElementPtrInst::CreateInBounds(ckptMemSegContainedType, ckptMemSegment,
+                                                               ArrayRef<Value *>(indexList, 1), "idx_"+valName,
+                                                               saveBBTerminator);
+            }
             Value *storeLocation = trackedVal;
-            if (isPointer)
+            if (isDescArray)
+            {
+              // its address was spilled on entry
+            }
+            else if (isDescVal)
+            {
+              // scalars go to their spill field as they are; scalars in memory by address
+              Type *fieldType = isDescByValue ? containedType
+                                : ((descKind == CKPT_DESC_VALUE) ? trackedVal->getType() : Type::getInt8PtrTy(context));
+              Value *field = getDescriptorSpillField(descSpill, descField, fieldType, descTable.saveCall);
+              Value *spilled = (descKind == CKPT_DESC_VALUE) ? trackedVal : new BitCastInst(trackedVal, fieldType, "", descTable.saveCall);
+              if (isDescByValue)
+              {
+                spilled = new LoadInst(containedType, trackedVal, "loaded_"+valName, false, descTable.saveCall);
+              }
+              new StoreInst(spilled, field, false, descTable.saveCall);
+            }
+            else if (isPointer)
             {
               if (containedType->isArrayTy())
               {
+                storeLocation = createOffsetPointer(storeLocation, regionOffsetBytes, saveBBTerminator);
                 #ifndef LLVM14_VER
-                  auto srcAlign = DL.getPrefTypeAlignment(storeLocation->getType());
+                  auto srcAlign = MinAlign(DL.getPrefTypeAlignment(storeLocation->getType()), regionOffsetBytes);
                   auto dstAlign = DL.getPrefTypeAlignment(elemPtrStore->getType());
                 #else
-                  MaybeAlign srcAlign = DL.getPrefTypeAlign(storeLocation->getType());
+                  MaybeAlign srcAlign = commonAlignment(DL.getPrefTypeAlign(storeLocation->getType()), regionOffsetBytes);
                   MaybeAlign dstAlign = DL.getPrefTypeAlign(elemPtrStore->getType());
                 #endif
 
 		  //TODO: data type filtering
 
 		  
-                builder.SetInsertPoint(saveBBTerminator);
-                #ifndef LLVM14_VER
-                  CallInst *memcpyCall = builder.CreateMemCpy(reinterpret_cast<Value*>(elemPtrStore), storeLocation, paddedValSizeBytes, srcAlign, true);
-                #else
-                  CallInst *memcpyCall = builder.CreateMemCpy(reinterpret_cast<Value*>(elemPtrStore), dstAlign, storeLocation, srcAlign, paddedValSizeBytes, true);
-                #endif
+                if (lossyNumElems > 0)
+                {
+                  createCkptLossyCopy(func_ckpt_lossy_encode, elemPtrStore, storeLocation, lossyNumElems, lossyMaxError, saveBBTerminator);
+                }
+                else if (dedupHashesValid)
+                {
+                  dedupSlotsUsed = createCkptDedupCopy(func_ckpt_copy_dedup, ckptMemSegment, elemPtrStore, storeLocation, paddedValSizeBytes,
+                                                       valMemSegIndex + numOfArrSlotsUsed, dedupHashesValid, saveBBTerminator);
+                }
+                else if (CkptRuntimeOption)
+                {
+                  createCkptRuntimeCopy(func_ckpt_copy_stream, elemPtrStore, storeLocation, paddedValSizeBytes, saveBBTerminator);
+                }
+                else
+                {
+                  builder.SetInsertPoint(saveBBTerminator);
+                  #ifndef LLVM14_VER
+                    CallInst *memcpyCall = builder.CreateMemCpy(reinterpret_cast<Value*>(elemPtrStore), storeLocation, paddedValSizeBytes, srcAlign, true);
+                  #else
+                    CallInst *memcpyCall = builder.CreateMemCpy(reinterpret_cast<Value*>(elemPtrStore), dstAlign, storeLocation, srcAlign, paddedValSizeBytes, true);
+                  #endif
+                }
 		  
 		  /*
 		  // array copy triggered 
@@ -634,7 +1182,7 @@ SubroutineInjection::injectSubroutines(
               {
                 // trackedVal is <type>** pointing to array 
                 Instruction *loadedAddrS = new LoadInst(containedType, storeLocation, "loaded_"+valName, false, saveBBTerminator);
-                storeLocation = loadedAddrS;
+                storeLocation = createOffsetPointer(loadedAddrS, regionOffsetBytes, saveBBTerminator);
 
                 bool copy_done = false;
                 if(TrackIndexOption){
@@ -656,6 +1204,14 @@ SubroutineInjection::injectSubroutines(
                     
                     call_params.push_back(elemPtrSrc);
                     call_params.push_back(index);
+                    if (CkptRuntimeOption)
+                    {
+                      // ckpt_copy_index32 takes untyped data pointers
+                      for (unsigned i = 0; i < call_params.size(); i++)
+                      {
+                        call_params[i] = IR.CreatePointerCast(call_params[i], func_mem_cpy_index_f->getFunctionType()->getParamType(i));
+                      }
+                    }
                     
                     //void mem_cpy_index_f(float* dest, float* src, int* index_list, int* sp)
                     CallInst* call1 = CallInst::Create(func_mem_cpy_index_f, call_params, "", saveBBTerminator);
@@ -674,10 +1230,10 @@ SubroutineInjection::injectSubroutines(
                 if(!copy_done){
                   // create memcpy inst (autoconverts pointers to i8*)
                   #ifndef LLVM14_VER
-                    auto srcAlign = DL.getPrefTypeAlignment(storeLocation->getType());
+                    auto srcAlign = MinAlign(DL.getPrefTypeAlignment(storeLocation->getType()), regionOffsetBytes);
                     auto dstAlign = DL.getPrefTypeAlignment(elemPtrStore->getType());
                   #else
-                    MaybeAlign srcAlign = DL.getPrefTypeAlign(storeLocation->getType());
+                    MaybeAlign srcAlign = commonAlignment(DL.getPrefTypeAlign(storeLocation->getType()), regionOffsetBytes);
                     MaybeAlign dstAlign = DL.getPrefTypeAlign(elemPtrStore->getType());
                   #endif
                     builder.SetInsertPoint(saveBBTerminator);
@@ -688,12 +1244,40 @@ SubroutineInjection::injectSubroutines(
                     //CallInst *memcpyCall = builder.CreateMemCpy(reinterpret_cast<Value*>(elemPtrStore), storeLocation, paddedValSizeBytes, srcAlign, true);
 
 		    /* array copy triggered */
-		    std::vector<Value*> call_params;
-		    call_params.push_back(reinterpret_cast<Value*>(elemPtrStore));
-		    call_params.push_back(storeLocation);
-		    auto size = llvm::ConstantInt::get(Type::getInt32Ty(F.getContext()), paddedValSizeBytes);
-		    call_params.push_back(size);
-		    CallInst* call1 = CallInst::Create(func_mem_cpy_wrapper_f, call_params, "", saveBBTerminator);
+		    if (isTeamShared)
+		    {
+		      createCkptTeamCopy(func_ckpt_team_copy, elemPtrStore, storeLocation, paddedValSizeBytes, teamThread32, teamNumThreads32, saveBBTerminator);
+		    }
+		    else if (lossyNumElems > 0)
+		    {
+		      createCkptLossyCopy(func_ckpt_lossy_encode, elemPtrStore, storeLocation, lossyNumElems, lossyMaxError, saveBBTerminator);
+		    }
+		    else if (dedupHashesValid)
+		    {
+		      dedupSlotsUsed = createCkptDedupCopy(func_ckpt_copy_dedup, ckptMemSegment, elemPtrStore, storeLocation, paddedValSizeBytes,
+		                                           valMemSegIndex + numOfArrSlotsUsed, dedupHashesValid, saveBBTerminator);
+		    }
+		    else if (CkptRuntimeOption)
+		    {
+		      createCkptRuntimeCopy(func_ckpt_copy_stream, elemPtrStore, storeLocation, paddedValSizeBytes, saveBBTerminator);
+		    }
+		    else if (func_mem_cpy_wrapper_f != NULL)
+		    {
+		      std::vector<Value*> call_params;
+		      call_params.push_back(reinterpret_cast<Value*>(elemPtrStore));
+		      call_params.push_back(storeLocation);
+		      auto size = llvm::ConstantInt::get(Type::getInt32Ty(F.getContext()), paddedValSizeBytes);
+		      call_params.push_back(size);
+		      CallInst* call1 = CallInst::Create(func_mem_cpy_wrapper_f, call_params, "", saveBBTerminator);
+		    }
+		    else
+		    {
+		      #ifndef LLVM14_VER
+		        builder.CreateMemCpy(reinterpret_cast<Value*>(elemPtrStore), storeLocation, paddedValSizeBytes, srcAlign, true);
+		      #else
+		        builder.CreateMemCpy(reinterpret_cast<Value*>(elemPtrStore), dstAlign, storeLocation, srcAlign, paddedValSizeBytes, true);
+		      #endif
+		    }
 		    
 		    for(Instruction* v : instWaitFor) {
 		      v->removeFromParent();
@@ -733,10 +1317,6 @@ SubroutineInjection::injectSubroutines(
                 StoreInst *storeInst = new StoreInst(storeLocation, elemPtrStore, false, saveBBTerminator);
               }
             }
-
-            // synthesize liveness data with both updated and original versions of tracked values:
-            saveBBLiveOutSet.insert(trackedVal);
-            saveBBLiveOutSet.insert(originalTrackedVal);
           }
 
           if (InjectionOption == RESTORE_ONLY || InjectionOption == SAVE_RESTORE)
@@ -746,29 +1326,73 @@ SubroutineInjection::injectSubroutines(
             ----------------------------------------------------------------------------- */
             Instruction *restoreBBTerminator = restoreBB->getTerminator();
             Value *restoredVal = nullptr;
-            Instruction *elemPtrLoad = GetElementPtrInst::CreateInBounds(ckptMemSegContainedType, ckptMemSegment,
-                                                                        ArrayRef<Value *>(indexList, 1), "idx_"+valName,
-                                                                        restoreBBTerminator);
+            Instruction *elemPtrLoad = nullptr;
+            if (!isDescVal)
+            {
+              elemPtrLoad = GetElementPtrInst::CreateInBounds(ckptMemSegContainedType, ckptMemSegment,
+                                                              ArrayRef<Value *>(restoreIndexList, 1), "idx_"+valName,
+                                                              restoreBBTerminator);
+            }
             Value *storeLocationOrig = originalTrackedVal; // is where the original value was stored during save operation
-            if (isPointer)
+            if (isDescVal)
+            {
+              // like the inline restore, scalars in memory are restored into a new alloca that is propagated
+              Instruction *restoreCall = descTable.restoreCall;
+              Value *address = nullptr;
+              if (descKind == CKPT_DESC_SCALAR_PTR)
+              {
+                address = new AllocaInst(containedType, 0, "alloca_"+valName, restoreCall);
+                restoredVal = address;
+              }
+              if (isDescByValue)
+              {
+                // store restored value back into the original alloca (-ckpt-restore-in-place)
+                Value *field = getDescriptorSpillField(descSpill, descField, containedType, restoreBBTerminator);
+                Value *loaded = new LoadInst(containedType, field, "load_"+valName, false, restoreBBTerminator);
+                new StoreInst(loaded, originalTrackedVal, false, restoreBBTerminator);
+              }
+              else if (descKind == CKPT_DESC_VALUE)
+              {
+                Value *field = getDescriptorSpillField(descSpill, descField, trackedVal->getType(), restoreBBTerminator);
+                restoredVal = new LoadInst(trackedVal->getType(), field, "load_"+valName, false, restoreBBTerminator);
+              }
+              else if (descKind == CKPT_DESC_SCALAR_PTR)
+              {
+                Value *field = getDescriptorSpillField(descSpill, descField, Type::getInt8PtrTy(context), restoreCall);
+                new StoreInst(new BitCastInst(address, Type::getInt8PtrTy(context), "", restoreCall), field, false, restoreCall);
+              }
+            }
+            else if (isPointer)
             {
               if (containedType->isArrayTy())
               {
                 // originalTrackedVal is a ptr to a [<size> x <type>] array
                 // restore values back into original pointer
+                storeLocationOrig = createOffsetPointer(storeLocationOrig, regionOffsetBytes, restoreBBTerminator);
                 #ifndef LLVM14_VER
                   auto srcAlignOriginalPtr = DL.getPrefTypeAlignment(elemPtrLoad->getType());
-                  auto dstAlignOriginalPtr = DL.getPrefTypeAlignment(storeLocationOrig->getType());
+                  auto dstAlignOriginalPtr = MinAlign(DL.getPrefTypeAlignment(storeLocationOrig->getType()), regionOffsetBytes);
                 #else
                   MaybeAlign srcAlignOriginalPtr = DL.getPrefTypeAlign(elemPtrLoad->getType());
-                  MaybeAlign dstAlignOriginalPtr = DL.getPrefTypeAlign(storeLocationOrig->getType());
-                #endif
-                builder.SetInsertPoint(restoreBBTerminator);
-                #ifndef LLVM14_VER
-                  CallInst *memcpyCallOrig =  builder.CreateMemCpy(storeLocationOrig, reinterpret_cast<Value*>(elemPtrLoad), paddedValSizeBytes, srcAlignOriginalPtr, true);
-                #else
-                  CallInst *memcpyCallOrig = builder.CreateMemCpy(storeLocationOrig, dstAlignOriginalPtr, reinterpret_cast<Value*>(elemPtrLoad), srcAlignOriginalPtr, paddedValSizeBytes, true);
+                  MaybeAlign dstAlignOriginalPtr = commonAlignment(DL.getPrefTypeAlign(storeLocationOrig->getType()), regionOffsetBytes);
                 #endif
+                if (lossyNumElems > 0)
+                {
+                  createCkptLossyCopy(func_ckpt_lossy_decode, storeLocationOrig, elemPtrLoad, lossyNumElems, lossyMaxError, restoreBBTerminator);
+                }
+                else if (CkptRuntimeOption)
+                {
+                  createCkptRuntimeCopy(func_ckpt_copy, storeLocationOrig, elemPtrLoad, paddedValSizeBytes, restoreBBTerminator);
+                }
+                else
+                {
+                  builder.SetInsertPoint(restoreBBTerminator);
+                  #ifndef LLVM14_VER
+                    CallInst *memcpyCallOrig =  builder.CreateMemCpy(storeLocationOrig, reinterpret_cast<Value*>(elemPtrLoad), paddedValSizeBytes, srcAlignOriginalPtr, true);
+                  #else
+                    CallInst *memcpyCallOrig = builder.CreateMemCpy(storeLocationOrig, dstAlignOriginalPtr, reinterpret_cast<Value*>(elemPtrLoad), srcAlignOriginalPtr, paddedValSizeBytes, true);
+                  #endif
+                }
                 restoredVal = nullptr;  // do not propagate
               }
               else if(isPointerPointer)// || numOfArrSlotsUsed > 1)
@@ -778,26 +1402,53 @@ SubroutineInjection::injectSubroutines(
                 /** TODO: ----- memcpy new (restored) array back into the original array pointer ----- */
                 // place inst in restoreBB to load array base-address (<type>*) from originalTrackedVal (<type>**) into "local" Value
                 Instruction *loadedAddrSOrig = new LoadInst(containedType, storeLocationOrig, "loaded_"+valName, false, restoreBBTerminator);
-                storeLocationOrig = loadedAddrSOrig;
+                storeLocationOrig = createOffsetPointer(loadedAddrSOrig, regionOffsetBytes, restoreBBTerminator);
                 #ifndef LLVM14_VER
                   auto srcAlignOriginalPtr = DL.getPrefTypeAlignment(elemPtrLoad->getType());
-                  auto dstAlignOriginalPtr = DL.getPrefTypeAlignment(storeLocationOrig->getType());
+                  auto dstAlignOriginalPtr = MinAlign(DL.getPrefTypeAlignment(storeLocationOrig->getType()), regionOffsetBytes);
                 #else
                   MaybeAlign srcAlignOriginalPtr = DL.getPrefTypeAlign(elemPtrLoad->getType());
-                  MaybeAlign dstAlignOriginalPtr = DL.getPrefTypeAlign(storeLocationOrig->getType());
-                #endif
-                builder.SetInsertPoint(restoreBBTerminator);
-                #ifndef LLVM14_VER
-                  CallInst *memcpyCallOrig =  builder.CreateMemCpy(storeLocationOrig, reinterpret_cast<Value*>(elemPtrLoad), paddedValSizeBytes, srcAlignOriginalPtr, true);
-                #else
-                  CallInst *memcpyCallOrig = builder.CreateMemCpy(storeLocationOrig, dstAlignOriginalPtr, reinterpret_cast<Value*>(elemPtrLoad), srcAlignOriginalPtr, paddedValSizeBytes, true);
+                  MaybeAlign dstAlignOriginalPtr = commonAlignment(DL.getPrefTypeAlign(storeLocationOrig->getType()), regionOffsetBytes);
                 #endif
+                if (isTeamShared)
+                {
+                  createCkptTeamCopy(func_ckpt_team_copy, storeLocationOrig, elemPtrLoad, paddedValSizeBytes, teamThread32, teamNumThreads32, restoreBBTerminator);
+                }
+                else if (lossyNumElems > 0)
+                {
+                  createCkptLossyCopy(func_ckpt_lossy_decode, storeLocationOrig, elemPtrLoad, lossyNumElems, lossyMaxError, restoreBBTerminator);
+                }
+                else if (CkptRuntimeOption)
+                {
+                  createCkptRuntimeCopy(func_ckpt_copy, storeLocationOrig, elemPtrLoad, paddedValSizeBytes, restoreBBTerminator);
+                }
+                else
+                {
+                  builder.SetInsertPoint(restoreBBTerminator);
+                  #ifndef LLVM14_VER
+                    CallInst *memcpyCallOrig =  builder.CreateMemCpy(storeLocationOrig, reinterpret_cast<Value*>(elemPtrLoad), paddedValSizeBytes, srcAlignOriginalPtr, true);
+                  #else
+                    CallInst *memcpyCallOrig = builder.CreateMemCpy(storeLocationOrig, dstAlignOriginalPtr, reinterpret_cast<Value*>(elemPtrLoad), srcAlignOriginalPtr, paddedValSizeBytes, true);
+                  #endif
+                }
 
                 /** TODO: The following store inst is unnecessary since we're using the original array address */
                 // store <type>* into original the <type>** Value (i.e. originalTrackedVal) pointing to the array
                 // StoreInst *storeInst = new StoreInst(storeLocationOrig, originalTrackedVal, false, restoreBBTerminator);
                 restoredVal = nullptr;  // do not propagate
               }
+              else if (isRestorableInPlace(storeLocationOrig, entryBB))
+              {
+                // store restored value back into the original alloca (-ckpt-restore-in-place)
+                Instruction *loadInst = new LoadInst(ckptMemSegContainedType, elemPtrLoad, "load_derefed_"+valName, false, restoreBBTerminator);
+                if (ckptMemSegContainedType != containedType)
+                {
+                  std::string name = JsonHelper::getOpName(reinterpret_cast<Value*>(loadInst), &M).erase(0,1);
+                  loadInst = addTypeConversionInst(loadInst, containedType, name, restoreBBTerminator);
+                }
+                new StoreInst(loadInst, storeLocationOrig, false, restoreBBTerminator);
+                restoredVal = nullptr;  // do not propagate
+              }
               else
               {
                 /** TODO: Choose between 1) propagating newly-allocated single-ptr OR 2) storing back to original val */
@@ -851,82 +1502,173 @@ SubroutineInjection::injectSubroutines(
               {
                 phi->addIncoming(trackedVal, checkpointBB);
               }
-              trackedValPhiValMap[trackedVal] = phi;
+              restoredValJunctionPhisMap[originalTrackedVal].push_back(phi);
             }
-
-            /*
-            --- 3.3.6: Configure live-out sets for saveBB, restoreBB and junctionBB; init trackValPhiValMap.
-            ----------------------------------------------------------------------------- */
-            /* Since the live-out data for all other BBs use the original value version too (and algo checks
-            live-out using this live-out data), it would be more consistent to use original value version
-            as live-out of saveBB, restoreBB & junctionBB instead of the new phi. */
-            // synthesize liveness data with both updated and original versions of tracked values:
-            restoreBBLiveOutSet.insert(trackedVal);
-            junctionBBLiveOutSet.insert(trackedVal);
-            restoreBBLiveOutSet.insert(originalTrackedVal);
-            junctionBBLiveOutSet.insert(originalTrackedVal);
           }
           
-          valMemSegIndex += numOfArrSlotsUsed;
+          if (isTeamKernel && !isTeamShared)
+          {
+            teamPrivateSlot += numOfArrSlotsUsed;
+          }
+          else
+          {
+            valMemSegIndex += numOfArrSlotsUsed + dedupSlotsUsed;
+          }
           printf("$$ next valMemSegIndex = %d\n", valMemSegIndex);
-          ckptSizeBytes += paddedValSizeBytes;
+          ckptSizeBytes += paddedValSizeBytes + dedupSlotsUsed * ckptMemSegContainedTypeSize;
         }
-        funcSaveBBsLiveOutMap[saveBB] = saveBBLiveOutSet;
-        funcRestoreBBsLiveOutMap[restoreBB] = restoreBBLiveOutSet;
-        funcJunctionBBsLiveOutMap[junctionBB] = junctionBBLiveOutSet;
-        funcJunctionBBPhiValsMap[junctionBB] = trackedValPhiValMap;
 
-        if (InjectionOption == RESTORE_ONLY || InjectionOption == SAVE_RESTORE)
+        /*
+        --- 3.3.6: Save derived pointers as their offset from the base of their array, and
+            re-derive them from the (restored) base on restore
+        ----------------------------------------------------------------------------- */
+        int derivedOwnBytes = 0;
+        int derivedOffsetBytes = 0;
+        for (auto iter : trackedValsOrdered)
         {
-          /*
-          ++ 3.4: Propagate loaded values from restoreBB across CFG.
-          +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++ */
-          for (auto iter : oldNewTrackedVals)
+          auto derivedIt = derivedPtrs.find(iter);
+          if (derivedIt == derivedPtrs.end()) continue;
+          Value *trackedVal = const_cast<Value*>(&*iter);
+          Value *originalTrackedVal = const_cast<Value*>(valVersionTracker.getOriginalOfCurrent(checkpointBB, &*iter));
+          Value *baseVal = const_cast<Value*>(derivedIt->second);
+          std::string valName = trackedValNames.at(originalTrackedVal);
+          AllocaInst *ptrAlloca = dyn_cast<AllocaInst>(originalTrackedVal);
+          Type *ptrType = ptrAlloca ? ptrAlloca->getAllocatedType() : trackedVal->getType();
+          Type *offsetType = Type::getInt64Ty(context);
+          int numOfArrSlotsUsed = ceil((float)sizeof(int64_t) / (float)ckptMemSegContainedTypeSize);
+          int offsetSizeBytes = numOfArrSlotsUsed * ckptMemSegContainedTypeSize;
+
+          // a pointer alloca would otherwise be saved like an array of its own (SSA pointers were not saved)
+          int ownSizeBytes = 0;
+          if (ptrAlloca)
+          {
+            ownSizeBytes = liveValDefMap.count(originalTrackedVal) ? liveValDefMap.at(originalTrackedVal) : valDefMap.at(originalTrackedVal);
+            Value *trackedValDeref = getDerefValFromPointer(originalTrackedVal, valVersionTracker.getVersions(originalTrackedVal), &F);
+            if (trackedValDeref != nullptr && valDefMap.count(trackedValDeref)) ownSizeBytes = valDefMap.at(trackedValDeref);
+            ownSizeBytes = ckptMemSegContainedTypeSize * (int)ceil((float)ownSizeBytes / (float)ckptMemSegContainedTypeSize);
+          }
+          derivedOwnBytes += ownSizeBytes;
+          derivedOffsetBytes += offsetSizeBytes;
+          std::cout << "Tracked pointer '" << valName << "' points into the array addressed by '" << JsonHelper::getOpName(baseVal, &M)
+                    << "'; saving its offset (" << offsetSizeBytes << " bytes instead of " << ownSizeBytes << ")" << std::endl;
+
+          Value *slotIndex = ConstantInt::get(Type::getInt32Ty(context), valMemSegIndex);
+          Value *restoreSlotIndex = slotIndex;
+          if (isTeamKernel)
+          {
+            Value *privateSlot = ConstantInt::get(Type::getInt32Ty(context), teamPrivateSlot);
+            if (teamSlotS) slotIndex = BinaryOperator::CreateAdd(teamSlotS, privateSlot, "slot_"+valName, saveBB->getTerminator());
+            if (teamSlotR) restoreSlotIndex = BinaryOperator::CreateAdd(teamSlotR, privateSlot, "slot_"+valName, restoreBB->getTerminator());
+          }
+
+          if (InjectionOption == SAVE_ONLY || InjectionOption == SAVE_RESTORE)
           {
-            /** TODO: verify safety of cast to non-const!! this is dangerous*/
-            Value *originalTrackedVal = const_cast<Value*>(iter.first);
-            Value *trackedVal = const_cast<Value*>(iter.second);
-            std::string valName = JsonHelper::getOpName(trackedVal, &M).erase(0,1);
+            IRBuilder<> saveBuilder(saveBB->getTerminator());
+            Value *ptr = ptrAlloca ? saveBuilder.CreateLoad(ptrType, ptrAlloca, "loaded_"+valName) : trackedVal;
+            Value *basePtr = createObjectBasePtr(baseVal, saveBuilder);
+            Value *offset = saveBuilder.CreateSub(saveBuilder.CreatePtrToInt(ptr, offsetType), saveBuilder.CreatePtrToInt(basePtr, offsetType), "offset_"+valName);
+            Value *elemPtrStore = saveBuilder.CreateInBoundsGEP(ckptMemSegContainedType, ckptMemSegment, slotIndex, "idx_"+valName);
+            saveBuilder.CreateStore(offset, saveBuilder.CreatePointerCast(elemPtrStore, offsetType->getPointerTo()));
+          }
 
-            Type *valType = trackedVal->getType();
-            if (valType->isPointerTy())
+          if (InjectionOption == RESTORE_ONLY || InjectionOption == SAVE_RESTORE)
+          {
+            IRBuilder<> restoreBuilder(restoreBB->getTerminator());
+            Value *elemPtrLoad = restoreBuilder.CreateInBoundsGEP(ckptMemSegContainedType, ckptMemSegment, restoreSlotIndex, "idx_"+valName);
+            Value *offset = restoreBuilder.CreateLoad(offsetType, restoreBuilder.CreatePointerCast(elemPtrLoad, offsetType->getPointerTo()), "offset_"+valName);
+            Value *basePtr = createObjectBasePtr(baseVal, restoreBuilder);
+            Value *restoredPtr = restoreBuilder.CreatePointerCast(restoreBuilder.CreateGEP(restoreBuilder.getInt8Ty(), basePtr, offset),
+                                                                   ptrType, "rederived_"+valName);
+            if (ptrAlloca)
             {
-              /** TODO: do 'continue' here if not propagating all pointer types*/
-              // continue;
-              // do not propagate <type>** Values
-              if (valType->getContainedType(0)->isPointerTy()) continue;
-              // do not propagate llvm array pointer type Values (ptr to [<size> x <type>] arr)
-              if (valType->getContainedType(0)->isArrayTy()) continue;
+              restoreBuilder.CreateStore(restoredPtr, ptrAlloca);
             }
-            
-            // for each BB, keeps track of versions of values that have been encountered in this BB (including the original value)
-            std::map<BasicBlock *, std::set<Value *>> visitedBBs;
+            else
+            {
+              PHINode *phi = PHINode::Create(trackedVal->getType(), 2, "new_"+valName, junctionBB->getTerminator());
+              phi->addIncoming(restoredPtr, restoreBB);
+              phi->addIncoming(trackedVal, (InjectionOption == SAVE_RESTORE) ? saveBB : checkpointBB);
+              restoredValJunctionPhisMap[originalTrackedVal].push_back(phi);
+            }
+          }
 
-            // get phi value in junctionBB that merges original & loaded versions of trackVal
-            if (!funcJunctionBBPhiValsMap.at(junctionBB).count(trackedVal))
+          if (isTeamKernel)
+          {
+            teamPrivateSlot += numOfArrSlotsUsed;
+          }
+          else
+          {
+            valMemSegIndex += numOfArrSlotsUsed;
+          }
+          ckptSizeBytes += offsetSizeBytes;
+        }
+        if (!derivedPtrs.empty())
+        {
+          std::cout << "Checkpoint '" << checkpointBBName << "': " << derivedPtrs.size()
+                    << " tracked pointer(s) re-derived from the array they point into; their offsets take "
+                    << derivedOffsetBytes << " bytes instead of " << derivedOwnBytes << std::endl;
+        }
+        if (isTeamKernel)
+        {
+          // the thread sub-segments follow the shared arrays, one cache-line aligned sub-segment per thread
+          int privateStartSlot = alignSlotToCacheLine(valMemSegIndex, ckptMemSegContainedTypeSize);
+          int threadStrideSlots = alignSlotToCacheLine(teamPrivateSlot, ckptMemSegContainedTypeSize);
+          for (Instruction *teamSlot : {teamSlotS, teamSlotR})
+          {
+            if (teamSlot) setTeamSlotLayout(teamSlot, privateStartSlot, threadStrideSlots);
+          }
+          std::cout << "Team checkpoint '" << checkpointBBName << "': ckpt_mem needs " << privateStartSlot * ckptMemSegContainedTypeSize
+                    << " + " << TEAM_NUM_THREADS_ARG_NAME << " * " << threadStrideSlots * ckptMemSegContainedTypeSize << " bytes" << std::endl;
+        }
+        if (descSpill)
+        {
+          std::cout << "Checkpoint '" << checkpointBBName << "': " << descTable.descs.size() << " value(s) saved/restored through a descriptor table" << std::endl;
+          finishDescriptorTable(descTable, M, checkpointBBName + ".ckpt_descs");
+          if (descTable.saveCall && !descTable.descs.empty())
+          {
+            // as after inline array copies
+            for (Instruction *v : instWaitFor)
             {
-              std::cout << "WARNING: No PHI node inserted in junctionBB for tracked val" 
-                        << JsonHelper::getOpName(trackedVal, &M) 
-                        << "; do not propagate." << std::endl;
-              continue;
+              v->removeFromParent();
+              v->insertBefore(saveBB->getTerminator());
             }
-            PHINode *phi = funcJunctionBBPhiValsMap.at(junctionBB).at(trackedVal);
-
-            propagateRestoredValuesBFS(resumeBB, junctionBB, trackedVal, phi,
-                                      originalTrackedVal, &visitedBBs,
-                                      &funcBBLiveValsMap, funcSaveBBsLiveOutMap, 
-                                      funcRestoreBBsLiveOutMap, funcJunctionBBsLiveOutMap,
-                                      &bbCheckpointsOldNewVals, &allTrackedValVersions);
-            printf("----------------\n");
           }
         }
-        // store ckpt size into map
+        if (dedupOwner)
+        {
+          // the hash tables now match the saved arrays
+          new StoreInst(ConstantInt::get(Type::getInt64Ty(context), dedupOwnerTag), dedupOwner, false, saveBB->getTerminator());
+        }
+        valuesEndSlot = std::max(valuesEndSlot, valMemSegIndex);
+        // store ckpt size into map
         ckptSizeMap[checkpointBB] = ckptSizeBytes;
       }
+    }
 
+    if (incrInitCall)
+    {
+      // ckpt_incr_begin backs up the values of every checkpoint, after the largest one
+      int64_t valuesOffset = (int64_t)valuesStartSlot * ckptMemSegContainedTypeSize;
+      int64_t valuesBytes = (int64_t)(valuesEndSlot - valuesStartSlot) * ckptMemSegContainedTypeSize;
+      int64_t backupOffset = alignTo(valuesOffset + valuesBytes, sizeof(int64_t));
+      incrInitCall->setArgOperand(3, ConstantInt::get(Type::getInt64Ty(context), valuesOffset));
+      incrInitCall->setArgOperand(4, ConstantInt::get(Type::getInt64Ty(context), valuesBytes));
+      incrInitCall->setArgOperand(5, ConstantInt::get(Type::getInt64Ty(context), backupOffset));
+      for (auto &iter : ckptSizeMap)
+      {
+        iter.second += backupOffset + valuesBytes - valuesOffset;
+      }
+    }
 
-      
-      // break; /** TODO: IS FOR TESTING (limits to 1 checkpoint; propagation algo does not work with > 1 ckpt) */
+    /*
+    = 3.4: Propagate loaded values from restoreBBs across CFG (for all checkpoints at once).
+    ============================================================================= */
+    if (InjectionOption == RESTORE_ONLY || InjectionOption == SAVE_RESTORE)
+    {
+      for (auto &iter : restoredValJunctionPhisMap)
+      {
+        propagateRestoredValuesSSA(iter.first, iter.second, checkpointBBPtrSet, valVersionTracker);
+      }
     }
 
     /*
@@ -947,14 +1689,24 @@ SubroutineInjection::injectSubroutines(
       BasicBlock *restoreBB = iter.second.restoreBB;
       Instruction *saveBBTerminator = (saveBB != nullptr) ? saveBB->getTerminator() : nullptr;
       Instruction *restoreBBTerminator = (restoreBB != nullptr) ? restoreBB->getTerminator() : nullptr;
+      Instruction *saveStartInst = nullptr;   // first inst of the saveBB after the ckpt id is set to -1
 
       if (InjectionOption == SAVE_ONLY || InjectionOption == SAVE_RESTORE)
       {
         Instruction *firstNonPhiInstSaveBB = saveBB->getFirstNonPHI();
-        Value *ckptIDIndexList[1] = {ConstantInt::get(Type::getInt32Ty(context), CKPT_ID)};
-        Instruction *elemPtrCkptId = GetElementPtrInst::CreateInBounds(ckptMemSegContainedType, ckptMemSegment,
-                                                                      ArrayRef<Value *>(ckptIDIndexList, 1),
-                                                                      "idx_ckpt_id", firstNonPhiInstSaveBB);
+        saveStartInst = firstNonPhiInstSaveBB;
+        Instruction *elemPtrCkptId = nullptr;
+        if (CkptHeaderOption)
+        {
+          elemPtrCkptId = getCkptHeaderFieldPtr(ckptMemSegment, CKPT_HEADER_CKPT_ID, "idx_ckpt_id", firstNonPhiInstSaveBB);
+        }
+        else
+        {
+          Value *ckptIDIndexList[1] = {ConstantInt::get(Type::getInt32Ty(context), CKPT_ID)};
+          elemPtrCkptId = GetElementPtrInst::CreateInBounds(ckptMemSegContainedType, ckptMemSegment,
+                                                            ArrayRef<Value *>(ckptIDIndexList, 1),
+                                                            "idx_ckpt_id", firstNonPhiInstSaveBB);
+        }
 
         Value *memLockCkptIDInt = {ConstantInt::get(Type::getInt32Ty(context), -1)}; // set ckpt_id to -1 to indicate it's currently being written to by ckpt.
         Value *savedMemLockCkptIDVal = memLockCkptIDInt;
@@ -962,7 +1714,7 @@ SubroutineInjection::injectSubroutines(
         Value *ckptIDValInt = {ConstantInt::get(Type::getInt32Ty(context), ckptID)};
         Value *savedCkptIDVal = ckptIDValInt;
 
-        if (ckptMemSegContainedType != Type::getInt32Ty(context))
+        if (!CkptHeaderOption && ckptMemSegContainedType != Type::getInt32Ty(context))
         {
           Value *memLockCkptIDValFloat = addTypeConversionInst(memLockCkptIDInt, ckptMemSegContainedType, "mem_lock_ckpt_id", firstNonPhiInstSaveBB);
           savedMemLockCkptIDVal = memLockCkptIDValFloat;
@@ -975,6 +1727,8 @@ SubroutineInjection::injectSubroutines(
         StoreInst *storeCkptId = new StoreInst(savedCkptIDVal, elemPtrCkptId, false, saveBBTerminator);
 	*/
 
+        StoreInst *storeMemLockCkptID = nullptr;
+        StoreInst *storeCkptId = nullptr;
 	if((instScopeEntry != NULL) && ((instScopeExit != NULL))){
 	  instScopeExit->removeFromParent();
 	  instScopeEntry->removeFromParent();
@@ -993,15 +1747,42 @@ SubroutineInjection::injectSubroutines(
 	    StoreInst *storeSync = new StoreInst(vzero, globalSync, false, elemPtrCkptId);
 	  }
 	    
-	  StoreInst *storeMemLockCkptID = new StoreInst(savedMemLockCkptIDVal, elemPtrCkptId, false, firstNonPhiInstSaveBB);
-	  StoreInst *storeCkptId = new StoreInst(savedCkptIDVal, elemPtrCkptId, false, saveBBTerminator);
+	  storeMemLockCkptID = new StoreInst(savedMemLockCkptIDVal, elemPtrCkptId, false, firstNonPhiInstSaveBB);
+	  storeCkptId = new StoreInst(savedCkptIDVal, elemPtrCkptId, false, saveBBTerminator);
 	  instScopeExit->insertAfter(storeCkptId);
 	  
 	}else{
-	  StoreInst *storeMemLockCkptID = new StoreInst(savedMemLockCkptIDVal, elemPtrCkptId, false, firstNonPhiInstSaveBB);
-	  StoreInst *storeCkptId = new StoreInst(savedCkptIDVal, elemPtrCkptId, false, saveBBTerminator);
+	  storeMemLockCkptID = new StoreInst(savedMemLockCkptIDVal, elemPtrCkptId, false, firstNonPhiInstSaveBB);
+	  storeCkptId = new StoreInst(savedCkptIDVal, elemPtrCkptId, false, saveBBTerminator);
 	}
-        
+
+        if (CkptHeaderOption)
+        {
+          // the ckpt id publishes the saved values to whoever restores from them
+          setCkptHeaderAccessOrdering(storeMemLockCkptID, AtomicOrdering::Monotonic);
+          setCkptHeaderAccessOrdering(storeCkptId, AtomicOrdering::Release);
+        }
+        if (ckptEpoch)
+        {
+          // tag the ckpt with the epoch of this invocation (while ckpt id is -1)
+          Instruction *elemPtrEpoch = getCkptHeaderFieldPtr(ckptMemSegment, CKPT_HEADER_EPOCH, "idx_epoch", firstNonPhiInstSaveBB);
+          builder.SetInsertPoint(firstNonPhiInstSaveBB);
+          Value *epochInt = builder.CreateIntCast(ckptEpoch, Type::getInt32Ty(context), true, "epoch");
+          StoreInst *storeEpoch = builder.CreateStore(epochInt, elemPtrEpoch);
+          setCkptHeaderAccessOrdering(storeEpoch, AtomicOrdering::Monotonic);
+        }
+        if (isTeamKernel)
+        {
+          // no thread may still be computing when the ckpt is overwritten, and all threads
+          // must have saved before it is published
+          createCkptTeamBarrier(func_ckpt_team_barrier, ckptMemSegment, teamNumThreads32, saveBB->getFirstNonPHI());
+          createCkptTeamBarrier(func_ckpt_team_barrier, ckptMemSegment, teamNumThreads32, storeCkptId);
+        }
+        if (incrSession)
+        {
+          // the ckpt id is published by the checkpoint site that copies the last chunk
+          insertIncrementalSavePoll(iter.second, ckptMemSegment, incrSession, storeCkptId, M);
+        }
       }
 
       /*
@@ -1010,6 +1791,42 @@ SubroutineInjection::injectSubroutines(
       /** TODO: remove after testing phase */
       Value *heartbeatIndexList[1] = {ConstantInt::get(Type::getInt32Ty(context), HEARTBEAT)};
       Value *addRhsOperandInt = ConstantInt::get(Type::getInt32Ty(context), 1);
+      if (CkptHeaderOption)
+      {
+        // relaxed atomic increment of the int32 heartbeat; watchdogs only need to see it change. A save
+        // bumps it when it starts, so readers of the segment (e.g. CkptReplica.h) can tell that a save
+        // overlapped their copy even if it published the same ckpt id again
+        for (Instruction *terminator : {saveStartInst, restoreBBTerminator})
+        {
+          if (terminator == nullptr) continue;
+          Instruction *elemPtrHeartbeat = getCkptHeaderFieldPtr(ckptMemSegment, CKPT_HEADER_HEARTBEAT, "idx_heartbeat", terminator);
+          builder.SetInsertPoint(terminator);
+          Value *heartbeatIncr = addRhsOperandInt;
+          if (isTeamKernel)
+          {
+            // count each team save/restore once
+            Value *isTeamLeader = builder.CreateICmpEQ(teamThread32, builder.getInt32(0), "is_team_leader");
+            heartbeatIncr = builder.CreateZExt(isTeamLeader, Type::getInt32Ty(context), "heartbeat_incr");
+          }
+          #ifndef LLVM14_VER
+            builder.CreateAtomicRMW(AtomicRMWInst::Add, elemPtrHeartbeat, heartbeatIncr, AtomicOrdering::Monotonic);
+          #else
+            builder.CreateAtomicRMW(AtomicRMWInst::Add, elemPtrHeartbeat, heartbeatIncr, MaybeAlign(4), AtomicOrdering::Monotonic);
+          #endif
+          if (terminator == saveStartInst)
+          {
+            // the stores of the saved values stay after it
+            builder.CreateFence(AtomicOrdering::Release);
+          }
+        }
+        if (isTeamKernel && restoreBBTerminator)
+        {
+          // slices restored by the other threads must be complete before any thread resumes
+          createCkptTeamBarrier(func_ckpt_team_barrier, ckptMemSegment, teamNumThreads32, restoreBBTerminator);
+        }
+      }
+      else
+      {
       if (InjectionOption == SAVE_ONLY || InjectionOption == SAVE_RESTORE)
       {
         // add inst to saveBB
@@ -1053,6 +1870,65 @@ SubroutineInjection::injectSubroutines(
         }
         StoreInst *storeHeartBeatR = new StoreInst(addInstR, elemPtrHeartbeatR, false, restoreBBTerminator);
       }
+      }
+    }
+
+    /*
+    ++ 4.3: with -ckpt-on-demand, only save when the host requested it
+    +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++ */
+    if (isTeamKernel && (CkptOnDemandOption || CkptAdaptiveOption))
+    {
+      // the threads could disagree on whether to save, and wait for each other forever
+      std::cout << "WARNING: Team kernels save at every checkpoint; ignoring -ckpt-on-demand/-ckpt-adaptive for '" << funcName << "'." << std::endl;
+    }
+    if (CkptOnDemandOption && !isTeamKernel && (InjectionOption == SAVE_ONLY || InjectionOption == SAVE_RESTORE))
+    {
+      for (auto iter : ckptIDsCkptToposMap)
+      {
+        insertSaveRequestPoll(iter.second, ckptMemSegment);
+      }
+    }
+    /*
+    ++ 4.4: with -ckpt-adaptive, only save when the interval controller says a save is due
+    +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++ */
+    else if (CkptAdaptiveOption && !isTeamKernel && (InjectionOption == SAVE_ONLY || InjectionOption == SAVE_RESTORE))
+    {
+      for (auto iter : ckptIDsCkptToposMap)
+      {
+        insertAdaptiveIntervalPoll(iter.second, M);
+      }
+    }
+
+    /*
+    ++ 4.5: with -ckpt-tile-work, only save once the iterations since the last save did a tile of work
+    +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++ */
+    else if (CkptTileWorkOption > 0)
+    {
+      for (auto iter : ckptIDsCkptToposMap)
+      {
+        if (ckptTiling.hasCheckpoint(iter.second.checkpointBB))
+        {
+          insertTileWorkPoll(iter.second, ckptTiling, entryBB);
+        }
+      }
+    }
+
+    if (CkptOutlineColdOption)
+    {
+      for (auto iter : ckptIDsCkptToposMap)
+      {
+        BasicBlock *saveBB = iter.second.saveBB;
+        // an unconditional saveBB runs at every checkpoint; outlining it only adds a call
+        BasicBlock *saveBBPredecessor = saveBB ? saveBB->getSinglePredecessor() : nullptr;
+        if (saveBBPredecessor && saveBBPredecessor->getTerminator()->getNumSuccessors() > 1)
+        {
+          coldBBs.push_back(saveBB);
+        }
+        if (iter.second.restoreBB)
+        {
+          coldBBs.push_back(iter.second.restoreBB);
+        }
+      }
     }
 
     if (InjectionOption == RESTORE_ONLY || InjectionOption == SAVE_RESTORE)
@@ -1063,19 +1939,75 @@ SubroutineInjection::injectSubroutines(
       /* a. if CheckpointID indicates no checkpoint has been saved, continue to computation.
         b. if CheckpointID exists, jump to restoreBB for that CheckpointID. */
 
+      if (!undoLogs.empty() || incrSession)
+      {
+        // a fresh run starts with empty undo logs (a restore empties them after the rollback), and
+        // without an incremental save in progress
+        BasicBlock *freshRunBB = splitEdgeWrapper(restoreControllerBB, restoreControllerSuccessor, funcName + ".freshRunBB", M);
+        IRBuilder<> initBuilder(freshRunBB->getTerminator());
+        FunctionType *initFuncTy = FunctionType::get(Type::getVoidTy(context),
+                                                     {initBuilder.getInt8PtrTy(), initBuilder.getInt64Ty(), initBuilder.getInt64Ty()}, false);
+        for (const UndoLog &undoLog : undoLogs)
+        {
+          Function *func_ckpt_undo_log_init = getCkptRuntimeFunc(M, "ckpt_undo_log_init", initFuncTy);
+          Value *callParams[3] = {initBuilder.CreatePointerCast(undoLog.logPtr, initBuilder.getInt8PtrTy()),
+                                  initBuilder.getInt64(undoLog.capacity), initBuilder.getInt64(undoLog.arrayBytes)};
+          initBuilder.CreateCall(initFuncTy, func_ckpt_undo_log_init, callParams);
+        }
+        if (incrSession)
+        {
+          FunctionType *resetFuncTy = FunctionType::get(Type::getVoidTy(context), {initBuilder.getInt8PtrTy()}, false);
+          Function *func_ckpt_incr_reset = getCkptRuntimeFunc(M, "ckpt_incr_reset", resetFuncTy);
+          initBuilder.CreateCall(resetFuncTy, func_ckpt_incr_reset, {incrSession});
+        }
+        restoreControllerSuccessor = freshRunBB;
+      }
+
       // load CheckpointID from memory
       Instruction *terminatorInst = restoreControllerBB->getTerminator();
+      if (incrSession)
+      {
+        // an incremental save interrupted by a failure leaves the ckpt id at -1; put the last published ckpt back
+        IRBuilder<> recoverBuilder(terminatorInst);
+        Type *bytePtrTy = recoverBuilder.getInt8PtrTy();
+        FunctionType *recoverFuncTy = FunctionType::get(Type::getVoidTy(context), {bytePtrTy, bytePtrTy}, false);
+        Function *func_ckpt_incr_recover = getCkptRuntimeFunc(M, "ckpt_incr_recover", recoverFuncTy);
+        Value *callParams[2] = {recoverBuilder.CreatePointerCast(ckptMemSegment, bytePtrTy), incrSession};
+        recoverBuilder.CreateCall(recoverFuncTy, func_ckpt_incr_recover, callParams);
+      }
+      Value *intCkptId = nullptr;
+      if (CkptHeaderOption)
+      {
+        Instruction *elemPtrLoad = getCkptHeaderFieldPtr(ckptMemSegment, CKPT_HEADER_CKPT_ID, "idx_ckpt_id_load", terminatorInst);
+        LoadInst *loadCheckpointID = new LoadInst(Type::getInt32Ty(context), elemPtrLoad, "load_ckpt_id", false, terminatorInst);
+        setCkptHeaderAccessOrdering(loadCheckpointID, AtomicOrdering::Acquire);
+        intCkptId = loadCheckpointID;
+        if (ckptEpoch)
+        {
+          // a ckpt saved by an invocation with another epoch is stale; treat it as no ckpt (id 0)
+          Instruction *elemPtrEpoch = getCkptHeaderFieldPtr(ckptMemSegment, CKPT_HEADER_EPOCH, "idx_epoch_load", terminatorInst);
+          LoadInst *loadEpoch = new LoadInst(Type::getInt32Ty(context), elemPtrEpoch, "load_epoch", false, terminatorInst);
+          setCkptHeaderAccessOrdering(loadEpoch, AtomicOrdering::Monotonic);
+          builder.SetInsertPoint(terminatorInst);
+          Value *epochInt = builder.CreateIntCast(ckptEpoch, Type::getInt32Ty(context), true, "epoch");
+          Value *isSameEpoch = builder.CreateICmpEQ(loadEpoch, epochInt, "is_same_epoch");
+          intCkptId = builder.CreateSelect(isSameEpoch, loadCheckpointID, builder.getInt32(0), "ckpt_id_same_epoch");
+        }
+      }
+      else
+      {
       Value *ckptIDIndexList[1] = {ConstantInt::get(Type::getInt32Ty(context), CKPT_ID)};
       Instruction *elemPtrLoad = GetElementPtrInst::CreateInBounds(ckptMemSegContainedType, ckptMemSegment,
                                                                   ArrayRef<Value *>(ckptIDIndexList, 1), "idx_ckpt_id_load",
                                                                   terminatorInst);
       LoadInst *loadCheckpointID = new LoadInst(ckptMemSegContainedType, elemPtrLoad, "load_ckpt_id", false, terminatorInst);
-      Value *intCkptId = loadCheckpointID;
+      intCkptId = loadCheckpointID;
       // convert loaded ckpt id into int32
       if (!ckptMemSegContainedType->isIntegerTy())
       {
         intCkptId = addTypeConversionInst(loadCheckpointID, Type::getInt32Ty(context), "ckpt_id", terminatorInst);
       }
+      }
     
       /*
       ++ 5.b: Create switch instruction in restoreControllerBB
@@ -1094,6 +2026,10 @@ SubroutineInjection::injectSubroutines(
         BasicBlock *restoreBB = checkpointTopo.restoreBB;
         switchInst->addCase(checkpointID, restoreBB); // insert new jump to basic block
       }
+      // nearly every call starts from the beginning; restores are the exception
+      std::vector<uint32_t> switchWeights(numCases + 1, COLD_BRANCH_WEIGHT);
+      switchWeights[0] = HOT_BRANCH_WEIGHT;
+      switchInst->setMetadata(LLVMContext::MD_prof, MDBuilder(context).createBranchWeights(switchWeights));
     }
 
     /*
@@ -1125,6 +2061,26 @@ SubroutineInjection::injectSubroutines(
                           : p_retVal;
           }
 
+          if (CkptHeaderOption)
+          {
+            Instruction *elemPtrIsCompleteS = getCkptHeaderFieldPtr(ckptMemSegment, CKPT_HEADER_IS_COMPLETE, "idx_isComplete", Inst);
+            Value *isCompleteInt = isComplete;
+            if (isComplete->getType()->isIntegerTy() && isComplete->getType() != Type::getInt32Ty(context))
+            {
+              isCompleteInt = CastInst::CreateIntegerCast(isComplete, Type::getInt32Ty(context), true, "isComplete", Inst);
+            }
+            else if (isComplete->getType()->isFloatTy() || isComplete->getType()->isDoubleTy())
+            {
+              isCompleteInt = addTypeConversionInst(isComplete, Type::getInt32Ty(context), "isComplete", Inst);
+            }
+            else if (!isComplete->getType()->isIntegerTy())
+            {
+              isCompleteInt = ConstantInt::get(Type::getInt32Ty(context), 1);
+            }
+            new StoreInst(isCompleteInt, elemPtrIsCompleteS, false, Inst);
+            continue;
+          }
+
           // insert inst into saveBB
           Instruction *elemPtrIsCompleteS = GetElementPtrInst::CreateInBounds(ckptMemSegContainedType, ckptMemSegment,
                                                                             ArrayRef<Value *>(isCompleteIndexList, 1),
@@ -1142,6 +2098,27 @@ SubroutineInjection::injectSubroutines(
       }
     }
 
+    /*
+    = 5.4: Log the old contents of the elements stored to arrays with an undo log
+    ============================================================================= */
+    for (const UndoLog &undoLog : undoLogs)
+    {
+      insertUndoLogging(undoLog, func_ckpt_undo_log_full);
+    }
+    /*
+    = 5.5: Copy the chunks of incrementally saved arrays before they are written
+    ============================================================================= */
+    if (!incrementalArrays.empty())
+    {
+      Type *bytePtrTy = Type::getInt8PtrTy(context);
+      FunctionType *beforeWriteFuncTy = FunctionType::get(Type::getVoidTy(context), {bytePtrTy, Type::getInt32Ty(context), Type::getInt64Ty(context)}, false);
+      Function *func_ckpt_incr_before_write = getCkptRuntimeFunc(M, "ckpt_incr_before_write", beforeWriteFuncTy);
+      for (unsigned idx = 0; idx < incrementalArrays.size(); idx++)
+      {
+        insertCopyBeforeWrite(incrementalArrays[idx], idx, incrSession, func_ckpt_incr_before_write);
+      }
+    }
+
     /* ============================================================================= */
     // store map of ckpt sizes; done only after all ckpting infrastructure is completed
     funcCkptSizeMap[&F] = ckptSizeMap;
@@ -1163,6 +2140,14 @@ SubroutineInjection::injectSubroutines(
     }
   }
 
+  /*
+  = 6: Move cold saveBBs and restoreBBs out of the checkpointed functions
+  ============================================================================= */
+  for (BasicBlock *coldBB : coldBBs)
+  {
+    outlineColdBB(coldBB);
+  }
+
   /** TODO: write funcCkptSizeMap to JSON */
   JsonHelper::writeFuncCkptSizesToJson(funcCkptSizeMap, CKPT_SIZES_JSON_PATH);
 
@@ -1170,633 +2155,757 @@ SubroutineInjection::injectSubroutines(
 }
 
 void
-SubroutineInjection::propagateRestoredValuesBFS(BasicBlock *startBB, BasicBlock *prevBB, Value *oldVal, Value *newVal,
-                                                Value *originalTrackedVal,
-                                                std::map<BasicBlock *, std::set<Value *>> *visitedBBs,
-                                                const LiveValues::LivenessResult *funcBBLiveValsMap,
-                                                std::map<BasicBlock *, std::set<const Value *>> &funcSaveBBsLiveOutMap,
-                                                std::map<BasicBlock *, std::set<const Value *>> &funcRestoreBBsLiveOutMap,
-                                                std::map<BasicBlock *, std::set<const Value *>> &funcJunctionBBsLiveOutMap,
-                                                CheckpointBBOldNewValsMap *ckptBBOldNewValsMap,
-                                                std::map<const Value*, std::set<const Value*>> *allTrackedValVersions)
-{
-  std::queue<SubroutineInjection::BBUpdateRequest> q;
-
-  // track versions of values in current "thread/path" of propagation
-  std::set<Value *> valueVersions;
-  valueVersions.insert(oldVal);
-  valueVersions.insert(newVal);
-  updateAllTrackedValVersionsMap(originalTrackedVal, newVal, allTrackedValVersions, startBB->getParent()->getParent());
-
-  SubroutineInjection::BBUpdateRequest updateRequest = {
-    .startBB = startBB,
-    .currBB = startBB,
-    .prevBB = prevBB,
-    .oldVal = oldVal,
-    .newVal = newVal,
-    .valueVersions = valueVersions
-  };
-  q.push(updateRequest);
-  
-  while(!q.empty())
-  {
-    SubroutineInjection::BBUpdateRequest updateRequest = q.front();
-    q.pop();
-    processUpdateRequest(updateRequest, &q, originalTrackedVal, visitedBBs,
-                        funcBBLiveValsMap, funcSaveBBsLiveOutMap,
-                        funcRestoreBBsLiveOutMap, funcJunctionBBsLiveOutMap,
-                        ckptBBOldNewValsMap);
-    updateAllTrackedValVersionsMap(originalTrackedVal, updateRequest.newVal, allTrackedValVersions, startBB->getParent()->getParent());
-  }
-}
-
-void
-SubroutineInjection::processUpdateRequest(SubroutineInjection::BBUpdateRequest updateRequest,
-                                          std::queue<SubroutineInjection::BBUpdateRequest> *q,
-                                          Value *originalTrackedVal,
-                                          std::map<BasicBlock *, std::set<Value *>> *visitedBBs,
-                                          const LiveValues::LivenessResult *funcBBLiveValsMap,
-                                          std::map<BasicBlock *, std::set<const Value *>> &funcSaveBBsLiveOutMap,
-                                          std::map<BasicBlock *, std::set<const Value *>> &funcRestoreBBsLiveOutMap,
-                                          std::map<BasicBlock *, std::set<const Value *>> &funcJunctionBBsLiveOutMap,
-                                          CheckpointBBOldNewValsMap *ckptBBOldNewValsMap)
-{
-  BasicBlock *startBB = updateRequest.startBB;
-  BasicBlock *currBB = updateRequest.currBB;
-  BasicBlock *prevBB = updateRequest.prevBB;
-  Value *oldVal = updateRequest.oldVal;
-  Value *newVal = updateRequest.newVal;
-  std::set<Value *> valueVersions = updateRequest.valueVersions;
-
-  Function *F = currBB->getParent();
+SubroutineInjection::propagateRestoredValuesSSA(Value *originalTrackedVal, const std::vector<PHINode *> &junctionPhis,
+                                                const std::set<BasicBlock *> &checkpointBBs,
+                                                ValueVersionTracker &valVersionTracker)
+{
+  Function *F = junctionPhis.front()->getParent()->getParent();
   Module *M = F->getParent();
-
-  std::cout<<"---\n";
-  std::cout<<"prevBB:{"<<JsonHelper::getOpName(prevBB, M)<<"}\n";
-  std::cout<<"currBB:{"<<JsonHelper::getOpName(currBB, M)<<"}\n";
-  std::cout<<"oldVal="<<JsonHelper::getOpName(oldVal, M)<<"; newVal="<<JsonHelper::getOpName(newVal, M)<<"\n";
-
-  // stop after we loop back to (and re-process) startBB
-  bool isStop = currBB == startBB && visitedBBs->count(currBB);
-  std::cout<<"isStop="<<isStop<<"\n";
-
-  // tracks history of the valueVersions set across successive visits of this BB.
-  std::set<Value *> bbValueVersions = getOrDefault(currBB, visitedBBs);  // marks BB as visited (if not already)
-  // stop propagation if val versions in valueVersions and bbValueVersions match exactly.
-  bool isAllContained = true;
-  for (auto valIter : bbValueVersions)
+  std::string valName = JsonHelper::getOpName(originalTrackedVal, M).erase(0,1);
+
+  // original val is available from its definition onwards; each junctionBB phi is the
+  // version of the val that is available after its checkpoint.
+  SmallVector<PHINode *, 8> insertedPhis;
+  SSAUpdater ssaUpdater(&insertedPhis);
+  ssaUpdater.Initialize(originalTrackedVal->getType(), "new_" + valName + ".phi");
+  Instruction *defInst = dyn_cast<Instruction>(originalTrackedVal);
+  BasicBlock *defBB = (defInst != nullptr) ? defInst->getParent() : &F->getEntryBlock();
+  ssaUpdater.AddAvailableValue(defBB, originalTrackedVal);
+  for (PHINode *phi : junctionPhis)
   {
-    isAllContained = isAllContained && valueVersions.count(&*valIter);
+    ssaUpdater.AddAvailableValue(phi->getParent(), phi);
+    updateAllTrackedValVersionsMap(originalTrackedVal, phi, valVersionTracker, M);
   }
-  if (isAllContained && bbValueVersions.size() == valueVersions.size()) isStop = true;
 
-  if (hasNPredecessorsOrMore(currBB, 2)
-      && 1 < numOfPredsWhereVarIsLiveOut(currBB, originalTrackedVal, funcBBLiveValsMap,
-                                  funcSaveBBsLiveOutMap, funcRestoreBBsLiveOutMap, 
-                                  funcJunctionBBsLiveOutMap)
-  )
+  // collect uses first, since rewriting a use removes it from the use-list.
+  // This includes the uses in saveBBs and junctionBB phis, which must see the version
+  // that reaches their own checkpoint.
+  std::vector<Use *> uses;
+  for (Use &use : originalTrackedVal->uses())
   {
-    if (isPhiInstExistForIncomingBBForTrackedVal(valueVersions, currBB, prevBB))
-    {
-      std::cout<<"MODIFY EXISTING PHI NODE\n";
-      // modify existing phi input from %oldVal to %newVal
-      for (auto phiIter = currBB->phis().begin(); phiIter != currBB->phis().end(); phiIter++)
-      {
-        PHINode *phi = &*phiIter;
-        for (unsigned i = 0; i < phi->getNumIncomingValues(); i++)
-        {
-          Value *incomingValue = phi->getIncomingValue(i);
-          BasicBlock *incomingBB = phi->getIncomingBlock(i);
-          if (incomingBB == prevBB && valueVersions.count(incomingValue))
-          {
-            if (incomingValue == newVal)
-            {
-              // we've already updated this phi instruction to use newVal in a previous traversal path
-              // do not add successors to BFS queue again.
-              continue;
-            }
-            else
-            {
-              setIncomingValueForBlock(phi, incomingBB, newVal);
-              bbValueVersions.insert(valueVersions.begin(), valueVersions.end());   // copy contents of valueVersions into bbValueVersions
-              updateMapEntry(currBB, bbValueVersions, visitedBBs);
-
-              std::string phiName = JsonHelper::getOpName(phi, M);
-              std::string incomingBBName = JsonHelper::getOpName(incomingBB, M);
-              std::string valueName = JsonHelper::getOpName(incomingValue, M);
-              std::string newValName = JsonHelper::getOpName(newVal, M);
-              std::cout<<"modify "<<phiName<<": change ["<<valueName<<", "<<incomingBBName<<"] to ["<<newValName<<", "<<incomingBBName<<"]\n";
-            }
-          }
-        }
-      }
-      // Do not propagate the LHS of the modified phi node further through the cfg
-      // If it's a new phi that algo has added, it should already have been propagated by the "Add new PHI" block.
-      // If it's an existing phi that was part of the CFG before propagation, then the phi value should already be 
-      // in the correct places in the cfg and does not need to be re-propagtaed.
-    }
-    else
-    {
-      std::cout<<"ADD NEW PHI NODE\n";      
-      // make new phi node
-      std::string bbName = JsonHelper::getOpName(currBB, M).erase(0,1);
-      std::string newValName = JsonHelper::getOpName(newVal, M).erase(0,1);
-      std::vector<BasicBlock *> predecessors = getBBPredecessors(currBB);
-      Instruction *firstInst = &*(currBB->begin());
-      PHINode *newPhi = PHINode::Create(oldVal->getType(), predecessors.size(), newValName + ".phi", firstInst);
-      std::cout<<"added new phi: "<<JsonHelper::getOpName(dyn_cast<Value>(newPhi), M)<<"\n";
-      for (BasicBlock *predBB : predecessors)
-      {
-        // if pred has exit edge to startBB and val is live-out from it, add new entry in new phi instruction.
-        if (isValLiveOutofBB(predBB, originalTrackedVal, funcBBLiveValsMap,
-                            funcSaveBBsLiveOutMap, funcRestoreBBsLiveOutMap, 
-                            funcJunctionBBsLiveOutMap))
-        {
-          Value *phiInput = (predBB == prevBB) ? newVal : oldVal;
-          std::cout<<"  add to phi: {"<<JsonHelper::getOpName(phiInput, M)<<", "<<JsonHelper::getOpName(predBB, M)<<"}\n";
-          newPhi->addIncoming(phiInput, predBB);
-          valueVersions.insert(phiInput);
-        }
-      }
-
-      // update each subsequent instruction in this BB from oldVal to newPhi
-      for (auto instIter = currBB->begin(); instIter != currBB->end(); instIter++)
-      {
-        Instruction *inst = &*instIter;
-        if (inst != dyn_cast<Instruction>(newPhi))   // don't update new phi instruction
-        {
-          std::cout<<"  try updating inst '"<<JsonHelper::getOpName(dyn_cast<Value>(inst), M)<<"'\n";
-          replaceOperandsInInst(inst, oldVal, newPhi);
-        }
-        if (valueVersions.count(inst)) isStop = true;   // inst is a definition of one of the value versions.
-      }
-      valueVersions.insert(newPhi);
-      bbValueVersions.insert(valueVersions.begin(), valueVersions.end());   // copy contents of valueVersions into bbValueVersions
-      updateMapEntry(currBB, bbValueVersions, visitedBBs);
-      // replace old value in ckptBBMap with this newPhi (if curBB is part of ckptBBOldNewValsMap)
-      if (ckptBBOldNewValsMap->count(currBB)) updateCkptBBMap(currBB, newPhi, bbValueVersions, ckptBBOldNewValsMap, originalTrackedVal);
-
-      if (!isStop)
-      {
-        // add direct successors of BB to queue (convert oldVal to newPhi)
-        for (BasicBlock *succBB : getBBSuccessors(currBB))
-        {
-          if (succBB != currBB)
-          {
-            SubroutineInjection::BBUpdateRequest newUpdateRequest = {
-              .startBB = startBB,
-              .currBB = succBB,
-              .prevBB = currBB,
-              .oldVal = oldVal,
-              .newVal = newPhi,
-              .valueVersions = valueVersions
-            };
-            q->push(newUpdateRequest);
-          }
-        }
-      }
-    }
+    Instruction *user = dyn_cast<Instruction>(use.getUser());
+    if (user != nullptr && user->getParent()->getParent() == F) uses.push_back(&use);
   }
-  else
+  for (Use *use : uses)
   {
-    // update instructions in BB
-    for (auto instIter = currBB->begin(); instIter != currBB->end(); instIter++)
-    {
-      Instruction *inst = &*instIter;
-      replaceOperandsInInst(inst, oldVal, newVal);
-      if (valueVersions.count(inst)) isStop = true;  // inst is a definition of one of the value versions.
-    }
-    valueVersions.insert(newVal);
-    bbValueVersions.insert(valueVersions.begin(), valueVersions.end());   // copy contents of valueVersions into bbValueVersions
-    updateMapEntry(currBB, bbValueVersions, visitedBBs);
-    // replace old value in ckptBBMap with this newVal (if curBB is part of ckptBBOldNewValsMap)
-    if (ckptBBOldNewValsMap->count(currBB)) updateCkptBBMap(currBB, newVal, bbValueVersions, ckptBBOldNewValsMap, originalTrackedVal);
-
-    if (!isStop)
-    {
-      // add direct successors of BB to queue (convert oldVal to newVal)
-      for (BasicBlock *succBB : getBBSuccessors(currBB))
-      {
-        if (succBB != currBB)
-        {
-          SubroutineInjection::BBUpdateRequest newUpdateRequest = {
-            .startBB = startBB,
-            .currBB = succBB,
-            .prevBB = currBB,
-            .oldVal = oldVal,
-            .newVal = newVal,
-            .valueVersions = valueVersions
-          };
-          q->push(newUpdateRequest);
-        }
-      }
-    }
+    ssaUpdater.RewriteUseAfterInsertions(*use);
   }
 
-  std::cout<<"@@@ valueVersions: (";
-  for (auto valIter : valueVersions)
-  {
-    Value *val = &*valIter;
-    std::cout<<JsonHelper::getOpName(val, M)<<", ";
-  }
-  std::cout<<")"<<std::endl;
-  std::cout<<"@@@ bbValueVersions: (";
-  for (auto valIter : bbValueVersions)
+  // version that reaches the end of each checkpoint BB is the one that gets saved there.
+  // Only look at BBs the updater has already resolved, so that no unused phis are added.
+  for (BasicBlock *checkpointBB : checkpointBBs)
   {
-    Value *val = &*valIter;
-    std::cout<<JsonHelper::getOpName(val, M)<<", ";
+    if (valVersionTracker.getCurrent(checkpointBB, originalTrackedVal) == nullptr) continue;
+    if (!ssaUpdater.HasValueForBlock(checkpointBB)) continue;
+    valVersionTracker.setCurrent(checkpointBB, originalTrackedVal, ssaUpdater.GetValueAtEndOfBlock(checkpointBB));
   }
-  std::cout<<")"<<std::endl;
-}
 
-void
-SubroutineInjection::updateMapEntry(BasicBlock *key, std::set<Value *> newVal, std::map<BasicBlock *, std::set<Value *>> *map)
-{
-  if (map->count(key))
+  for (PHINode *phi : insertedPhis)
   {
-    // map::emplace will silently fail if key already exists in map, so we delete the key first.
-    map->erase(key);
+    updateAllTrackedValVersionsMap(originalTrackedVal, phi, valVersionTracker, M);
   }
-  map->emplace(key, newVal);
+  std::cout << "Propagated " << valName << ": " << uses.size() << " uses, "
+            << junctionPhis.size() << " junction phis, " << insertedPhis.size() << " new phis" << std::endl;
 }
 
-std::set<Value *>
-SubroutineInjection::getOrDefault(BasicBlock *key, std::map<BasicBlock *, std::set<Value *>> *map)
+void
+SubroutineInjection::initValueVersionTracker(const CheckpointBBMap &bbCheckpoints, ValueVersionTracker &valVersionTracker)
 {
-  if (!map->count(key))
+  for (auto &bbIt : bbCheckpoints)
   {
-    // if key not present, emplace and initialise key-value pair
-    std::set<Value *> emptySet;
-    map->emplace(key, emptySet);
+    valVersionTracker.addCheckpoint(bbIt.first, bbIt.second);
   }
-  return map->at(key);
 }
 
-const Value *
-SubroutineInjection::findKeyByValueInMap(const Value *value, std::map<const Value*, const Value*> map)
+void
+SubroutineInjection::updateAllTrackedValVersionsMap(Value *originalTrackedVal, Value *newTrackedVal,
+                                                    ValueVersionTracker &valVersionTracker, Module *M)
 {
-  for (auto it : map)
+  if (valVersionTracker.addVersion(originalTrackedVal, newTrackedVal))
   {
-    if (it.second == value) return it.first;
+    std::cout<<"£££ add "<<JsonHelper::getOpName(newTrackedVal, M)<<" to "<<JsonHelper::getOpName(originalTrackedVal, M)<<" set"<<std::endl;
   }
-  return nullptr;
-}
-
-const Value *
-SubroutineInjection::findKeyByValueInMap(Value *value, std::map<const Value*, std::set<const Value*>> map)
-{
-  for (auto it : map)
+  else
   {
-    if (it.second.count(value)) return it.first;
+    std::cout<<"£££ XX "<<JsonHelper::getOpName(newTrackedVal, M)<<" not found!"<<std::endl;
   }
-  return nullptr;
 }
 
-bool
-SubroutineInjection::isValLiveOutofBB(BasicBlock *BB, Value *val, const LiveValues::LivenessResult *funcBBLiveValsMap,
-                                      std::map<BasicBlock *, std::set<const Value *>> &funcSaveBBsLiveOutMap,
-                                      std::map<BasicBlock *, std::set<const Value *>> &funcRestoreBBsLiveOutMap,
-                                      std::map<BasicBlock *, std::set<const Value *>> &funcJunctionBBsLiveOutMap)
+std::pair<SubroutineInjection::CheckpointIdBBMap, int>
+SubroutineInjection::getCheckpointIdBBMap(
+  std::map<BasicBlock *, SubroutineInjection::CheckpointTopo> &checkpointBBTopoMap,
+  int startingCkptNum,
+  Module &M
+) const
 {
-  Function *F = BB->getParent();
-  std::set<const Value *> liveOutSet;
-  if (funcJunctionBBsLiveOutMap.count(BB))
-  {
-    // BB is a junctionBB
-    liveOutSet = funcJunctionBBsLiveOutMap.at(BB);
-  }
-  else if (funcSaveBBsLiveOutMap.count(BB)) {
-    // BB is a saveBB
-    liveOutSet = funcSaveBBsLiveOutMap.at(BB);
-  }
-  else if (funcRestoreBBsLiveOutMap.count(BB))
-  {
-    // BB is a restoreBB
-    liveOutSet = funcRestoreBBsLiveOutMap.at(BB);
-  }
-  else if (funcBBLiveValsMap->at(F).count(BB))
+  int funcCkptIDCounter = startingCkptNum;  // id=0 means no ckpt has been saved
+  CheckpointIdBBMap checkpointIdBBMap;
+  std::map<BasicBlock *, SubroutineInjection::CheckpointTopo>::iterator iter;
+  for (iter = checkpointBBTopoMap.begin(); iter != checkpointBBTopoMap.end(); ++iter)
   {
-    // BB is an original BB
-    liveOutSet = funcBBLiveValsMap->at(F).at(BB).liveOutVals;
-  }
-  return liveOutSet.count(val);
-}
+    SubroutineInjection::CheckpointTopo checkpointTopo = iter->second;
+    BasicBlock *saveBB = checkpointTopo.saveBB;
+    BasicBlock *restoreBB = checkpointTopo.restoreBB;
+    BasicBlock *junctionBB = checkpointTopo.junctionBB;
+    // append checkpoint id to saveBB and restoreBB names
+    if (saveBB != nullptr)
+    {
+      std::string saveBBName = JsonHelper::getOpName(saveBB, &M).erase(0,1) + ".id" + std::to_string(funcCkptIDCounter);
+      dyn_cast<Value>(saveBB)->setName(saveBBName);
+    }
 
-/** TODO: this should also ideally also consider the live-out set of restoreControllerBB, which is the live-out set of entryBB*/
-unsigned
-SubroutineInjection::numOfPredsWhereVarIsLiveOut(BasicBlock *BB, Value *val, const LiveValues::LivenessResult *funcBBLiveValsMap,
-                                                std::map<BasicBlock *, std::set<const Value *>> &funcSaveBBsLiveOutMap,
-                                                std::map<BasicBlock *, std::set<const Value *>> &funcRestoreBBsLiveOutMap,
-                                                std::map<BasicBlock *, std::set<const Value *>> &funcJunctionBBsLiveOutMap)
-{
-  unsigned count = 0;
-  for (auto iter = pred_begin(BB); iter != pred_end(BB); iter++)
-  {
-    BasicBlock *pred = *iter;
-    if (isValLiveOutofBB(pred, val, funcBBLiveValsMap, funcSaveBBsLiveOutMap,
-                         funcRestoreBBsLiveOutMap, funcJunctionBBsLiveOutMap))
+    if (restoreBB != nullptr)
     {
-      count ++;
-    } 
-  }
-  return count;
-}
+      std::string restoreBBName = JsonHelper::getOpName(restoreBB, &M).erase(0,1) + ".id" + std::to_string(funcCkptIDCounter);
+      dyn_cast<Value>(restoreBB)->setName(restoreBBName);
+    }
 
-bool
-SubroutineInjection::isPhiInstExistForIncomingBBForTrackedVal(std::set<Value *> valueVersions, BasicBlock *currBB, BasicBlock *prevBB)
-{
-  for (auto phiIter = currBB->phis().begin(); phiIter != currBB->phis().end(); phiIter++)
-  {
-    PHINode *phi = &*phiIter;
-    for (unsigned i = 0; i < phi->getNumIncomingValues(); i++)
+    if (junctionBB != nullptr)
     {
-      Value *incomingValue = phi->getIncomingValue(i);
-      BasicBlock *incomingBB = phi->getIncomingBlock(i);
-      if (incomingBB == prevBB && valueVersions.count(incomingValue))
-      {
-        return true;
-      }
+      std::string junctionBBName = JsonHelper::getOpName(junctionBB, &M).erase(0,1) + ".id" + std::to_string(funcCkptIDCounter);
+      dyn_cast<Value>(junctionBB)->setName(junctionBBName);
     }
+
+    checkpointIdBBMap.emplace(funcCkptIDCounter, checkpointTopo);
+    funcCkptIDCounter ++;
   }
-  return false;
+  std::pair<SubroutineInjection::CheckpointIdBBMap, int> ckptIDInfoPair(checkpointIdBBMap, funcCkptIDCounter);
+  return ckptIDInfoPair;
 }
 
-bool
-SubroutineInjection::isPhiInstForValExistInBB(Value *val, BasicBlock *BB)
+/** TODO: remove Module param when removing print statement */
+Instruction *
+SubroutineInjection::getCmpInstForCondiBrInst(Instruction *condiBranchInst, Module &M) const
 {
-  for (auto phiIter = BB->phis().begin(); phiIter != BB->phis().end(); phiIter++)
+  Value* condition = dyn_cast<BranchInst>(condiBranchInst)->getCondition();
+  Instruction *cmp_instr = nullptr;
+  while(cmp_instr == nullptr)
   {
-    PHINode *phi = &*phiIter;
-    User::op_iterator operandIter;
-    for (operandIter = phi->op_begin(); operandIter != phi->op_end(); operandIter++)
+    // attempt to find branch instr's corresponding cmp instr
+    Instruction *instr = condiBranchInst->getPrevNode();
+    
+    if (instr == nullptr) break;  // have reached list head; desired cmp instr not found
+    
+    Value *instr_val = dyn_cast<Value>(instr);
+    std::cout << "?" << JsonHelper::getOpName(instr_val, &M) << "\n";
+    if ((isa <ICmpInst> (instr) || isa <FCmpInst> (instr)) && instr == condition)
     {
-      const Value *operand = *operandIter;
-      if (operand == val) return true; 
+      cmp_instr = instr;
     }
   }
-  return false;
+  return cmp_instr;
 }
 
-bool
-SubroutineInjection::replaceOperandsInInst(Instruction *inst, Value *oldVal, Value *newVal)
+std::set<BasicBlock*>
+SubroutineInjection::getCkptBBsInFunc(Function *F, CheckpointBBMap &bbCheckpoints) const
 {
-  bool hasReplaced = false;
-  Module *M = inst->getParent()->getParent()->getParent();
-  User::op_iterator operandIter;
-  for (operandIter = inst->op_begin(); operandIter != inst->op_end(); operandIter++)
+  std::set<BasicBlock*> checkpointBBPtrSet;
+
+  Function::iterator funcIter;
+  for (funcIter = F->begin(); funcIter != F->end(); ++funcIter)
   {
-    const Value *value = *operandIter;
-    std::string valName = JsonHelper::getOpName(value, M);
-    // std::cout<<"\n\n*** "<<JsonHelper::getOpName(value, M)<<"\n\n";
-    if (value == oldVal)
+    BasicBlock* bb_ptr = &(*funcIter);
+    if (bbCheckpoints.count(bb_ptr))
     {
-      // replace old operand with new operand
-      *operandIter = newVal;
-      hasReplaced = true;
-      std::string newValName = JsonHelper::getOpName(*operandIter, M);
-      std::cout << "Replacement: OldVal=" << valName << "; NewVal=" << newValName << "\n";
+      checkpointBBPtrSet.insert(bb_ptr);
+      Module *M = F->getParent();
+      std::cout<<JsonHelper::getOpName(bb_ptr, M)<<"\n";
     }
   }
-  return hasReplaced;
+  return checkpointBBPtrSet;
 }
 
-void
-SubroutineInjection::updateCkptBBMap(BasicBlock *ckptBB, Value *newVal, std::set<Value *> bbValueVersions,
-                                    CheckpointBBOldNewValsMap *ckptBBOldNewValsMap, Value *originalTrackedVal)
+std::set<Value *>
+SubroutineInjection::getFuncParams(Function *F) const
 {
-  // if ckptBBMap contains value in valueVersions, remove value and replace it with newVal.
-  Module *M = ckptBB->getParent()->getParent();
-  std::map<const Value*, const Value*> *ckptBBOldNewTrackedVals = &ckptBBOldNewValsMap->at(ckptBB);
-  std::set<const Value*> updatedTrackedVals = getOldNewTrackedValsSets(*ckptBBOldNewTrackedVals).second;
-  for (auto val : bbValueVersions)
+  std::set<Value *> argSet;
+  Function::arg_iterator argIter;
+  for (argIter = F->arg_begin(); argIter != F->arg_end(); argIter++)
   {
-    if (updatedTrackedVals.count(val))
-    {
-      ckptBBOldNewTrackedVals->erase(originalTrackedVal);
-      ckptBBOldNewTrackedVals->emplace(originalTrackedVal, newVal);
-      std::cout<<">> "<<JsonHelper::getOpName(ckptBB, M)<<": Replaced "<<JsonHelper::getOpName(val, M)<<" with "<<JsonHelper::getOpName(newVal, M)<<std::endl;
-      break;  // there should only be one version of value in ckptBBTrackedVals set
-    }
+    Value *arg = &*argIter;
+    StringRef argName = JsonHelper::getOpName(arg, F->getParent()).erase(0,1);
+    std::cout<<"ARG: "<<argName.str()<<std::endl;
+    argSet.insert(arg);
   }
+  return argSet;
 }
 
-SubroutineInjection::CheckpointBBOldNewValsMap
-SubroutineInjection::initBBCheckpointsOldNewVals(CheckpointBBMap bbCheckpoints)
+Value *
+SubroutineInjection::getDerefValFromPointer(Value* ptrValue, const ValueVersionTracker::VersionSet &valVersions, Function *F)
 {
-  CheckpointBBOldNewValsMap bbCheckpointsOldNewVals;
-  for (auto bbIt : bbCheckpoints)
+  if (StoredValsFunc != F)
+  {
+    // index the first store to each address, instead of scanning F for every lookup
+    StoredValsByAddr.clear();
+    unsigned position = 0;
+    for (auto funcIter = F->begin(); funcIter != F->end(); ++funcIter)
+    {
+      BasicBlock *BB = &*funcIter;
+      for (auto bbIter = BB->begin(); bbIter != BB->end(); ++bbIter)
+      {
+        Instruction *Inst = &*bbIter;
+        if (isa<StoreInst>(Inst))
+        {
+          Value *storeValue = Inst->getOperand(0);
+          Value *storeAddrPtr = Inst->getOperand(1);
+          StoredValsByAddr.insert({storeAddrPtr, {position, storeValue}});
+        }
+        position ++;
+      }
+    }
+    StoredValsFunc = F;
+  }
+
+  // return value of the first store to any version of the pointer
+  const std::pair<unsigned, Value *> *firstStore = nullptr;
+  for (const Value *version : valVersions)
   {
-    std::map<const Value*, const Value*> oldNewVals;
-    const BasicBlock *bb = bbIt.first;
-    for (auto val : bbIt.second)
+    auto iter = StoredValsByAddr.find(version);
+    if (iter != StoredValsByAddr.end() && (firstStore == nullptr || iter->second.first < firstStore->first))
     {
-      oldNewVals.emplace(val, val);
+      firstStore = &iter->second;
     }
-    bbCheckpointsOldNewVals.emplace(bb, oldNewVals);
   }
-  return bbCheckpointsOldNewVals;
+  if (firstStore != nullptr)
+  {
+    return firstStore->second;
+  }
+  std::cout << "WARNING: Could not find value stored to by '" 
+            << JsonHelper::getOpName(ptrValue, F->getParent())
+            << " " << ptrValue 
+            << "'!" << std::endl;
+  return nullptr;
 }
 
-std::map<const Value *, std::set<const Value *>>
-SubroutineInjection::initAllTrackedValVersions(CheckpointBBMap bbCheckpoints)
+Instruction *
+SubroutineInjection::addTypeConversionInst(Value *val, Type *destType, std::string valName, Instruction* insertBefore)
 {
-  std::map<const Value *, std::set<const Value *>> allTrackedValVersions;
-  std::set<const Value *> allValsSet;
-  for (auto bbIt : bbCheckpoints)
+  // conditions live at a checkpoint() call (its BB is not split by SplitConditionalBB) go through an i32
+  Type *int32Ty = Type::getInt32Ty(val->getContext());
+  if (val->getType()->isIntegerTy(1))
+  {
+    Instruction *ext = new ZExtInst(val, int32Ty, "i32_"+valName, insertBefore);
+    return destType->isIntegerTy(32) ? ext : addTypeConversionInst(ext, destType, valName, insertBefore);
+  }
+  if (destType->isIntegerTy(1))
+  {
+    Value *i32Val = val->getType()->isIntegerTy(32) ? val : addTypeConversionInst(val, int32Ty, valName, insertBefore);
+    return i32Val ? new TruncInst(i32Val, destType, "i1_"+valName, insertBefore) : nullptr;
+  }
+  if (val->getType()->isIntegerTy(32) && (destType->isFloatTy() || destType->isDoubleTy()))
   {
-    std::set<const Value *> bbTrackedVals = bbIt.second;
-    allValsSet.insert(bbTrackedVals.begin(), bbTrackedVals.end());
+    return new SIToFPInst(val, destType, "fp_"+valName, insertBefore);
   }
-  for (auto val : allValsSet)
+  else if ((val->getType()->isFloatTy() || val->getType()->isDoubleTy()) && destType->isIntegerTy(32)) 
   {
-    std::set<const Value *> valVersionsSet;
-    valVersionsSet.insert(val);
-    allTrackedValVersions.emplace(val, valVersionsSet);
+    return new FPToSIInst(val, destType, "i32_"+valName, insertBefore);
   }
-  return allTrackedValVersions;
+  return nullptr;
+}
+
+int
+SubroutineInjection::getValuesStartSlot(int ckptMemSegContainedTypeSize) const
+{
+  if (!CkptHeaderOption) return VALUES_START;
+  assert(CKPT_HEADER_BYTES % ckptMemSegContainedTypeSize == 0 && "ckpt_mem header must hold a whole number of slots!");
+  return CKPT_HEADER_BYTES / ckptMemSegContainedTypeSize;
+}
+
+Instruction *
+SubroutineInjection::getCkptHeaderFieldPtr(Value *ckptMemSegment, unsigned field, std::string name, Instruction *insertBefore) const
+{
+  IRBuilder<> builder(insertBefore);
+  Type *int32Ty = builder.getInt32Ty();
+  Value *header = builder.CreatePointerCast(ckptMemSegment, int32Ty->getPointerTo(), "ckpt_header");
+  Value *indexList[1] = {builder.getInt32(field)};
+  return GetElementPtrInst::CreateInBounds(int32Ty, header, ArrayRef<Value *>(indexList, 1), name, insertBefore);
 }
 
 void
-SubroutineInjection::updateAllTrackedValVersionsMap(Value *originalTrackedVal, Value *newTrackedVal,
-                                                    std::map<const Value*, std::set<const Value*>> *allTrackedValVersions,
-                                                    Module *M)
+SubroutineInjection::setCkptHeaderAccessOrdering(Instruction *I, AtomicOrdering order) const
 {
-  if (allTrackedValVersions->count(originalTrackedVal))
+  // atomic accesses need an explicit alignment; header fields are int32s
+  if (StoreInst *storeInst = dyn_cast<StoreInst>(I))
   {
-    std::cout<<"£££ add "<<JsonHelper::getOpName(newTrackedVal, M)<<" to "<<JsonHelper::getOpName(originalTrackedVal, M)<<" set"<<std::endl;
-    std::set<const Value*> *valVersionsSet = &allTrackedValVersions->at(originalTrackedVal);
-    valVersionsSet->insert(newTrackedVal);
+    storeInst->setAtomic(order);
+    #ifndef LLVM14_VER
+      storeInst->setAlignment(4);
+    #else
+      storeInst->setAlignment(Align(4));
+    #endif
   }
-  else
+  else if (LoadInst *loadInst = dyn_cast<LoadInst>(I))
   {
-    std::cout<<"£££ XX "<<JsonHelper::getOpName(newTrackedVal, M)<<" not found!"<<std::endl;
+    loadInst->setAtomic(order);
+    #ifndef LLVM14_VER
+      loadInst->setAlignment(4);
+    #else
+      loadInst->setAlignment(Align(4));
+    #endif
   }
 }
 
-std::pair<std::set<const Value *>, std::set<const Value *>>
-SubroutineInjection::getOldNewTrackedValsSets(std::map<const Value*, const Value*> oldNewTrackedVals)
+bool
+SubroutineInjection::makeSaveBBConditional(const CheckpointTopo &checkpointTopo,
+                                           std::function<Value *(IRBuilder<> &)> getIsSaveDue)
 {
-  std::set<const Value *> originalTrackedVals;
-  std::set<const Value *> updatedTrackedVals;
-  for (auto iter : oldNewTrackedVals)
+  BasicBlock *checkpointBB = checkpointTopo.checkpointBB;
+  BasicBlock *saveBB = checkpointTopo.saveBB;
+  BasicBlock *saveBBSuccessor = saveBB->getSingleSuccessor();
+  BranchInst *checkpointBBBranch = dyn_cast<BranchInst>(checkpointBB->getTerminator());
+  if (!saveBBSuccessor || !checkpointBBBranch || checkpointBBBranch->isConditional())
+  {
+    std::cout << "WARNING: Could not make saveBB '" << saveBB->getName().str() << "' conditional; saving unconditionally." << std::endl;
+    return false;
+  }
+
+  IRBuilder<> builder(checkpointBBBranch);
+  Value *isSaveDue = getIsSaveDue(builder);
+  MDNode *unlikely = MDBuilder(checkpointBB->getContext()).createBranchWeights(COLD_BRANCH_WEIGHT, HOT_BRANCH_WEIGHT);
+  builder.CreateCondBr(isSaveDue, saveBB, saveBBSuccessor, unlikely);
+  checkpointBBBranch->eraseFromParent();
+
+  // values flowing out of saveBB are defined before it, so they are also available in checkpointBB
+  for (PHINode &phi : saveBBSuccessor->phis())
   {
-    originalTrackedVals.insert(iter.first);
-    updatedTrackedVals.insert(iter.second);
+    Value *incomingVal = phi.getIncomingValueForBlock(saveBB);
+    assert(!(isa<Instruction>(incomingVal) && cast<Instruction>(incomingVal)->getParent() == saveBB)
+           && "saveBB must not define values used after it!");
+    phi.addIncoming(incomingVal, checkpointBB);
   }
-  std::pair<std::set<const Value *>, std::set<const Value *>> pair = {originalTrackedVals, updatedTrackedVals};
-  return pair;
+  return true;
 }
 
-std::pair<SubroutineInjection::CheckpointIdBBMap, int>
-SubroutineInjection::getCheckpointIdBBMap(
-  std::map<BasicBlock *, SubroutineInjection::CheckpointTopo> &checkpointBBTopoMap,
-  int startingCkptNum,
-  Module &M
-) const
+void
+SubroutineInjection::insertSaveRequestPoll(const CheckpointTopo &checkpointTopo, Value *ckptMemSegment)
 {
-  int funcCkptIDCounter = startingCkptNum;  // id=0 means no ckpt has been saved
-  CheckpointIdBBMap checkpointIdBBMap;
-  std::map<BasicBlock *, SubroutineInjection::CheckpointTopo>::iterator iter;
-  for (iter = checkpointBBTopoMap.begin(); iter != checkpointBBTopoMap.end(); ++iter)
-  {
-    SubroutineInjection::CheckpointTopo checkpointTopo = iter->second;
-    BasicBlock *saveBB = checkpointTopo.saveBB;
-    BasicBlock *restoreBB = checkpointTopo.restoreBB;
-    BasicBlock *junctionBB = checkpointTopo.junctionBB;
-    // append checkpoint id to saveBB and restoreBB names
-    if (saveBB != nullptr)
-    {
-      std::string saveBBName = JsonHelper::getOpName(saveBB, &M).erase(0,1) + ".id" + std::to_string(funcCkptIDCounter);
-      dyn_cast<Value>(saveBB)->setName(saveBBName);
-    }
+  Type *int32Ty = Type::getInt32Ty(ckptMemSegment->getContext());
+
+  // checkpointBB: poll the request flag; is the only overhead when no save is requested
+  bool isConditional = makeSaveBBConditional(checkpointTopo, [&](IRBuilder<> &builder) {
+    Instruction *elemPtrRequest = getCkptHeaderFieldPtr(ckptMemSegment, CKPT_HEADER_SAVE_REQUEST, "idx_save_request_poll",
+                                                        &*builder.GetInsertPoint());
+    LoadInst *loadRequest = builder.CreateLoad(int32Ty, elemPtrRequest, "load_save_request");
+    setCkptHeaderAccessOrdering(loadRequest, AtomicOrdering::Monotonic);
+    return builder.CreateICmpNE(loadRequest, ConstantInt::get(int32Ty, 0), "is_save_requested");
+  });
+  if (!isConditional) return;
+
+  // saveBB: clear the request, then acknowledge the save (after the ckpt id is published)
+  Instruction *saveBBTerminator = checkpointTopo.saveBB->getTerminator();
+  Instruction *elemPtrRequestS = getCkptHeaderFieldPtr(ckptMemSegment, CKPT_HEADER_SAVE_REQUEST, "idx_save_request", saveBBTerminator);
+  StoreInst *clearRequest = new StoreInst(ConstantInt::get(int32Ty, 0), elemPtrRequestS, false, saveBBTerminator);
+  setCkptHeaderAccessOrdering(clearRequest, AtomicOrdering::Monotonic);
+  Instruction *elemPtrAck = getCkptHeaderFieldPtr(ckptMemSegment, CKPT_HEADER_SAVE_ACK, "idx_save_ack", saveBBTerminator);
+  IRBuilder<> builder(saveBBTerminator);
+  #ifndef LLVM14_VER
+    builder.CreateAtomicRMW(AtomicRMWInst::Add, elemPtrAck, ConstantInt::get(int32Ty, 1), AtomicOrdering::Release);
+  #else
+    builder.CreateAtomicRMW(AtomicRMWInst::Add, elemPtrAck, ConstantInt::get(int32Ty, 1), MaybeAlign(4), AtomicOrdering::Release);
+  #endif
+}
 
-    if (restoreBB != nullptr)
-    {
-      std::string restoreBBName = JsonHelper::getOpName(restoreBB, &M).erase(0,1) + ".id" + std::to_string(funcCkptIDCounter);
-      dyn_cast<Value>(restoreBB)->setName(restoreBBName);
-    }
+void
+SubroutineInjection::insertAdaptiveIntervalPoll(const CheckpointTopo &checkpointTopo, Module &M)
+{
+  LLVMContext &context = M.getContext();
+  Type *int32Ty = Type::getInt32Ty(context);
+  FunctionType *pollTy = FunctionType::get(int32Ty, false);
+  FunctionType *timerTy = FunctionType::get(Type::getVoidTy(context), false);
+  #ifndef LLVM14_VER
+    Function *pollFunc = cast<Function>(M.getOrInsertFunction("ckpt_interval_poll", pollTy));
+    Function *saveBeginFunc = cast<Function>(M.getOrInsertFunction("ckpt_interval_save_begin", timerTy));
+    Function *saveEndFunc = cast<Function>(M.getOrInsertFunction("ckpt_interval_save_end", timerTy));
+  #else
+    Function *pollFunc = cast<Function>(M.getOrInsertFunction("ckpt_interval_poll", pollTy).getCallee());
+    Function *saveBeginFunc = cast<Function>(M.getOrInsertFunction("ckpt_interval_save_begin", timerTy).getCallee());
+    Function *saveEndFunc = cast<Function>(M.getOrInsertFunction("ckpt_interval_save_end", timerTy).getCallee());
+  #endif
+
+  // checkpointBB: ask the controller whether a save is due
+  bool isConditional = makeSaveBBConditional(checkpointTopo, [&](IRBuilder<> &builder) {
+    Value *isDue = builder.CreateCall(pollTy, pollFunc, {}, "ckpt_interval_poll");
+    return builder.CreateICmpNE(isDue, ConstantInt::get(int32Ty, 0), "is_save_due");
+  });
+  if (!isConditional) return;
+
+  // saveBB: time the save
+  BasicBlock *saveBB = checkpointTopo.saveBB;
+  CallInst::Create(timerTy, saveBeginFunc, {}, "", saveBB->getFirstNonPHI());
+  CallInst::Create(timerTy, saveEndFunc, {}, "", saveBB->getTerminator());
+}
 
-    if (junctionBB != nullptr)
-    {
-      std::string junctionBBName = JsonHelper::getOpName(junctionBB, &M).erase(0,1) + ".id" + std::to_string(funcCkptIDCounter);
-      dyn_cast<Value>(junctionBB)->setName(junctionBBName);
-    }
+void
+SubroutineInjection::insertTileWorkPoll(const CheckpointTopo &checkpointTopo, const CheckpointTiling &ckptTiling, BasicBlock *entryBB)
+{
+  Type *int64Ty = Type::getInt64Ty(entryBB->getContext());
+  // work done since the last save; starts as a full tile, so the first checkpoint of each run saves
+  // (kernels that update their arrays in place cannot start over from a fresh run)
+  AllocaInst *tileWork = new AllocaInst(int64Ty, 0, "ckpt_tile_work", &*entryBB->getFirstInsertionPt());
+  new StoreInst(ConstantInt::get(int64Ty, CkptTileWorkOption), tileWork, false, entryBB->getTerminator());
+
+  // checkpointBB: add the work of this iteration, and save once the tile is done
+  bool isConditional = makeSaveBBConditional(checkpointTopo, [&](IRBuilder<> &builder) {
+    Value *iterWork = ckptTiling.createIterationWork(checkpointTopo.checkpointBB, builder);
+    Value *work = builder.CreateAdd(builder.CreateLoad(int64Ty, tileWork, "load_tile_work"), iterWork, "tile_work");
+    builder.CreateStore(work, tileWork);
+    return builder.CreateICmpSGE(work, ConstantInt::get(int64Ty, CkptTileWorkOption), "is_tile_done");
+  });
+  if (!isConditional) return;
+
+  // saveBB: start the next tile
+  new StoreInst(ConstantInt::get(int64Ty, 0), tileWork, false, checkpointTopo.saveBB->getTerminator());
+}
 
-    checkpointIdBBMap.emplace(funcCkptIDCounter, checkpointTopo);
-    funcCkptIDCounter ++;
+void
+SubroutineInjection::insertIncrementalSavePoll(const CheckpointTopo &checkpointTopo, Value *ckptMemSegment, Value *incrSession,
+                                               StoreInst *storeCkptId, Module &M)
+{
+  LLVMContext &context = M.getContext();
+  Type *int32Ty = Type::getInt32Ty(context);
+  Type *bytePtrTy = Type::getInt8PtrTy(context);
+  Type *voidTy = Type::getVoidTy(context);
+  FunctionType *pollTy = FunctionType::get(int32Ty, {bytePtrTy, bytePtrTy}, false);
+  FunctionType *sessionTy = FunctionType::get(voidTy, {bytePtrTy, bytePtrTy}, false);
+  FunctionType *commitTy = FunctionType::get(voidTy, {bytePtrTy, int32Ty}, false);
+  Function *pollFunc = getCkptRuntimeFunc(M, "ckpt_incr_poll", pollTy);
+  Function *beginFunc = getCkptRuntimeFunc(M, "ckpt_incr_begin", sessionTy);
+  Function *commitFunc = getCkptRuntimeFunc(M, "ckpt_incr_commit", commitTy);
+
+  // checkpointBB: copy the next chunks; only start a save once the previous one is published
+  bool isConditional = makeSaveBBConditional(checkpointTopo, [&](IRBuilder<> &builder) {
+    Value *callParams[2] = {builder.CreatePointerCast(ckptMemSegment, bytePtrTy), incrSession};
+    Value *isIdle = builder.CreateCall(pollTy, pollFunc, callParams, "ckpt_incr_poll");
+    return builder.CreateICmpNE(isIdle, ConstantInt::get(int32Ty, 0), "is_save_due");
+  });
+
+  // saveBB: back up the published values before the ckpt id is set to -1, and hand the id to the session
+  BasicBlock *saveBB = checkpointTopo.saveBB;
+  IRBuilder<> builder(saveBB->getFirstNonPHI());
+  Value *ckptMem = builder.CreatePointerCast(ckptMemSegment, bytePtrTy);
+  builder.CreateCall(sessionTy, beginFunc, {ckptMem, incrSession});
+  builder.SetInsertPoint(storeCkptId);
+  builder.CreateCall(commitTy, commitFunc, {incrSession, storeCkptId->getValueOperand()});
+  if (!isConditional)
+  {
+    // the save cannot be spread over the following sites; complete it here
+    Function *finishFunc = getCkptRuntimeFunc(M, "ckpt_incr_finish", sessionTy);
+    builder.CreateCall(sessionTy, finishFunc, {ckptMem, incrSession});
   }
-  std::pair<SubroutineInjection::CheckpointIdBBMap, int> ckptIDInfoPair(checkpointIdBBMap, funcCkptIDCounter);
-  return ckptIDInfoPair;
+  storeCkptId->eraseFromParent();
 }
 
-/** TODO: remove Module param when removing print statement */
-Instruction *
-SubroutineInjection::getCmpInstForCondiBrInst(Instruction *condiBranchInst, Module &M) const
+Function *
+SubroutineInjection::outlineColdBB(BasicBlock *BB) const
 {
-  Value* condition = dyn_cast<BranchInst>(condiBranchInst)->getCondition();
-  Instruction *cmp_instr = nullptr;
-  while(cmp_instr == nullptr)
+  Function *F = BB->getParent();
+  std::string bbName = BB->getName().str();
+
+  // restored values live in allocas of the restoreBB, which must outlive the outlined call;
+  // the restoreBB runs at most once per call, so they can move to the entry block
+  std::vector<AllocaInst *> allocas;
+  for (Instruction &I : *BB)
   {
-    // attempt to find branch instr's corresponding cmp instr
-    Instruction *instr = condiBranchInst->getPrevNode();
-    
-    if (instr == nullptr) break;  // have reached list head; desired cmp instr not found
-    
-    Value *instr_val = dyn_cast<Value>(instr);
-    std::cout << "?" << JsonHelper::getOpName(instr_val, &M) << "\n";
-    if ((isa <ICmpInst> (instr) || isa <FCmpInst> (instr)) && instr == condition)
+    AllocaInst *allocaInst = dyn_cast<AllocaInst>(&I);
+    if (!allocaInst) continue;
+    if (!isa<Constant>(allocaInst->getArraySize()))
     {
-      cmp_instr = instr;
+      std::cout << "WARNING: '" << bbName << "' has a dynamic alloca; not outlining it." << std::endl;
+      return nullptr;
     }
+    allocas.push_back(allocaInst);
+  }
+  Instruction *entryInsertPoint = &*F->getEntryBlock().getFirstInsertionPt();
+  for (AllocaInst *allocaInst : allocas)
+  {
+    allocaInst->moveBefore(entryInsertPoint);
   }
-  return cmp_instr;
-}
 
-std::set<BasicBlock*>
-SubroutineInjection::getCkptBBsInFunc(Function *F, CheckpointBBMap &bbCheckpoints) const
-{
-  std::set<BasicBlock*> checkpointBBPtrSet;
+  BasicBlock *region[1] = {BB};
+  CodeExtractor extractor(ArrayRef<BasicBlock *>(region, 1));
+  Function *coldFunc = nullptr;
+  if (extractor.isEligible())
+  {
+    #ifndef LLVM14_VER
+      coldFunc = extractor.extractCodeRegion();
+    #else
+      CodeExtractorAnalysisCache extractorCache(*F);
+      coldFunc = extractor.extractCodeRegion(extractorCache);
+    #endif
+  }
+  if (!coldFunc)
+  {
+    std::cout << "WARNING: Could not outline '" << bbName << "'." << std::endl;
+    return nullptr;
+  }
 
-  Function::iterator funcIter;
-  for (funcIter = F->begin(); funcIter != F->end(); ++funcIter)
+  #ifndef LLVM14_VER
+    coldFunc->addAttribute(AttributeList::FunctionIndex, Attribute::Cold);
+    coldFunc->addAttribute(AttributeList::FunctionIndex, Attribute::NoInline);
+  #else
+    coldFunc->addFnAttr(Attribute::Cold);
+    coldFunc->addFnAttr(Attribute::NoInline);
+  #endif
+  for (User *user : coldFunc->users())
   {
-    BasicBlock* bb_ptr = &(*funcIter);
-    if (bbCheckpoints.count(bb_ptr))
+    if (CallInst *callInst = dyn_cast<CallInst>(user))
     {
-      checkpointBBPtrSet.insert(bb_ptr);
-      Module *M = F->getParent();
-      std::cout<<JsonHelper::getOpName(bb_ptr, M)<<"\n";
+      #ifndef LLVM14_VER
+        callInst->addAttribute(AttributeList::FunctionIndex, Attribute::Cold);
+      #else
+        callInst->addFnAttr(Attribute::Cold);
+      #endif
     }
   }
-  return checkpointBBPtrSet;
+  std::cout << "Outlined '" << bbName << "' into cold function '" << coldFunc->getName().str() << "'" << std::endl;
+  return coldFunc;
 }
 
-std::set<Value *>
-SubroutineInjection::getFuncParams(Function *F) const
+Function *
+SubroutineInjection::getCkptRuntimeFunc(Module &M, StringRef funcName, bool isIndexed) const
 {
-  std::set<Value *> argSet;
-  Function::arg_iterator argIter;
-  for (argIter = F->arg_begin(); argIter != F->arg_end(); argIter++)
+  LLVMContext &C = M.getContext();
+  Type *bytePtrTy = Type::getInt8PtrTy(C);
+  FunctionType *funcTy = nullptr;
+  if (isIndexed)
   {
-    Value *arg = &*argIter;
-    StringRef argName = JsonHelper::getOpName(arg, F->getParent()).erase(0,1);
-    std::cout<<"ARG: "<<argName.str()<<std::endl;
-    argSet.insert(arg);
+    Type *indexPtrTy = Type::getInt32PtrTy(C);
+    funcTy = FunctionType::get(Type::getVoidTy(C), {bytePtrTy, bytePtrTy, indexPtrTy, indexPtrTy}, false);
   }
-  return argSet;
+  else
+  {
+    funcTy = FunctionType::get(Type::getVoidTy(C), {bytePtrTy, bytePtrTy, Type::getInt64Ty(C)}, false);
+  }
+  return getCkptRuntimeFunc(M, funcName, funcTy);
+}
+
+Function *
+SubroutineInjection::getCkptRuntimeFunc(Module &M, StringRef funcName, FunctionType *funcTy) const
+{
+  #ifndef LLVM14_VER
+    Function *func = cast<Function>(M.getOrInsertFunction(funcName, funcTy));
+  #else
+    Function *func = cast<Function>(M.getOrInsertFunction(funcName, funcTy).getCallee());
+  #endif
+  // keep the copy an opaque call, so it is not folded back into the kernel
+  #ifndef LLVM14_VER
+    func->addAttribute(AttributeList::FunctionIndex, Attribute::NoInline);
+  #else
+    func->addFnAttr(Attribute::NoInline);
+  #endif
+  return func;
+}
+
+CallInst *
+SubroutineInjection::createCkptRuntimeCopy(Function *copyFunc, Value *dst, Value *src, uint64_t numBytes,
+                                           Instruction *insertBefore) const
+{
+  IRBuilder<> builder(insertBefore);
+  Type *bytePtrTy = builder.getInt8PtrTy();
+  Value *callParams[3] = {builder.CreatePointerCast(dst, bytePtrTy),
+                          builder.CreatePointerCast(src, bytePtrTy),
+                          builder.getInt64(numBytes)};
+  return builder.CreateCall(copyFunc->getFunctionType(), copyFunc, callParams);
+}
+
+int
+SubroutineInjection::getDescriptorKind(Value *val, Type *ckptMemSegContainedType, const DataLayout &DL, int &conv, int &valueBytes) const
+{
+  Type *valType = val->getType();
+  conv = CKPT_DESC_CONV_NONE;
+  valueBytes = 0;
+  if (valType->isPointerTy())
+  {
+    Type *containedType = valType->getContainedType(0);
+    if (containedType->isArrayTy()) return CKPT_DESC_ARRAY;
+    if (containedType->isPointerTy()) return CKPT_DESC_ARRAY_INDIRECT;
+    valType = containedType;
+  }
+  // the same conversions as addTypeConversionInst
+  if (valType->isIntegerTy(32) && ckptMemSegContainedType->isFloatTy())
+  {
+    conv = CKPT_DESC_CONV_I32_F32;
+  }
+  else if (valType->isIntegerTy(32) && ckptMemSegContainedType->isDoubleTy())
+  {
+    conv = CKPT_DESC_CONV_I32_F64;
+  }
+  else if (valType != ckptMemSegContainedType)
+  {
+    return -1;
+  }
+  valueBytes = DL.getTypeStoreSize(valType);
+  if (valueBytes > CKPT_DESC_SPILL_FIELD_BYTES) return -1;
+  return (valType == val->getType()) ? CKPT_DESC_VALUE : CKPT_DESC_SCALAR_PTR;
+}
+
+CallInst *
+SubroutineInjection::createDescriptorCall(Function *descFunc, Value *ckptMemSegment, AllocaInst *spill, Instruction *insertBefore) const
+{
+  IRBuilder<> builder(insertBefore);
+  Type *bytePtrTy = builder.getInt8PtrTy();
+  Value *callParams[4] = {builder.CreatePointerCast(ckptMemSegment, bytePtrTy),
+                          ConstantPointerNull::get(cast<PointerType>(bytePtrTy)),
+                          builder.getInt32(0),
+                          builder.CreatePointerCast(spill, bytePtrTy)};
+  return builder.CreateCall(descFunc->getFunctionType(), descFunc, callParams);
+}
+
+void
+SubroutineInjection::addDescriptor(DescriptorTable &table, int kind, int conv, unsigned spillField, int64_t ckptOffset, int64_t numBytes,
+                                   int64_t arrayOffset) const
+{
+  CallInst *call = table.saveCall ? table.saveCall : table.restoreCall;
+  LLVMContext &C = call->getContext();
+  Type *int8Ty = Type::getInt8Ty(C);
+  Type *int16Ty = Type::getInt16Ty(C);
+  Type *int32Ty = Type::getInt32Ty(C);
+  assert(ckptOffset <= std::numeric_limits<uint32_t>::max() && numBytes <= std::numeric_limits<uint32_t>::max()
+         && "ckpt_desc_t offsets are 32-bit!");
+  // mirrors ckpt_desc_t
+  StructType *descTy = StructType::get(C, {int8Ty, int8Ty, int16Ty, int32Ty, int32Ty, int32Ty});
+  table.descs.push_back(ConstantStruct::get(descTy, {ConstantInt::get(int8Ty, kind),
+                                                     ConstantInt::get(int8Ty, conv),
+                                                     ConstantInt::get(int16Ty, spillField),
+                                                     ConstantInt::get(int32Ty, ckptOffset),
+                                                     ConstantInt::get(int32Ty, numBytes),
+                                                     ConstantInt::get(int32Ty, arrayOffset)}));
 }
 
 Value *
-SubroutineInjection::getDerefValFromPointer(Value* ptrValue, std::set<const Value *> valVersions, Function *F) const
+SubroutineInjection::getDescriptorSpillField(AllocaInst *spill, unsigned idx, Type *fieldType, Instruction *insertBefore) const
+{
+  IRBuilder<> builder(insertBefore);
+  Value *field = builder.CreateConstInBoundsGEP2_32(spill->getAllocatedType(), spill, 0, idx);
+  return builder.CreatePointerCast(field, fieldType->getPointerTo());
+}
+
+void
+SubroutineInjection::finishDescriptorTable(DescriptorTable &table, Module &M, std::string name) const
 {
-  for (auto funcIter = F->begin(); funcIter != F->end(); ++funcIter)
+  CallInst *calls[2] = {table.saveCall, table.restoreCall};
+  if (table.descs.empty())
   {
-    BasicBlock *BB = &*funcIter;
-    for (auto bbIter = BB->begin(); bbIter != BB->end(); ++bbIter)
+    for (CallInst *call : calls)
     {
-      Instruction *Inst = &*bbIter;
-      if (isa<StoreInst>(Inst))
-      {
-        Value *storeValue = Inst->getOperand(0);
-        Value *storeAddrPtr = Inst->getOperand(1);
-        if (valVersions.count(storeAddrPtr))
-        {
-          return storeValue;
-        }
-      }
+      if (call) call->eraseFromParent();
     }
+    return;
+  }
+  ArrayType *tableTy = ArrayType::get(table.descs[0]->getType(), table.descs.size());
+  GlobalVariable *tableVar = new GlobalVariable(M, tableTy, true, GlobalValue::PrivateLinkage,
+                                                ConstantArray::get(tableTy, table.descs), name);
+  for (CallInst *call : calls)
+  {
+    if (!call) continue;
+    call->setArgOperand(1, ConstantExpr::getPointerCast(tableVar, call->getArgOperand(1)->getType()));
+    call->setArgOperand(2, ConstantInt::get(Type::getInt32Ty(M.getContext()), table.descs.size()));
   }
-  std::cout << "WARNING: Could not find value stored to by '" 
-            << JsonHelper::getOpName(ptrValue, F->getParent())
-            << " " << ptrValue 
-            << "'!" << std::endl;
-  return nullptr;
 }
 
-Instruction *
-SubroutineInjection::addTypeConversionInst(Value *val, Type *destType, std::string valName, Instruction* insertBefore)
+CallInst *
+SubroutineInjection::createCkptLossyCopy(Function *lossyFunc, Value *dst, Value *src, int64_t numElems, double maxError,
+                                         Instruction *insertBefore) const
 {
-  if (val->getType()->isIntegerTy(32) && (destType->isFloatTy() || destType->isDoubleTy()))
-  {
-    return new SIToFPInst(val, destType, "fp_"+valName, insertBefore);
-  }
-  else if ((val->getType()->isFloatTy() || val->getType()->isDoubleTy()) && destType->isIntegerTy(32)) 
+  IRBuilder<> builder(insertBefore);
+  FunctionType *funcTy = lossyFunc->getFunctionType();
+  if (funcTy->getNumParams() == 2)
   {
-    return new FPToSIInst(val, destType, "i32_"+valName, insertBefore);
+    // decode: the encoded array holds its #elements and error
+    Value *callParams[2] = {builder.CreatePointerCast(dst, funcTy->getParamType(0)),
+                            builder.CreatePointerCast(src, funcTy->getParamType(1))};
+    return builder.CreateCall(funcTy, lossyFunc, callParams);
   }
-  return nullptr;
+  Value *callParams[4] = {builder.CreatePointerCast(dst, funcTy->getParamType(0)),
+                          builder.CreatePointerCast(src, funcTy->getParamType(1)),
+                          builder.getInt64(numElems),
+                          ConstantFP::get(builder.getDoubleTy(), maxError)};
+  return builder.CreateCall(funcTy, lossyFunc, callParams);
+}
+
+int
+SubroutineInjection::createCkptDedupCopy(Function *dedupFunc, Value *ckptMemSegment, Value *dst, Value *src, uint64_t numBytes,
+                                         int tableSlot, Value *hashesValid, Instruction *insertBefore) const
+{
+  IRBuilder<> builder(insertBefore);
+  Type *ckptMemSegContainedType = ckptMemSegment->getType()->getContainedType(0);
+  int ckptMemSegContainedTypeSize = insertBefore->getModule()->getDataLayout().getTypeAllocSizeInBits(ckptMemSegContainedType) / 8;
+  // small chunks of a large array make a large table: slots are counted in 64 bits
+  int64_t slot = tableSlot;
+  while ((slot * ckptMemSegContainedTypeSize) % sizeof(uint64_t) != 0) slot++;
+  uint64_t numChunks = divideCeil(numBytes, CkptDedupChunkBytesOption);
+  Value *table = builder.CreateInBoundsGEP(ckptMemSegContainedType, ckptMemSegment, builder.getInt64(slot));
+  Type *bytePtrTy = builder.getInt8PtrTy();
+  Value *callParams[6] = {builder.CreatePointerCast(dst, bytePtrTy),
+                          builder.CreatePointerCast(src, bytePtrTy),
+                          builder.getInt64(numBytes),
+                          builder.getInt64(CkptDedupChunkBytesOption),
+                          builder.CreatePointerCast(table, builder.getInt64Ty()->getPointerTo()),
+                          hashesValid};
+  builder.CreateCall(dedupFunc->getFunctionType(), dedupFunc, callParams);
+  slot += divideCeil(numChunks * sizeof(uint64_t), ckptMemSegContainedTypeSize);
+  return slot - tableSlot;
+}
+
+int
+SubroutineInjection::alignSlotToCacheLine(int slot, int ckptMemSegContainedTypeSize) const
+{
+  int slotsPerLine = CKPT_CACHE_LINE_BYTES / ckptMemSegContainedTypeSize;
+  return ((slot + slotsPerLine - 1) / slotsPerLine) * slotsPerLine;
+}
+
+Instruction *
+SubroutineInjection::createTeamSlotBase(Value *teamThread, Instruction *insertBefore) const
+{
+  // the layout is only known once all values of the ckpt are placed; see setTeamSlotLayout
+  Type *int32Ty = Type::getInt32Ty(insertBefore->getContext());
+  Instruction *threadOffset = BinaryOperator::CreateMul(teamThread, ConstantInt::get(int32Ty, 0), "team_thread_offset", insertBefore);
+  return BinaryOperator::CreateAdd(threadOffset, ConstantInt::get(int32Ty, 0), "team_slot", insertBefore);
+}
+
+void
+SubroutineInjection::setTeamSlotLayout(Instruction *teamSlotBase, int privateStartSlot, int threadStrideSlots) const
+{
+  Type *int32Ty = teamSlotBase->getType();
+  Instruction *threadOffset = cast<Instruction>(teamSlotBase->getOperand(0));
+  threadOffset->setOperand(1, ConstantInt::get(int32Ty, threadStrideSlots));
+  teamSlotBase->setOperand(1, ConstantInt::get(int32Ty, privateStartSlot));
+}
+
+CallInst *
+SubroutineInjection::createCkptTeamCopy(Function *teamCopyFunc, Value *dst, Value *src, uint64_t numBytes,
+                                        Value *teamThread, Value *teamNumThreads, Instruction *insertBefore) const
+{
+  IRBuilder<> builder(insertBefore);
+  Type *bytePtrTy = builder.getInt8PtrTy();
+  Value *callParams[5] = {builder.CreatePointerCast(dst, bytePtrTy),
+                          builder.CreatePointerCast(src, bytePtrTy),
+                          builder.getInt64(numBytes),
+                          teamThread,
+                          teamNumThreads};
+  return builder.CreateCall(teamCopyFunc->getFunctionType(), teamCopyFunc, callParams);
+}
+
+CallInst *
+SubroutineInjection::createCkptTeamBarrier(Function *teamBarrierFunc, Value *ckptMemSegment, Value *teamNumThreads,
+                                           Instruction *insertBefore) const
+{
+  IRBuilder<> builder(insertBefore);
+  Value *callParams[2] = {builder.CreatePointerCast(ckptMemSegment, builder.getInt8PtrTy(), "ckpt_mem_team"),
+                          teamNumThreads};
+  return builder.CreateCall(teamBarrierFunc->getFunctionType(), teamBarrierFunc, callParams);
 }
 
 Value *
-SubroutineInjection::getSelectedFuncParam(std::set<Value *> funcParams, StringRef segmentName, Module *M) const
+SubroutineInjection::getSelectedFuncParam(const std::set<Value *> &funcParams, StringRef segmentName, Module *M) const
 {
   for (auto iter : funcParams)
   {
     Value *arg = &*iter;
-    StringRef argName = JsonHelper::getOpName(arg, M).erase(0,1);
-    if (argName.equals(segmentName)) 
+    std::string argName = JsonHelper::getOpName(arg, M).erase(0,1);
+    if (segmentName.equals(argName))
     {
-      std::cout<<"Found target memory segment ARG: "<<argName.str()<<std::endl;
+      std::cout<<"Found target memory segment ARG: "<<argName<<std::endl;
       return arg;  
     }
   }
@@ -1904,6 +3013,10 @@ SubroutineInjection::getFuncValuePtrsMap(Module &M, LiveValues::TrackedValuesMap
     // std::set<const Value*> valuePtrsSet;
     std::map<std::string, const Value*> valuePtrsMap;
 
+    // number unnamed vals once for the whole function (instead of once per operand)
+    ModuleSlotTracker MST(&M);
+    MST.incorporateFunction(F);
+
     Function::iterator bbIter;
     for (bbIter = F.begin(); bbIter != F.end(); ++bbIter)
     {
@@ -1916,7 +3029,7 @@ SubroutineInjection::getFuncValuePtrsMap(Module &M, LiveValues::TrackedValuesMap
         for (operand = instrIter->op_begin(); operand != instrIter->op_end(); ++operand)
         {
           const Value *value = *operand;
-          std::string valName = JsonHelper::getOpName(value, &M);
+          std::string valName = JsonHelper::getOpName(value, MST);
 
           // valuePtrsSet.insert(valuePtr);
           valuePtrsMap.emplace(valName, value);
@@ -1929,7 +3042,7 @@ SubroutineInjection::getFuncValuePtrsMap(Module &M, LiveValues::TrackedValuesMap
 }
 
 long unsigned int
-SubroutineInjection::getMaxNumOfTrackedValsForBBs(LiveValues::BBTrackedVals &bbTrackedVals) const
+SubroutineInjection::getMaxNumOfTrackedValsForBBs(const LiveValues::BBTrackedVals &bbTrackedVals) const
 {    
   auto maxElem = std::max_element(bbTrackedVals.cbegin(), bbTrackedVals.cend(),
                                   [](const auto &a, const auto &b)
@@ -1940,7 +3053,7 @@ SubroutineInjection::getMaxNumOfTrackedValsForBBs(LiveValues::BBTrackedVals &bbT
 }
 
 SubroutineInjection::CheckpointBBMap
-SubroutineInjection::chooseBBWithLeastTrackedVals(LiveValues::BBTrackedVals bbTrackedVals, Function *F,
+SubroutineInjection::chooseBBWithLeastTrackedVals(const LiveValues::BBTrackedVals &bbTrackedVals, Function *F,
                                                   long unsigned int minValsCount) const
 { 
   CheckpointBBMap cpBBMap;
@@ -1995,7 +3108,7 @@ SubroutineInjection::chooseBBWithLeastTrackedVals(LiveValues::BBTrackedVals bbTr
 }
 
 LiveValues::BBTrackedVals
-SubroutineInjection::getBBsWithOneSuccessor(LiveValues::BBTrackedVals bbTrackedVals) const
+SubroutineInjection::getBBsWithOneSuccessor(const LiveValues::BBTrackedVals &bbTrackedVals) const
 {
   LiveValues::BBTrackedVals filteredBBTrackedVals;
   LiveValues::BBTrackedVals::const_iterator funcIter;
@@ -2003,7 +3116,17 @@ SubroutineInjection::getBBsWithOneSuccessor(LiveValues::BBTrackedVals bbTrackedV
   {
     const BasicBlock *BB = funcIter->first;
     const std::set<const Value *> &trackedValues = funcIter->second;
-    if (BB->getTerminator()->getNumSuccessors() == 1)
+    // a BB with a checkpoint() call is split right after it (chooseBBWithCheckpointDirective),
+    // so the checkpoint BB has one successor whatever BB's terminator is
+    bool hasCheckpointCall = false;
+    for (const Instruction &I : *BB)
+    {
+      const CallInst *call = dyn_cast<CallInst>(&I);
+      if (!call || !call->getCalledFunction()) continue;
+      StringRef name = call->getCalledFunction()->getName();
+      if (name.contains("checkpoint") && !name.contains("checkpoint_")) hasCheckpointCall = true;
+    }
+    if (BB->getTerminator()->getNumSuccessors() == 1 || hasCheckpointCall)
     {
       filteredBBTrackedVals.emplace(BB, trackedValues);
     }
@@ -2012,7 +3135,7 @@ SubroutineInjection::getBBsWithOneSuccessor(LiveValues::BBTrackedVals bbTrackedV
 }
 
 LiveValues::BBTrackedVals
-SubroutineInjection::removeSelectedTrackedVals(LiveValues::BBTrackedVals bbTrackedVals, std::set<Value *> ignoredValues) const
+SubroutineInjection::removeSelectedTrackedVals(const LiveValues::BBTrackedVals &bbTrackedVals, const std::set<Value *> &ignoredValues) const
 {
   LiveValues::BBTrackedVals filteredBBTrackedVals;
   LiveValues::BBTrackedVals::const_iterator funcIter;
@@ -2058,7 +3181,7 @@ SubroutineInjection::removeSelectedTrackedVals(LiveValues::BBTrackedVals bbTrack
 }
 
 LiveValues::BBTrackedVals
-SubroutineInjection::removeMatchedNestedPtrVals(LiveValues::BBTrackedVals bbTrackedVals, StringRef matchStr) const
+SubroutineInjection::removeMatchedNestedPtrVals(const LiveValues::BBTrackedVals &bbTrackedVals, StringRef matchStr) const
 {
   LiveValues::BBTrackedVals filteredBBTrackedVals;
   LiveValues::BBTrackedVals::const_iterator funcIter;
@@ -2093,7 +3216,7 @@ SubroutineInjection::removeMatchedNestedPtrVals(LiveValues::BBTrackedVals bbTrac
 }
 
 LiveValues::BBTrackedVals
-SubroutineInjection::removeBBsWithNoTrackedVals(LiveValues::BBTrackedVals bbTrackedVals) const
+SubroutineInjection::removeBBsWithNoTrackedVals(const LiveValues::BBTrackedVals &bbTrackedVals) const
 {
   LiveValues::BBTrackedVals filteredBBTrackedVals;
   LiveValues::BBTrackedVals::const_iterator funcIter;
@@ -2124,13 +3247,13 @@ SubroutineInjection::printCheckPointBBs(const CheckpointFuncBBMap &fBBMap, Modul
   std::set<const Value *>::const_iterator valIt;
   for (funcIt = fBBMap.cbegin(); funcIt != fBBMap.cend(); funcIt++){
     const Function *func = funcIt->first;
-    const CheckpointBBMap bbMap = funcIt->second;
+    const CheckpointBBMap &bbMap = funcIt->second;
 
     std::cout << "Checkpoint candidate BBs for '" << JsonHelper::getOpName(func, &M) << "':\n";
     for (bbIt = bbMap.cbegin(); bbIt != bbMap.cend(); bbIt++)
     {
       const BasicBlock *bb = bbIt->first;
-      const std::set<const Value *> vals = bbIt->second;
+      const std::set<const Value *> &vals = bbIt->second;
       std::cout << "  BB: " << JsonHelper::getOpName(bb, &M) << "\n    ";
     
       for (valIt = vals.cbegin(); valIt != vals.cend(); valIt++)
@@ -2147,14 +3270,14 @@ SubroutineInjection::printCheckPointBBs(const CheckpointFuncBBMap &fBBMap, Modul
 }
 
 void
-SubroutineInjection::printCheckpointIdBBMap(SubroutineInjection::CheckpointIdBBMap map, Function *F)
+SubroutineInjection::printCheckpointIdBBMap(const SubroutineInjection::CheckpointIdBBMap &map, Function *F)
 {
   Module *M = F->getParent();
   std::cout << "\nXXX ----CHECKPOINTS for '" << JsonHelper::getOpName(F, M) << "'---- XXX\n";
   SubroutineInjection::CheckpointIdBBMap::const_iterator iter;
   for (iter = map.cbegin(); iter != map.cend(); ++iter)
   {
-    uint8_t id = iter->first;
+    unsigned id = iter->first;
     CheckpointTopo topo = iter->second;
     std::cout << "ID = " << std::to_string(id) << "\n";
     std::cout << "CheckpointBB = " << JsonHelper::getOpName(topo.checkpointBB, M) << "\n";
@@ -2166,21 +3289,20 @@ SubroutineInjection::printCheckpointIdBBMap(SubroutineInjection::CheckpointIdBBM
 }
 
 void
-SubroutineInjection::printFuncValuePtrsMap(SubroutineInjection::FuncValuePtrsMap map, Module &M)
+SubroutineInjection::printFuncValuePtrsMap(const SubroutineInjection::FuncValuePtrsMap &map, Module &M)
 {
   SubroutineInjection::FuncValuePtrsMap::const_iterator iter;
   for (iter = map.cbegin(); iter != map.cend(); ++iter)
   {
     const Function *func = iter->first;
-    std::map<std::string, const Value*> valuePtrsMap = iter->second;
+    const std::map<std::string, const Value*> &valuePtrsMap = iter->second;
     std::cout << func->getName().str() << ":\n";
 
-    std::map<std::string, const Value*>::iterator it;
+    std::map<std::string, const Value*>::const_iterator it;
     for (it = valuePtrsMap.begin(); it != valuePtrsMap.end(); ++it)
     {
-      std::string valName = it->first;
-      const Value* val = it->second;
-      std::cout << "  " << valName << " {" << JsonHelper::getOpName(val, &M) << "}\n";
+      // the key is the value's name; naming the value again would re-number the function
+      std::cout << "  " << it->first << "\n";
     }
     // std::cout << "## size = " << valuePtrsMap.size() << "\n";
   }
@@ -2188,7 +3310,7 @@ SubroutineInjection::printFuncValuePtrsMap(SubroutineInjection::FuncValuePtrsMap
 
 
 SubroutineInjection::CheckpointBBMap
-SubroutineInjection::chooseBBWithCheckpointDirective(LiveValues::BBTrackedVals bbTrackedVals, Function *F)
+SubroutineInjection::chooseBBWithCheckpointDirective(const LiveValues::BBTrackedVals &bbTrackedVals, Function *F)
 {
   std::cout << "\n\n\n\n **************** chooseBBWithCheckpointDirective ********* \n\n" << std::endl;
   Module *M = F->getParent();
@@ -2265,19 +3387,27 @@ SubroutineInjection::chooseBBWithCheckpointDirective(LiveValues::BBTrackedVals b
         if(name.contains("checkpoint")){
           std::cout << "\n contain checkpoint \n";
           // ensure that we have tracked-values information on the selected checkpoint BB
-          for (bbIt = bbTrackedVals.cbegin(); bbIt != bbTrackedVals.cend(); bbIt++)
+          bbIt = bbTrackedVals.find(BB);
+          if (bbIt != bbTrackedVals.cend())
           {
-            const BasicBlock *trackedBB = bbIt->first;
-            const std::set<const Value *> &trackedVals = bbIt->second;
-            std::cout<<"  trackedBB="<<JsonHelper::getOpName(trackedBB, M)<<std::endl;
-            if (trackedBB == BB)
+            std::cout << "\n BB added" << std::endl;
+            curr_BB_added = true;
+            cpBBMap.emplace(bbIt->first, bbIt->second);
+            // the tracked vals are those live at the call; split the BB after it so that the checkpoint is placed there
+            // (also when only the terminator follows, if it does not have one successor)
+            Instruction *nextInst = inst->getNextNode();
+            if (nextInst != BB->getTerminator() || BB->getTerminator()->getNumSuccessors() != 1)
             {
-              std::cout << "\n BB added" << std::endl;
-              curr_BB_added = true;
-              cpBBMap.emplace(trackedBB, trackedVals);
-              inst->eraseFromParent();
-              break;  // break out of bbTrackedVals for-loop
+              std::string resumeBBName = JsonHelper::getOpName(BB, M).erase(0,1) + ".ckpt.resume";
+              BB->splitBasicBlock(nextInst, resumeBBName);
+              std::cout << "Split BB after checkpoint call; resumes at '" << resumeBBName << "'" << std::endl;
             }
+            inst->eraseFromParent();
+          }
+          else if (!name.contains("checkpoint_"))
+          {
+            std::cout << "WARNING: checkpoint() in '" << JsonHelper::getOpName(BB, M)
+                      << "' has no values left to save. Ignore checkpoint." << std::endl;
           }
         }
         if(curr_BB_added) break; // break out of inst for-loop
@@ -2289,26 +3419,783 @@ SubroutineInjection::chooseBBWithCheckpointDirective(LiveValues::BBTrackedVals b
 }
 
 
-std::tuple<llvm::Value*, Value*>
-SubroutineInjection::getOffsetArray(Value* v, Function &F){
-  Value* offset = nullptr;
-  Function::iterator BBIter;
-  for (BBIter = F.begin(); BBIter != F.end(); ++BBIter){
-    BasicBlock* BB = &(*BBIter);
-    BasicBlock::iterator instrIter;
-    for (instrIter = BB->begin(); instrIter != BB->end(); ++instrIter){
-      Instruction* I =  &(*instrIter);
-      if (I == v){
-        //Found affectation
-        if (I->getOpcode() == Instruction::GetElementPtr){
-          Value* value;
-          std::tie(value, offset) = getOffsetArray(I->getOperand(0), F);
-          offset = I->getOperand(1);
-          return std::tuple<llvm::Value*, Value*>{value, offset};
+AllocaInst *
+SubroutineInjection::getDirectiveBuffer(Value *ptr, const DataLayout &DL, int64_t &offsetBytes) const
+{
+  offsetBytes = 0;
+  Value *V = ptr;
+  while (true)
+  {
+    if (auto *cast = dyn_cast<BitCastOperator>(V))
+    {
+      V = cast->getOperand(0);
+    }
+    else if (auto *gep = dyn_cast<GEPOperator>(V))
+    {
+      APInt gepOffset(DL.getIndexTypeSizeInBits(gep->getType()), 0);
+      if (offsetBytes >= 0 && gep->accumulateConstantOffset(DL, gepOffset))
+      {
+        offsetBytes += gepOffset.getSExtValue();
+      }
+      else
+      {
+        offsetBytes = -1;
+      }
+      V = gep->getPointerOperand();
+    }
+    else break;
+  }
+
+  // array passed to the function: ptr is based on the pointer loaded from its alloca
+  if (auto *load = dyn_cast<LoadInst>(V))
+  {
+    auto *ptrAlloca = dyn_cast<AllocaInst>(load->getPointerOperand()->stripPointerCasts());
+    if (ptrAlloca && ptrAlloca->getAllocatedType()->isPointerTy()) return ptrAlloca;
+    return nullptr;
+  }
+  // local array or scalar (a pointer alloca itself only holds an address)
+  auto *alloca = dyn_cast<AllocaInst>(V);
+  if (alloca && !alloca->getAllocatedType()->isPointerTy()) return alloca;
+  return nullptr;
+}
+
+
+void
+SubroutineInjection::getCheckpointRegionDirectives(Function &F, CheckpointRegionMap &regions, std::set<Value *> &excluded,
+                                                   UndoLogEntriesMap &undoLogEntries, LossyErrorMap &lossyErrors)
+{
+  Module *M = F.getParent();
+  const DataLayout &DL = M->getDataLayout();
+  std::vector<CallInst *> directives;
+  std::vector<Instruction *> ckptCalls;
+  std::set<AllocaInst *> excludedBuffers;
+
+  for (BasicBlock &BB : F)
+  {
+    for (Instruction &I : BB)
+    {
+      CallInst *call = dyn_cast<CallInst>(&I);
+      if (!call || !call->getCalledFunction()) continue;
+      StringRef name = call->getCalledFunction()->getName();
+      bool isRegion = name.contains(REGION_DIRECTIVE_NAME);
+      bool isExclude = name.contains(EXCLUDE_DIRECTIVE_NAME);
+      bool isUndoLog = name.contains(UNDO_LOG_DIRECTIVE_NAME);
+      bool isLossy = name.contains(LOSSY_DIRECTIVE_NAME);
+      if (!isRegion && !isExclude && !isUndoLog && !isLossy)
+      {
+        if (name.contains("checkpoint")) ckptCalls.push_back(call);
+        continue;
+      }
+      directives.push_back(call);
+
+      int64_t offsetBytes = 0;
+      AllocaInst *buffer = (call->arg_size() > 0) ? getDirectiveBuffer(call->getArgOperand(0), DL, offsetBytes) : nullptr;
+      if (!buffer)
+      {
+        std::cout << "WARNING: " << name.str() << " in '" << JsonHelper::getOpName(&F, M)
+                  << "' does not point into a local array or an array argument; ignoring directive." << std::endl;
+        continue;
+      }
+      std::string bufferName = JsonHelper::getOpName(buffer, M);
+      if (isExclude)
+      {
+        excludedBuffers.insert(buffer);
+        continue;
+      }
+      if (isUndoLog)
+      {
+        // the log rolls back the array in place, so the array must outlive the failed run
+        ConstantInt *maxEntries = (call->arg_size() > 1) ? dyn_cast<ConstantInt>(call->getArgOperand(1)) : nullptr;
+        if (!maxEntries || maxEntries->isZero() || !buffer->getAllocatedType()->isPointerTy())
+        {
+          std::cout << "WARNING: " << UNDO_LOG_DIRECTIVE_NAME << " for '" << bufferName
+                    << "' needs an array argument and a constant, non-zero number of entries; saving the whole array." << std::endl;
+          continue;
+        }
+        undoLogEntries[buffer] = maxEntries->getZExtValue();
+        continue;
+      }
+      if (isLossy)
+      {
+        ConstantFP *maxError = (call->arg_size() > 1) ? dyn_cast<ConstantFP>(call->getArgOperand(1)) : nullptr;
+        if (!maxError || !(maxError->getValueAPF().convertToDouble() > 0))
+        {
+          std::cout << "WARNING: " << LOSSY_DIRECTIVE_NAME << " for '" << bufferName
+                    << "' needs a constant, positive max error; saving the array losslessly." << std::endl;
+          continue;
+        }
+        lossyErrors[buffer] = maxError->getValueAPF().convertToDouble();
+        std::cout << "Lossy saves of '" << bufferName << "' with max absolute error " << lossyErrors[buffer] << std::endl;
+        continue;
+      }
+
+      ConstantInt *len = (call->arg_size() > 1) ? dyn_cast<ConstantInt>(call->getArgOperand(1)) : nullptr;
+      if (!len || offsetBytes < 0)
+      {
+        std::cout << "WARNING: " << REGION_DIRECTIVE_NAME << " for '" << bufferName
+                  << "' needs a constant offset and length; saving the whole array." << std::endl;
+        continue;
+      }
+      regions[buffer] = {(uint64_t)offsetBytes, len->getZExtValue()};
+      std::cout << "Checkpoint region of '" << bufferName << "': bytes [" << offsetBytes << ", "
+                << offsetBytes + len->getZExtValue() << ")" << std::endl;
+    }
+  }
+
+  // an excluded buffer is only dropped from the saves if a resumed run cannot read its stale contents
+  if (!excludedBuffers.empty())
+  {
+    DominatorTree DT(F);
+    LoopInfo LI(DT);
+    for (AllocaInst *buffer : excludedBuffers)
+    {
+      std::string bufferName = JsonHelper::getOpName(buffer, M);
+      bool isDead = true;
+      for (Instruction *ckptCall : ckptCalls)
+      {
+        if (!isOverwrittenBeforeRead(buffer, ckptCall, LI))
+        {
+          std::cout << "WARNING: '" << bufferName << "' is excluded from checkpoints but may be read before it is overwritten after the checkpoint in '"
+                    << JsonHelper::getOpName(ckptCall->getParent(), M) << "'; still saving it." << std::endl;
+          isDead = false;
+          break;
         }
-	      return std::tuple<llvm::Value*, Value*>{I, offset};
       }
+      if (!isDead) continue;
+      excluded.insert(buffer);
+      regions.erase(buffer);
+      std::cout << "Excluded '" << bufferName << "' from checkpoints (dead at resume)" << std::endl;
+    }
+  }
+
+  for (CallInst *directive : directives)
+  {
+    directive->eraseFromParent();
+  }
+}
+
+
+std::set<Value *>
+SubroutineInjection::getStructFieldsInitializedOnEntry(Function &F, BasicBlock *entryBB) const
+{
+  Module *M = F.getParent();
+  std::set<Value *> fields;
+  for (Instruction &I : *entryBB)
+  {
+    AllocaInst *field = dyn_cast<AllocaInst>(&I);
+    if (!field || !field->getMetadata(STRUCT_FIELD_MD_NAME)) continue;
+    if (isOnlyWrittenOnEntry(field, entryBB))
+    {
+      std::cout << "Struct field '" << JsonHelper::getOpName(field, M) << "' is only initialized on entry; not saved." << std::endl;
+      fields.insert(field);
+    }
+  }
+  return fields;
+}
+
+
+bool
+SubroutineInjection::isRestorableInPlace(Value *ptr, BasicBlock *entryBB) const
+{
+  // allocas of entryBB dominate every restoreBB, so the restored value can be stored back into them
+  AllocaInst *alloca = dyn_cast<AllocaInst>(ptr);
+  return CkptRestoreInPlaceOption && alloca != nullptr && alloca->getParent() == entryBB
+         && alloca->isStaticAlloca();
+}
+
+bool
+SubroutineInjection::isOnlyWrittenOnEntry(Value *ptr, BasicBlock *entryBB) const
+{
+  for (User *user : ptr->users())
+  {
+    if (isa<LoadInst>(user)) continue;
+    if (StoreInst *store = dyn_cast<StoreInst>(user))
+    {
+      if (store->getPointerOperand() != ptr || store->getParent() != entryBB) return false;
+      if (!isRecomputedOnEntry(store->getValueOperand(), entryBB)) return false;
+      continue;
+    }
+    if (isa<GetElementPtrInst>(user) || isa<BitCastInst>(user))
+    {
+      if (!isOnlyWrittenOnEntry(user, entryBB)) return false;
+      continue;
+    }
+    // e.g. passed to a call, or its address is stored
+    return false;
+  }
+  return true;
+}
+
+
+bool
+SubroutineInjection::isRecomputedOnEntry(Value *val, BasicBlock *entryBB) const
+{
+  if (isa<Constant>(val) || isa<Argument>(val)) return true;
+  Instruction *inst = dyn_cast<Instruction>(val);
+  if (!inst || inst->getParent() != entryBB || isa<CallBase>(inst) || isa<PHINode>(inst)) return false;
+  if (LoadInst *load = dyn_cast<LoadInst>(inst))
+  {
+    // reads what entryBB stored before (allocas are fresh in each run)
+    AllocaInst *alloca = dyn_cast<AllocaInst>(load->getPointerOperand());
+    if (!alloca) return false;
+    for (User *user : alloca->users())
+    {
+      Instruction *userInst = dyn_cast<Instruction>(user);
+      if (!userInst || userInst->getParent() != entryBB || !userInst->comesBefore(load)) continue;
+      if (isa<LoadInst>(userInst)) continue;
+      StoreInst *store = dyn_cast<StoreInst>(userInst);
+      if (!store || store->getPointerOperand() != alloca || !isRecomputedOnEntry(store->getValueOperand(), entryBB)) return false;
+    }
+    return true;
+  }
+  if (inst->mayReadOrWriteMemory()) return false;
+  for (Value *op : inst->operands())
+  {
+    if (!isRecomputedOnEntry(op, entryBB)) return false;
+  }
+  return true;
+}
+
+
+bool
+SubroutineInjection::isOverwrittenBeforeRead(AllocaInst *buffer, Instruction *ckptCall, LoopInfo &LI) const
+{
+  const DataLayout &DL = buffer->getModule()->getDataLayout();
+  BasicBlock *ckptBB = ckptCall->getParent();
+  auto pointsIntoBuffer = [&](Value *ptr) {
+    int64_t offsetBytes;
+    return getDirectiveBuffer(ptr, DL, offsetBytes) == buffer;
+  };
+
+  // a write only overwrites the whole buffer if no loop still in progress at resume indexes it
+  auto isCompleteWrite = [&](Instruction *write, Value *ptr) {
+    std::set<Value *> addrRoots, visited;
+    getAddressRoots(ptr, addrRoots, visited);
+    for (Loop *L = LI.getLoopFor(ckptBB); L; L = L->getParentLoop())
+    {
+      if (!L->contains(write)) continue;
+      // the loop's induction variables are among the values its exit conditions are computed from
+      SmallVector<BasicBlock *, 4> exitingBBs;
+      L->getExitingBlocks(exitingBBs);
+      std::set<Value *> condRoots, condVisited;
+      for (BasicBlock *exitingBB : exitingBBs)
+      {
+        BranchInst *exitBr = dyn_cast<BranchInst>(exitingBB->getTerminator());
+        if (!exitBr || !exitBr->isConditional()) return false;
+        getAddressRoots(exitBr->getCondition(), condRoots, condVisited);
+      }
+      for (Value *root : condRoots)
+      {
+        if (!addrRoots.count(root)) continue;
+        if (isa<PHINode>(root)) return false;
+        // alloca-based induction variable: stored to inside the loop
+        for (User *U : root->users())
+        {
+          StoreInst *store = dyn_cast<StoreInst>(U);
+          if (store && store->getPointerOperand() == root && L->contains(store)) return false;
+        }
+      }
+    }
+    return true;
+  };
+
+  enum { NONE, READ, OVERWRITE } access;
+  auto getAccess = [&](Instruction *I) {
+    if (auto *load = dyn_cast<LoadInst>(I))
+    {
+      return pointsIntoBuffer(load->getPointerOperand()) ? READ : NONE;
+    }
+    if (auto *store = dyn_cast<StoreInst>(I))
+    {
+      if (!pointsIntoBuffer(store->getPointerOperand())) return NONE;
+      return isCompleteWrite(store, store->getPointerOperand()) ? OVERWRITE : NONE;
+    }
+    if (auto *memTransfer = dyn_cast<MemTransferInst>(I))
+    {
+      if (pointsIntoBuffer(memTransfer->getRawSource())) return READ;
+    }
+    if (auto *memIntrinsic = dyn_cast<MemIntrinsic>(I))
+    {
+      if (!pointsIntoBuffer(memIntrinsic->getRawDest())) return NONE;
+      return isCompleteWrite(memIntrinsic, memIntrinsic->getRawDest()) ? OVERWRITE : NONE;
+    }
+    if (auto *intrinsic = dyn_cast<IntrinsicInst>(I))
+    {
+      Intrinsic::ID id = intrinsic->getIntrinsicID();
+      if (isa<DbgInfoIntrinsic>(I) || id == Intrinsic::lifetime_start || id == Intrinsic::lifetime_end) return NONE;
+    }
+    if (auto *call = dyn_cast<CallInst>(I))
+    {
+      // the callee may read the buffer
+      for (unsigned i = 0; i < call->arg_size(); i++)
+      {
+        Value *arg = call->getArgOperand(i);
+        if (arg->getType()->isPointerTy() && pointsIntoBuffer(arg)) return READ;
+      }
+    }
+    return NONE;
+  };
+
+  // DFS over the CFG edges reachable from ckptCall without overwriting the buffer. A loop
+  // entered after ckptCall runs at least once: its exit edges are only followed once
+  // its backedge was reached (i.e. an iteration did not overwrite the buffer).
+  typedef std::pair<BasicBlock *, BasicBlock *> Edge;
+  std::set<BasicBlock *> visited;
+  std::set<Loop *> iteratedLoops;
+  std::map<Loop *, std::vector<Edge>> deferredExits;
+  std::vector<Edge> worklist;
+
+  // returns true if the buffer is read in BB from instIter on; queues BB's out edges if it is not overwritten
+  auto scanBB = [&](BasicBlock *BB, BasicBlock::iterator instIter) {
+    access = NONE;
+    for (; instIter != BB->end() && access == NONE; ++instIter)
+    {
+      access = getAccess(&*instIter);
+    }
+    if (access == NONE)
+    {
+      for (BasicBlock *succ : successors(BB)) worklist.push_back({BB, succ});
+    }
+    return access == READ;
+  };
+
+  if (scanBB(ckptBB, std::next(ckptCall->getIterator()))) return false;
+  while (!worklist.empty())
+  {
+    Edge edge = worklist.back();
+    worklist.pop_back();
+    BasicBlock *from = edge.first;
+    BasicBlock *to = edge.second;
+
+    Loop *exitedLoop = nullptr;
+    for (Loop *L = LI.getLoopFor(from); L && !L->contains(to) && !exitedLoop; L = L->getParentLoop())
+    {
+      if (!L->contains(ckptBB) && !iteratedLoops.count(L)) exitedLoop = L;
+    }
+    if (exitedLoop)
+    {
+      deferredExits[exitedLoop].push_back(edge);
+      continue;
+    }
+    Loop *toLoop = LI.getLoopFor(to);
+    if (toLoop && toLoop->getHeader() == to && toLoop->contains(from) && !toLoop->contains(ckptBB)
+        && iteratedLoops.insert(toLoop).second)
+    {
+      std::vector<Edge> &exits = deferredExits[toLoop];
+      worklist.insert(worklist.end(), exits.begin(), exits.end());
+      exits.clear();
+    }
+    if (!visited.insert(to).second) continue;
+    if (scanBB(to, to->begin())) return false;
+  }
+  return true;
+}
+
+
+Value *
+SubroutineInjection::createOffsetPointer(Value *ptr, uint64_t offsetBytes, Instruction *insertBefore) const
+{
+  if (offsetBytes == 0) return ptr;
+  IRBuilder<> builder(insertBefore);
+  Value *bytePtr = builder.CreatePointerCast(ptr, builder.getInt8PtrTy(ptr->getType()->getPointerAddressSpace()));
+  Value *offsetPtr = builder.CreateInBoundsGEP(builder.getInt8Ty(), bytePtr, builder.getInt64(offsetBytes), "region");
+  return builder.CreatePointerCast(offsetPtr, ptr->getType());
+}
+
+
+Value *
+SubroutineInjection::getPointerProvenance(Value *ptr, std::set<Value *> &visited) const
+{
+  Value *V = ptr->stripPointerCasts();
+  while (auto *gep = dyn_cast<GEPOperator>(V))
+  {
+    V = gep->getPointerOperand()->stripPointerCasts();
+  }
+  if (isa<Argument>(V) && V->getType()->isPointerTy()) return V;
+  if (isa<AllocaInst>(V)) return V;
+  if (auto *load = dyn_cast<LoadInst>(V))
+  {
+    auto *ptrAlloca = dyn_cast<AllocaInst>(load->getPointerOperand()->stripPointerCasts());
+    if (ptrAlloca && ptrAlloca->getAllocatedType()->isPointerTy()) return getStoredPointerProvenance(ptrAlloca, visited);
+  }
+  return nullptr;
+}
+
+
+Value *
+SubroutineInjection::getStoredPointerProvenance(AllocaInst *ptrAlloca, std::set<Value *> &visited) const
+{
+  if (!visited.insert(ptrAlloca).second) return nullptr;
+  Value *object = nullptr;
+  for (User *U : ptrAlloca->users())
+  {
+    if (isa<LoadInst>(U)) continue;
+    StoreInst *store = dyn_cast<StoreInst>(U);
+    if (!store || store->getValueOperand() == ptrAlloca) return nullptr;  // address escapes
+    // pointer bumps (p += n) keep the object of p
+    Value *storedPtr = store->getValueOperand()->stripPointerCasts();
+    while (auto *gep = dyn_cast<GEPOperator>(storedPtr))
+    {
+      storedPtr = gep->getPointerOperand()->stripPointerCasts();
+    }
+    auto *storedLoad = dyn_cast<LoadInst>(storedPtr);
+    if (storedLoad && storedLoad->getPointerOperand()->stripPointerCasts() == ptrAlloca) continue;
+    Value *storedObject = getPointerProvenance(store->getValueOperand(), visited);
+    if (!storedObject || (object && storedObject != object)) return nullptr;
+    object = storedObject;
+  }
+  return object;
+}
+
+
+AllocaInst *
+SubroutineInjection::getPointerArgHolder(Value *arg) const
+{
+  if (!isa<Argument>(arg)) return nullptr;
+  auto cached = PointerArgHolders.find(arg);
+  if (cached != PointerArgHolders.end()) return cached->second;
+  AllocaInst *&argHolder = PointerArgHolders[arg];
+  for (User *U : arg->users())
+  {
+    StoreInst *store = dyn_cast<StoreInst>(U);
+    AllocaInst *holder = store ? dyn_cast<AllocaInst>(store->getPointerOperand()) : nullptr;
+    if (!holder || store->getValueOperand() != arg) continue;
+    bool holdsArg = true;
+    for (User *holderUser : holder->users())
+    {
+      StoreInst *holderStore = dyn_cast<StoreInst>(holderUser);
+      if (holderStore && holderStore->getValueOperand()->stripPointerCasts() != arg) holdsArg = false;
+      else if (!holderStore && !isa<LoadInst>(holderUser)) holdsArg = false;
+    }
+    if (holdsArg) return argHolder = holder;
+  }
+  return nullptr;
+}
+
+
+Value *
+SubroutineInjection::getTrackedPointerObject(const Value *trackedVal) const
+{
+  Value *val = const_cast<Value *>(trackedVal);
+  if (!val->getType()->isPointerTy() || isa<Argument>(val)) return nullptr;
+  auto cached = TrackedPointerObjects.find(val);
+  if (cached != TrackedPointerObjects.end()) return cached->second;
+  Value *&trackedObject = TrackedPointerObjects[val];
+  std::set<Value *> visited;
+  AllocaInst *alloca = dyn_cast<AllocaInst>(val);
+  if (!alloca) return trackedObject = getPointerProvenance(val, visited);
+  if (!alloca->getAllocatedType()->isPointerTy()) return nullptr;
+  Value *object = getStoredPointerProvenance(alloca, visited);
+  if (object == nullptr || alloca == getPointerArgHolder(object)) return nullptr;  // holds the whole array argument
+  return trackedObject = object;
+}
+
+
+void
+SubroutineInjection::addArraysOfTrackedPointers(CheckpointBBMap &bbCheckpoints, const std::set<Value *> &ignoredVals) const
+{
+  for (auto &iter : bbCheckpoints)
+  {
+    std::set<const Value *> &trackedVals = iter.second;
+    const Module *M = iter.first->getModule();
+    std::set<const Value *> arrayHolders;
+    for (const Value *val : trackedVals)
+    {
+      Value *object = getTrackedPointerObject(val);
+      AllocaInst *holder = object ? getPointerArgHolder(object) : nullptr;
+      if (!holder || trackedVals.count(holder) || ignoredVals.count(holder) || ignoredVals.count(object)) continue;
+      if (arrayHolders.insert(holder).second)
+      {
+        std::cout << "Tracked pointer '" << JsonHelper::getOpName(val, M) << "' in BB '" << JsonHelper::getOpName(iter.first, M)
+                  << "' points into array '" << JsonHelper::getOpName(object, M) << "'; also saving '"
+                  << JsonHelper::getOpName(holder, M) << "'" << std::endl;
+      }
+    }
+    trackedVals.insert(arrayHolders.begin(), arrayHolders.end());
+  }
+}
+
+
+std::map<const Value *, const Value *>
+SubroutineInjection::getDerivedPointers(const std::set<const Value *> &trackedVals) const
+{
+  std::map<const Value *, const Value *> derivedPtrs;
+  for (const Value *val : trackedVals)
+  {
+    Value *object = getTrackedPointerObject(val);
+    if (object == nullptr) continue;
+    // local arrays are addressed by their alloca; array arguments by the alloca holding them
+    Value *baseVal = isa<AllocaInst>(object) ? object : getPointerArgHolder(object);
+    AllocaInst *baseAlloca = dyn_cast_or_null<AllocaInst>(baseVal);
+    if (baseAlloca && (baseAlloca->getAllocatedType()->isArrayTy() || baseAlloca->getAllocatedType()->isPointerTy()))
+    {
+      derivedPtrs[val] = baseVal;
+    }
+  }
+  return derivedPtrs;
+}
+
+
+Value *
+SubroutineInjection::createObjectBasePtr(Value *baseVal, IRBuilder<> &builder) const
+{
+  AllocaInst *baseAlloca = cast<AllocaInst>(baseVal);
+  Value *basePtr = baseAlloca;
+  if (baseAlloca->getAllocatedType()->isPointerTy())
+  {
+    basePtr = builder.CreateLoad(baseAlloca->getAllocatedType(), baseAlloca, "base_" + baseAlloca->getName());
+  }
+  return builder.CreatePointerCast(basePtr, builder.getInt8PtrTy());
+}
+
+
+void
+SubroutineInjection::getAddressRoots(Value *V, std::set<Value *> &roots, std::set<Value *> &visited) const
+{
+  if (!visited.insert(V).second) return;
+  if (auto *load = dyn_cast<LoadInst>(V))
+  {
+    Value *ptr = load->getPointerOperand()->stripPointerCasts();
+    if (isa<AllocaInst>(ptr)) roots.insert(ptr);
+    return;
+  }
+  if (isa<PHINode>(V))
+  {
+    roots.insert(V);
+    return;
+  }
+  if (auto *I = dyn_cast<Instruction>(V))
+  {
+    for (Value *op : I->operands())
+    {
+      getAddressRoots(op, roots, visited);
+    }
+  }
+}
+
+
+std::vector<SubroutineInjection::UndoLog>
+SubroutineInjection::getUndoLogArrays(Function &F, const CheckpointBBMap &bbCheckpoints, const UndoLogEntriesMap &undoLogEntries,
+                                      const LiveValues::VariableDefMap &valDefMap, const ValueVersionTracker &valVersionTracker)
+{
+  Module *M = F.getParent();
+  std::set<const Value *> trackedVals;
+  for (auto &iter : bbCheckpoints)
+  {
+    trackedVals.insert(iter.second.begin(), iter.second.end());
+  }
+
+  std::vector<UndoLog> undoLogs;
+  for (Argument &arg : F.args())
+  {
+    AllocaInst *holder = getPointerArgHolder(&arg);
+    if (!holder || !holder->getAllocatedType()->isPointerTy() || !trackedVals.count(holder)) continue;
+    auto entriesIt = undoLogEntries.find(holder);
+    bool hasDirective = (entriesIt != undoLogEntries.end());
+    if (!hasDirective && CkptUndoLogEntriesOption == 0) continue;
+
+    std::string holderName = JsonHelper::getOpName(holder, M).erase(0,1);
+    Value *array = getDerefValFromPointer(holder, valVersionTracker.getVersions(holder), &F);
+    if (array == nullptr || !valDefMap.count(array))
+    {
+      if (hasDirective) std::cout << "WARNING: Size of '" << holderName << "' is unknown; not using an undo log for it." << std::endl;
+      continue;
+    }
+    uint64_t arrayBytes = valDefMap.at(array);
+    uint64_t capacity = hasDirective ? entriesIt->second : (uint64_t)CkptUndoLogEntriesOption;
+    // a save of an array that is not much larger than its log copies about as many bytes as the log takes
+    if (!hasDirective && capacity * sizeof(ckpt_undo_entry_t) * UNDO_LOG_MIN_ARRAY_TO_LOG_RATIO > arrayBytes) continue;
+
+    UndoLog undoLog = {holder, capacity, arrayBytes, 0, nullptr, {}};
+    if (!getArrayStores(holder, undoLog.stores))
+    {
+      std::cout << "WARNING: '" << holderName << "' is not only written by stores of scalars (or its address escapes); saving the whole array." << std::endl;
+      continue;
+    }
+    undoLogs.push_back(undoLog);
+  }
+  return undoLogs;
+}
+
+
+bool
+SubroutineInjection::getArrayStores(AllocaInst *holder, std::vector<StoreInst *> &stores) const
+{
+  const DataLayout &DL = holder->getModule()->getDataLayout();
+  // the holder only stores the argument (getPointerArgHolder); follow every pointer loaded from it
+  std::vector<Value *> worklist;
+  for (User *U : holder->users())
+  {
+    if (isa<LoadInst>(U)) worklist.push_back(U);
+  }
+  std::set<Value *> visited;
+  while (!worklist.empty())
+  {
+    Value *ptr = worklist.back();
+    worklist.pop_back();
+    if (!visited.insert(ptr).second) continue;
+    for (User *U : ptr->users())
+    {
+      if (isa<GetElementPtrInst>(U) || isa<BitCastInst>(U))
+      {
+        worklist.push_back(U);
+      }
+      else if (StoreInst *store = dyn_cast<StoreInst>(U))
+      {
+        if (store->getValueOperand() == ptr) return false;
+        // an undo log entry holds up to 8 bytes of old contents; aligned stores of them never straddle two chunks
+        Type *elemTy = store->getValueOperand()->getType();
+        uint64_t widthBytes = DL.getTypeStoreSize(elemTy);
+        bool isScalar = elemTy->isIntegerTy() || elemTy->isFloatingPointTy();
+        if (!isScalar || store->isAtomic() || !(widthBytes == 1 || widthBytes == 2 || widthBytes == 4 || widthBytes == 8)) return false;
+        stores.push_back(store);
+      }
+      else if (!isa<LoadInst>(U) && !isa<ICmpInst>(U) && !isa<DbgInfoIntrinsic>(U))
+      {
+        // calls, memcpy/memset, pointer arithmetic through integers, phis, ...
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+
+void
+SubroutineInjection::insertUndoLogging(const UndoLog &undoLog, Function *func_ckpt_undo_log_full) const
+{
+  LLVMContext &context = undoLog.holder->getContext();
+  const DataLayout &DL = undoLog.holder->getModule()->getDataLayout();
+  Type *int64Ty = Type::getInt64Ty(context);
+  Type *bytePtrTy = Type::getInt8PtrTy(context);
+  MDNode *hasRoomWeights = MDBuilder(context).createBranchWeights(HOT_BRANCH_WEIGHT, COLD_BRANCH_WEIGHT);
+  const uint64_t entriesStart = sizeof(ckpt_undo_log_t) / sizeof(int64_t);
+  for (StoreInst *store : undoLog.stores)
+  {
+    Value *ptr = store->getPointerOperand();
+    Type *elemTy = store->getValueOperand()->getType();
+    uint64_t widthBytes = DL.getTypeStoreSize(elemTy);
+    IRBuilder<> builder(store);
+    Value *array = builder.CreateLoad(undoLog.holder->getAllocatedType(), undoLog.holder, "undo_array");
+    Value *offset = builder.CreateSub(builder.CreatePtrToInt(ptr, int64Ty), builder.CreatePtrToInt(array, int64Ty), "undo_offset");
+    Value *len = builder.CreateLoad(int64Ty, undoLog.logPtr, "undo_len");
+    // a spilled log (len -1) has no room either
+    Value *hasRoom = builder.CreateICmpULT(len, builder.getInt64(undoLog.capacity), "undo_has_room");
+    Instruction *appendTerm = nullptr;
+    Instruction *fullTerm = nullptr;
+    SplitBlockAndInsertIfThenElse(hasRoom, store, &appendTerm, &fullTerm, hasRoomWeights);
+
+    // append {offset << CKPT_UNDO_WIDTH_BITS | width, old contents}
+    builder.SetInsertPoint(appendTerm);
+    Value *oldBits = builder.CreateLoad(elemTy, ptr, "undo_old");
+    if (!elemTy->isIntegerTy())
+    {
+      oldBits = builder.CreateBitCast(oldBits, builder.getIntNTy(widthBytes * 8));
+    }
+    oldBits = builder.CreateZExt(oldBits, int64Ty);
+    Value *offsetWidth = builder.CreateOr(builder.CreateShl(offset, CKPT_UNDO_WIDTH_BITS), builder.getInt64(widthBytes));
+    Value *entryIndex = builder.CreateAdd(builder.CreateShl(len, 1), builder.getInt64(entriesStart));
+    Value *entryPtr = builder.CreateInBoundsGEP(int64Ty, undoLog.logPtr, entryIndex, "undo_entry");
+    builder.CreateStore(offsetWidth, entryPtr);
+    builder.CreateStore(oldBits, builder.CreateInBoundsGEP(int64Ty, entryPtr, builder.getInt64(1)));
+    builder.CreateStore(builder.CreateAdd(len, builder.getInt64(1)), undoLog.logPtr);
+
+    // full: snapshot the array once; later stores until the next save are not logged
+    builder.SetInsertPoint(fullTerm);
+    Value *isSpilled = builder.CreateICmpEQ(len, builder.getInt64(CKPT_UNDO_LOG_SPILLED), "undo_spilled");
+    Instruction *spillTerm = SplitBlockAndInsertIfThen(builder.CreateNot(isSpilled), fullTerm, false);
+    builder.SetInsertPoint(spillTerm);
+    Value *callParams[2] = {builder.CreatePointerCast(undoLog.logPtr, bytePtrTy), builder.CreatePointerCast(array, bytePtrTy)};
+    builder.CreateCall(func_ckpt_undo_log_full->getFunctionType(), func_ckpt_undo_log_full, callParams);
+  }
+}
+
+
+std::vector<SubroutineInjection::IncrementalArray>
+SubroutineInjection::getIncrementalArrays(Function &F, const CheckpointBBMap &bbCheckpoints, const LiveValues::VariableDefMap &valDefMap,
+                                          const ValueVersionTracker &valVersionTracker)
+{
+  Module *M = F.getParent();
+  std::set<const Value *> trackedVals;
+  for (auto &iter : bbCheckpoints)
+  {
+    trackedVals.insert(iter.second.begin(), iter.second.end());
+  }
+
+  uint64_t chunkBytes = alignTo(CkptIncrementalChunkBytesOption, sizeof(int64_t));
+  std::vector<IncrementalArray> incrementalArrays;
+  for (Argument &arg : F.args())
+  {
+    AllocaInst *holder = getPointerArgHolder(&arg);
+    if (!holder || !holder->getAllocatedType()->isPointerTy() || !trackedVals.count(holder)) continue;
+    Value *array = getDerefValFromPointer(holder, valVersionTracker.getVersions(holder), &F);
+    if (array == nullptr || !valDefMap.count(array)) continue;
+    uint64_t arrayBytes = valDefMap.at(array);
+    // a single chunk is copied as a whole by the first site after the save anyway
+    if (arrayBytes < 2 * chunkBytes) continue;
+
+    std::string holderName = JsonHelper::getOpName(holder, M).erase(0,1);
+    if (incrementalArrays.size() == CKPT_INCR_MAX_ARRAYS)
+    {
+      std::cout << "WARNING: At most " << CKPT_INCR_MAX_ARRAYS << " arrays are saved incrementally; saving '" << holderName << "' whole." << std::endl;
+      continue;
+    }
+    IncrementalArray incrArray = {holder, arrayBytes, chunkBytes, 0, {}};
+    if (!getArrayStores(holder, incrArray.stores))
+    {
+      std::cout << "WARNING: '" << holderName << "' is not only written by stores of scalars (or its address escapes); saving the whole array." << std::endl;
+      continue;
+    }
+    incrementalArrays.push_back(incrArray);
+  }
+  return incrementalArrays;
+}
+
+
+void
+SubroutineInjection::insertCopyBeforeWrite(const IncrementalArray &incrArray, int idx, Value *incrSession,
+                                           Function *func_ckpt_incr_before_write) const
+{
+  LLVMContext &context = incrArray.holder->getContext();
+  Type *int32Ty = Type::getInt32Ty(context);
+  Type *int64Ty = Type::getInt64Ty(context);
+  MDNode *unlikely = MDBuilder(context).createBranchWeights(COLD_BRANCH_WEIGHT, HOT_BRANCH_WEIGHT);
+  for (StoreInst *store : incrArray.stores)
+  {
+    IRBuilder<> builder(store);
+    Value *array = builder.CreateLoad(incrArray.holder->getAllocatedType(), incrArray.holder, "incr_array");
+    Value *offset = builder.CreateSub(builder.CreatePtrToInt(store->getPointerOperand(), int64Ty), builder.CreatePtrToInt(array, int64Ty),
+                                      "incr_offset");
+    // each chunk fails the check at most once per save: while no save is in progress, all versions equal the epoch
+    Value *elemPtrEpoch = builder.CreateInBoundsGEP(builder.getInt8Ty(), incrSession, builder.getInt64(offsetof(ckpt_incr_session_t, save_epoch)));
+    Value *epoch = builder.CreateLoad(int32Ty, builder.CreatePointerCast(elemPtrEpoch, int32Ty->getPointerTo()), "incr_epoch");
+    Value *versions = builder.CreateInBoundsGEP(builder.getInt8Ty(), incrSession, builder.getInt64(incrArray.stateOffset));
+    Value *chunk = builder.CreateUDiv(offset, builder.getInt64(incrArray.chunkBytes), "incr_chunk");
+    Value *elemPtrVersion = builder.CreateInBoundsGEP(int32Ty, builder.CreatePointerCast(versions, int32Ty->getPointerTo()), chunk);
+    Value *version = builder.CreateLoad(int32Ty, elemPtrVersion, "incr_version");
+    Value *isStale = builder.CreateICmpNE(version, epoch, "incr_chunk_stale");
+    Instruction *copyTerm = SplitBlockAndInsertIfThen(isStale, store, false, unlikely);
+    builder.SetInsertPoint(copyTerm);
+    Value *callParams[3] = {incrSession, builder.getInt32(idx), offset};
+    builder.CreateCall(func_ckpt_incr_before_write->getFunctionType(), func_ckpt_incr_before_write, callParams);
+  }
+}
+
+
+std::tuple<llvm::Value*, Value*>
+SubroutineInjection::getOffsetArray(Value* v, Function &F){
+  Value* offset = nullptr;
+  // v is only of interest if it is defined in F
+  Instruction* I = dyn_cast<Instruction>(v);
+  if (I != nullptr && I->getParent()->getParent() == &F){
+    //Found affectation
+    if (I->getOpcode() == Instruction::GetElementPtr){
+      Value* value;
+      std::tie(value, offset) = getOffsetArray(I->getOperand(0), F);
+      offset = I->getOperand(1);
+      return std::tuple<llvm::Value*, Value*>{value, offset};
     }
+    return std::tuple<llvm::Value*, Value*>{I, offset};
   }
   return std::tuple<llvm::Value*, Value*>{nullptr, offset};
 }
@@ -2399,9 +4286,8 @@ int SubroutineInjection::insertIndexTracking(Function& F)
 }
 
 
-void SubroutineInjection::allocateindexStacks(std::set<const Value *> trackedVals, std::map<const Value*, const Value*> oldNewTrackedVals,
-                                              std::map<const Value *, std::set<const Value*>> allTrackedValVersions,
-                                              LiveValues::VariableDefMap valDefMap, LiveValues::VariableDefMap liveValDefMap,
+void SubroutineInjection::allocateindexStacks(const std::set<const Value *> &trackedVals, const ValueVersionTracker &valVersionTracker,
+                                              const LiveValues::VariableDefMap &valDefMap, const LiveValues::VariableDefMap &liveValDefMap,
                                               Value* ckptMemSegment, Function& F, Module& M){
   const DataLayout &DL = M.getDataLayout();
   BasicBlock* BB = &(*F.begin());
@@ -2420,8 +4306,11 @@ void SubroutineInjection::allocateindexStacks(std::set<const Value *> trackedVal
   
   Type *ckptMemSegContainedType = ckptMemSegment->getType()->getContainedType(0);
   int ckptMemSegContainedTypeSize = DL.getTypeAllocSizeInBits(ckptMemSegContainedType) / 8;
-  int valMemSegIndex = VALUES_START; // start index of "slots" for values in memory segment
+  int valMemSegIndex = getValuesStartSlot(ckptMemSegContainedTypeSize); // start index of "slots" for values in memory segment
+  // derived pointers are saved after all other values (as in injectSubroutines)
+  std::map<const Value *, const Value *> derivedPtrs = getDerivedPointers(trackedVals);
   for (auto iter : trackedValsOrdered){
+    if (derivedPtrs.count(iter)) continue;
     int numOfArrSlotsUsed = 1;
     Value *trackedVal = const_cast<Value*>(&*iter);
     std::string valTrackedName = JsonHelper::getOpName(trackedVal, &M).erase(0,1);
@@ -2433,11 +4322,11 @@ void SubroutineInjection::allocateindexStacks(std::set<const Value *> trackedVal
     bool isPointer = valRawType->isPointerTy();
     Type *containedType = isPointer ? valRawType->getContainedType(0) : valRawType;
     bool isPointerPointer = isPointer && containedType->isPointerTy();
-    int valSizeBytes = liveValDefMap.at(trackedVal);
+    int valSizeBytes = liveValDefMap.count(trackedVal) ? liveValDefMap.at(trackedVal) : valDefMap.at(trackedVal);
 
     if (isPointer){
-      const Value *originalTrackedVal = findKeyByValueInMap(trackedVal, allTrackedValVersions);
-      std::set<const Value*> valVersions = allTrackedValVersions.at(originalTrackedVal);
+      const Value *originalTrackedVal = valVersionTracker.getOriginal(trackedVal);
+      const ValueVersionTracker::VersionSet &valVersions = valVersionTracker.getVersions(originalTrackedVal);
       Value *trackedValDeref = getDerefValFromPointer(trackedVal, valVersions ,&F);
        if (trackedValDeref != nullptr){
         if (valDefMap.count(trackedValDeref)){
@@ -2449,10 +4338,10 @@ void SubroutineInjection::allocateindexStacks(std::set<const Value *> trackedVal
     }
     
     if (isPointerPointer){
-      int valSizeBytes = liveValDefMap.at(trackedVal);
+      int valSizeBytes = liveValDefMap.count(trackedVal) ? liveValDefMap.at(trackedVal) : valDefMap.at(trackedVal);
       // find value that this trackedVal points to
-      const Value *originalTrackedVal = findKeyByValueInMap(trackedVal, allTrackedValVersions);
-      std::set<const Value*> valVersions = allTrackedValVersions.at(originalTrackedVal);
+      const Value *originalTrackedVal = valVersionTracker.getOriginal(trackedVal);
+      const ValueVersionTracker::VersionSet &valVersions = valVersionTracker.getVersions(originalTrackedVal);
       Value *trackedValDeref = getDerefValFromPointer(trackedVal, valVersions, &F);
       if (trackedValDeref != nullptr){
         if (valDefMap.count(trackedValDeref)){
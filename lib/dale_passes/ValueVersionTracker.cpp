@@ -0,0 +1,109 @@
+/**
+ * Bookkeeping for the versions of tracked values that are created while
+ * restored values are propagated across the CFG by SubroutineInjection.
+ */
+
+#include "dale_passes/ValueVersionTracker.h"
+
+using namespace llvm;
+
+void
+ValueVersionTracker::addCheckpoint(const BasicBlock *checkpointBB, const std::set<const Value *> &trackedVals)
+{
+  CheckpointVersions &ckptVersions = CkptVersions[checkpointBB];
+  for (const Value *val : trackedVals)
+  {
+    if (ckptVersions.originalToCurrent.insert({val, val}).second)
+    {
+      ckptVersions.originals.push_back(val);
+      ckptVersions.currentToOriginal[val] = val;
+    }
+    AllVersions[val].insert(val);
+    VersionToOriginal[val] = val;
+  }
+}
+
+bool
+ValueVersionTracker::addVersion(const Value *originalVal, const Value *newVersion)
+{
+  auto iter = AllVersions.find(originalVal);
+  if (iter == AllVersions.end()) return false;
+  iter->second.insert(newVersion);
+  VersionToOriginal[newVersion] = originalVal;
+  return true;
+}
+
+const Value *
+ValueVersionTracker::getOriginal(const Value *version) const
+{
+  auto iter = VersionToOriginal.find(version);
+  return (iter != VersionToOriginal.end()) ? iter->second : nullptr;
+}
+
+const ValueVersionTracker::VersionSet &
+ValueVersionTracker::getVersions(const Value *originalVal) const
+{
+  auto iter = AllVersions.find(originalVal);
+  assert(iter != AllVersions.end() && "Value is not a tracked value!");
+  return iter->second;
+}
+
+const Value *
+ValueVersionTracker::getCurrent(const BasicBlock *checkpointBB, const Value *originalVal) const
+{
+  auto ckptIter = CkptVersions.find(checkpointBB);
+  if (ckptIter == CkptVersions.end()) return nullptr;
+  auto iter = ckptIter->second.originalToCurrent.find(originalVal);
+  return (iter != ckptIter->second.originalToCurrent.end()) ? iter->second : nullptr;
+}
+
+const Value *
+ValueVersionTracker::getOriginalOfCurrent(const BasicBlock *checkpointBB, const Value *currentVal) const
+{
+  auto ckptIter = CkptVersions.find(checkpointBB);
+  if (ckptIter == CkptVersions.end()) return nullptr;
+  auto iter = ckptIter->second.currentToOriginal.find(currentVal);
+  return (iter != ckptIter->second.currentToOriginal.end()) ? iter->second : nullptr;
+}
+
+bool
+ValueVersionTracker::setCurrent(const BasicBlock *checkpointBB, const Value *originalVal, const Value *newCurrent)
+{
+  auto ckptIter = CkptVersions.find(checkpointBB);
+  if (ckptIter == CkptVersions.end()) return false;
+  CheckpointVersions &ckptVersions = ckptIter->second;
+  auto iter = ckptVersions.originalToCurrent.find(originalVal);
+  if (iter == ckptVersions.originalToCurrent.end()) return false;
+  ckptVersions.currentToOriginal.erase(iter->second);
+  iter->second = newCurrent;
+  ckptVersions.currentToOriginal[newCurrent] = originalVal;
+  return true;
+}
+
+std::vector<ValueVersionTracker::OriginalCurrentPair>
+ValueVersionTracker::getOriginalCurrentPairs(const BasicBlock *checkpointBB) const
+{
+  std::vector<OriginalCurrentPair> pairs;
+  auto ckptIter = CkptVersions.find(checkpointBB);
+  if (ckptIter == CkptVersions.end()) return pairs;
+  const CheckpointVersions &ckptVersions = ckptIter->second;
+  pairs.reserve(ckptVersions.originals.size());
+  for (const Value *original : ckptVersions.originals)
+  {
+    pairs.emplace_back(original, ckptVersions.originalToCurrent.lookup(original));
+  }
+  return pairs;
+}
+
+std::set<const Value *>
+ValueVersionTracker::getCurrentVals(const BasicBlock *checkpointBB) const
+{
+  std::set<const Value *> currentVals;
+  auto ckptIter = CkptVersions.find(checkpointBB);
+  if (ckptIter == CkptVersions.end()) return currentVals;
+  for (auto &iter : ckptIter->second.originalToCurrent)
+  {
+    currentVals.insert(iter.second);
+  }
+  return currentVals;
+}
@@ -88,6 +88,8 @@ JsonHelper::updateJsonMapWithFuncTrackedValues(
   {
     BBTrackedVals_JSON jsonBBTrackedVals;
     const std::string funcName = getOpName(F, M);
+    ModuleSlotTracker MST(M);
+    MST.incorporateFunction(*F);
     for(bbIt = trackedValsMap.at(F).cbegin();
         bbIt != trackedValsMap.at(F).cend();
         bbIt++)
@@ -99,7 +101,7 @@ JsonHelper::updateJsonMapWithFuncTrackedValues(
       {        
         // Capture printAsOperand output, since value names don't actually 
         // exist and are allocated only during printing.
-        std::string valName = getOpName(*valIt, M);
+        std::string valName = getOpName(*valIt, MST);
         jsonTrackedVals.emplace(valName);
       }
       jsonBBTrackedVals.emplace(bbName, jsonTrackedVals);
@@ -205,8 +207,8 @@ JsonHelper::getFuncBBTrackedValsMap(
     std::cout<<"\n"<<funcName<<":\n";
     if (jsonMap.count(funcName) && funcValuePtrsMap.count(&F))
     {
-      SubroutineInjection::ValuePtrsMap valuePtrsMap = funcValuePtrsMap.at(&F);
-      LiveValues::BBTrackedVals_JSON bbTrackedVals_json = jsonMap.at(funcName);
+      const SubroutineInjection::ValuePtrsMap &valuePtrsMap = funcValuePtrsMap.at(&F);
+      const LiveValues::BBTrackedVals_JSON &bbTrackedVals_json = jsonMap.at(funcName);
       LiveValues::BBTrackedVals bbTrackedValsMap;
       Function::iterator bbIter;
       for (bbIter = F.begin(); bbIter != F.end(); ++bbIter)
@@ -218,7 +220,7 @@ JsonHelper::getFuncBBTrackedValsMap(
         if (bbTrackedVals_json.count(bbName))
         {
           // get names of tracked values in this BB from json map
-          std::set<std::string> trackedVals_json = bbTrackedVals_json.at(bbName);
+          const std::set<std::string> &trackedVals_json = bbTrackedVals_json.at(bbName);
           std::set<std::string>::const_iterator valIt;
           for (valIt = trackedVals_json.cbegin(); valIt != trackedVals_json.cend(); valIt++)
           {
@@ -228,7 +230,7 @@ JsonHelper::getFuncBBTrackedValsMap(
               // get pointers to values corresponding to value name
               const Value* val = valuePtrsMap.at(valName);
               trackedVals.insert(val);
-              std::cout<<JsonHelper::getOpName(val, &M)<< " ";
+              std::cout<<valName<< " ";
             }
           }
           std::cout<<"\n";
@@ -356,6 +358,8 @@ JsonHelper::updateJsonMapWithFuncLiveValues(LiveValuesMap_JSON &jsonMap,
   {
     BBLiveVals_JSON jsonBBLiveVals;
     const std::string funcName = getOpName(F, M);
+    ModuleSlotTracker MST(M);
+    MST.incorporateFunction(*F);
     for(bbIt = liveValsMap.at(F).cbegin();
         bbIt != liveValsMap.at(F).cend();
         bbIt++)
@@ -368,7 +372,7 @@ JsonHelper::updateJsonMapWithFuncLiveValues(LiveValuesMap_JSON &jsonMap,
       const std::set<const Value *> &liveInVals = bbIt->second.liveInVals;
       for(valIt = liveInVals.cbegin(); valIt != liveInVals.cend(); valIt++)
       {        
-        std::string valName = getOpName(*valIt, M);
+        std::string valName = getOpName(*valIt, MST);
         varValue = 1;
         it = mapVars.find(*valIt); 
         if (it != mapVars.end())
@@ -382,7 +386,7 @@ JsonHelper::updateJsonMapWithFuncLiveValues(LiveValuesMap_JSON &jsonMap,
       const std::set<const Value *> &liveOutVals = bbIt->second.liveOutVals;
       for(valIt = liveOutVals.cbegin(); valIt != liveOutVals.cend(); valIt++)
       {        
-        std::string valName = getOpName(*valIt, M);
+        std::string valName = getOpName(*valIt, MST);
         varValue = 1;
         it = mapVars.find(*valIt); 
         if (it != mapVars.end())
@@ -530,8 +534,8 @@ JsonHelper::getFuncBBLiveValsInfo(
     if (jsonMap.count(funcName) && funcValuePtrsMap.count(&F))
     {
       // std::cout<<JsonHelper::getOpName(&F, &M)<<"\n";
-      SubroutineInjection::ValuePtrsMap valuePtrsMap = funcValuePtrsMap.at(&F);
-      LiveValues::BBLiveVals_JSON bbLiveVals_json = jsonMap.at(funcName);
+      const SubroutineInjection::ValuePtrsMap &valuePtrsMap = funcValuePtrsMap.at(&F);
+      const LiveValues::BBLiveVals_JSON &bbLiveVals_json = jsonMap.at(funcName);
       LiveValues::BBLiveVals bbLiveValsMap;
       Function::iterator bbIter;
       for (bbIter = F.begin(); bbIter != F.end(); ++bbIter)
@@ -546,8 +550,8 @@ JsonHelper::getFuncBBLiveValsInfo(
           // get names of live-in/out values in this BB from json map
           //std::set<std::string> liveInVals_json = bbLiveVals_json.at(bbName).liveInVals_json;
           //std::set<std::string> liveOutVals_json = bbLiveVals_json.at(bbName).liveOutVals_json;
-	        std::set<std::pair<std::string, int>> liveInVals_json = bbLiveVals_json.at(bbName).liveInVals_json;
-          std::set<std::pair<std::string, int>> liveOutVals_json = bbLiveVals_json.at(bbName).liveOutVals_json;
+	        const std::set<std::pair<std::string, int>> &liveInVals_json = bbLiveVals_json.at(bbName).liveInVals_json;
+          const std::set<std::pair<std::string, int>> &liveOutVals_json = bbLiveVals_json.at(bbName).liveOutVals_json;
 
           // process live-in values
           std::cout<<"    live-in\n        ";
@@ -562,7 +566,7 @@ JsonHelper::getFuncBBLiveValsInfo(
               const Value* val = valuePtrsMap.at(valName);
               liveInVals.insert(val);
               valSizeMap.emplace(val, valSize);
-              std::cout<<JsonHelper::getOpName(val, &M)<< " ";
+              std::cout<<valName<< " ";
             }
           }
           std::cout<<"\n";
@@ -579,7 +583,7 @@ JsonHelper::getFuncBBLiveValsInfo(
               const Value* val = valuePtrsMap.at(valName);
               liveOutVals.insert(val);
               valSizeMap.emplace(val, valSize);
-              std::cout<<JsonHelper::getOpName(val, &M)<< " ";
+              std::cout<<valName<< " ";
             }
           }
           std::cout<<"\n";
@@ -642,6 +646,15 @@ JsonHelper::getOpName(const Value *value_ptr, const Module *M)
   return rso.str();
 }
 
+std::string
+JsonHelper::getOpName(const Value *value_ptr, ModuleSlotTracker &MST)
+{
+  std::string valNameStr;
+  raw_string_ostream rso(valNameStr);
+  value_ptr->printAsOperand(rso, false, MST);
+  return rso.str();
+}
+
 std::string
 JsonHelper::getOpName(const BasicBlock *bb_ptr, const Module *M)
 {
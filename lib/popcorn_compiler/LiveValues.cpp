@@ -191,8 +191,12 @@ LiveValues::getTrackedValues(const Function *F)
       
       std::set<const Value *> *trackedVals = new std::set<const Value *>;
       
+      // the checkpoint is placed right after the checkpoint() call, so it saves the vals live there
+      const Instruction *ckptCall = getCheckpointCall(BB);
+      const std::set<const Value *> &checkpointVals = ckptCall ? getInstLiveVals(BB).at(ckptCall) : liveOutVals;
+
       // iterate through live-out vals in BB
-      for(valIt = liveOutVals.cbegin(); valIt != liveOutVals.cend(); valIt++)
+      for(valIt = checkpointVals.cbegin(); valIt != checkpointVals.cend(); valIt++)
       {
         trackedVals->insert(*valIt);
       }
@@ -277,41 +281,54 @@ std::set<const Value *>
 {
   const BasicBlock *BB = inst->getParent();
   const Function *F = BB->getParent();
-  BasicBlock::const_reverse_iterator ri, rie;
-  std::set<const Value *> *live = nullptr;
 
   // Note: some functions have unreachable basic blocks (e.g., functions that
   // call exit and then return a value).  If we don't have analysis for the
   // block, return an empty set.
-  const LiveVals &Blocks = FuncBBLiveOut.at(F);
-  if(Blocks.count(BB)) live = new std::set<const Value *>(Blocks.at(BB));
-  else return new std::set<const Value *>;
+  if(!FuncBBLiveOut.at(F).count(BB)) return new std::set<const Value *>;
 
-  for(ri = BB->rbegin(), rie = BB->rend(); ri != rie; ri++)
-  {
-    if(&*ri == inst) break;
+  return new std::set<const Value *>(getInstLiveVals(BB).at(inst));
+}
 
-    live->erase(&*ri);
+///////////////////////////////////////////////////////////////////////////////
+// Private API
+///////////////////////////////////////////////////////////////////////////////
+
+const LiveValues::InstLiveVals &
+LiveValues::getInstLiveVals(const BasicBlock *BB) const
+{
+  std::map<const BasicBlock *, InstLiveVals>::const_iterator cached = BBInstLiveVals.find(BB);
+  if(cached != BBInstLiveVals.end()) return cached->second;
+
+  InstLiveVals &instLiveVals = BBInstLiveVals[BB];
+  std::set<const Value *> live(FuncBBLiveOut.at(BB->getParent()).at(BB));
+  for(BasicBlock::const_reverse_iterator ri = BB->rbegin(), rie = BB->rend();
+      ri != rie;
+      ri++)
+  {
+    live.erase(&*ri);
     for(User::const_op_iterator op = ri->op_begin();
         op != ri->op_end();
         op++)
       if(includeVal(*op))
-        live->insert(*op);
+        live.insert(*op);
+    instLiveVals.emplace(&*ri, live);
   }
 
-  live->erase(&*ri);
-  for(User::const_op_iterator op = ri->op_begin();
-      op != ri->op_end();
-      op++)
-    if(includeVal(*op))
-      live->insert(*op);
-
-  return live;
+  return instLiveVals;
 }
 
-///////////////////////////////////////////////////////////////////////////////
-// Private API
-///////////////////////////////////////////////////////////////////////////////
+const Instruction *LiveValues::getCheckpointCall(const BasicBlock *BB) const
+{
+  for(BasicBlock::const_iterator it = BB->begin(); it != BB->end(); it++)
+  {
+    const CallInst *call = dyn_cast<CallInst>(&*it);
+    if(!call || !call->getCalledFunction()) continue;
+    StringRef name = call->getCalledFunction()->getName();
+    if(name.contains("checkpoint") && !name.contains("checkpoint_")) return call;
+  }
+  return nullptr;
+}
 
 bool LiveValues::includeVal(const llvm::Value *val) const
 {
@@ -0,0 +1,214 @@
+/**
+ * Throughput benchmark for the ckpt_runtime copy kernels.
+ *
+ * For each ISA variant supported by the CPU and each buffer size, measures the
+ * bandwidth (GB/s of payload moved) of the contiguous, streaming, gather, scatter,
+ * index-tracked and strided copies, and checks each result against a plain loop.
+ *
+ * To Run:
+ * $ /path/to/build/bin/CkptCopyBench [size_bytes ...]
+ */
+
+#include "ckpt_runtime/CkptCopy.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#define MIN_BENCH_BYTES (256UL << 20)  // move at least 256 MiB per measurement
+#define STRIDED_BLOCK_BYTES 4096
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+/* Allocator for 64-byte aligned buffers, like the checkpoint memory segment */
+template <typename T>
+struct AlignedAlloc {
+  typedef T value_type;
+  AlignedAlloc(void) {}
+  template <typename U> AlignedAlloc(const AlignedAlloc<U> &) {}
+  T *allocate(size_t n) { return static_cast<T *>(aligned_alloc(64, ((n * sizeof(T) + 63) / 64) * 64)); }
+  void deallocate(T *p, size_t) { free(p); }
+  bool operator==(const AlignedAlloc &) const { return true; }
+  bool operator!=(const AlignedAlloc &) const { return false; }
+};
+
+typedef std::vector<uint32_t, AlignedAlloc<uint32_t>> AlignedBuf;
+
+/* Buffers shared by all kernels for one size */
+typedef struct {
+  size_t bytes;
+  int32_t numElems;
+  AlignedBuf src;
+  AlignedBuf dst;
+  AlignedBuf ref;
+  std::vector<int32_t> indexList;  // every 4th element, shuffled
+} BenchBufs;
+
+/**
+* Runs kernel repeatedly until at least MIN_BENCH_BYTES of payload were moved,
+* and returns the bandwidth in GB/s.
+*/
+template <typename KernelFn>
+double
+measure(size_t payloadBytes, KernelFn kernel)
+{
+  size_t reps = MIN_BENCH_BYTES / payloadBytes;
+  if (reps < 3) reps = 3;
+  kernel();  // warm-up
+  Clock::time_point start = Clock::now();
+  for (size_t r = 0; r < reps; r++)
+  {
+    kernel();
+  }
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  return (double)payloadBytes * reps / seconds / 1e9;
+}
+
+void
+initBufs(BenchBufs &bufs, size_t bytes)
+{
+  bufs.bytes = bytes;
+  bufs.numElems = (int32_t)(bytes / sizeof(uint32_t));
+  bufs.src.resize(bufs.numElems);
+  bufs.dst.assign(bufs.numElems, 0);
+  bufs.ref.assign(bufs.numElems, 0);
+  for (int32_t k = 0; k < bufs.numElems; k++)
+  {
+    bufs.src[k] = (uint32_t)k * 2654435761u;
+  }
+  bufs.indexList.clear();
+  for (int32_t k = 0; k < bufs.numElems; k += 4)
+  {
+    bufs.indexList.push_back(k);
+  }
+  std::mt19937 rng(42);
+  std::shuffle(bufs.indexList.begin(), bufs.indexList.end(), rng);
+}
+
+bool
+checkEqual(const AlignedBuf &a, const AlignedBuf &b, size_t numElems)
+{
+  return memcmp(a.data(), b.data(), numElems * sizeof(uint32_t)) == 0;
+}
+
+/**
+* Benchmarks all kernels of the selected ISA for one buffer size.
+* Returns false if any kernel produced a wrong result.
+*/
+bool
+benchSize(BenchBufs &bufs)
+{
+  bool ok = true;
+  const size_t bytes = bufs.bytes;
+  const int32_t numIdx = (int32_t)bufs.indexList.size();
+  const size_t idxBytes = numIdx * sizeof(uint32_t);
+  uint32_t *dst = bufs.dst.data();
+  const uint32_t *src = bufs.src.data();
+  const int32_t *idx = bufs.indexList.data();
+  std::string errs;
+
+  // contiguous copies
+  double copyBw = measure(bytes, [&]() { ckpt_copy(dst, src, bytes); });
+  if (!checkEqual(bufs.dst, bufs.src, bufs.numElems)) errs += " copy";
+  bufs.dst.assign(bufs.numElems, 0);
+  double streamBw = measure(bytes, [&]() { ckpt_copy_stream(dst, src, bytes); });
+  if (!checkEqual(bufs.dst, bufs.src, bufs.numElems)) errs += " copy_stream";
+
+  // gather / scatter of every 4th element (random order)
+  bufs.ref.assign(bufs.numElems, 0);
+  for (int32_t k = 0; k < numIdx; k++) bufs.ref[k] = src[idx[k]];
+  bufs.dst.assign(bufs.numElems, 0);
+  double gatherBw = measure(idxBytes, [&]() { ckpt_gather32(dst, src, idx, numIdx); });
+  if (!checkEqual(bufs.dst, bufs.ref, numIdx)) errs += " gather32";
+
+  bufs.ref.assign(bufs.numElems, 0);
+  for (int32_t k = 0; k < numIdx; k++) bufs.ref[idx[k]] = src[k];
+  bufs.dst.assign(bufs.numElems, 0);
+  double scatterBw = measure(idxBytes, [&]() { ckpt_scatter32(dst, src, idx, numIdx); });
+  if (!checkEqual(bufs.dst, bufs.ref, bufs.numElems)) errs += " scatter32";
+
+  // index-tracked save (resets the stack pointer, so it is restored before each call)
+  bufs.ref.assign(bufs.numElems, 0);
+  for (int32_t k = 0; k < numIdx; k++) bufs.ref[idx[k]] = src[idx[k]];
+  bufs.dst.assign(bufs.numElems, 0);
+  int32_t sp = numIdx;
+  double indexBw = measure(idxBytes, [&]() {
+    sp = numIdx;
+    ckpt_copy_index32(dst, src, const_cast<int32_t *>(idx), &sp);
+  });
+  if (!checkEqual(bufs.dst, bufs.ref, bufs.numElems) || sp != 0) errs += " copy_index32";
+
+  // strided: every other block of STRIDED_BLOCK_BYTES (n/a if not even one block fits)
+  char stridedBw[16] = "n/a";
+  if (bytes >= 2 * STRIDED_BLOCK_BYTES)
+  {
+    size_t count = bytes / (2 * STRIDED_BLOCK_BYTES);
+    size_t blockElems = STRIDED_BLOCK_BYTES / sizeof(uint32_t);
+    bufs.ref.assign(bufs.numElems, 0);
+    for (size_t b = 0; b < count; b++)
+    {
+      memcpy(&bufs.ref[b * blockElems], &src[2 * b * blockElems], STRIDED_BLOCK_BYTES);
+    }
+    bufs.dst.assign(bufs.numElems, 0);
+    double bw = measure(count * STRIDED_BLOCK_BYTES, [&]() {
+      ckpt_copy_strided(dst, src, STRIDED_BLOCK_BYTES, count, STRIDED_BLOCK_BYTES, 2 * STRIDED_BLOCK_BYTES);
+    });
+    snprintf(stridedBw, sizeof(stridedBw), "%.2f", bw);
+    if (!checkEqual(bufs.dst, bufs.ref, bufs.numElems)) errs += " strided";
+  }
+
+  printf("%-8s %10zu %9.2f %9.2f %9.2f %9.2f %9.2f %9s",
+         ckpt_copy_isa(), bytes, copyBw, streamBw, gatherBw, scatterBw, indexBw, stridedBw);
+  if (!errs.empty())
+  {
+    printf("   WRONG RESULT:%s", errs.c_str());
+    ok = false;
+  }
+  printf("\n");
+  fflush(stdout);
+  return ok;
+}
+
+} /* anonymous namespace */
+
+int
+main(int argc, char **argv)
+{
+  std::vector<size_t> sizes;
+  for (int i = 1; i < argc; i++)
+  {
+    sizes.push_back(strtoull(argv[i], nullptr, 0));
+  }
+  if (sizes.empty())
+  {
+    sizes = {4UL << 10, 256UL << 10, 4UL << 20, 64UL << 20};
+  }
+
+  const char *isas[] = {"scalar", "avx2", "avx512"};
+  std::string defaultIsa = ckpt_copy_isa();
+  bool ok = true;
+  BenchBufs bufs;
+
+  printf("Bandwidth in GB/s of payload (gather/scatter/index: every 4th 32-bit element; strided: every other 4 KiB block)\n");
+  printf("%-8s %10s %9s %9s %9s %9s %9s %9s\n",
+         "isa", "bytes", "copy", "stream", "gather", "scatter", "index", "strided");
+  for (size_t bytes : sizes)
+  {
+    initBufs(bufs, bytes);
+    for (const char *isa : isas)
+    {
+      if (ckpt_copy_select_isa(isa) != 0) continue;  // not supported by this CPU
+      ok = benchSize(bufs) && ok;
+    }
+  }
+  ckpt_copy_select_isa(defaultIsa.c_str());
+  printf("default isa: %s\n", defaultIsa.c_str());
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,180 @@
+/**
+ * Benchmark of checkpoint replication (ckpt_runtime/CkptReplica.h) with both ends
+ * on localhost.
+ *
+ * A kernel updates part of the first half of an array (the second half stays
+ * zero, like rows not computed yet), computes for the rest of each interval, and
+ * saves the whole array into ckpt_mem the way the code injected with -ckpt-header
+ * does (ckpt id set to -1, heartbeat bumped, values copied, ckpt id published). A
+ * sender streams the checkpoints to a receiver in the same process, with and
+ * without compression. Reports the kernel's time per save (alone, and while
+ * replicating), the checkpoints sent, acknowledged and retried, the bytes sent,
+ * the replication bandwidth and the latency from a save to its acknowledgement,
+ * and checks that the receiver's newest checkpoint is the last one saved.
+ *
+ * To Run:
+ * $ /path/to/build/bin/CkptReplicaBench [segment_bytes [changed_percent [interval_ms [chunk_bytes]]]]
+ */
+
+#include "ckpt_runtime/CkptHeader.h"
+#include "ckpt_runtime/CkptReplica.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#define NUM_STEPS     60
+#define CKPT_SITE_ID  3
+#define EPOCH         7
+#define FLUSH_MS      10000
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double
+secondsSince(Clock::time_point start)
+{
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/* What the injected saveBB does, for a kernel whose only live value is the array */
+void
+saveCheckpoint(char *ckptMem, const std::vector<float> &array)
+{
+  ckpt_header_t *header = ckpt_header(ckptMem);
+  __atomic_store_n(&header->ckpt_id, -1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&header->heartbeat, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(ckpt_values(ckptMem), array.data(), array.size() * sizeof(float));
+  __atomic_store_n(&header->ckpt_id, CKPT_SITE_ID, __ATOMIC_RELEASE);
+}
+
+/**
+* Each step updates changedPercent of the array (a band of 4 KiB blocks that moves
+* through its first half, like the rows of a sweep), computes until intervalMs
+* passed, then saves; returns the mean seconds per save.
+*/
+double
+runKernel(char *ckptMem, std::vector<float> &array, int changedPercent, int intervalMs)
+{
+  const size_t blockFloats = 1024;
+  size_t numBlocks = array.size() / blockFloats;
+  size_t numUpdatedBlocks = std::max<size_t>(1, numBlocks / 2);
+  size_t changedBlocks = std::max<size_t>(1, numBlocks * changedPercent / 100);
+  double saveS = 0;
+  volatile double sink = 0;
+  for (int step = 0; step < NUM_STEPS; step++)
+  {
+    Clock::time_point stepStart = Clock::now();
+    for (size_t b = 0; b < changedBlocks; b++)
+    {
+      float *block = &array[((step * changedBlocks + b) % numUpdatedBlocks) * blockFloats];
+      for (size_t k = 0; k < blockFloats; k++) block[k] += 1.0f + k % 7;
+    }
+    while (secondsSince(stepStart) * 1000 < intervalMs)
+    {
+      for (int k = 0; k < 1000; k++) sink = sink * 0.5 + k;
+    }
+    Clock::time_point saveStart = Clock::now();
+    saveCheckpoint(ckptMem, array);
+    saveS += secondsSince(saveStart);
+  }
+  return saveS / NUM_STEPS;
+}
+
+bool
+runReplication(int64_t bytes, int changedPercent, int intervalMs, int64_t chunkBytes, int32_t flags, double aloneSaveS)
+{
+  std::vector<char> ckptMem(bytes);
+  ckpt_header_reset(ckptMem.data());
+  ckpt_header(ckptMem.data())->epoch = EPOCH;
+  // half of the array stays zero (e.g. rows not computed yet), which compresses
+  std::vector<float> array((bytes - CKPT_HEADER_BYTES) / sizeof(float), 0.0f);
+  for (size_t i = 0; i < array.size() / 2; i++) array[i] = (float)(i % 1000) * 0.5f;
+
+  ckpt_repl_receiver_t *receiver = ckpt_repl_receiver_start("127.0.0.1", 0, bytes);
+  ckpt_repl_sender_t *sender = receiver ? ckpt_repl_sender_start(ckptMem.data(), bytes, "127.0.0.1",
+                                                                 ckpt_repl_receiver_port(receiver), chunkBytes, flags)
+                                        : nullptr;
+  if (sender == nullptr)
+  {
+    printf("ERROR: cannot connect to the receiver on localhost\n");
+    ckpt_repl_receiver_stop(receiver);
+    return false;
+  }
+
+  Clock::time_point start = Clock::now();
+  double saveS = runKernel(ckptMem.data(), array, changedPercent, intervalMs);
+  Clock::time_point flushStart = Clock::now();
+  int32_t flushedId = ckpt_repl_sender_flush(sender, FLUSH_MS);
+  double flushMs = secondsSince(flushStart) * 1000;
+  double elapsedS = secondsSince(start);
+  ckpt_repl_stats_t stats;
+  ckpt_repl_sender_stats(sender, &stats);
+  ckpt_repl_sender_stop(sender);
+
+  std::vector<char> restored(bytes);
+  int32_t restoredId = ckpt_repl_receiver_restore(receiver, restored.data(), bytes);
+  ckpt_repl_receiver_stop(receiver);
+  bool ok = flushedId == CKPT_SITE_ID && restoredId == CKPT_SITE_ID && ckpt_header(restored.data())->epoch == EPOCH
+            && memcmp(ckpt_values(restored.data()), array.data(), array.size() * sizeof(float)) == 0;
+
+  printf("%-10s %9.2f %9.2f %6lld %6lld %6lld %10.1f %10.1f %9.1f %9.1f %9.2f  %s\n",
+         (flags & CKPT_REPL_COMPRESS) ? "compress" : "raw", aloneSaveS * 1000, saveS * 1000,
+         (long long)stats.ckpts_sent, (long long)stats.ckpts_acked, (long long)stats.ckpts_retried,
+         stats.raw_bytes_sent / 1048576.0, stats.wire_bytes_sent / 1048576.0,
+         stats.raw_bytes_sent / 1048576.0 / elapsedS, stats.last_ack_us / 1000, flushMs, ok ? "OK" : "WRONG");
+  return ok;
+}
+
+/* Parses a positional argument; false unless it is a whole number in [min, max] */
+bool
+parseArg(const char *arg, int64_t min, int64_t max, int64_t *value)
+{
+  char *end;
+  errno = 0;
+  long long parsed = strtoll(arg, &end, 0);
+  if (end == arg || *end != '\0' || errno == ERANGE || parsed < min || parsed > max) return false;
+  *value = parsed;
+  return true;
+}
+
+} /* anonymous namespace */
+
+int
+main(int argc, char **argv)
+{
+  int64_t bytes = 64L << 20, changed = 5, interval = 100, chunkBytes = 256L << 10;
+  const int64_t minBytes = CKPT_HEADER_BYTES + 4096 * sizeof(float);
+  bool argsOk = argc <= 5
+                && (argc <= 1 || parseArg(argv[1], minBytes, INT64_MAX, &bytes))
+                && (argc <= 2 || parseArg(argv[2], 0, 100, &changed))
+                && (argc <= 3 || parseArg(argv[3], 0, INT32_MAX, &interval))
+                && (argc <= 4 || (parseArg(argv[4], 8, INT64_MAX, &chunkBytes) && chunkBytes % 8 == 0));
+  if (!argsOk)
+  {
+    fprintf(stderr, "usage: %s [segment_bytes [changed_percent [interval_ms [chunk_bytes]]]]\n"
+                    "  segment_bytes: at least %lld; changed_percent: 0 to 100; chunk_bytes: a multiple of 8\n",
+            argv[0], (long long)minBytes);
+    return 1;
+  }
+  int changedPercent = (int)changed, intervalMs = (int)interval;
+
+  // the kernel alone, for the cost of a save without replication
+  std::vector<char> ckptMem(bytes);
+  std::vector<float> array((bytes - CKPT_HEADER_BYTES) / sizeof(float), 1.0f);
+  double aloneSaveS = runKernel(ckptMem.data(), array, changedPercent, intervalMs);
+
+  printf("segment %lld bytes, %d%% changed per step, a save every %d ms, chunks of %lld bytes, %d steps\n",
+         (long long)bytes, changedPercent, intervalMs, (long long)chunkBytes, NUM_STEPS);
+  printf("%-10s %9s %9s %6s %6s %6s %10s %10s %9s %9s %9s\n", "mode", "alone ms", "save ms", "sent", "acked",
+         "retry", "raw MiB", "wire MiB", "MiB/s", "ack ms", "flush ms");
+  bool ok = runReplication(bytes, changedPercent, intervalMs, chunkBytes, 0, aloneSaveS);
+  ok = runReplication(bytes, changedPercent, intervalMs, chunkBytes, CKPT_REPL_COMPRESS, aloneSaveS) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+/**
+ * Peer daemon for checkpoint replication (ckpt_runtime/CkptReplica.h): receives
+ * the checkpoints a sender streams from another node, and writes the newest fully
+ * received one to a file, which a host on this node can load into ckpt_mem to
+ * resume the kernel after the sender's node failed.
+ *
+ * The file holds the whole segment, header included (ckpt id and epoch set, zero
+ * heartbeat); it is replaced atomically (rename) after each checkpoint, at most
+ * once per second.
+ *
+ * To Run:
+ * $ /path/to/build/bin/CkptReplicaPeer <port> <segment_bytes> [out_file]
+ */
+
+#include "ckpt_runtime/CkptReplica.h"
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#define WAIT_MS 1000
+
+namespace {
+
+volatile sig_atomic_t Stopping = 0;
+
+void
+handleSignal(int)
+{
+  Stopping = 1;
+}
+
+bool
+writeSegment(const std::string &path, const std::vector<char> &segment)
+{
+  std::string tmpPath = path + ".tmp";
+  FILE *file = fopen(tmpPath.c_str(), "wb");
+  if (file == nullptr) return false;
+  bool ok = fwrite(segment.data(), 1, segment.size(), file) == segment.size();
+  ok = (fclose(file) == 0) && ok;
+  return ok && rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+} /* anonymous namespace */
+
+int
+main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    fprintf(stderr, "usage: %s <port> <segment_bytes> [out_file]\n", argv[0]);
+    return 1;
+  }
+  int32_t port = atoi(argv[1]);
+  int64_t bytes = strtoll(argv[2], nullptr, 0);
+  std::string outPath = (argc > 3) ? argv[3] : "";
+
+  ckpt_repl_receiver_t *receiver = ckpt_repl_receiver_start(nullptr, port, bytes);
+  if (receiver == nullptr)
+  {
+    fprintf(stderr, "ERROR: cannot listen on port %d\n", port);
+    return 1;
+  }
+  signal(SIGINT, handleSignal);
+  signal(SIGTERM, handleSignal);
+  printf("listening on port %d for a segment of %lld bytes\n", ckpt_repl_receiver_port(receiver), (long long)bytes);
+  fflush(stdout);
+
+  std::vector<char> segment(bytes);
+  int64_t written = 0;
+  while (!Stopping)
+  {
+    int32_t ckptId, epoch;
+    int64_t commits = ckpt_repl_receiver_wait(receiver, written + 1, WAIT_MS, &ckptId, &epoch);
+    if (commits <= written) continue;
+    printf("checkpoint %d (epoch %d) received, %lld so far\n", ckptId, epoch, (long long)commits);
+    fflush(stdout);
+    if (!outPath.empty())
+    {
+      ckpt_repl_receiver_restore(receiver, segment.data(), bytes);
+      if (!writeSegment(outPath, segment)) fprintf(stderr, "WARNING: cannot write %s\n", outPath.c_str());
+    }
+    written = commits;
+  }
+  ckpt_repl_receiver_stop(receiver);
+  return 0;
+}
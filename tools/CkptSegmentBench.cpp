@@ -0,0 +1,181 @@
+/**
+ * Benchmark of the checkpoint segment allocator (ckpt_runtime/CkptSegment.h).
+ *
+ * Allocates a segment the way the examples do (a static array, i.e. private
+ * zero-fill-on-demand pages, and create_shared_memory, a plain shared mmap), then
+ * with ckpt_segment_alloc for combinations of huge pages, pre-faulting, NUMA
+ * binding and mlock. Into each, it saves a checkpoint the way the code injected
+ * with -ckpt-header does (ckpt id set to -1, heartbeat bumped, values copied, ckpt
+ * id published), once right after the allocation and then repeatedly. Reports the
+ * allocation time (including pre-faulting), the bandwidth of the first save and
+ * of the following ones (steady state), the first save's time over the steady
+ * state's, and how much of the segment huge pages back. Huge pages are MAP_HUGETLB
+ * pages if enough are reserved (/proc/sys/vm/nr_hugepages), else THP.
+ *
+ * To Run:
+ * $ /path/to/build/bin/CkptSegmentBench [segment_bytes [saves]]
+ */
+
+#include "ckpt_runtime/CkptHeader.h"
+#include "ckpt_runtime/CkptSegment.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/mman.h>
+#include <vector>
+
+#define CKPT_SITE_ID  4
+#define NUM_TRIALS    3
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double
+msSince(Clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+/* What the injected saveBB does, for a kernel whose only live value is the array */
+void
+saveCheckpoint(char *ckptMem, const std::vector<char> &values)
+{
+  ckpt_header_t *header = ckpt_header(ckptMem);
+  __atomic_store_n(&header->ckpt_id, -1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&header->heartbeat, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(ckpt_values(ckptMem), values.data(), values.size());
+  __atomic_store_n(&header->ckpt_id, CKPT_SITE_ID, __ATOMIC_RELEASE);
+}
+
+typedef struct {
+  const char *name;
+  int32_t flags;     /* of ckpt_segment_alloc; -1: plain mmap */
+  int32_t numaNode;
+  int mapFlags;      /* of the plain mmap */
+} Config;
+
+typedef struct {
+  double allocMs, firstMs, steadyMs;
+  int64_t hugeBytes;
+  int32_t flags;
+} Result;
+
+bool
+runConfig(const Config &config, int64_t bytes, int saves, const std::vector<char> &values, Result *result)
+{
+  Clock::time_point start = Clock::now();
+  char *ckptMem;
+  if (config.flags < 0)
+  {
+    ckptMem = static_cast<char *>(mmap(nullptr, bytes, PROT_READ | PROT_WRITE, config.mapFlags, -1, 0));
+    if (ckptMem == MAP_FAILED) return false;
+  }
+  else
+  {
+    ckptMem = static_cast<char *>(ckpt_segment_alloc(bytes, config.numaNode, config.flags));
+    if (ckptMem == nullptr) return false;
+  }
+  result->allocMs = msSince(start);
+
+  start = Clock::now();
+  saveCheckpoint(ckptMem, values);
+  result->firstMs = msSince(start);
+  start = Clock::now();
+  for (int i = 0; i < saves; i++) saveCheckpoint(ckptMem, values);
+  result->steadyMs = msSince(start) / saves;
+  bool ok = ckpt_header(ckptMem)->ckpt_id == CKPT_SITE_ID
+            && memcmp(ckpt_values(ckptMem), values.data(), values.size()) == 0;
+
+  ckpt_segment_info_t info;
+  result->hugeBytes = 0;
+  result->flags = 0;
+  if (config.flags < 0)
+  {
+    munmap(ckptMem, bytes);
+  }
+  else
+  {
+    ckpt_segment_info(ckptMem, &info);
+    result->hugeBytes = info.huge_bytes;
+    result->flags = info.flags;
+    ckpt_segment_free(ckptMem);
+  }
+  return ok;
+}
+
+std::string
+pagesOf(const Result &result)
+{
+  if (result.flags & CKPT_SEGMENT_HUGETLB) return "hugetlb";
+  return result.hugeBytes > 0 ? "THP" : "4K";
+}
+
+/* Parses a positional argument; false unless it is a whole number in [min, max] */
+bool
+parseArg(const char *arg, int64_t min, int64_t max, int64_t *value)
+{
+  char *end;
+  errno = 0;
+  long long parsed = strtoll(arg, &end, 0);
+  if (end == arg || *end != '\0' || errno == ERANGE || parsed < min || parsed > max) return false;
+  *value = parsed;
+  return true;
+}
+
+} /* anonymous namespace */
+
+int
+main(int argc, char **argv)
+{
+  int64_t bytes = 256L << 20, saves = 5;
+  bool argsOk = argc <= 3
+                && (argc <= 1 || parseArg(argv[1], 2 * CKPT_HEADER_BYTES, INT64_MAX, &bytes))
+                && (argc <= 2 || parseArg(argv[2], 1, INT32_MAX, &saves));
+  if (!argsOk)
+  {
+    fprintf(stderr, "usage: %s [segment_bytes [saves]]\n"
+                    "  segment_bytes: at least %d; saves: at least 1\n", argv[0], 2 * CKPT_HEADER_BYTES);
+    return 1;
+  }
+  std::vector<char> values(bytes - CKPT_HEADER_BYTES);
+  for (size_t i = 0; i < values.size(); i++) values[i] = (char)(i * 131);
+
+  const int32_t prefault = CKPT_SEGMENT_PREFAULT, huge = CKPT_SEGMENT_HUGE, shared = CKPT_SEGMENT_SHARED;
+  const Config configs[] = {
+    {"static array (private)", -1, 0, MAP_PRIVATE | MAP_ANONYMOUS},
+    {"create_shared_memory", -1, 0, MAP_SHARED | MAP_ANONYMOUS},
+    {"private prefault", prefault, CKPT_SEGMENT_NODE_ANY, 0},
+    {"shared prefault", shared | prefault, CKPT_SEGMENT_NODE_ANY, 0},
+    {"private huge", huge, CKPT_SEGMENT_NODE_ANY, 0},
+    {"private huge prefault", huge | prefault, CKPT_SEGMENT_NODE_ANY, 0},
+    {"shared huge prefault", shared | huge | prefault, CKPT_SEGMENT_NODE_ANY, 0},
+    {"+ local node + mlock", shared | huge | prefault | CKPT_SEGMENT_MLOCK, CKPT_SEGMENT_NODE_LOCAL, 0},
+  };
+
+  printf("segment %lld bytes, %d steady-state saves, median of %d trials, on NUMA node %d\n", (long long)bytes,
+         (int)saves, NUM_TRIALS, ckpt_segment_node());
+  printf("%-24s %9s %10s %10s %11s %8s %9s %8s\n", "allocation", "alloc ms", "first ms", "first GiB/s",
+         "steady GiB/s", "1st/st", "huge MiB", "pages");
+  double gib = (bytes - CKPT_HEADER_BYTES) / 1073741824.0;
+  bool ok = true;
+  for (const Config &config : configs)
+  {
+    std::vector<Result> trials(NUM_TRIALS);
+    for (Result &trial : trials) ok = runConfig(config, bytes, saves, values, &trial) && ok;
+    // median by the first save, which is what the allocation changes
+    std::sort(trials.begin(), trials.end(), [](const Result &a, const Result &b) { return a.firstMs < b.firstMs; });
+    const Result &result = trials[NUM_TRIALS / 2];
+    printf("%-24s %9.1f %10.1f %10.2f %11.2f %8.2f %9.1f %8s\n", config.name, result.allocMs, result.firstMs,
+           gib / (result.firstMs / 1000), gib / (result.steadyMs / 1000), result.firstMs / result.steadyMs,
+           result.hugeBytes / 1048576.0, pagesOf(result).c_str());
+  }
+  printf("%s\n", ok ? "OK" : "WRONG");
+  return ok ? 0 : 1;
+}
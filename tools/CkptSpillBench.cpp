@@ -0,0 +1,202 @@
+/**
+ * Benchmark of the asynchronous checkpoint spill (ckpt_runtime/CkptSpill.h).
+ *
+ * Persists a segment with a published checkpoint to a file, first the blocking
+ * way (pwrite and fdatasync on the host thread), then with ckpt_spill for each
+ * combination of O_DIRECT and registered buffers. While a spill runs, the host
+ * computes in slices of 100 us between polls. Reports the time until the
+ * checkpoint is durable, the spill bandwidth, the time the host spent in spill
+ * calls, and the queue depth. It then checks that ckpt_spill_load returns the
+ * spilled checkpoint, and that a spill the kernel interrupts with a save ends torn
+ * without losing the previous durable checkpoint.
+ *
+ * To Run:
+ * $ /path/to/build/bin/CkptSpillBench [file [segment_bytes [chunk_bytes [queue_depth]]]]
+ */
+
+#include "ckpt_runtime/CkptHeader.h"
+#include "ckpt_runtime/CkptSpill.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#define CKPT_SITE_ID   2
+#define EPOCH          5
+#define NUM_SPILLS     3
+#define HOST_SLICE_US  100
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double
+msSince(Clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+/* What the injected saveBB does: overwrite the values with a new pattern and publish them */
+void
+saveCheckpoint(char *ckptMem, int64_t bytes, uint32_t pattern)
+{
+  ckpt_header_t *header = ckpt_header(ckptMem);
+  __atomic_store_n(&header->ckpt_id, -1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&header->heartbeat, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  uint32_t *values = static_cast<uint32_t *>(ckpt_values(ckptMem));
+  for (int64_t i = 0; i < (bytes - CKPT_HEADER_BYTES) / 4; i++) values[i] = pattern + (uint32_t)i * 2654435761U;
+  header->epoch = EPOCH;
+  __atomic_store_n(&header->ckpt_id, CKPT_SITE_ID, __ATOMIC_RELEASE);
+}
+
+bool
+isLoaded(const std::string &path, const char *ckptMem, int64_t bytes)
+{
+  std::vector<char> loaded(bytes);
+  int32_t epoch = 0;
+  return ckpt_spill_load(path.c_str(), loaded.data(), bytes, &epoch) == CKPT_SITE_ID && epoch == EPOCH
+         && memcmp(ckpt_values(loaded.data()), ckpt_values(const_cast<char *>(ckptMem)), bytes - CKPT_HEADER_BYTES) == 0;
+}
+
+/* The host computes between polls until the spill is done; returns the state */
+int32_t
+runHostLoop(ckpt_spill_t *spill, long *slices)
+{
+  volatile double sink = 0;
+  int32_t state;
+  while ((state = ckpt_spill_poll(spill)) == CKPT_SPILL_RUNNING)
+  {
+    Clock::time_point start = Clock::now();
+    while (msSince(start) * 1000 < HOST_SLICE_US) sink = sink * 0.5 + 1;
+    (*slices)++;
+  }
+  return state;
+}
+
+double
+runBlocking(const std::string &path, const char *ckptMem, int64_t bytes)
+{
+  Clock::time_point start = Clock::now();
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  bool ok = fd >= 0;
+  for (int64_t done = 0; ok && done < bytes;)
+  {
+    ssize_t n = pwrite(fd, ckptMem + done, bytes - done, done);
+    ok = n > 0;
+    done += ok ? n : 0;
+  }
+  ok = ok && fdatasync(fd) == 0;
+  if (fd >= 0) close(fd);
+  unlink(path.c_str());
+  return ok ? msSince(start) : -1;
+}
+
+bool
+runSpills(const std::string &path, char *ckptMem, int64_t bytes, int64_t chunkBytes, int32_t queueDepth, int32_t flags)
+{
+  unlink(path.c_str());
+  ckpt_spill_t *spill = ckpt_spill_open(path.c_str(), ckptMem, bytes, chunkBytes, queueDepth, flags);
+  if (spill == nullptr)
+  {
+    printf("ERROR: cannot open %s\n", path.c_str());
+    return false;
+  }
+  bool ok = true;
+  long slices = 0;
+  double spillMs = 0;
+  for (int i = 0; i < NUM_SPILLS; i++)
+  {
+    saveCheckpoint(ckptMem, bytes, i);
+    Clock::time_point start = Clock::now();
+    ok = ckpt_spill_begin(spill) == CKPT_SITE_ID && ok;
+    ok = runHostLoop(spill, &slices) == CKPT_SPILL_DURABLE && ok;
+    spillMs += msSince(start);
+    ok = isLoaded(path, ckptMem, bytes) && ok;
+  }
+
+  // a save in the middle of a spill tears it; the file keeps the last durable ckpt. The save comes
+  // before the first poll: a small segment's writes may all complete by then, and the spill is whole
+  std::vector<char> durable(ckptMem, ckptMem + bytes);
+  saveCheckpoint(ckptMem, bytes, 100);
+  bool isTornOk = ckpt_spill_begin(spill) == CKPT_SITE_ID;
+  saveCheckpoint(ckptMem, bytes, 101);
+  isTornOk = ckpt_spill_wait(spill, -1) == CKPT_SPILL_TORN && isTornOk;
+  isTornOk = isLoaded(path, durable.data(), bytes) && isTornOk;
+  ok = ok && isTornOk;
+
+  ckpt_spill_stats_t stats;
+  ckpt_spill_stats(spill, &stats);
+  ckpt_spill_close(spill);
+  unlink(path.c_str());
+
+  std::string mode = (stats.flags & CKPT_SPILL_DIRECT) ? "direct" : "buffered";
+  if (stats.flags & CKPT_SPILL_REGISTERED) mode += "+reg";
+  if (!stats.uses_io_uring) mode += " (pwrite)";
+  printf("%-22s %10.1f %10.1f %10.2f %8ld %7.1f %5d  %s\n", mode.c_str(), spillMs / NUM_SPILLS,
+         bytes / 1048576.0 / (spillMs / NUM_SPILLS / 1000), stats.host_ms / (NUM_SPILLS + 1), slices / NUM_SPILLS,
+         stats.mean_queue_depth, stats.max_queue_depth, ok ? "OK" : (isTornOk ? "WRONG" : "TORN-WRONG"));
+  return ok;
+}
+
+/* Parses a positional argument; false unless it is a whole number in [min, max] */
+bool
+parseArg(const char *arg, int64_t min, int64_t max, int64_t *value)
+{
+  char *end;
+  errno = 0;
+  long long parsed = strtoll(arg, &end, 0);
+  if (end == arg || *end != '\0' || errno == ERANGE || parsed < min || parsed > max) return false;
+  *value = parsed;
+  return true;
+}
+
+} /* anonymous namespace */
+
+int
+main(int argc, char **argv)
+{
+  std::string path = (argc > 1) ? argv[1] : "ckpt_spill_bench.bin";
+  int64_t bytes = 256L << 20, chunkBytes = 1L << 20, queueDepth = 32;
+  // chunks are a multiple of 4 KiB for the O_DIRECT spills
+  bool argsOk = argc <= 5 && !path.empty() && path[0] != '-'
+                && (argc <= 2 || parseArg(argv[2], CKPT_HEADER_BYTES + 4, INT64_MAX, &bytes))
+                && (argc <= 3 || (parseArg(argv[3], 4096, INT64_MAX, &chunkBytes) && chunkBytes % 4096 == 0))
+                && (argc <= 4 || parseArg(argv[4], 1, 4096, &queueDepth));
+  if (!argsOk)
+  {
+    fprintf(stderr, "usage: %s [file [segment_bytes [chunk_bytes [queue_depth]]]]\n"
+                    "  chunk_bytes: a multiple of 4096; queue_depth: 1 to 4096\n", argv[0]);
+    return 1;
+  }
+
+  char *ckptMem = static_cast<char *>(mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (ckptMem == MAP_FAILED)
+  {
+    perror("mmap");
+    return 1;
+  }
+  ckpt_header_reset(ckptMem);
+  saveCheckpoint(ckptMem, bytes, 0);
+
+  printf("%lld bytes to %s, chunks of %lld bytes, queue depth %d\n", (long long)bytes, path.c_str(),
+         (long long)chunkBytes, (int)queueDepth);
+  printf("%-22s %10s %10s %10s %8s %7s %5s\n", "mode", "spill ms", "MiB/s", "host ms", "slices", "mean qd", "max");
+  double blockingMs = runBlocking(path, ckptMem, bytes);
+  printf("%-22s %10.1f %10.1f %10.1f %8d %7s %5s\n", "blocking pwrite+sync", blockingMs,
+         bytes / 1048576.0 / (blockingMs / 1000), blockingMs, 0, "-", "-");
+  bool ok = blockingMs >= 0;
+  for (int32_t flags : {0, CKPT_SPILL_REGISTERED, CKPT_SPILL_DIRECT, CKPT_SPILL_DIRECT | CKPT_SPILL_REGISTERED})
+  {
+    ok = runSpills(path, ckptMem, bytes, chunkBytes, queueDepth, flags) && ok;
+  }
+  munmap(ckptMem, bytes);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,203 @@
+/**
+ * Failover latency benchmark for the ckpt_runtime hot standby.
+ *
+ * For each size of the checkpointed array, a primary process saves the array into
+ * a shared ckpt_mem segment and keeps beating its heartbeat until it is killed.
+ * The time from the moment the watchdog (this process) has seen the primary die
+ * to the restored array being ready to resume from is measured for:
+ *   cold     the watchdog restores itself, like backup_thread: it allocates the
+ *            output array and copies the checkpoint into it
+ *   standby  a standby process, forked in advance, is woken by the handover and
+ *            restores the checkpoint, without pre-warming
+ *   prewarm  as standby, with the segment, output array and code pre-faulted
+ * and each restored array is checked.
+ *
+ * To Run:
+ * $ /path/to/build/bin/CkptStandbyBench [size_bytes ...]
+ */
+
+#include "ckpt_runtime/CkptStandby.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <signal.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#define NUM_TRIALS 7
+
+namespace {
+
+/* Shared between the primary, the standby and the watchdog */
+typedef struct {
+  int32_t heartbeat;
+  int32_t numSaves;
+} PrimaryState;
+
+typedef enum { COLD, STANDBY, PREWARM } Mode;
+
+const char *ModeNames[] = {"cold", "standby", "prewarm"};
+
+int64_t
+nowNs(void)
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void *
+createSharedMemory(size_t bytes)
+{
+  void *mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+  {
+    perror("mmap");
+    exit(1);
+  }
+  return mem;
+}
+
+uint64_t
+getExpectedWord(size_t i)
+{
+  return i * 0x9E3779B97F4A7C15ULL;
+}
+
+/* Restores the array from ckpt_mem (what the restoreBBs of a kernel do); returns false if it is wrong */
+__attribute__((noinline)) bool
+restoreArray(uint64_t *out, const uint64_t *ckptMem, size_t numWords)
+{
+  memcpy(out, ckptMem, numWords * sizeof(uint64_t));
+  for (size_t i = 0; i < numWords; i += 4096)
+  {
+    if (out[i] != getExpectedWord(i)) return false;
+  }
+  return true;
+}
+
+/* Saves the array once, then beats the heartbeat until killed */
+void
+runPrimary(PrimaryState *state, uint64_t *ckptMem, size_t numWords)
+{
+  std::vector<uint64_t> work(numWords);
+  for (size_t i = 0; i < numWords; i++) work[i] = getExpectedWord(i);
+  memcpy(ckptMem, work.data(), numWords * sizeof(uint64_t));
+  __atomic_store_n(&state->numSaves, 1, __ATOMIC_RELEASE);
+  while (true)
+  {
+    __atomic_add_fetch(&state->heartbeat, 1, __ATOMIC_RELAXED);
+  }
+}
+
+/* Returns the failover latency in microseconds (negative if the restored array is wrong) */
+double
+runTrial(Mode mode, size_t bytes)
+{
+  size_t numWords = bytes / sizeof(uint64_t);
+  PrimaryState *state = static_cast<PrimaryState *>(createSharedMemory(sizeof(PrimaryState)));
+  uint64_t *ckptMem = static_cast<uint64_t *>(createSharedMemory(bytes));
+  ckpt_standby_t *standby = ckpt_standby_create();
+  int32_t *restoreOk = static_cast<int32_t *>(createSharedMemory(sizeof(int32_t)));
+
+  pid_t standbyPid = -1;
+  if (mode != COLD)
+  {
+    standbyPid = fork();
+    if (standbyPid == 0)
+    {
+      uint64_t *out = static_cast<uint64_t *>(malloc(bytes));
+      if (mode == PREWARM)
+      {
+        ckpt_standby_prewarm(ckptMem, bytes, 0);
+        ckpt_standby_prewarm(out, bytes, 1);
+        ckpt_standby_prewarm_code(reinterpret_cast<const void *>(&restoreArray));
+      }
+      if (ckpt_standby_wait(standby) == CKPT_STANDBY_HANDOVER)
+      {
+        *restoreOk = restoreArray(out, ckptMem, numWords);
+        ckpt_standby_resumed(standby);
+      }
+      _exit(0);
+    }
+    while (!ckpt_standby_is_ready(standby)) usleep(100);
+  }
+
+  pid_t primaryPid = fork();
+  if (primaryPid == 0)
+  {
+    runPrimary(state, ckptMem, numWords);
+    _exit(0);
+  }
+  while (__atomic_load_n(&state->numSaves, __ATOMIC_ACQUIRE) == 0) usleep(100);
+  usleep(1000);
+  kill(primaryPid, SIGKILL);
+  waitpid(primaryPid, nullptr, 0);
+
+  double latencyUs = 0;
+  if (mode == COLD)
+  {
+    int64_t detected = nowNs();
+    uint64_t *out = static_cast<uint64_t *>(malloc(bytes));
+    *restoreOk = restoreArray(out, ckptMem, numWords);
+    latencyUs = (nowNs() - detected) / 1000.0;
+    free(out);
+  }
+  else
+  {
+    ckpt_standby_handover(standby);
+    waitpid(standbyPid, nullptr, 0);
+    latencyUs = ckpt_standby_failover_us(standby);
+  }
+  if (!*restoreOk) latencyUs = -1;
+
+  ckpt_standby_destroy(standby);
+  munmap(state, sizeof(PrimaryState));
+  munmap(ckptMem, bytes);
+  munmap(restoreOk, sizeof(int32_t));
+  return latencyUs;
+}
+
+} /* anonymous namespace */
+
+int
+main(int argc, char **argv)
+{
+  std::vector<size_t> sizes;
+  for (int i = 1; i < argc; i++) sizes.push_back(strtoull(argv[i], nullptr, 0));
+  if (sizes.empty()) sizes = {1UL << 20, 16UL << 20, 256UL << 20};
+
+  bool ok = true;
+  printf("%12s %8s %14s %14s %14s\n", "bytes", "mode", "median (us)", "min (us)", "max (us)");
+  for (size_t bytes : sizes)
+  {
+    bytes = std::max<size_t>(bytes / sizeof(uint64_t) * sizeof(uint64_t), sizeof(uint64_t));
+    for (Mode mode : {COLD, STANDBY, PREWARM})
+    {
+      std::vector<double> latencies;
+      for (int trial = 0; trial < NUM_TRIALS; trial++)
+      {
+        double latencyUs = runTrial(mode, bytes);
+        if (latencyUs < 0)
+        {
+          printf("ERROR: %s restore of %zu bytes is wrong or did not happen\n", ModeNames[mode], bytes);
+          ok = false;
+          continue;
+        }
+        latencies.push_back(latencyUs);
+      }
+      if (latencies.empty()) continue;
+      std::sort(latencies.begin(), latencies.end());
+      printf("%12zu %8s %14.1f %14.1f %14.1f\n", bytes, ModeNames[mode], latencies[latencies.size() / 2],
+             latencies.front(), latencies.back());
+      fflush(stdout);
+    }
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,512 @@
+/**
+ * Replays a checkpoint event trace (ckpt_runtime/CkptTrace.h) against a storage
+ * backend, so a backend (or its settings) can be evaluated on the saves of a real
+ * run without re-running the kernel.
+ *
+ * replay: performs the recorded saves in a segment (ckpt_trace_replay_save), at
+ * the recorded times divided by speed (0: back to back), while the backend
+ * persists them the way a host would drive it:
+ *   memory                    copies each new checkpoint into a second buffer
+ *   spill:<file>              ckpt_spill (io_uring), polled between saves
+ *   spill-direct:<file>       the same, with O_DIRECT and registered buffers
+ *   replica[:<host>:<port>]   ckpt_repl sender, to a receiver in this process or
+ *                             to a CkptReplicaPeer
+ *   replica-compress[:...]    the same, compressed
+ * Reports the replay time against the recorded one, the time per save, how many
+ * saves the backend persisted (exactly, or only through a later one), the bytes it
+ * wrote and its throughput, and the latency from each save to the backend having
+ * persisted it or a later one (percentiles). For local backends, it then checks
+ * that the backend holds the last save.
+ *
+ * record: records a trace of a synthetic kernel that updates changed_percent of
+ * its segment between saves (like CkptReplicaBench), for trying replays without
+ * a kernel; payload is none, hashes (default) or payloads.
+ *
+ * To Run:
+ * $ /path/to/build/bin/CkptTraceReplay replay <trace> <backend> [speed]
+ * $ /path/to/build/bin/CkptTraceReplay record <trace> [segment_bytes [changed_percent [interval_ms [saves [payload]]]]]
+ */
+
+#include "ckpt_runtime/CkptHeader.h"
+#include "ckpt_runtime/CkptReplica.h"
+#include "ckpt_runtime/CkptSegment.h"
+#include "ckpt_runtime/CkptSpill.h"
+#include "ckpt_runtime/CkptTrace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define REGION_BYTES      (64L << 10)
+#define POLL_INTERVAL_US  50
+#define DRAIN_MS          30000
+#define SPILL_CHUNK_BYTES (1L << 20)
+#define SPILL_QUEUE_DEPTH 32
+#define REPL_CHUNK_BYTES  (256L << 10)
+#define CKPT_SITE_ID      5
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double
+msSince(Clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+/* Parses a positional argument; false unless it is a whole number in [min, max] */
+bool
+parseArg(const char *arg, int64_t min, int64_t max, int64_t *value)
+{
+  char *end;
+  errno = 0;
+  long long parsed = strtoll(arg, &end, 0);
+  if (end == arg || *end != '\0' || errno == ERANGE || parsed < min || parsed > max) return false;
+  *value = parsed;
+  return true;
+}
+
+/* Parses the replay speed; false unless it is a finite number >= 0 */
+bool
+parseSpeed(const char *arg, double *speed)
+{
+  char *end;
+  errno = 0;
+  double parsed = strtod(arg, &end);
+  if (end == arg || *end != '\0' || errno == ERANGE || !std::isfinite(parsed) || parsed < 0) return false;
+  *speed = parsed;
+  return true;
+}
+
+bool
+isNewer(int32_t heartbeat, int32_t than)
+{
+  return (int32_t)((uint32_t)heartbeat - (uint32_t)than) >= 0;
+}
+
+/* A storage backend, driven by the replay loop like a host would */
+class Backend
+{
+public:
+  virtual ~Backend() {}
+  virtual bool start(char *ckptMem, int64_t bytes) = 0;
+  /* Does the host's share of the work; returns the heartbeat of the newest save persisted (0: none) */
+  virtual int32_t poll() = 0;
+  virtual int64_t bytesWritten() = 0;
+  /* Reads the persisted checkpoint back into ckptMem; false if this backend cannot */
+  virtual bool restore(char *ckptMem) = 0;
+  virtual void stop() = 0;
+};
+
+class MemoryBackend : public Backend
+{
+public:
+  bool
+  start(char *ckptMem, int64_t bytes) override
+  {
+    Mem = ckptMem;
+    Copy.resize(bytes);
+    return true;
+  }
+
+  int32_t
+  poll() override
+  {
+    const ckpt_header_t *header = ckpt_header(Mem);
+    int32_t heartbeat = ckpt_heartbeat(header);
+    if (ckpt_last_id(header) > 0 && heartbeat != Heartbeat)
+    {
+      // the replay saves on this thread, so no save overlaps the copy
+      memcpy(Copy.data(), Mem, Copy.size());
+      Heartbeat = heartbeat;
+      Written += Copy.size();
+    }
+    return Heartbeat;
+  }
+
+  int64_t
+  bytesWritten() override
+  {
+    return Written;
+  }
+
+  bool
+  restore(char *ckptMem) override
+  {
+    memcpy(ckptMem, Copy.data(), Copy.size());
+    return true;
+  }
+
+  void
+  stop() override
+  {
+  }
+
+private:
+  char *Mem = nullptr;
+  std::vector<char> Copy;
+  int32_t Heartbeat = 0;
+  int64_t Written = 0;
+};
+
+class SpillBackend : public Backend
+{
+public:
+  SpillBackend(const std::string &path, int32_t flags) : Path(path), Flags(flags) {}
+
+  bool
+  start(char *ckptMem, int64_t bytes) override
+  {
+    Bytes = bytes;
+    Spill = ckpt_spill_open(Path.c_str(), ckptMem, bytes, SPILL_CHUNK_BYTES, SPILL_QUEUE_DEPTH, Flags);
+    return Spill != nullptr;
+  }
+
+  int32_t
+  poll() override
+  {
+    if (ckpt_spill_poll(Spill) != CKPT_SPILL_RUNNING) ckpt_spill_begin(Spill);
+    ckpt_spill_stats_t stats;
+    ckpt_spill_stats(Spill, &stats);
+    return stats.durable_heartbeat;
+  }
+
+  int64_t
+  bytesWritten() override
+  {
+    ckpt_spill_stats_t stats;
+    ckpt_spill_stats(Spill, &stats);
+    return stats.bytes_written;
+  }
+
+  bool
+  restore(char *ckptMem) override
+  {
+    return ckpt_spill_load(Path.c_str(), ckptMem, Bytes, nullptr) > 0;
+  }
+
+  void
+  stop() override
+  {
+    ckpt_spill_close(Spill);
+  }
+
+private:
+  std::string Path;
+  int32_t Flags;
+  int64_t Bytes = 0;
+  ckpt_spill_t *Spill = nullptr;
+};
+
+class ReplicaBackend : public Backend
+{
+public:
+  ReplicaBackend(const std::string &host, int32_t port, int32_t flags) : Host(host), Port(port), Flags(flags) {}
+
+  bool
+  start(char *ckptMem, int64_t bytes) override
+  {
+    Bytes = bytes;
+    if (Host.empty())
+    {
+      Receiver = ckpt_repl_receiver_start("127.0.0.1", 0, bytes);
+      if (Receiver == nullptr) return false;
+      Host = "127.0.0.1";
+      Port = ckpt_repl_receiver_port(Receiver);
+    }
+    Sender = ckpt_repl_sender_start(ckptMem, bytes, Host.c_str(), Port, REPL_CHUNK_BYTES, Flags);
+    return Sender != nullptr;
+  }
+
+  int32_t
+  poll() override
+  {
+    ckpt_repl_stats_t stats;
+    ckpt_repl_sender_stats(Sender, &stats);
+    return stats.ckpts_acked > 0 ? stats.acked_heartbeat : 0;
+  }
+
+  int64_t
+  bytesWritten() override
+  {
+    ckpt_repl_stats_t stats;
+    ckpt_repl_sender_stats(Sender, &stats);
+    return stats.wire_bytes_sent;
+  }
+
+  bool
+  restore(char *ckptMem) override
+  {
+    return Receiver && ckpt_repl_receiver_restore(Receiver, ckptMem, Bytes) > 0;
+  }
+
+  void
+  stop() override
+  {
+    ckpt_repl_sender_stop(Sender);
+    ckpt_repl_receiver_stop(Receiver);
+  }
+
+private:
+  std::string Host;
+  int32_t Port;
+  int32_t Flags;
+  int64_t Bytes = 0;
+  ckpt_repl_sender_t *Sender = nullptr;
+  ckpt_repl_receiver_t *Receiver = nullptr;
+};
+
+Backend *
+makeBackend(const std::string &spec)
+{
+  size_t colon = spec.find(':');
+  std::string kind = spec.substr(0, colon);
+  std::string rest = (colon == std::string::npos) ? "" : spec.substr(colon + 1);
+  if (kind == "memory") return new MemoryBackend();
+  if (kind == "spill" && !rest.empty()) return new SpillBackend(rest, 0);
+  if (kind == "spill-direct" && !rest.empty())
+  {
+    return new SpillBackend(rest, CKPT_SPILL_DIRECT | CKPT_SPILL_REGISTERED);
+  }
+  if (kind == "replica" || kind == "replica-compress")
+  {
+    int32_t flags = (kind == "replica-compress") ? CKPT_REPL_COMPRESS : 0;
+    size_t portColon = rest.rfind(':');
+    if (rest.empty()) return new ReplicaBackend("", 0, flags);
+    int64_t port;
+    if (portColon != std::string::npos && parseArg(rest.c_str() + portColon + 1, 1, 65535, &port))
+    {
+      return new ReplicaBackend(rest.substr(0, portColon), (int32_t)port, flags);
+    }
+  }
+  return nullptr;
+}
+
+/* A save of the replay that the backend has not persisted yet */
+typedef struct {
+  int32_t heartbeat;
+  Clock::time_point publishedAt;
+} PendingSave;
+
+double
+percentile(std::vector<double> &values, double fraction)
+{
+  if (values.empty()) return 0;
+  size_t index = std::min(values.size() - 1, (size_t)(fraction * values.size()));
+  std::nth_element(values.begin(), values.begin() + index, values.end());
+  return values[index];
+}
+
+int
+replay(const std::string &tracePath, const std::string &backendSpec, double speed)
+{
+  ckpt_trace_info_t info;
+  ckpt_trace_reader_t *reader = ckpt_trace_open(tracePath.c_str(), &info);
+  if (reader == nullptr)
+  {
+    fprintf(stderr, "ERROR: %s is not a checkpoint trace\n", tracePath.c_str());
+    return 1;
+  }
+  Backend *backend = makeBackend(backendSpec);
+  if (backend == nullptr)
+  {
+    fprintf(stderr, "ERROR: unknown backend '%s'\n", backendSpec.c_str());
+    ckpt_trace_close(reader);
+    return 1;
+  }
+  char *ckptMem = static_cast<char *>(ckpt_segment_alloc(info.segment_bytes, CKPT_SEGMENT_NODE_ANY,
+                                                         CKPT_SEGMENT_PREFAULT));
+  ckpt_header_reset(ckptMem);
+
+  // the baseline sets up the segment as it was when the recording started
+  ckpt_trace_event_t event;
+  int32_t status = ckpt_trace_next(reader, &event);
+  int64_t baselineNs = (status > 0) ? event.start_ns : 0;
+  if (status > 0 && (event.flags & CKPT_TRACE_BASELINE)) ckpt_trace_replay_save(ckptMem, &info, &event);
+  if (!backend->start(ckptMem, info.segment_bytes))
+  {
+    fprintf(stderr, "ERROR: cannot start backend '%s'\n", backendSpec.c_str());
+    ckpt_segment_free(ckptMem);
+    ckpt_trace_close(reader);
+    delete backend;
+    return 1;
+  }
+
+  std::deque<PendingSave> pending;
+  std::vector<double> latenciesMs;
+  int64_t events = 0, torn = 0, changedBytes = 0, exact = 0, superseded = 0;
+  int64_t recordedNs = 0;
+  double saveMs = 0;
+  auto resolve = [&](int32_t persisted) {
+    Clock::time_point now = Clock::now();
+    while (persisted != 0 && !pending.empty() && isNewer(persisted, pending.front().heartbeat))
+    {
+      latenciesMs.push_back(std::chrono::duration<double, std::milli>(now - pending.front().publishedAt).count());
+      (pending.front().heartbeat == persisted ? exact : superseded)++;
+      pending.pop_front();
+    }
+  };
+
+  Clock::time_point start = Clock::now();
+  while ((status = ckpt_trace_next(reader, &event)) > 0)
+  {
+    Clock::time_point due = start + std::chrono::nanoseconds(speed > 0 ? (int64_t)((event.start_ns - baselineNs) / speed) : 0);
+    while (Clock::now() < due)
+    {
+      resolve(backend->poll());
+      std::this_thread::sleep_for(std::chrono::microseconds(POLL_INTERVAL_US));
+    }
+    Clock::time_point saveStart = Clock::now();
+    int32_t heartbeat = ckpt_trace_replay_save(ckptMem, &info, &event);
+    Clock::time_point published = Clock::now();
+    saveMs += std::chrono::duration<double, std::milli>(published - saveStart).count();
+    pending.push_back({heartbeat, published});
+    resolve(backend->poll());
+    events++;
+    torn += (event.flags & CKPT_TRACE_TORN) ? 1 : 0;
+    changedBytes += event.changed_bytes;
+    recordedNs = event.publish_ns - baselineNs;
+  }
+  double replayMs = msSince(start);
+  if (status < 0)
+  {
+    fprintf(stderr, "WARNING: %s is truncated or malformed after %lld events\n", tracePath.c_str(), (long long)events);
+  }
+  Clock::time_point drainStart = Clock::now();
+  while (!pending.empty() && msSince(drainStart) < DRAIN_MS)
+  {
+    resolve(backend->poll());
+    std::this_thread::sleep_for(std::chrono::microseconds(POLL_INTERVAL_US));
+  }
+  double elapsedMs = msSince(start);
+  int64_t written = backend->bytesWritten();
+
+  std::vector<char> restored(info.segment_bytes);
+  bool canRestore = backend->restore(restored.data());
+  bool isRestoredOk = canRestore
+                      && memcmp(ckpt_values(restored.data()), ckpt_values(ckptMem),
+                                info.segment_bytes - CKPT_HEADER_BYTES) == 0;
+  backend->stop();
+  delete backend;
+  ckpt_segment_free(ckptMem);
+  ckpt_trace_close(reader);
+
+  printf("trace %s: %lld events (%lld torn), segment %.1f MiB in regions of %lld KiB, %s\n", tracePath.c_str(),
+         (long long)events, (long long)torn, info.segment_bytes / 1048576.0, (long long)info.region_bytes >> 10,
+         (info.flags & CKPT_TRACE_PAYLOADS) ? "payloads" : "synthetic contents");
+  if (speed > 0) printf("backend %s, speed %gx\n", backendSpec.c_str(), speed);
+  else printf("backend %s, speed max\n", backendSpec.c_str());
+  printf("%-34s %10.1f ms (recorded %.1f ms)\n", "replay", replayMs, recordedNs / 1e6);
+  printf("%-34s %10.3f ms\n", "time per save", events ? saveMs / events : 0);
+  printf("%-34s %10lld exact, %lld through a later save, %lld not within %d ms\n", "saves persisted",
+         (long long)exact, (long long)superseded, (long long)pending.size(), DRAIN_MS);
+  printf("%-34s %10.1f MiB (%.1f MiB/s)\n", "changed by the saves", changedBytes / 1048576.0,
+         changedBytes / 1048576.0 / (elapsedMs / 1000));
+  printf("%-34s %10.1f MiB (%.1f MiB/s)\n", "written by the backend", written / 1048576.0,
+         written / 1048576.0 / (elapsedMs / 1000));
+  printf("%-34s %10.2f / %.2f / %.2f ms\n", "save to persisted (p50/p99/max)", percentile(latenciesMs, 0.5),
+         percentile(latenciesMs, 0.99), percentile(latenciesMs, 1.0));
+  if (!canRestore)
+  {
+    printf("last save held by the backend: not checked (remote)\n");
+    return pending.empty() && status == 0 ? 0 : 1;
+  }
+  printf("last save held by the backend: %s\n", isRestoredOk ? "OK" : "WRONG");
+  return isRestoredOk && pending.empty() && status == 0 ? 0 : 1;
+}
+
+/* What the injected saveBB does, for a kernel whose only live value is the array */
+void
+saveCheckpoint(char *ckptMem, const std::vector<float> &array)
+{
+  ckpt_header_t *header = ckpt_header(ckptMem);
+  __atomic_store_n(&header->ckpt_id, -1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&header->heartbeat, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(ckpt_values(ckptMem), array.data(), array.size() * sizeof(float));
+  __atomic_store_n(&header->ckpt_id, CKPT_SITE_ID, __ATOMIC_RELEASE);
+}
+
+int
+record(const std::string &tracePath, int64_t bytes, int changedPercent, int intervalMs, int saves, int32_t flags)
+{
+  std::vector<char> ckptMem(bytes);
+  ckpt_header_reset(ckptMem.data());
+  std::vector<float> array((bytes - CKPT_HEADER_BYTES) / sizeof(float), 0.0f);
+  ckpt_trace_t *trace = ckpt_trace_start(tracePath.c_str(), ckptMem.data(), bytes, REGION_BYTES, flags);
+  if (trace == nullptr)
+  {
+    fprintf(stderr, "ERROR: cannot create %s\n", tracePath.c_str());
+    return 1;
+  }
+
+  // each step updates a band of changedPercent of the array, which moves through it
+  const size_t blockFloats = 1024;
+  size_t numBlocks = std::max<size_t>(1, array.size() / blockFloats);
+  size_t changedBlocks = std::max<size_t>(1, numBlocks * changedPercent / 100);
+  volatile double sink = 0;
+  for (int step = 0; step < saves; step++)
+  {
+    Clock::time_point stepStart = Clock::now();
+    for (size_t b = 0; b < changedBlocks; b++)
+    {
+      size_t first = ((step * changedBlocks + b) % numBlocks) * blockFloats;
+      for (size_t k = first; k < std::min(first + blockFloats, array.size()); k++) array[k] += 1.0f + k % 7;
+    }
+    while (msSince(stepStart) < intervalMs)
+    {
+      for (int k = 0; k < 1000; k++) sink = sink * 0.5 + k;
+    }
+    saveCheckpoint(ckptMem.data(), array);
+  }
+  ckpt_trace_stats_t stats;
+  ckpt_trace_stop(trace, &stats);
+  printf("recorded %lld events to %s: %lld saves (%lld missed between polls), %lld torn, %lld retries, "
+         "%.1f MiB changed, %.1f MiB trace\n", (long long)stats.events, tracePath.c_str(), (long long)stats.saves,
+         (long long)stats.missed_saves, (long long)stats.torn_events, (long long)stats.retries,
+         stats.changed_bytes / 1048576.0, stats.file_bytes / 1048576.0);
+  return 0;
+}
+
+} /* anonymous namespace */
+
+int
+main(int argc, char **argv)
+{
+  std::string mode = (argc > 1) ? argv[1] : "";
+  bool isTrace = argc > 2 && argv[2][0] != '\0' && argv[2][0] != '-';
+  double speed = 1.0;
+  if (mode == "replay" && isTrace && argc > 3 && argc <= 5 && (argc <= 4 || parseSpeed(argv[4], &speed)))
+  {
+    return replay(argv[2], argv[3], speed);
+  }
+  int64_t bytes = 64L << 20, changedPercent = 5, intervalMs = 100, saves = 50;
+  std::string payload = (argc > 7) ? argv[7] : "hashes";
+  if (mode == "record" && isTrace && argc <= 8
+      && (argc <= 3 || parseArg(argv[3], CKPT_HEADER_BYTES + REGION_BYTES, INT64_MAX, &bytes))
+      && (argc <= 4 || parseArg(argv[4], 0, 100, &changedPercent))
+      && (argc <= 5 || parseArg(argv[5], 0, INT32_MAX, &intervalMs))
+      && (argc <= 6 || parseArg(argv[6], 1, INT32_MAX, &saves))
+      && (payload == "none" || payload == "hashes" || payload == "payloads"))
+  {
+    int32_t flags = (payload == "payloads") ? CKPT_TRACE_HASHES | CKPT_TRACE_PAYLOADS
+                    : (payload == "none")   ? 0
+                                            : CKPT_TRACE_HASHES;
+    return record(argv[2], bytes, (int)changedPercent, (int)intervalMs, (int)saves, flags);
+  }
+  fprintf(stderr, "usage: %s replay <trace> <backend> [speed]\n"
+                  "       %s record <trace> [segment_bytes [changed_percent [interval_ms [saves [payload]]]]]\n"
+                  "  speed: >= 0; segment_bytes: at least %lld; changed_percent: 0 to 100; saves: at least 1;\n"
+                  "  payload: none, hashes or payloads\n",
+          argv[0], argv[0], (long long)(CKPT_HEADER_BYTES + REGION_BYTES));
+  return 1;
+}
@@ -0,0 +1,251 @@
+#!/usr/bin/env python3
+"""
+Checkpoint-scaling regression benchmark for the SubroutineInjection pass.
+
+Generates kernels (LLVM IR + annotated source) with a given number of
+checkpoint() directives in a single function, runs the checkpointing pass
+pipeline on each of them, and reports the compile time.
+
+Each kernel is a loop whose body is a chain of stages; every stage updates
+arr[i] and s, calls tick() and ends with a checkpoint() directive.
+
+To Run:
+$ python3 tools/ckpt_scaling_bench.py --build-dir /path/to/build [--counts 1,10,100,500] [--check]
+
+--check also compiles each instrumented kernel and runs it with a fork-based
+driver that kills the kernel at several ticks, re-runs it to restore from
+the last checkpoint, and compares the result against an uninterrupted run.
+"""
+
+import argparse
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+ARR_SIZE = 64
+LOOP_ITERS = 8
+
+SOURCE_TEMPLATE = """extern "C" {{
+  void checkpoint() {{}}
+  void tick();
+  /*#FUNCTION_DEF#*/
+  /* FUNC kern : ARGS arr{{}}[{arr_size}] */
+  void kern(float* arr, float* ckpt_mem){{
+    int i; float s = 0;
+    for (i=0; i<{loop_iters}; i++) {{
+      /* {num_ckpts} x: arr[i] = arr[i] + s; s += 1; tick(); checkpoint(); */
+    }}
+  }}
+}}
+"""
+
+DRIVER_SOURCE = r"""
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#define N %(arr_size)d
+#define CKPT_SLOTS 4096
+#define TOTAL_TICKS %(total_ticks)d
+void kern(float*, float*);
+static int ticks = 0, fail_at = -1;
+void tick(void){ if (++ticks == fail_at) _exit(3); }
+void cpy_wrapper_f(float* d, float* s, int n){ memcpy(d, s, n); }
+static void init(float* a){ for(int k=0;k<N;k++) a[k]=k*0.5f; }
+int main(void){
+  float ref[N]; static float ck[CKPT_SLOTS];
+  init(ref); kern(ref, ck);
+  int bad = 0;
+  int step = TOTAL_TICKS / 16; if (step < 1) step = 1;
+  for (int f = 1; f <= TOTAL_TICKS; f += step) {
+    float *a = mmap(0, N*sizeof(float), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    float *m = mmap(0, CKPT_SLOTS*sizeof(float), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    init(a);
+    pid_t pid = fork();
+    if (pid==0){ ticks = 0; fail_at = f; kern(a, m); _exit(0); }
+    int st; waitpid(pid, &st, 0);
+    if (!WIFEXITED(st) || WEXITSTATUS(st) != 3) { printf("NOT KILLED fail_at=%%d\n", f); bad = 1; }
+    kern(a, m);
+    if (memcmp(a, ref, sizeof ref)) { printf("MISMATCH fail_at=%%d\n", f); bad = 1; }
+    munmap(a, N*sizeof(float)); munmap(m, CKPT_SLOTS*sizeof(float));
+  }
+  return bad;
+}
+"""
+
+
+def gen_kernel_ir(num_ckpts):
+  """Returns clang -O0 style IR for a kernel with num_ckpts checkpoint() calls."""
+  lines = []
+  lines.append('; ModuleID = \'kern.cpp\'')
+  lines.append('source_filename = "kern.cpp"')
+  lines.append('target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"')
+  lines.append('target triple = "x86_64-pc-linux-gnu"')
+  lines.append('')
+  lines.append('define dso_local void @checkpoint() {')
+  lines.append('entry:')
+  lines.append('  ret void')
+  lines.append('}')
+  lines.append('')
+  lines.append('declare void @tick()')
+  lines.append('declare void @cpy_wrapper_f(float*, float*, i32)')
+  lines.append('')
+  lines.append('define dso_local void @kern(float* noundef %arr, float* noundef %ckpt_mem) {')
+  lines.append('entry:')
+  lines.append('  %arr.addr = alloca float*, align 8')
+  lines.append('  %ckpt_mem.addr = alloca float*, align 8')
+  lines.append('  %i = alloca i32, align 4')
+  lines.append('  %s = alloca float, align 4')
+  lines.append('  store float* %arr, float** %arr.addr, align 8')
+  lines.append('  store float* %ckpt_mem, float** %ckpt_mem.addr, align 8')
+  lines.append('  store float 0.000000e+00, float* %s, align 4')
+  lines.append('  store i32 0, i32* %i, align 4')
+  lines.append('  br label %for.cond')
+  lines.append('')
+
+  # unnamed values are numbered in order of definition, as clang does
+  slot = [0]
+
+  def tmp():
+    name = '%' + str(slot[0])
+    slot[0] += 1
+    return name
+
+  lines.append('for.cond:')
+  i_val = tmp()
+  lines.append('  %s = load i32, i32* %%i, align 4' % i_val)
+  lines.append('  %%cmp = icmp slt i32 %s, %d' % (i_val, LOOP_ITERS))
+  lines.append('  br i1 %cmp, label %stage0, label %for.end')
+  lines.append('')
+
+  for k in range(num_ckpts):
+    next_bb = 'stage%d' % (k + 1) if k + 1 < num_ckpts else 'for.inc'
+    lines.append('stage%d:' % k)
+    arr_val = tmp()
+    lines.append('  %s = load float*, float** %%arr.addr, align 8' % arr_val)
+    idx_val = tmp()
+    lines.append('  %s = load i32, i32* %%i, align 4' % idx_val)
+    lines.append('  %%idxprom%d = sext i32 %s to i64' % (k, idx_val))
+    lines.append('  %%arrayidx%d = getelementptr inbounds float, float* %s, i64 %%idxprom%d' % (k, arr_val, k))
+    elem_val = tmp()
+    lines.append('  %s = load float, float* %%arrayidx%d, align 4' % (elem_val, k))
+    s_val = tmp()
+    lines.append('  %s = load float, float* %%s, align 4' % s_val)
+    lines.append('  %%add%d = fadd float %s, %s' % (k, elem_val, s_val))
+    lines.append('  store float %%add%d, float* %%arrayidx%d, align 4' % (k, k))
+    s_val2 = tmp()
+    lines.append('  %s = load float, float* %%s, align 4' % s_val2)
+    lines.append('  %%incs%d = fadd float %s, 1.000000e+00' % (k, s_val2))
+    lines.append('  store float %%incs%d, float* %%s, align 4' % k)
+    lines.append('  call void @tick()')
+    lines.append('  call void @checkpoint()')
+    lines.append('  br label %%%s' % next_bb)
+    lines.append('')
+
+  lines.append('for.inc:')
+  inc_val = tmp()
+  lines.append('  %s = load i32, i32* %%i, align 4' % inc_val)
+  lines.append('  %%inc = add nsw i32 %s, 1' % inc_val)
+  lines.append('  store i32 %inc, i32* %i, align 4')
+  lines.append('  br label %for.cond')
+  lines.append('')
+  lines.append('for.end:')
+  lines.append('  ret void')
+  lines.append('}')
+  return '\n'.join(lines) + '\n'
+
+
+def run_pipeline(args, work_dir, num_ckpts):
+  """Runs the pass pipeline on a generated kernel; returns (seconds, output IR path)."""
+  lib_dir = os.path.join(os.path.abspath(args.build_dir), 'lib')
+  in_ll = os.path.join(work_dir, 'kern.ll')
+  src = os.path.join(work_dir, 'kern.cpp')
+  out_ll = os.path.join(work_dir, 'kern_ckpt.ll')
+  with open(in_ll, 'w') as f:
+    f.write(gen_kernel_ir(num_ckpts))
+  with open(src, 'w') as f:
+    f.write(SOURCE_TEMPLATE.format(arr_size=ARR_SIZE, loop_iters=LOOP_ITERS, num_ckpts=num_ckpts))
+
+  cmd = [args.opt, '-enable-new-pm=0',
+         '-load=' + os.path.join(lib_dir, 'libSplitConditionalBB.so'),
+         '-load=' + os.path.join(lib_dir, 'libLiveValues.so'),
+         '-load=' + os.path.join(lib_dir, 'libSubroutineInjection.so'),
+         '-split-conditional-bb', '-live-values', '-source', src,
+         '-subroutine-injection', '-S', in_ll, '-o', out_ll]
+  # the passes exchange data through json files in the working directory
+  with open(os.path.join(work_dir, 'opt.log'), 'w') as log:
+    start = time.monotonic()
+    rc = subprocess.call(cmd, cwd=work_dir, stdout=log, stderr=subprocess.STDOUT)
+    elapsed = time.monotonic() - start
+  if rc != 0:
+    raise RuntimeError('opt failed for %d checkpoints (see %s)' % (num_ckpts, os.path.join(work_dir, 'opt.log')))
+  if subprocess.call([args.opt, '-verify', '-disable-output', out_ll]) != 0:
+    raise RuntimeError('output IR for %d checkpoints does not verify' % num_ckpts)
+  return elapsed, out_ll
+
+
+def check_restore(args, work_dir, out_ll, num_ckpts):
+  """Builds the instrumented kernel with the fork-based driver and runs it."""
+  obj = os.path.join(work_dir, 'kern_ckpt.o')
+  drv_src = os.path.join(work_dir, 'driver.c')
+  drv = os.path.join(work_dir, 'driver')
+  with open(drv_src, 'w') as f:
+    f.write(DRIVER_SOURCE % {'arr_size': ARR_SIZE, 'total_ticks': num_ckpts * LOOP_ITERS})
+  subprocess.check_call([args.llc, '-relocation-model=pic', '-filetype=obj', out_ll, '-o', obj])
+  subprocess.check_call([args.cc, drv_src, obj, '-o', drv])
+  return subprocess.call([drv], cwd=work_dir) == 0
+
+
+def main():
+  parser = argparse.ArgumentParser(description='Checkpoint-scaling regression benchmark.')
+  parser.add_argument('--build-dir', required=True, help='cmake build dir containing lib/libSubroutineInjection.so')
+  parser.add_argument('--counts', default='1,10,100,500', help='comma-separated numbers of checkpoints')
+  parser.add_argument('--opt', default=shutil.which('opt') or 'opt')
+  parser.add_argument('--llc', default=shutil.which('llc') or 'llc')
+  parser.add_argument('--cc', default=shutil.which('cc') or 'cc')
+  parser.add_argument('--check', action='store_true', help='also run restore-correctness check for each kernel')
+  parser.add_argument('--max-growth', type=float, default=2.0,
+                      help='fail if time grows more than this factor faster than #checkpoints between the two largest counts')
+  parser.add_argument('--keep', action='store_true', help='keep generated files')
+  args = parser.parse_args()
+
+  counts = [int(c) for c in args.counts.split(',')]
+  results = []
+  ok = True
+  root_dir = tempfile.mkdtemp(prefix='ckpt_scaling_')
+  print('%8s %12s %12s %8s' % ('#ckpts', 'time (s)', 'ms/ckpt', 'restore'))
+  for num_ckpts in counts:
+    work_dir = os.path.join(root_dir, str(num_ckpts))
+    os.makedirs(work_dir)
+    elapsed, out_ll = run_pipeline(args, work_dir, num_ckpts)
+    restore = '-'
+    if args.check:
+      passed = check_restore(args, work_dir, out_ll, num_ckpts)
+      restore = 'OK' if passed else 'FAIL'
+      ok = ok and passed
+    results.append((num_ckpts, elapsed))
+    print('%8d %12.3f %12.3f %8s' % (num_ckpts, elapsed, 1000.0 * elapsed / num_ckpts, restore))
+    sys.stdout.flush()
+
+  if len(results) >= 2:
+    (n_a, t_a), (n_b, t_b) = results[-2], results[-1]
+    growth = (t_b / t_a) / (float(n_b) / n_a)
+    print('time growth relative to #checkpoints (%d -> %d): %.2fx' % (n_a, n_b, growth))
+    if growth > args.max_growth:
+      print('FAIL: compile time grows super-linearly in the number of checkpoints')
+      ok = False
+
+  if args.keep:
+    print('generated files kept in ' + root_dir)
+  else:
+    shutil.rmtree(root_dir)
+  return 0 if ok else 1
+
+
+if __name__ == '__main__':
+  sys.exit(main())
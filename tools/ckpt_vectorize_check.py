@@ -0,0 +1,355 @@
+#!/usr/bin/env python3
+"""
+Vectorizer check for the SubroutineInjection pass.
+
+Runs the checkpointing pass pipeline on two kernels whose checkpoint() sits
+right after vectorizable inner loops, optimizes the plain and the instrumented
+kernels with opt -O2, and compares the loop-vectorize remarks:
+  blur: a 3-point stencil loop and a copy loop per time step
+  lud:  the row elimination loop of an LU decomposition, per pivot
+
+By default the instrumented kernels are built with -ckpt-restore-in-place,
+which keeps the scalars of the kernel in their allocas, so the inner loops
+should vectorize as often as in the plain kernels. The check fails if they
+vectorize less often.
+
+To Run:
+$ python3 tools/ckpt_vectorize_check.py --build-dir /path/to/build [--pass-flags="-ckpt-restore-in-place -ckpt-descriptor-table"]
+"""
+
+import argparse
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+KERNELS = {}
+
+KERNELS['blur'] = (r"""; ModuleID = 'blur.cpp'
+source_filename = "blur.cpp"
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-pc-linux-gnu"
+
+define dso_local void @checkpoint() {
+entry:
+  ret void
+}
+
+declare void @tick()
+
+define dso_local void @blur(float* noundef %dst, float* noundef %src, float* noundef %ckpt_mem) {
+entry:
+  %dst.addr = alloca float*, align 8
+  %src.addr = alloca float*, align 8
+  %ckpt_mem.addr = alloca float*, align 8
+  %i = alloca i32, align 4
+  %j = alloca i32, align 4
+  store float* %dst, float** %dst.addr, align 8
+  store float* %src, float** %src.addr, align 8
+  store float* %ckpt_mem, float** %ckpt_mem.addr, align 8
+  store i32 0, i32* %i, align 4
+  br label %for.cond
+
+for.cond:
+  %0 = load i32, i32* %i, align 4
+  %cmp = icmp slt i32 %0, 8
+  br i1 %cmp, label %for.body, label %for.end24
+
+for.body:
+  store i32 1, i32* %j, align 4
+  br label %for.cond1
+
+for.cond1:
+  %1 = load i32, i32* %j, align 4
+  %cmp2 = icmp slt i32 %1, 1023
+  br i1 %cmp2, label %for.body3, label %for.end
+
+for.body3:
+  %2 = load float*, float** %src.addr, align 8
+  %3 = load i32, i32* %j, align 4
+  %sub = sub nsw i32 %3, 1
+  %idxprom = sext i32 %sub to i64
+  %arrayidx = getelementptr inbounds float, float* %2, i64 %idxprom
+  %4 = load float, float* %arrayidx, align 4
+  %idxprom4 = sext i32 %3 to i64
+  %arrayidx5 = getelementptr inbounds float, float* %2, i64 %idxprom4
+  %5 = load float, float* %arrayidx5, align 4
+  %add = fadd float %4, %5
+  %add6 = add nsw i32 %3, 1
+  %idxprom7 = sext i32 %add6 to i64
+  %arrayidx8 = getelementptr inbounds float, float* %2, i64 %idxprom7
+  %6 = load float, float* %arrayidx8, align 4
+  %add9 = fadd float %add, %6
+  %mul = fmul float %add9, 2.500000e-01
+  %7 = load i32, i32* %i, align 4
+  %conv = sitofp i32 %7 to float
+  %add10 = fadd float %mul, %conv
+  %8 = load float*, float** %dst.addr, align 8
+  %arrayidx12 = getelementptr inbounds float, float* %8, i64 %idxprom4
+  store float %add10, float* %arrayidx12, align 4
+  br label %for.inc
+
+for.inc:
+  %9 = load i32, i32* %j, align 4
+  %inc = add nsw i32 %9, 1
+  store i32 %inc, i32* %j, align 4
+  br label %for.cond1
+
+for.end:
+  store i32 0, i32* %j, align 4
+  br label %for.cond13
+
+for.cond13:
+  %10 = load i32, i32* %j, align 4
+  %cmp14 = icmp slt i32 %10, 1024
+  br i1 %cmp14, label %for.body15, label %for.end22
+
+for.body15:
+  %11 = load float*, float** %dst.addr, align 8
+  %12 = load i32, i32* %j, align 4
+  %idxprom16 = sext i32 %12 to i64
+  %arrayidx17 = getelementptr inbounds float, float* %11, i64 %idxprom16
+  %13 = load float, float* %arrayidx17, align 4
+  %14 = load float*, float** %src.addr, align 8
+  %arrayidx19 = getelementptr inbounds float, float* %14, i64 %idxprom16
+  store float %13, float* %arrayidx19, align 4
+  %inc21 = add nsw i32 %12, 1
+  store i32 %inc21, i32* %j, align 4
+  br label %for.cond13
+
+for.end22:
+  call void @tick()
+  call void @checkpoint()
+  br label %for.inc23
+
+for.inc23:
+  %15 = load i32, i32* %i, align 4
+  %inc24 = add nsw i32 %15, 1
+  store i32 %inc24, i32* %i, align 4
+  br label %for.cond
+
+for.end24:
+  ret void
+}
+""", r"""extern "C" {
+  void checkpoint() {}
+  void tick();
+  /*#FUNCTION_DEF#*/
+  /* FUNC blur : ARGS dst{}[1024], src{}[1024] */
+  void blur(float* dst, float* src, float* ckpt_mem){
+    int i, j;
+    for (i=0; i<8; i++) {
+      for (j=1; j<1023; j++) dst[j] = (src[j-1] + src[j] + src[j+1]) * 0.25f + i;
+      for (j=0; j<1024; j++) src[j] = dst[j];
+      tick(); checkpoint();
+    }
+  }
+}
+""")
+
+KERNELS['lud'] = (r"""; ModuleID = 'lud.cpp'
+source_filename = "lud.cpp"
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-pc-linux-gnu"
+
+define dso_local void @checkpoint() {
+entry:
+  ret void
+}
+
+declare void @tick()
+
+define dso_local void @lud(float* noundef %a, float* noundef %ckpt_mem) {
+entry:
+  %a.addr = alloca float*, align 8
+  %ckpt_mem.addr = alloca float*, align 8
+  %i = alloca i32, align 4
+  %r = alloca i32, align 4
+  %j = alloca i32, align 4
+  %l = alloca float, align 4
+  store float* %a, float** %a.addr, align 8
+  store float* %ckpt_mem, float** %ckpt_mem.addr, align 8
+  store i32 0, i32* %i, align 4
+  br label %for.cond
+
+for.cond:
+  %0 = load i32, i32* %i, align 4
+  %cmp = icmp slt i32 %0, 64
+  br i1 %cmp, label %for.body, label %for.end24
+
+for.body:
+  %1 = load i32, i32* %i, align 4
+  %add = add nsw i32 %1, 1
+  store i32 %add, i32* %r, align 4
+  br label %for.cond1
+
+for.cond1:
+  %2 = load i32, i32* %r, align 4
+  %cmp2 = icmp slt i32 %2, 64
+  br i1 %cmp2, label %for.body3, label %for.end22
+
+for.body3:
+  %3 = load float*, float** %a.addr, align 8
+  %4 = load i32, i32* %r, align 4
+  %mul = mul nsw i32 %4, 64
+  %5 = load i32, i32* %i, align 4
+  %add4 = add nsw i32 %mul, %5
+  %idxprom = sext i32 %add4 to i64
+  %arrayidx = getelementptr inbounds float, float* %3, i64 %idxprom
+  %6 = load float, float* %arrayidx, align 4
+  %mul5 = mul nsw i32 %5, 64
+  %add6 = add nsw i32 %mul5, %5
+  %idxprom7 = sext i32 %add6 to i64
+  %arrayidx8 = getelementptr inbounds float, float* %3, i64 %idxprom7
+  %7 = load float, float* %arrayidx8, align 4
+  %div = fdiv float %6, %7
+  store float %div, float* %l, align 4
+  store i32 %5, i32* %j, align 4
+  br label %for.cond9
+
+for.cond9:
+  %8 = load i32, i32* %j, align 4
+  %cmp10 = icmp slt i32 %8, 64
+  br i1 %cmp10, label %for.body11, label %for.end
+
+for.body11:
+  %9 = load float, float* %l, align 4
+  %10 = load float*, float** %a.addr, align 8
+  %11 = load i32, i32* %i, align 4
+  %mul12 = mul nsw i32 %11, 64
+  %12 = load i32, i32* %j, align 4
+  %add13 = add nsw i32 %mul12, %12
+  %idxprom14 = sext i32 %add13 to i64
+  %arrayidx15 = getelementptr inbounds float, float* %10, i64 %idxprom14
+  %13 = load float, float* %arrayidx15, align 4
+  %mul16 = fmul float %9, %13
+  %14 = load i32, i32* %r, align 4
+  %mul17 = mul nsw i32 %14, 64
+  %add18 = add nsw i32 %mul17, %12
+  %idxprom19 = sext i32 %add18 to i64
+  %arrayidx20 = getelementptr inbounds float, float* %10, i64 %idxprom19
+  %15 = load float, float* %arrayidx20, align 4
+  %sub = fsub float %15, %mul16
+  store float %sub, float* %arrayidx20, align 4
+  %inc = add nsw i32 %12, 1
+  store i32 %inc, i32* %j, align 4
+  br label %for.cond9
+
+for.end:
+  %16 = load i32, i32* %r, align 4
+  %inc21 = add nsw i32 %16, 1
+  store i32 %inc21, i32* %r, align 4
+  br label %for.cond1
+
+for.end22:
+  call void @tick()
+  call void @checkpoint()
+  br label %for.inc23
+
+for.inc23:
+  %17 = load i32, i32* %i, align 4
+  %inc23 = add nsw i32 %17, 1
+  store i32 %inc23, i32* %i, align 4
+  br label %for.cond
+
+for.end24:
+  ret void
+}
+""", r"""extern "C" {
+  void checkpoint() {}
+  void tick();
+  /*#FUNCTION_DEF#*/
+  /* FUNC lud : ARGS a{}[4096] */
+  void lud(float* a, float* ckpt_mem){
+    int i, r, j; float l;
+    for (i=0; i<64; i++) {
+      for (r=i+1; r<64; r++) {
+        l = a[r*64+i] / a[i*64+i];
+        for (j=i; j<64; j++) a[r*64+j] -= l * a[i*64+j];
+      }
+      tick(); checkpoint();
+    }
+  }
+}
+""")
+
+REMARK_FLAGS = ['-pass-remarks=loop-vectorize', '-pass-remarks-missed=loop-vectorize',
+                '-pass-remarks-analysis=loop-vectorize']
+
+
+def run_pipeline(args, work_dir, name, pass_flags):
+  """Runs the pass pipeline on kernel name; returns the output IR path."""
+  lib_dir = os.path.join(os.path.abspath(args.build_dir), 'lib')
+  in_ll = os.path.join(work_dir, name + '.ll')
+  src = os.path.join(work_dir, name + '.cpp')
+  out_ll = os.path.join(work_dir, name + '_ckpt.ll')
+  cmd = [args.opt, '-enable-new-pm=0',
+         '-load=' + os.path.join(lib_dir, 'libSplitConditionalBB.so'),
+         '-load=' + os.path.join(lib_dir, 'libLiveValues.so'),
+         '-load=' + os.path.join(lib_dir, 'libSubroutineInjection.so'),
+         '-split-conditional-bb', '-live-values', '-source', src,
+         '-subroutine-injection', '-S', in_ll, '-o', out_ll] + pass_flags
+  # the passes exchange data through json files in the working directory
+  with open(os.path.join(work_dir, name + '_opt.log'), 'w') as log:
+    rc = subprocess.call(cmd, cwd=work_dir, stdout=log, stderr=subprocess.STDOUT)
+  if rc != 0:
+    raise RuntimeError('opt failed for %s (see %s)' % (name, os.path.join(work_dir, name + '_opt.log')))
+  return out_ll
+
+
+def get_vectorize_remarks(args, ll):
+  """Returns the loop-vectorize remarks of opt -O2 on ll."""
+  proc = subprocess.run([args.opt, '-O2', '-disable-output', ll] + REMARK_FLAGS,
+                        stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+  if proc.returncode != 0:
+    raise RuntimeError('opt -O2 failed for ' + ll)
+  return [m.group(1) for m in re.finditer(r'remark: [^:]*:\d+:\d+: (.*)', proc.stdout)]
+
+
+def count_vectorized(remarks):
+  return sum(1 for r in remarks if r.startswith('vectorized loop'))
+
+
+def main():
+  parser = argparse.ArgumentParser(description='Vectorizer check of instrumented kernels.')
+  parser.add_argument('--build-dir', required=True, help='cmake build dir containing lib/libSubroutineInjection.so')
+  parser.add_argument('--pass-flags', default='-ckpt-restore-in-place', help='flags for the SubroutineInjection pass')
+  parser.add_argument('--opt', default=shutil.which('opt') or 'opt')
+  parser.add_argument('--verbose', action='store_true', help='print all loop-vectorize remarks')
+  parser.add_argument('--keep', action='store_true', help='keep generated files')
+  args = parser.parse_args()
+
+  pass_flags = args.pass_flags.split()
+  ok = True
+  root_dir = tempfile.mkdtemp(prefix='ckpt_vectorize_')
+  print('%8s %12s %14s %8s' % ('kernel', 'plain', 'instrumented', 'result'))
+  for name, (ir, src) in sorted(KERNELS.items()):
+    work_dir = os.path.join(root_dir, name)
+    os.makedirs(work_dir)
+    with open(os.path.join(work_dir, name + '.ll'), 'w') as f:
+      f.write(ir)
+    with open(os.path.join(work_dir, name + '.cpp'), 'w') as f:
+      f.write(src)
+    plain = get_vectorize_remarks(args, os.path.join(work_dir, name + '.ll'))
+    instrumented = get_vectorize_remarks(args, run_pipeline(args, work_dir, name, pass_flags))
+    passed = count_vectorized(instrumented) >= count_vectorized(plain)
+    ok = ok and passed
+    print('%8s %12d %14d %8s' % (name, count_vectorized(plain), count_vectorized(instrumented), 'OK' if passed else 'FAIL'))
+    if args.verbose or not passed:
+      for remark in plain:
+        print('  plain:        ' + remark)
+      for remark in instrumented:
+        print('  instrumented: ' + remark)
+    sys.stdout.flush()
+
+  if args.keep:
+    print('generated files kept in ' + root_dir)
+  else:
+    shutil.rmtree(root_dir)
+  return 0 if ok else 1
+
+
+if __name__ == '__main__':
+  sys.exit(main())